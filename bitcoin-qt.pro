@@ -166,6 +166,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/net.h \
     src/key.h \
     src/db.h \
+    src/logdb.h \
     src/walletdb.h \
     src/script.h \
     src/init.h \
@@ -199,6 +200,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/walletstack.h \
     src/qt/walletframe.h \
     src/bitcoinrpc.h \
+    src/rpcqueue.h \
+    src/jsonwriter.h \
     src/qt/overviewpage.h \
     src/qt/csvmodelwriter.h \
     src/crypter.h \
@@ -220,6 +223,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/leveldb.h \
     src/threadsafety.h \
     src/limitedmap.h \
+    src/memusage.h \
+    src/sigcache.h \
     src/qt/macnotificationhandler.h \
     src/qt/splashscreen.h \
     src/qt/qcustomplot.h \
@@ -239,6 +244,9 @@ HEADERS += src/qt/bitcoingui.h \
     src/endiannes.h \
     src/qt/blockexplorer.h \
     src/ecdsa.h \
+    src/secp256k1.h \
+    src/sha256.h \
+    src/sha256_multiway.h \
     src/qt/miningpage.h
 
 SOURCES += src/qt/bitcoin.cpp \
@@ -262,6 +270,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/netbase.cpp \
     src/key.cpp \
     src/script.cpp \
+    src/sigcache.cpp \
     src/main.cpp \
     src/init.cpp \
     src/net.cpp \
@@ -269,6 +278,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/db.cpp \
+    src/logdb.cpp \
     src/walletdb.cpp \
     src/qt/clientmodel.cpp \
     src/qt/guiutil.cpp \
@@ -288,6 +298,8 @@ SOURCES += src/qt/bitcoin.cpp \
     src/qt/walletstack.cpp \
     src/qt/walletframe.cpp \
     src/bitcoinrpc.cpp \
+    src/jsonwriter.cpp \
+    src/rest.cpp \
     src/rpcdump.cpp \
     src/rpcnet.cpp \
     src/rpcmining.cpp \
@@ -326,6 +338,11 @@ SOURCES += src/qt/bitcoin.cpp \
     src/bttrackers.cpp \
     src/qt/blockexplorer.cpp \
     src/ecdsa.cpp \
+    src/secp256k1.cpp \
+    src/sha256.cpp \
+    src/sha256-sse41.cpp \
+    src/sha256-avx2.cpp \
+    src/sha256-shani.cpp \
     src/qt/miningpage.cpp
 
 RESOURCES += src/qt/bitcoin.qrc
@@ -10,6 +10,8 @@
 #include "base58.h"
 #include "bitcoinrpc.h"
 #include "db.h"
+#include "jsonwriter.h"
+#include "rpcqueue.h"
 
 #include <boost/asio.hpp>
 #include <boost/asio/ip/v6_only.hpp>
@@ -36,6 +38,9 @@ static std::string strRPCUserColonPass;
 static asio::io_service* rpc_io_service = NULL;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
+static CRPCWorkQueue* rpc_work_queue = NULL;
+// Connections serving /rest/ requests, with -rest
+static CRPCWorkQueue* rest_work_queue = NULL;
 
 static inline unsigned short GetDefaultRPCPort()
 {
@@ -114,6 +119,13 @@ Value ValueFromAmount(int64 amount)
     return (double)amount / (double)COIN;
 }
 
+Value ValueFromStream(rpcstreamfn_type streamer, const Array& params, bool fHelp)
+{
+    CJSONWriter writer(true);
+    streamer(params, fHelp, writer);
+    return writer.value();
+}
+
 std::string HexBits(unsigned int nBits)
 {
     union {
@@ -210,8 +222,8 @@ static const CRPCCommand vRPCCommands[] =
     { "stop",                   &stop,                   true,      true,       false },
     { "getblockcount",          &getblockcount,          true,      false,      false },
     { "getbestblockhash",       &getbestblockhash,       true,      false,      false },
-    { "getconnectioncount",     &getconnectioncount,     true,      false,      false },
-    { "getpeerinfo",            &getpeerinfo,            true,      false,      false },
+    { "getconnectioncount",     &getconnectioncount,     true,      true,       false },
+    { "getpeerinfo",            &getpeerinfo,            true,      true,       false },
     { "addnode",                &addnode,                true,      true,       false },
 #if ENABLE_DARKSEND_FEATURES
     { "masternode",             &masternode,             false,     false,      true },
@@ -245,9 +257,12 @@ static const CRPCCommand vRPCCommands[] =
     { "move",                   &movecmd,                false,     false,      true },
     { "sendfrom",               &sendfrom,               false,     false,      true },
     { "sendmany",               &sendmany,               false,     false,      true },
+    { "sendpayouts",            &sendpayouts,            false,     false,      true },
     { "addmultisigaddress",     &addmultisigaddress,     false,     false,      true },
     { "createmultisig",         &createmultisig,         true,      true ,      false },
-    { "getrawmempool",          &getrawmempool,          true,      false,      false },
+    { "getrawmempool",          &getrawmempool,          true,      true,       false },
+    { "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,      true,       false },
     { "getblock",               &getblock,               false,     false,      false },
     { "getblockhash",           &getblockhash,           false,     false,      false },
     { "gettransaction",         &gettransaction,         false,     false,      true },
@@ -265,6 +280,7 @@ static const CRPCCommand vRPCCommands[] =
     { "makekeypair",            &makekeypair,            true,     	false,		true },
     { "dumpprivkey",            &dumpprivkey,            true,      false,      true },
     { "importprivkey",          &importprivkey,          false,     false,      true },
+    { "getrescaninfo",          &getrescaninfo,          true,      true,       true },
     { "listunspent",            &listunspent,            false,     false,      true },
     { "getrawtransaction",      &getrawtransaction,      false,     false,      false },
     { "createrawtransaction",   &createrawtransaction,   false,     false,      false },
@@ -278,6 +294,20 @@ static const CRPCCommand vRPCCommands[] =
     { "verifychain",            &verifychain,            true,      false,      false },
 };
 
+/** Commands that can write their result straight into the reply, without
+ *  building a json_spirit::Value first. They are still called through the
+ *  actor above for help and by in-process callers. */
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      streamer
+  //  ------------------------  -----------------------
+    { "getblock",               &getblock_json },
+    { "getrawmempool",          &getrawmempool_json },
+    { "gettransaction",         &gettransaction_json },
+    { "listtransactions",       &listtransactions_json },
+    { "listsinceblock",         &listsinceblock_json },
+    { "listunspent",            &listunspent_json },
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -288,6 +318,8 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamCommands[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].streamer;
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -298,6 +330,20 @@ const CRPCCommand *CRPCTable::operator[](string name) const
     return (*it).second;
 }
 
+static void CallRPCCommand(const CRPCCommand* pcmd, rpcstreamfn_type streamer, const Array& params, Value& result, CJSONWriter* pwriter)
+{
+    if (streamer)
+        streamer(params, false, *pwriter);
+    else
+        result = pcmd->actor(params, false);
+}
+
+/** Commands that work without a wallet but use it if there is one */
+static bool IsOptionalWalletRPCCommand(const std::string& command)
+{
+    return command == "getinfo" || command == "validateaddress" || command == "signrawtransaction";
+}
+
 static bool IsSimpleMiningRPCCommand(std::string command)
 {
     return command == "getwork" || command == "getworkex";
@@ -340,6 +386,36 @@ string rfc1123Time()
     return string(buffer);
 }
 
+static const char *HTTPStatus(int nStatus)
+{
+    if (nStatus == HTTP_OK) return "OK";
+    if (nStatus == HTTP_BAD_REQUEST) return "Bad Request";
+    if (nStatus == HTTP_FORBIDDEN) return "Forbidden";
+    if (nStatus == HTTP_NOT_FOUND) return "Not Found";
+    if (nStatus == HTTP_INTERNAL_SERVER_ERROR) return "Internal Server Error";
+    if (nStatus == HTTP_SERVICE_UNAVAILABLE) return "Service Unavailable";
+    return "";
+}
+
+string HTTPReplyHeader(int nStatus, bool keepalive, size_t nContentLength, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Content-Length: %"PRIszu"\r\n"
+            "Content-Type: %s\r\n"
+            "Server: spreadcoin-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        HTTPStatus(nStatus),
+        rfc1123Time().c_str(),
+        keepalive ? "keep-alive" : "close",
+        nContentLength,
+        contentType,
+        FormatFullVersion().c_str());
+}
+
 static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
 {
     if (nStatus == HTTP_UNAUTHORIZED)
@@ -359,29 +435,7 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time().c_str(), FormatFullVersion().c_str());
-    const char *cStatus;
-         if (nStatus == HTTP_OK) cStatus = "OK";
-    else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
-    else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
-    else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
-    else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
-    else cStatus = "";
-    return strprintf(
-            "HTTP/1.1 %d %s\r\n"
-            "Date: %s\r\n"
-            "Connection: %s\r\n"
-            "Content-Length: %"PRIszu"\r\n"
-            "Content-Type: application/json\r\n"
-            "Server: spreadcoin-json-rpc/%s\r\n"
-            "\r\n"
-            "%s",
-        nStatus,
-        cStatus,
-        rfc1123Time().c_str(),
-        keepalive ? "keep-alive" : "close",
-        strMsg.size(),
-        FormatFullVersion().c_str(),
-        strMsg.c_str());
+    return HTTPReplyHeader(nStatus, keepalive, strMsg.size(), "application/json") + strMsg;
 }
 
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
@@ -673,7 +727,7 @@ private:
     iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
 };
 
-void ServiceConnection(AcceptedConnection *conn);
+bool ServiceConnection(AcceptedConnection *conn);
 
 // Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
@@ -737,8 +791,7 @@ static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol,
             conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
         delete conn;
     }
-    else {
-        ServiceConnection(conn);
+    else if (ServiceConnection(conn)) {
         conn->close();
         delete conn;
     }
@@ -858,9 +911,21 @@ void StartRPCThreads()
         return;
     }
 
+    rpc_work_queue = new CRPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", 16), 1));
     rpc_worker_group = new boost::thread_group();
     for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
         rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < std::max((int)GetArg("-rpcworkers", 4), 1); i++)
+        rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Thread, rpc_work_queue));
+
+    if (GetBoolArg("-rest"))
+    {
+        // A REST job is a whole connection and only ends when the client
+        // closes it, so connections aren't queued behind busy threads
+        rest_work_queue = new CRPCWorkQueue(0);
+        for (int i = 0; i < std::max((int)GetArg("-restthreads", 4), 1); i++)
+            rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Thread, rest_work_queue));
+    }
 }
 
 void StopRPCThreads()
@@ -868,8 +933,15 @@ void StopRPCThreads()
     if (rpc_io_service == NULL) return;
 
     rpc_io_service->stop();
-    rpc_worker_group->join_all();
+    if (rpc_work_queue)
+        rpc_work_queue->Interrupt();
+    if (rest_work_queue)
+        rest_work_queue->Interrupt();
+    if (rpc_worker_group)
+        rpc_worker_group->join_all();
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
+    delete rest_work_queue; rest_work_queue = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -915,7 +987,24 @@ void JSONRequest::parse(const Value& valRequest)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
 }
 
-static Object JSONRPCExecOne(const Value& req, bool simpleMiningRPC)
+/** Run a call and write the whole reply, result, error and id. Throws if
+ *  the call fails, the caller then writes the error reply. */
+static string JSONRPCExecWrite(const JSONRequest& jreq, bool simpleMiningRPC)
+{
+    CJSONWriter writer;
+    writer.BeginObject();
+    writer.Key("result");
+    tableRPC.execute(jreq.strMethod, jreq.params, simpleMiningRPC, writer);
+    writer.Pair("error", Value::null);
+    writer.Pair("id", jreq.id);
+    writer.EndObject();
+
+    string strReply;
+    writer.swap(strReply);
+    return strReply;
+}
+
+static string JSONRPCExecOne(const Value& req, bool simpleMiningRPC)
 {
     Object rpc_result;
 
@@ -923,8 +1012,7 @@ static Object JSONRPCExecOne(const Value& req, bool simpleMiningRPC)
     try {
         jreq.parse(req);
 
-        Value result = tableRPC.execute(jreq.strMethod, jreq.params, simpleMiningRPC);
-        rpc_result = JSONRPCReplyObj(result, Value::null, jreq.id);
+        return JSONRPCExecWrite(jreq, simpleMiningRPC);
     }
     catch (Object& objError)
     {
@@ -936,19 +1024,90 @@ static Object JSONRPCExecOne(const Value& req, bool simpleMiningRPC)
                                      JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
     }
 
-    return rpc_result;
+    return write_string(Value(rpc_result), false);
+}
+
+static void JSONRPCExecBatchItem(const Value* preq, bool simpleMiningRPC, string* pstrReply, CRPCPending* ppending)
+{
+    try {
+        *pstrReply = JSONRPCExecOne(*preq, simpleMiningRPC);
+    }
+    catch (...) {
+        *pstrReply = write_string(Value(JSONRPCReplyObj(Value::null, JSONRPCError(RPC_MISC_ERROR, "Unknown exception"), Value::null)), false);
+    }
+    ppending->Done();
 }
 
-static string JSONRPCExecBatch(const Array& vReq, bool simpleMiningRPC)
+string JSONRPCExecBatch(const Array& vReq, bool simpleMiningRPC, CRPCWorkQueue* pqueue)
 {
-    Array ret;
+    // The calls of a batch don't depend on each other, spread them over the
+    // workers. Those that don't fit in the queue run here instead.
+    vector<string> vReply(vReq.size());
+    CRPCPending pending;
     for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx], simpleMiningRPC));
+    {
+        pending.Add();
+        if (!pqueue || !pqueue->Enqueue(boost::bind(&JSONRPCExecBatchItem, &vReq[reqIdx], simpleMiningRPC, &vReply[reqIdx], &pending)))
+            JSONRPCExecBatchItem(&vReq[reqIdx], simpleMiningRPC, &vReply[reqIdx], &pending);
+    }
+    pending.Wait();
+
+    CJSONWriter writer;
+    writer.BeginArray();
+    BOOST_FOREACH(const string& strReply, vReply)
+        writer.WriteRaw(strReply);
+    writer.EndArray();
+    return writer.str();
+}
 
-    return write_string(Value(ret), false) + "\n";
+/** Run a single call on a worker. Errors are handed back to the connection
+ *  thread, which replies with the matching HTTP status. */
+static void JSONRPCExecCall(const JSONRequest* pjreq, bool simpleMiningRPC, string* pstrReply, Object* perror, CRPCPending* ppending)
+{
+    try {
+        *pstrReply = JSONRPCExecWrite(*pjreq, simpleMiningRPC);
+    }
+    catch (Object& objError) {
+        *perror = objError;
+    }
+    catch (std::exception& e) {
+        *perror = JSONRPCError(RPC_PARSE_ERROR, e.what());
+    }
+    catch (...) {
+        *perror = JSONRPCError(RPC_MISC_ERROR, "Unknown exception");
+    }
+    ppending->Done();
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+/** Serve a connection on a REST thread, starting with the /rest/ request
+ *  already read from it, until the client or an error closes it */
+static void ServiceRESTConnection(AcceptedConnection *conn, string strMethod, string strURI, bool fKeepAlive)
+{
+    while (HTTPReq_REST(conn->stream(), strMethod, strURI, fKeepAlive))
+    {
+        int nProto = 0;
+        map<string, string> mapHeaders;
+        string strRequest;
+        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
+            break;
+        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
+
+        // JSON-RPC needs a connection of its own
+        if (strURI.compare(0, 6, "/rest/") != 0)
+        {
+            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
+            break;
+        }
+        fKeepAlive = (mapHeaders["connection"] != "close");
+    }
+    conn->close();
+    delete conn;
+}
+
+/** Serve the requests on a connection. Returns false if the connection was
+ *  handed over to the REST threads, which close it, true if the caller
+ *  still has to. */
+bool ServiceConnection(AcceptedConnection *conn)
 {
     bool fRun = true;
     while (fRun)
@@ -964,6 +1123,21 @@ void ServiceConnection(AcceptedConnection *conn)
         // Read HTTP message headers and body
         ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
 
+        // Read-only chain data, public like the P2P network serves it. The
+        // connection moves to the REST threads, so clients keeping it open
+        // don't take threads away from JSON-RPC. If all of them are busy
+        // the client is told so at once instead of waiting for one.
+        if (rest_work_queue && strURI.compare(0, 6, "/rest/") == 0)
+        {
+            bool fKeepAlive = (mapHeaders["connection"] != "close");
+            if (!rest_work_queue->Enqueue(boost::bind(&ServiceRESTConnection, conn, strMethod, strURI, fKeepAlive)))
+            {
+                conn->stream() << HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", false) << std::flush;
+                break;
+            }
+            return false;
+        }
+
         if (strURI != "/") {
             conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
             break;
@@ -1009,14 +1183,23 @@ void ServiceConnection(AcceptedConnection *conn)
             if (valRequest.type() == obj_type) {
                 jreq.parse(valRequest);
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params, SimpleMiningRPC);
-
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+                Object objError;
+                CRPCPending pending;
+                pending.Add();
+                if (!rpc_work_queue->Enqueue(boost::bind(&JSONRPCExecCall, &jreq, SimpleMiningRPC, &strReply, &objError, &pending)))
+                {
+                    printf("ThreadRPCServer work queue depth exceeded, refusing %s\n", jreq.strMethod.c_str());
+                    conn->stream() << HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", false) << std::flush;
+                    break;
+                }
+                pending.Wait();
+                if (!objError.empty())
+                    throw objError;
+                strReply += "\n";
 
             // array of requests
             } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array(), SimpleMiningRPC);
+                strReply = JSONRPCExecBatch(valRequest.get_array(), SimpleMiningRPC, rpc_work_queue) + "\n";
             else
                 throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -1033,9 +1216,12 @@ void ServiceConnection(AcceptedConnection *conn)
             break;
         }
     }
+    return true;
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, bool simpleMining) const
+/** Call a command with the locks it needs. Returns true if its streamer
+ *  wrote the result to pwriter, false if the actor returned it in result. */
+bool CRPCTable::call(const std::string &strMethod, const json_spirit::Array &params, bool simpleMining, json_spirit::Value& result, CJSONWriter* pwriter) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -1052,22 +1238,30 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    rpcstreamfn_type streamer = NULL;
+    if (pwriter)
+    {
+        map<string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+        if (it != mapStreamCommands.end())
+            streamer = (*it).second;
+    }
+
     try
     {
         // Execute
-        Value result;
         {
             if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
-            else if (!pwalletMain) {
+                CallRPCCommand(pcmd, streamer, params, result, pwriter);
+            else if (!pwalletMain || (!pcmd->reqWallet && !IsOptionalWalletRPCCommand(strMethod))) {
+                // Calls that only read the chain don't wait for the wallet
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                CallRPCCommand(pcmd, streamer, params, result, pwriter);
             } else {
                 LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
+                CallRPCCommand(pcmd, streamer, params, result, pwriter);
             }
         }
-        return result;
+        return streamer != NULL;
     }
     catch (std::exception& e)
     {
@@ -1075,6 +1269,22 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, bool simpleMining) const
+{
+    Value result;
+    call(strMethod, params, simpleMining, result, NULL);
+    return result;
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, bool simpleMining, CJSONWriter& writer) const
+{
+    // Results of commands without a streamer are written out once the
+    // locks are released
+    Value result;
+    if (!call(strMethod, params, simpleMining, result, &writer))
+        writer.Write(result);
+}
+
 
 Object CallRPC(const string& strMethod, const Array& params)
 {
@@ -1197,6 +1407,8 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listsinceblock"         && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "sendmany"               && n > 1) ConvertTo<Object>(params[1]);
     if (strMethod == "sendmany"               && n > 2) ConvertTo<boost::int64_t>(params[2]);
+    if (strMethod == "sendpayouts"            && n > 1) ConvertTo<Object>(params[1]);
+    if (strMethod == "sendpayouts"            && n > 2) ConvertTo<boost::int64_t>(params[2]);
     if (strMethod == "addmultisigaddress"     && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "addmultisigaddress"     && n > 1) ConvertTo<Array>(params[1]);
     if (strMethod == "createmultisig"         && n > 0) ConvertTo<boost::int64_t>(params[0]);
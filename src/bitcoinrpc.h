@@ -10,8 +10,11 @@
 #include <list>
 #include <map>
 
+class CBlock;
 class CBlockIndex;
 class CReserveKey;
+class CRPCWorkQueue;
+class CJSONWriter;
 
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_writer_template.h"
@@ -28,6 +31,7 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
 // Bitcoin RPC error codes
@@ -70,6 +74,15 @@ json_spirit::Object JSONRPCError(int code, const std::string& message);
 
 void StartRPCThreads();
 void StopRPCThreads();
+/** Status line and headers of an HTTP reply whose body follows separately */
+std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t nContentLength, const char *contentType);
+/** Serve a GET request for /rest/..., in rest.cpp. Returns false if the
+ *  connection should be closed. */
+bool HTTPReq_REST(std::ostream& stream, const std::string& strMethod, const std::string& strURI, bool fKeepAlive);
+/** Run the calls of a JSON-RPC batch on the workers of pqueue, or in this
+ *  thread if it is NULL or full. Returns the JSON text of the replies, in
+ *  request order. */
+std::string JSONRPCExecBatch(const json_spirit::Array& vReq, bool simpleMiningRPC, CRPCWorkQueue* pqueue);
 int CommandLineRPC(int argc, char *argv[]);
 
 /** Convert parameter values for RPC call from strings to command-specific JSON objects. */
@@ -90,6 +103,8 @@ void RPCTypeCheck(const json_spirit::Object& o,
                   const std::map<std::string, json_spirit::Value_type>& typesExpected, bool fAllowNull=false);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+/** A command that writes its result as JSON text instead of returning it */
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 
 class CRPCCommand
 {
@@ -101,6 +116,13 @@ public:
     bool reqWallet;
 };
 
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type streamer;
+};
+
 /**
  * Bitcoin RPC command dispatcher.
  */
@@ -108,6 +130,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
+
+    bool call(const std::string &method, const json_spirit::Array &params, bool simpleMining, json_spirit::Value& result, CJSONWriter* pwriter) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
@@ -121,6 +146,9 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params, bool simpleMining) const;
+    /** Execute a method and write its result to writer, without building
+     *  a json_spirit::Value if the method has a streamer. */
+    void execute(const std::string &method, const json_spirit::Array &params, bool simpleMining, CJSONWriter& writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -131,6 +159,9 @@ extern void ShutdownRPCMining();
 extern int64 nWalletUnlockTime;
 extern int64 AmountFromValue(const json_spirit::Value& value);
 extern json_spirit::Value ValueFromAmount(int64 amount);
+/** Call a streamer and read what it writes back in, for the actor of a
+ *  command that has one */
+extern json_spirit::Value ValueFromStream(rpcstreamfn_type streamer, const json_spirit::Array& params, bool fHelp);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
 extern std::string HexBits(unsigned int nBits);
 extern std::string HelpRequiringPassphrase();
@@ -144,6 +175,7 @@ extern json_spirit::Value addnode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getaddednodeinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrescaninfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getgenerate(const json_spirit::Array& params, bool fHelp); // in rpcmining.cpp
 extern json_spirit::Value setgenerate(const json_spirit::Array& params, bool fHelp);
@@ -168,19 +200,23 @@ extern json_spirit::Value getbalance(const json_spirit::Array& params, bool fHel
 extern json_spirit::Value movecmd(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendfrom(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendmany(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value sendpayouts(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addmultisigaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createmultisig(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp);
+extern void listtransactions_json(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value listaddressgroupings(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp);
+extern void listsinceblock_json(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value makekeypair(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp); // in checkpointsync.cpp
 extern json_spirit::Value sendcheckpoint(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value enforcecheckpoint(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettransaction(const json_spirit::Array& params, bool fHelp);
+extern void gettransaction_json(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value backupwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value keypoolrefill(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value walletpassphrase(const json_spirit::Array& params, bool fHelp);
@@ -192,6 +228,7 @@ extern json_spirit::Value getinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
+extern void listunspent_json(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value lockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listlockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -205,8 +242,13 @@ extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool f
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value setmininput(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern void getrawmempool_json(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
+extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcacheinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern void getblock_json(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
+extern void BlockToJSON(const CBlock& block, const CBlockIndex* blockindex, CJSONWriter& writer);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
@@ -7,12 +7,23 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/foreach.hpp>
 
 #include <vector>
 #include <algorithm>
 
 template<typename T> class CCheckQueueControl;
 
+/** Run a worker's batch of checks, stopping at the first failure. Check
+  * types that can verify a batch faster than one by one specialize this.
+  */
+template<typename T> bool RunCheckBatch(std::vector<T> &vChecks) {
+    BOOST_FOREACH(T &check, vChecks)
+        if (!check())
+            return false;
+    return true;
+}
+
 /** Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -110,9 +121,8 @@ private:
                 fOk = fAllOk;
             }
             // execute work
-            BOOST_FOREACH(T &check, vChecks)
-                if (fOk)
-                    fOk = check();
+            if (fOk)
+                fOk = RunCheckBatch(vChecks);
             vChecks.clear();
         } while(true);
     }
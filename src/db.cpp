@@ -215,7 +215,7 @@ void CDBEnv::CheckpointLSN(std::string strFile)
 
 
 CDB::CDB(const char *pszFile, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+    pdb(NULL), activeTxn(NULL), plog(NULL), plogTxn(NULL)
 {
     int ret;
     if (pszFile == NULL)
@@ -229,6 +229,22 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
 
     {
         LOCK(bitdb.cs_db);
+        map<string, CLogDB*>::iterator mi = bitdb.mapLogDb.find(pszFile);
+        if (mi != bitdb.mapLogDb.end())
+        {
+            // Kept in a log store, Berkeley DB isn't involved at all
+            strFile = pszFile;
+            plog = (*mi).second;
+            if (fCreate && !Exists(string("version")))
+            {
+                bool fTmp = fReadOnly;
+                fReadOnly = false;
+                WriteVersion(CLIENT_VERSION);
+                fReadOnly = fTmp;
+            }
+            return;
+        }
+
         if (!bitdb.Open(GetDataDir()))
             throw runtime_error("env open failed");
 
@@ -279,7 +295,7 @@ CDB::CDB(const char *pszFile, const char* pszMode) :
 
 void CDB::Flush()
 {
-    if (activeTxn)
+    if (activeTxn || plog)
         return;
 
     // Flush database activity from memory pool to disk log
@@ -292,6 +308,13 @@ void CDB::Flush()
 
 void CDB::Close()
 {
+    if (plog)
+    {
+        delete plogTxn;
+        plogTxn = NULL;
+        plog = NULL;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -307,6 +330,105 @@ void CDB::Close()
     }
 }
 
+bool CDB::ReadFromLog(const CDataStream& ssKey, CSerializeData& vchValue)
+{
+    CSerializeData vchKey(ssKey.begin(), ssKey.end());
+    if (plogTxn)
+    {
+        // A transaction sees its own writes
+        if (plogTxn->setErase.count(vchKey))
+            return false;
+        CLogDataMap::const_iterator it = plogTxn->mapWrite.find(vchKey);
+        if (it != plogTxn->mapWrite.end())
+        {
+            vchValue = (*it).second;
+            return true;
+        }
+    }
+    return plog->Read(vchKey, vchValue);
+}
+
+bool CDB::WriteToLog(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    CSerializeData vchKey(ssKey.begin(), ssKey.end());
+    CSerializeData vchValue(ssValue.begin(), ssValue.end());
+    if (!plogTxn)
+        return plog->Write(vchKey, vchValue, fOverwrite);
+    if (!fOverwrite)
+    {
+        CSerializeData vchOld;
+        if (ReadFromLog(ssKey, vchOld))
+            return false;
+    }
+    plogTxn->Write(vchKey, vchValue);
+    return true;
+}
+
+bool CDB::EraseFromLog(const CDataStream& ssKey)
+{
+    CSerializeData vchKey(ssKey.begin(), ssKey.end());
+    if (!plogTxn)
+        return plog->Erase(vchKey);
+    plogTxn->Erase(vchKey);
+    return true;
+}
+
+int CDB::ReadAtLogCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    CSerializeData vchKey, vchValue;
+    bool fFound;
+    if (fFlags == DB_SET_RANGE)
+        fFound = pcursor->plog->Seek(CSerializeData(ssKey.begin(), ssKey.end()), true, vchKey, vchValue);
+    else if (fFlags == DB_NEXT)
+        fFound = pcursor->plog->Seek(pcursor->vchKey, !pcursor->fStarted, vchKey, vchValue);
+    else
+        return EINVAL;
+    if (!fFound)
+        return DB_NOTFOUND;
+    pcursor->vchKey = vchKey;
+    pcursor->fStarted = true;
+
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write(&vchKey[0], vchKey.size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write(&vchValue[0], vchValue.size());
+    return 0;
+}
+
+bool CDBEnv::OpenLogDb(const string& strFile)
+{
+    LOCK(cs_db);
+    if (mapLogDb.count(strFile))
+        return true;
+    CLogDB* plog = new CLogDB();
+    if (!plog->Open(GetDataDir() / strFile))
+    {
+        delete plog;
+        return false;
+    }
+    mapLogDb[strFile] = plog;
+    return true;
+}
+
+void CDBEnv::CloseLogDb(const string& strFile)
+{
+    LOCK(cs_db);
+    map<string, CLogDB*>::iterator mi = mapLogDb.find(strFile);
+    if (mi == mapLogDb.end())
+        return;
+    delete (*mi).second;
+    mapLogDb.erase(mi);
+}
+
+CLogDB* CDBEnv::GetLogDb(const string& strFile)
+{
+    LOCK(cs_db);
+    map<string, CLogDB*>::iterator mi = mapLogDb.find(strFile);
+    return (mi == mapLogDb.end() ? NULL : (*mi).second);
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -333,6 +455,34 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    CLogDB* plog = bitdb.GetLogDb(strFile);
+    if (plog)
+    {
+        // A new snapshot leaves nothing of the old records on disk
+        printf("Rewriting %s...\n", strFile.c_str());
+        CLogBatch batch;
+        if (pszSkip)
+        {
+            CSerializeData vchSkip(pszSkip, pszSkip + strlen(pszSkip));
+            CSerializeData vchKey = vchSkip, vchValue;
+            bool fInclusive = true;
+            while (plog->Seek(vchKey, fInclusive, vchKey, vchValue) &&
+                   vchKey.size() >= vchSkip.size() && std::equal(vchSkip.begin(), vchSkip.end(), vchKey.begin()))
+            {
+                batch.Erase(vchKey);
+                fInclusive = false;
+            }
+        }
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION);
+        ssKey << string("version");
+        ssValue << CLIENT_VERSION;
+        batch.Write(CSerializeData(ssKey.begin(), ssKey.end()), CSerializeData(ssValue.begin(), ssValue.end()));
+        bool fSuccess = plog->WriteBatch(batch) && plog->Compact();
+        if (!fSuccess)
+            printf("Rewriting of %s FAILED!\n", strFile.c_str());
+        return fSuccess;
+    }
+
     while (true)
     {
         {
@@ -363,7 +513,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess)
                         {
@@ -431,6 +581,19 @@ void CDBEnv::Flush(bool fShutdown)
     // Flush log data to the actual data file
     //  on all files that are not in use
     printf("Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " db not started");
+    {
+        // Log stores are never out of date on disk, only not synced yet.
+        // They stay in mapLogDb after shutdown so a late write fails
+        // instead of going to Berkeley DB.
+        LOCK(cs_db);
+        for (map<string, CLogDB*>::iterator mi = mapLogDb.begin(); mi != mapLogDb.end(); ++mi)
+        {
+            if (fShutdown)
+                (*mi).second->Close();
+            else
+                (*mi).second->Sync();
+        }
+    }
     if (!fDbEnvInit)
         return;
     {
@@ -9,6 +9,8 @@
 #include "net.h"
 #include "init.h"
 #include "util.h"
+#include "sigcache.h"
+#include "sha256.h"
 #include "ui_interface.h"
 
 #include <boost/filesystem.hpp>
@@ -309,6 +311,9 @@ std::string HelpMessage()
         "  -gen                   " + _("Generate coins (default: 0)") + "\n" +
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -maxmempool=<n>        " + _("Keep the transaction memory pool below <n> megabytes (default: 100)") + "\n" +
+        "  -mempoolexpiry=<n>     " + _("Do not keep transactions in the memory pool longer than <n> hours (default: 72)") + "\n" +
+        "  -maxsigcachesize=<n>   " + _("Keep at most <n> verified signatures in memory, 32 bytes each (default: 50000)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Exclusively connect through socks proxy") + "\n" +
         "  -proxytoo=<ip:port>    " + _("Also connect through socks proxy") + "\n" +
@@ -365,7 +370,11 @@ std::string HelpMessage()
 #ifndef QT_GUI
         "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n" +
 #endif
-        "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n" +
+        "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC connections (default: 4)") + "\n" +
+        "  -rpcworkers=<n>        " + _("Set the number of threads to run RPC calls (default: 4)") + "\n" +
+        "  -rpcworkqueue=<n>      " + _("Refuse RPC calls while <n> are already waiting for a thread (default: 16)") + "\n" +
+        "  -rest                  " + _("Serve raw blocks, headers, transactions and unspent outputs under /rest/ on the RPC port, without authorization (default: 0)") + "\n" +
+        "  -restthreads=<n>       " + _("Set the number of threads to serve REST connections, more are refused (default: 4)") + "\n" +
         "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n" +
         "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n" +
         "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received (%s in cmd is replaced by message)") + "\n" +
@@ -373,6 +382,8 @@ std::string HelpMessage()
         "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n" +
         "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n" +
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
+        "  -lazywallet            " + _("Leave the supporting transactions of confirmed wallet transactions on disk until needed") + "\n" +
+        "  -walletlog             " + _("Keep the wallet in an append-only log instead of Berkeley DB. wallet.dat is migrated on first use and kept as wallet.dat.migrated") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 288, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-4, default: 3)") + "\n" +
         "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n" +
@@ -576,6 +587,12 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // The signature cache is sized once, before any script check thread starts
+    InitSignatureCache();
+
+    // Likewise the SHA-256 code for merkle trees is picked once
+    printf("Using %s SHA-256 for merkle trees\n", SHA256AutoDetect().c_str());
+
     // -debug implies fDebug*
     if (fDebug)
         fDebugNet = true;
@@ -629,6 +646,9 @@ bool AppInit2(boost::thread_group& threadGroup)
             return InitError(strprintf(_("Invalid amount for -minrelaytxfee=<amount>: '%s'"), mapArgs["-minrelaytxfee"].c_str()));
     }
 
+    mempool.SetLimits((size_t)GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000,
+                      GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+
     if (mapArgs.count("-paytxfee"))
     {
         if (!ParseMoney(mapArgs["-paytxfee"], nTransactionFee))
@@ -684,7 +704,11 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     // ********************************************************* Step 5: verify wallet database integrity
 
-    if (!fDisableWallet) {
+    // Once there is a log store it is the wallet, whether or not -walletlog
+    // is still given. Migrating moves wallet.dat aside.
+    bool fWalletLog = CLogDB::Exists(GetDataDir() / "wallet.dat");
+
+    if (!fDisableWallet && !fWalletLog) {
         uiInterface.InitMessage(_("Verifying wallet..."));
 
         if (!bitdb.Open(GetDataDir()))
@@ -728,7 +752,25 @@ bool AppInit2(boost::thread_group& threadGroup)
             if (r == CDBEnv::RECOVER_FAIL)
                 return InitError(_("wallet.dat corrupt, salvage failed"));
         }
-    } // (!fDisableWallet)
+
+        if (GetBoolArg("-walletlog") && filesystem::exists(GetDataDir() / "wallet.dat"))
+        {
+            uiInterface.InitMessage(_("Migrating wallet..."));
+            if (!CWalletDB::MigrateToLog("wallet.dat"))
+                return InitError(_("Error migrating wallet.dat to a log store"));
+            if (filesystem::exists(GetDataDir() / "wallet.dat"))
+                InitWarning(_("Warning: wallet.dat could not be renamed after migrating it to a log store. It still holds the wallet's keys without any encryption added later; remove it once the migrated wallet works."));
+            else
+                InitWarning(_("Warning: wallet.dat was migrated to a log store and kept as wallet.dat.migrated. It still holds the wallet's keys without any encryption added later; remove it once the migrated wallet works."));
+        }
+    } // (!fDisableWallet && !fWalletLog)
+
+    if (!fDisableWallet && (fWalletLog || GetBoolArg("-walletlog")))
+    {
+        uiInterface.InitMessage(_("Verifying wallet..."));
+        if (!bitdb.OpenLogDb("wallet.dat"))
+            return InitError(_("Error loading the wallet log store"));
+    }
 
     // ********************************************************* Step 6: network initialization
 
@@ -1025,6 +1067,7 @@ bool AppInit2(boost::thread_group& threadGroup)
         nStart = GetTimeMillis();
         bool fFirstRun = true;
         pwalletMain = new CWallet("wallet.dat");
+        pwalletMain->fLazyLoad = GetBoolArg("-lazywallet");
         DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRun);
         if (nLoadWalletRet != DB_LOAD_OK)
         {
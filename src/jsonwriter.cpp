@@ -0,0 +1,332 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonwriter.h"
+#include "json/json_spirit_writer_template.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <wctype.h>
+#include <iomanip>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+void CJSONWriter::WriteString(const char* pbegin, const char* pend)
+{
+    strOut += '"';
+    const char* pRun = pbegin;
+    for (const char* p = pbegin; p != pend; p++)
+    {
+        // Most characters are copied as they are, in runs
+        const char c = *p;
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+            continue;
+        strOut.append(pRun, p);
+        pRun = p + 1;
+
+        // The rest are escaped the way json_spirit does it
+        if (add_esc_char(c, strOut))
+            continue;
+        const wint_t unsigned_c((c >= 0) ? c : 256 + c);
+        if (iswprint(unsigned_c))
+            strOut += c;
+        else
+            strOut += non_printable_to_string<string>(unsigned_c);
+    }
+    strOut.append(pRun, pend);
+    strOut += '"';
+}
+
+json_spirit::Value& CJSONWriter::AddValue(const Value& value)
+{
+    if (vOpen.empty())
+    {
+        valueOut = value;
+        return valueOut;
+    }
+    // Only the innermost container grows, so the pointers to the ones
+    // around it stay valid
+    Value& container = *vOpen.back();
+    if (container.type() == obj_type)
+    {
+        Object& obj = container.get_obj();
+        obj.push_back(json_spirit::Pair(strKey, value));
+        return obj.back().value_;
+    }
+    Array& arr = container.get_array();
+    arr.push_back(value);
+    return arr.back();
+}
+
+void CJSONWriter::BeginObject()
+{
+    if (fValue)
+    {
+        vOpen.push_back(&AddValue(Object()));
+        return;
+    }
+    Separate();
+    strOut += '{';
+    fSeparate = false;
+}
+
+void CJSONWriter::EndObject()
+{
+    if (fValue)
+    {
+        vOpen.pop_back();
+        return;
+    }
+    strOut += '}';
+    fSeparate = true;
+}
+
+void CJSONWriter::BeginArray()
+{
+    if (fValue)
+    {
+        vOpen.push_back(&AddValue(Array()));
+        return;
+    }
+    Separate();
+    strOut += '[';
+    fSeparate = false;
+}
+
+void CJSONWriter::EndArray()
+{
+    if (fValue)
+    {
+        vOpen.pop_back();
+        return;
+    }
+    strOut += ']';
+    fSeparate = true;
+}
+
+void CJSONWriter::Key(const char* psz)
+{
+    if (fValue)
+    {
+        strKey = psz;
+        return;
+    }
+    Separate();
+    WriteString(psz, psz + strlen(psz));
+    strOut += ':';
+    fSeparate = false;
+}
+
+void CJSONWriter::Key(const std::string& str)
+{
+    if (fValue)
+    {
+        strKey = str;
+        return;
+    }
+    Separate();
+    WriteString(str.data(), str.data() + str.size());
+    strOut += ':';
+    fSeparate = false;
+}
+
+void CJSONWriter::Write(const char* psz)
+{
+    if (fValue)
+    {
+        AddValue(string(psz));
+        return;
+    }
+    Separate();
+    WriteString(psz, psz + strlen(psz));
+    fSeparate = true;
+}
+
+void CJSONWriter::Write(const std::string& str)
+{
+    if (fValue)
+    {
+        AddValue(str);
+        return;
+    }
+    Separate();
+    WriteString(str.data(), str.data() + str.size());
+    fSeparate = true;
+}
+
+void CJSONWriter::Write(bool f)
+{
+    if (fValue)
+    {
+        AddValue(f);
+        return;
+    }
+    Separate();
+    strOut += (f ? "true" : "false");
+    fSeparate = true;
+}
+
+void CJSONWriter::Write(int n)
+{
+    Write((long long)n);
+}
+
+void CJSONWriter::Write(unsigned int n)
+{
+    Write((long long)n);
+}
+
+void CJSONWriter::Write(long long n)
+{
+    if (fValue)
+    {
+        AddValue((boost::int64_t)n);
+        return;
+    }
+    Separate();
+    char buf[32];
+    strOut.append(buf, snprintf(buf, sizeof(buf), "%lld", n));
+    fSeparate = true;
+}
+
+void CJSONWriter::Write(unsigned long long n)
+{
+    if (fValue)
+    {
+        // Signed where it fits, as the actors building Values have it
+        if (n <= (unsigned long long)std::numeric_limits<boost::int64_t>::max())
+            AddValue((boost::int64_t)n);
+        else
+            AddValue((boost::uint64_t)n);
+        return;
+    }
+    Separate();
+    char buf[32];
+    strOut.append(buf, snprintf(buf, sizeof(buf), "%llu", n));
+    fSeparate = true;
+}
+
+void CJSONWriter::Write(double d)
+{
+    if (fValue)
+    {
+        AddValue(d);
+        return;
+    }
+    Separate();
+
+    // The same as json_spirit's std::fixed with a precision of 8, which
+    // isn't what printf gives: printf takes the decimal point from
+    // LC_NUMERIC, and the GUI sets that to the user's locale.
+    //
+    // Amounts come from whole units, so below 1e7 the units can be
+    // recovered exactly and written as integers. The double is then within
+    // half a unit of the last digit, so this is also what rounding its
+    // exact value to 8 decimals gives.
+    if (d > -1e7 && d < 1e7)
+    {
+        long long n = (long long)(d * 1e8 + (d < 0 ? -0.5 : 0.5));
+        if ((double)n / 1e8 == d && (n != 0 || copysign(1.0, d) > 0))
+        {
+            unsigned long long u = (n < 0 ? -(unsigned long long)n : n);
+            char buf[32];
+            strOut.append(buf, snprintf(buf, sizeof(buf), "%s%llu.%08llu", n < 0 ? "-" : "", u / 100000000ULL, u % 100000000ULL));
+            fSeparate = true;
+            return;
+        }
+    }
+    std::ostringstream os;
+    os.imbue(std::locale::classic());
+    os << std::showpoint << std::fixed << std::setprecision(8) << d;
+    strOut += os.str();
+    fSeparate = true;
+}
+
+void CJSONWriter::WriteNull()
+{
+    if (fValue)
+    {
+        AddValue(Value());
+        return;
+    }
+    Separate();
+    strOut += "null";
+    fSeparate = true;
+}
+
+void CJSONWriter::Write(const Value& value)
+{
+    if (fValue)
+    {
+        AddValue(value);
+        return;
+    }
+    switch (value.type())
+    {
+    case obj_type:   Write(value.get_obj()); break;
+    case array_type: Write(value.get_array()); break;
+    case str_type:   Write(value.get_str()); break;
+    case bool_type:  Write(value.get_bool()); break;
+    case int_type:
+        if (value.is_uint64())
+            Write((unsigned long long)value.get_uint64());
+        else
+            Write((long long)value.get_int64());
+        break;
+    case real_type:  Write(value.get_real()); break;
+    case null_type:  WriteNull(); break;
+    }
+}
+
+void CJSONWriter::Write(const Object& obj)
+{
+    if (fValue)
+    {
+        AddValue(obj);
+        return;
+    }
+    BeginObject();
+    BOOST_FOREACH(const json_spirit::Pair& pair, obj)
+    {
+        Key(pair.name_);
+        Write(pair.value_);
+    }
+    EndObject();
+}
+
+void CJSONWriter::Write(const Array& arr)
+{
+    if (fValue)
+    {
+        AddValue(arr);
+        return;
+    }
+    BeginArray();
+    BOOST_FOREACH(const Value& value, arr)
+        Write(value);
+    EndArray();
+}
+
+void CJSONWriter::WriteRaw(const std::string& strJSON)
+{
+    assert(!fValue);
+    Separate();
+    strOut += strJSON;
+    fSeparate = true;
+}
+
+void CJSONWriter::Append(const CJSONWriter& part)
+{
+    assert(part.fValue == fValue);
+    if (fValue)
+        AddValue(part.valueOut);
+    else
+        WriteRaw(part.strOut);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_JSONWRITER_H
+#define BITCOIN_JSONWRITER_H
+
+#include <string>
+#include <vector>
+
+#include "json/json_spirit_value.h"
+
+/** Writes JSON text straight into a string, without building a
+ *  json_spirit::Value tree first. The text is the same write_string gives
+ *  for the same values when not pretty printing.
+ *
+ * Objects and arrays are opened and closed explicitly and the commas are
+ * put in as needed. Inside an object every value follows a Key().
+ *
+ * Constructed with fValue set, the same calls build a json_spirit::Value
+ * instead, for callers in this process that want the result as a Value.
+ */
+class CJSONWriter
+{
+private:
+    std::string strOut;
+    bool fSeparate;
+
+    bool fValue;
+    json_spirit::Value valueOut;
+    /** The open objects and arrays, innermost last */
+    std::vector<json_spirit::Value*> vOpen;
+    std::string strKey;
+
+    void Separate()
+    {
+        if (fSeparate)
+            strOut += ',';
+    }
+
+    void WriteString(const char* pbegin, const char* pend);
+    json_spirit::Value& AddValue(const json_spirit::Value& value);
+
+public:
+    explicit CJSONWriter(bool fValueIn = false) : fSeparate(false), fValue(fValueIn) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    void Key(const char* psz);
+    void Key(const std::string& str);
+
+    void Write(const char* psz);
+    void Write(const std::string& str);
+    void Write(bool f);
+    void Write(int n);
+    void Write(unsigned int n);
+    void Write(long long n);
+    void Write(unsigned long long n);
+    void Write(double d);
+    void WriteNull();
+    void Write(const json_spirit::Value& value);
+    void Write(const json_spirit::Object& obj);
+    void Write(const json_spirit::Array& arr);
+
+    /** Append a value that is already JSON text, e.g. another writer's.
+     *  Only for writers producing text. */
+    void WriteRaw(const std::string& strJSON);
+
+    /** An empty writer producing the same kind of output as this one, for
+     *  parts that are written on their own and added with Append() */
+    CJSONWriter NewPart() const { return CJSONWriter(fValue); }
+    /** Add what a writer from NewPart() wrote as the next value */
+    void Append(const CJSONWriter& part);
+
+    template<typename T> void Pair(const char* pszKey, const T& value)
+    {
+        Key(pszKey);
+        Write(value);
+    }
+
+    template<typename T> void Pair(const std::string& strKey, const T& value)
+    {
+        Key(strKey);
+        Write(value);
+    }
+
+    const std::string& str() const { return strOut; }
+    /** The value written, if constructed with fValue */
+    const json_spirit::Value& value() const { return valueOut; }
+    /** Hand over the text written so far and start again */
+    void swap(std::string& str) { strOut.swap(str); strOut.clear(); fSeparate = false; }
+    void reserve(size_t n) { if (!fValue) strOut.reserve(n); }
+};
+
+#endif // BITCOIN_JSONWRITER_H
@@ -7,6 +7,7 @@
 #include <openssl/obj_mac.h>
 
 #include "key.h"
+#include "secp256k1.h"
 
 
 // Generate a private key from just the secret parameter
@@ -339,6 +340,16 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
+    if (vchSig.size() != 65)
+        return false;
+    unsigned char pubkey[33];
+    if (!Secp256k1RecoverCompact(hash, &vchSig[1], vchSig[0] - 27, pubkey))
+        return false;
+    Set(pubkey, pubkey + sizeof(pubkey));
+    return true;
+}
+
+bool CPubKey::RecoverCompactOpenSSL(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
     CECKey key;
@@ -351,18 +362,46 @@ bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned cha
 bool CPubKey::VerifyCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
-    if (vchSig.size() != 65)
-        return false;
-    CECKey key;
-    if (!key.Recover(hash, &vchSig[1], vchSig[0] - 27))
-        return false;
     CPubKey pubkeyRec;
-    key.GetPubKey(pubkeyRec);
+    if (!pubkeyRec.RecoverCompact(hash, vchSig))
+        return false;
     if (*this != pubkeyRec)
         return false;
     return true;
 }
 
+bool VerifyCompactBatch(const std::vector<CCompactSigCheck>& vChecks, std::vector<bool>* pvValid) {
+    size_t n = vChecks.size();
+    if (pvValid)
+        pvValid->assign(n, false);
+    if (n == 0)
+        return true;
+
+    std::vector<uint256> vHash(n);
+    std::vector<const unsigned char*> vSig(n);
+    std::vector<int> vRec(n);
+    std::vector<unsigned char> vPubKey(n * 33);
+    std::vector<char> vRecovered(n);
+    // Malformed signatures get an invalid recovery id so they just fail
+    static const unsigned char vchEmpty[64] = {};
+    for (size_t i = 0; i < n; i++) {
+        const std::vector<unsigned char>& vchSig = vChecks[i].vchSig;
+        vHash[i] = vChecks[i].hash;
+        vSig[i] = vchSig.size() == 65 ? &vchSig[1] : vchEmpty;
+        vRec[i] = vchSig.size() == 65 ? vchSig[0] - 27 : -1;
+    }
+    Secp256k1RecoverCompactBatch(n, &vHash[0], &vSig[0], &vRec[0], (unsigned char (*)[33])&vPubKey[0], &vRecovered[0]);
+
+    bool fAllValid = true;
+    for (size_t i = 0; i < n; i++) {
+        bool fValid = vRecovered[i] && Hash160(&vPubKey[i * 33], &vPubKey[i * 33 + 33]) == vChecks[i].pubKeyHash;
+        if (pvValid)
+            (*pvValid)[i] = fValid;
+        fAllValid &= fValid;
+    }
+    return fAllValid;
+}
+
 bool CPubKey::IsFullyValid() const {
     if (!IsValid())
         return false;
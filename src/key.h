@@ -152,8 +152,31 @@ public:
 
     // Recover a public key from a compact signature.
     bool RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig);
+
+    // Same as RecoverCompact, but through OpenSSL instead of the native
+    // secp256k1 code. Much slower; kept to cross-check the native version.
+    bool RecoverCompactOpenSSL(const uint256 &hash, const std::vector<unsigned char>& vchSig);
+};
+
+/** A compact signature that must recover to the public key with the given
+ *  Hash160, as checked by CheckSig() in script.cpp. */
+struct CCompactSigCheck
+{
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+    uint160 pubKeyHash;
+
+    CCompactSigCheck() {}
+    CCompactSigCheck(const uint256 &hashIn, const std::vector<unsigned char>& vchSigIn, const uint160 &pubKeyHashIn) :
+        hash(hashIn), vchSig(vchSigIn), pubKeyHash(pubKeyHashIn) {}
 };
 
+/** Check many compact signatures at once. The modular inversions needed to
+ *  recover their public keys are shared across the whole batch, which makes
+ *  this cheaper than calling VerifyCompact on each. Returns whether all of
+ *  them are valid; if pvValid is given it receives the result of each one. */
+bool VerifyCompactBatch(const std::vector<CCompactSigCheck>& vChecks, std::vector<bool>* pvValid = NULL);
+
 
 // secure_allocator is defined in allocators.h
 // CPrivKey is a serialized private key, with all parameters included (279 bytes)
@@ -0,0 +1,456 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logdb.h"
+#include "util.h"
+
+#include <boost/crc.hpp>
+#include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+enum
+{
+    LOG_WRITE = 1,
+    LOG_ERASE = 2,
+};
+
+/** Size, CRC32 of the size and CRC32 of the payload in front of every
+ *  record. The size has its own checksum so that damage to it can't be
+ *  taken for a record cut short at the end of the file. */
+static const unsigned int LOG_HEADER_SIZE = 12;
+/** Snapshots are written as records of about this size */
+static const unsigned int SNAPSHOT_RECORD_SIZE = 1024 * 1024;
+
+static unsigned int LogChecksum(const char* pbegin, const char* pend)
+{
+    boost::crc_32_type crc;
+    crc.process_block(pbegin, pend);
+    return crc.checksum();
+}
+
+/** Frame a record's payload with its size and checksum and write it out */
+static bool WriteLogRecord(FILE* file, const CDataStream& ssPayload)
+{
+    unsigned int nSize = ssPayload.size();
+    unsigned int nSizeChecksum = LogChecksum((const char*)&nSize, (const char*)&nSize + 4);
+    unsigned int nChecksum = LogChecksum(&ssPayload[0], &ssPayload[0] + nSize);
+    char header[LOG_HEADER_SIZE];
+    memcpy(header, &nSize, 4);
+    memcpy(header + 4, &nSizeChecksum, 4);
+    memcpy(header + 8, &nChecksum, 4);
+    return fwrite(header, 1, LOG_HEADER_SIZE, file) == LOG_HEADER_SIZE &&
+           fwrite(&ssPayload[0], 1, nSize, file) == nSize;
+}
+
+static boost::filesystem::path AddExtension(const boost::filesystem::path& path, const char* pszExt)
+{
+    return boost::filesystem::path(path.string() + pszExt);
+}
+
+
+CLogDB::CLogDB() : fileLog(NULL), nSnapshotSize(0), nLogSize(0), fSynced(true)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+bool CLogDB::Exists(const boost::filesystem::path& pathBase)
+{
+    return filesystem::exists(AddExtension(pathBase, ".snapshot"));
+}
+
+bool CLogDB::WriteSnapshot(const boost::filesystem::path& path, const CLogDataMap& mapRecords, uint64* pnSize)
+{
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (!file)
+        return error("CLogDB::WriteSnapshot() : can't create %s", path.string().c_str());
+
+    bool fOk = true;
+    uint64 nSize = 0;
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    CLogDataMap::const_iterator it = mapRecords.begin();
+    while (fOk && it != mapRecords.end())
+    {
+        ssPayload << (unsigned char)LOG_WRITE << (*it).first << (*it).second;
+        ++it;
+        if (ssPayload.size() >= SNAPSHOT_RECORD_SIZE || it == mapRecords.end())
+        {
+            fOk = WriteLogRecord(file, ssPayload);
+            nSize += LOG_HEADER_SIZE + ssPayload.size();
+            ssPayload.clear();
+        }
+    }
+    if (fOk)
+    {
+        FileCommit(file);
+        fOk = !ferror(file);
+    }
+    fclose(file);
+    if (!fOk)
+    {
+        filesystem::remove(path);
+        return error("CLogDB::WriteSnapshot() : error writing %s", path.string().c_str());
+    }
+    if (pnSize)
+        *pnSize = nSize;
+    return true;
+}
+
+bool CLogDB::Replay(const boost::filesystem::path& path, bool fLog)
+{
+    if (!filesystem::exists(path))
+        return true;
+    uint64 nFileSize = filesystem::file_size(path);
+    if (nFileSize == 0)
+        return true;
+
+    // Map the file instead of reading it, the records are parsed straight
+    // out of the page cache
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return error("CLogDB::Replay() : can't open %s", path.string().c_str());
+    void* pmap = mmap(NULL, nFileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pmap == MAP_FAILED)
+        return error("CLogDB::Replay() : can't map %s", path.string().c_str());
+    madvise(pmap, nFileSize, MADV_SEQUENTIAL);
+    const char* pbegin = (const char*)pmap;
+#else
+    CSerializeData vchFile(nFileSize);
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("CLogDB::Replay() : can't open %s", path.string().c_str());
+    bool fRead = (fread(&vchFile[0], 1, nFileSize, file) == nFileSize);
+    fclose(file);
+    if (!fRead)
+        return error("CLogDB::Replay() : can't read %s", path.string().c_str());
+    const char* pbegin = &vchFile[0];
+#endif
+    const char* pend = pbegin + nFileSize;
+
+    // A record running past the end of the file, by a size that checks
+    // out, is a write a crash cut short; so is a tail of zeros the file
+    // system left behind. Anything else that doesn't check out is damage
+    // to the file.
+    const char* p = pbegin;
+    bool fTorn = false, fCorrupt = false;
+    while (p < pend)
+    {
+        unsigned int nSize, nSizeChecksum, nChecksum;
+        if (pend - p < (ptrdiff_t)LOG_HEADER_SIZE)
+        {
+            fTorn = true;
+            break;
+        }
+        memcpy(&nSize, p, 4);
+        memcpy(&nSizeChecksum, p + 4, 4);
+        memcpy(&nChecksum, p + 8, 4);
+        if (LogChecksum(p, p + 4) != nSizeChecksum)
+        {
+            const char* pZero = p;
+            while (pZero < pend && *pZero == 0)
+                pZero++;
+            if (pZero == pend)
+                fTorn = true;
+            else
+                fCorrupt = true;
+            break;
+        }
+        const char* pPayload = p + LOG_HEADER_SIZE;
+        if ((uint64)(pend - pPayload) < nSize)
+        {
+            fTorn = true;
+            break;
+        }
+        if (LogChecksum(pPayload, pPayload + nSize) != nChecksum)
+        {
+            fCorrupt = true;
+            break;
+        }
+
+        // The checksum matched, so the payload is what was written and can
+        // go straight into the map
+        try {
+            CDataStreamView ssPayload(pPayload, pPayload + nSize, SER_DISK, CLIENT_VERSION);
+            while (!ssPayload.empty())
+            {
+                unsigned char nOp;
+                CSerializeData key;
+                ssPayload >> nOp >> key;
+                if (nOp == LOG_WRITE)
+                    ssPayload >> mapData[key];
+                else if (nOp == LOG_ERASE)
+                    mapData.erase(key);
+                else
+                    throw runtime_error("unknown operation");
+            }
+        }
+        catch (std::exception &e) {
+            fCorrupt = true;
+            break;
+        }
+        p = pPayload + nSize;
+    }
+    uint64 nValid = p - pbegin;
+
+#ifndef WIN32
+    munmap(pmap, nFileSize);
+#endif
+
+    // Damage is left for the user to deal with, cutting the file there
+    // would throw away every record after it
+    if (fCorrupt || (fTorn && !fLog))
+        return error("CLogDB::Replay() : %s is corrupt at offset %"PRI64u, path.string().c_str(), nValid);
+
+    if (!fLog)
+    {
+        nSnapshotSize = nValid;
+        return true;
+    }
+
+    nLogSize = nValid;
+    if (fTorn)
+    {
+        // Drop the cut short record, or everything appended after it would
+        // be lost on the next replay
+        printf("CLogDB::Replay() : dropping %"PRI64u" bytes at the end of %s\n", nFileSize - nValid, path.string().c_str());
+        FILE* file = fopen(path.string().c_str(), "r+b");
+        if (!file || !TruncateFile(file, nValid))
+        {
+            if (file)
+                fclose(file);
+            return error("CLogDB::Replay() : can't truncate %s", path.string().c_str());
+        }
+        FileCommit(file);
+        fclose(file);
+    }
+    return true;
+}
+
+void CLogDB::Apply(const CLogBatch& batch)
+{
+    BOOST_FOREACH(const CSerializeData& key, batch.setErase)
+        mapData.erase(key);
+    for (CLogDataMap::const_iterator it = batch.mapWrite.begin(); it != batch.mapWrite.end(); ++it)
+        mapData[(*it).first] = (*it).second;
+}
+
+bool CLogDB::Append(const CLogBatch& batch)
+{
+    if (!fileLog)
+        return false;
+
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    BOOST_FOREACH(const CSerializeData& key, batch.setErase)
+        ssPayload << (unsigned char)LOG_ERASE << key;
+    for (CLogDataMap::const_iterator it = batch.mapWrite.begin(); it != batch.mapWrite.end(); ++it)
+        ssPayload << (unsigned char)LOG_WRITE << (*it).first << (*it).second;
+
+    if (!WriteLogRecord(fileLog, ssPayload) || fflush(fileLog) != 0)
+    {
+        // Cut off whatever part of the record made it, so the records
+        // appended later can still be replayed
+        clearerr(fileLog);
+        TruncateFile(fileLog, nLogSize);
+        fseek(fileLog, 0, SEEK_END);
+        return error("CLogDB::Append() : error writing %s", pathLog.string().c_str());
+    }
+    nLogSize += LOG_HEADER_SIZE + ssPayload.size();
+    fSynced = false;
+    return true;
+}
+
+bool CLogDB::Open(const boost::filesystem::path& pathBase)
+{
+    LOCK(cs_logdb);
+    if (fileLog)
+        return true;
+
+    pathSnapshot = AddExtension(pathBase, ".snapshot");
+    pathLog = AddExtension(pathBase, ".log");
+    mapData.clear();
+    nSnapshotSize = nLogSize = 0;
+
+    int64 nStart = GetTimeMillis();
+    if (!filesystem::exists(pathSnapshot))
+    {
+        // A log without its snapshot is left over from an earlier store
+        // that never finished being created
+        filesystem::remove(pathLog);
+        if (!WriteSnapshot(pathSnapshot, mapData))
+            return false;
+    }
+    if (!Replay(pathSnapshot, false) || !Replay(pathLog, true))
+    {
+        mapData.clear();
+        return false;
+    }
+
+    fileLog = fopen(pathLog.string().c_str(), "ab");
+    if (!fileLog)
+        return error("CLogDB::Open() : can't open %s", pathLog.string().c_str());
+    fSynced = true;
+    printf("Loaded %"PRIszu" records from %s (%"PRI64u" + %"PRI64u" bytes) in %"PRI64d"ms\n",
+           mapData.size(), pathBase.string().c_str(), nSnapshotSize, nLogSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK(cs_logdb);
+    if (!fileLog)
+        return;
+    FileCommit(fileLog);
+    fclose(fileLog);
+    fileLog = NULL;
+    fSynced = true;
+}
+
+bool CLogDB::IsOpen() const
+{
+    LOCK(cs_logdb);
+    return fileLog != NULL;
+}
+
+bool CLogDB::Read(const CSerializeData& key, CSerializeData& value) const
+{
+    LOCK(cs_logdb);
+    CLogDataMap::const_iterator it = mapData.find(key);
+    if (it == mapData.end())
+        return false;
+    value = (*it).second;
+    return true;
+}
+
+bool CLogDB::Exists(const CSerializeData& key) const
+{
+    LOCK(cs_logdb);
+    return mapData.count(key) > 0;
+}
+
+bool CLogDB::Write(const CSerializeData& key, const CSerializeData& value, bool fOverwrite)
+{
+    LOCK(cs_logdb);
+    if (!fOverwrite && mapData.count(key))
+        return false;
+    CLogBatch batch;
+    batch.mapWrite[key] = value;
+    if (!Append(batch))
+        return false;
+    mapData[key] = value;
+    return true;
+}
+
+bool CLogDB::Erase(const CSerializeData& key)
+{
+    LOCK(cs_logdb);
+    if (!mapData.count(key))
+        return true;
+    CLogBatch batch;
+    batch.setErase.insert(key);
+    if (!Append(batch))
+        return false;
+    mapData.erase(key);
+    return true;
+}
+
+bool CLogDB::WriteBatch(const CLogBatch& batch)
+{
+    if (batch.IsEmpty())
+        return true;
+    LOCK(cs_logdb);
+    if (!Append(batch))
+        return false;
+    Apply(batch);
+    return true;
+}
+
+bool CLogDB::Seek(const CSerializeData& key, bool fInclusive, CSerializeData& keyRet, CSerializeData& valueRet) const
+{
+    LOCK(cs_logdb);
+    CLogDataMap::const_iterator it = (fInclusive ? mapData.lower_bound(key) : mapData.upper_bound(key));
+    if (it == mapData.end())
+        return false;
+    keyRet = (*it).first;
+    valueRet = (*it).second;
+    return true;
+}
+
+bool CLogDB::Sync()
+{
+    LOCK(cs_logdb);
+    if (fSynced || !fileLog)
+        return true;
+    FileCommit(fileLog);
+    fSynced = true;
+    return !ferror(fileLog);
+}
+
+bool CLogDB::NeedsCompaction() const
+{
+    LOCK(cs_logdb);
+    return fileLog && nLogSize > std::max(nSnapshotSize, MIN_COMPACT_SIZE);
+}
+
+bool CLogDB::Compact()
+{
+    LOCK(cs_logdb);
+    if (!fileLog)
+        return false;
+
+    int64 nStart = GetTimeMillis();
+    boost::filesystem::path pathNew = AddExtension(pathSnapshot, ".new");
+    uint64 nSize;
+    if (!WriteSnapshot(pathNew, mapData, &nSize))
+        return false;
+    if (!RenameOver(pathNew, pathSnapshot))
+    {
+        filesystem::remove(pathNew);
+        return error("CLogDB::Compact() : can't rename %s", pathNew.string().c_str());
+    }
+
+    // Everything in the log is in the snapshot now
+    if (!TruncateFile(fileLog, 0))
+        return error("CLogDB::Compact() : can't truncate %s", pathLog.string().c_str());
+    fseek(fileLog, 0, SEEK_END);
+    FileCommit(fileLog);
+    printf("Compacted %s: %"PRI64u" bytes of log into a %"PRI64u" byte snapshot in %"PRI64d"ms\n",
+           pathLog.string().c_str(), nLogSize, nSize, GetTimeMillis() - nStart);
+    nSnapshotSize = nSize;
+    nLogSize = 0;
+    fSynced = true;
+    return true;
+}
+
+bool CLogDB::Backup(const boost::filesystem::path& pathDest) const
+{
+    LOCK(cs_logdb);
+    return WriteSnapshot(pathDest, mapData);
+}
+
+uint64 CLogDB::GetLogSize() const
+{
+    LOCK(cs_logdb);
+    return nLogSize;
+}
+
+size_t CLogDB::GetRecordCount() const
+{
+    LOCK(cs_logdb);
+    return mapData.size();
+}
@@ -0,0 +1,127 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_LOGDB_H
+#define BITCOIN_LOGDB_H
+
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include "serialize.h"
+#include "sync.h"
+
+/** Orders keys the way Berkeley DB's default btree comparison does: bytes
+ *  compared as unsigned, and a key sorts before the keys it is a prefix of. */
+struct CLogKeyCompare
+{
+    bool operator()(const CSerializeData& a, const CSerializeData& b) const
+    {
+        size_t n = std::min(a.size(), b.size());
+        int c = (n == 0 ? 0 : memcmp(&a[0], &b[0], n));
+        return c < 0 || (c == 0 && a.size() < b.size());
+    }
+};
+
+typedef std::map<CSerializeData, CSerializeData, CLogKeyCompare> CLogDataMap;
+
+/** Writes and erases buffered by a transaction, so they reach the log as a
+ *  single record: after a crash either all of them are there or none. */
+class CLogBatch
+{
+public:
+    CLogDataMap mapWrite;
+    std::set<CSerializeData, CLogKeyCompare> setErase;
+
+    void Write(const CSerializeData& key, const CSerializeData& value)
+    {
+        setErase.erase(key);
+        mapWrite[key] = value;
+    }
+
+    void Erase(const CSerializeData& key)
+    {
+        mapWrite.erase(key);
+        setErase.insert(key);
+    }
+
+    bool IsEmpty() const { return mapWrite.empty() && setErase.empty(); }
+};
+
+/** Key/value store kept in memory, and on disk as a snapshot of all records
+ *  plus an append-only log of the changes made since the snapshot.
+ *
+ * Both files are a sequence of records, each a list of writes and erases
+ * behind its size and CRC32s of the size and of the payload. Opening maps the files into memory and replays
+ * them; a record cut short by a crash at the end of the log is dropped, a
+ * damaged one anywhere makes Open() fail and leaves the files as they are. A
+ * write is one fwrite to the end of the log and goes to the OS straight
+ * away; the fsync is left to Sync(), which the wallet flush thread calls
+ * every half second, so writes close together share one. That is the same
+ * durability Berkeley DB gives the wallet with DB_TXN_WRITE_NOSYNC.
+ *
+ * Once the log is larger than the snapshot, Compact() writes a new snapshot
+ * next to the old one, renames it over it and truncates the log. Replaying
+ * the old log over the new snapshot gives the same records, so a crash
+ * between the rename and the truncation loses nothing.
+ */
+class CLogDB
+{
+private:
+    mutable CCriticalSection cs_logdb;
+    boost::filesystem::path pathSnapshot;
+    boost::filesystem::path pathLog;
+    FILE* fileLog;
+    CLogDataMap mapData;
+    uint64 nSnapshotSize;
+    uint64 nLogSize;
+    bool fSynced;
+
+    bool Replay(const boost::filesystem::path& path, bool fLog);
+    bool Append(const CLogBatch& batch);
+    void Apply(const CLogBatch& batch);
+
+public:
+    /** The log is compacted once it is larger than this and the snapshot */
+    static const uint64 MIN_COMPACT_SIZE = 4 * 1024 * 1024;
+
+    CLogDB();
+    ~CLogDB();
+
+    /** Whether there is a store for pathBase, i.e. its snapshot exists */
+    static bool Exists(const boost::filesystem::path& pathBase);
+    /** Write the records to a new snapshot file at path */
+    static bool WriteSnapshot(const boost::filesystem::path& path, const CLogDataMap& mapRecords, uint64* pnSize = NULL);
+
+    /** Load the store at pathBase (pathBase.snapshot and pathBase.log), or
+     *  create an empty one */
+    bool Open(const boost::filesystem::path& pathBase);
+    /** Sync and close the files. Reads still work, writes fail. */
+    void Close();
+    bool IsOpen() const;
+
+    bool Read(const CSerializeData& key, CSerializeData& value) const;
+    bool Exists(const CSerializeData& key) const;
+    bool Write(const CSerializeData& key, const CSerializeData& value, bool fOverwrite = true);
+    bool Erase(const CSerializeData& key);
+    bool WriteBatch(const CLogBatch& batch);
+
+    /** The first record with a key after key, or at or after it if
+     *  fInclusive. Returns false if there is none. */
+    bool Seek(const CSerializeData& key, bool fInclusive, CSerializeData& keyRet, CSerializeData& valueRet) const;
+
+    /** fsync the writes made since the last call */
+    bool Sync();
+    bool NeedsCompaction() const;
+    bool Compact();
+    /** Copy the current records to a snapshot file elsewhere, for backups */
+    bool Backup(const boost::filesystem::path& pathDest) const;
+
+    uint64 GetLogSize() const;
+    size_t GetRecordCount() const;
+};
+
+#endif // BITCOIN_LOGDB_H
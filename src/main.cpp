@@ -12,6 +12,8 @@
 #include "ui_interface.h"
 #include "checkqueue.h"
 #include "ecdsa.h"
+#include "memusage.h"
+#include "sigcache.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -38,7 +40,7 @@ unsigned int nTransactionsUpdated = 0;
 map<uint256, CBlockIndex*> mapBlockIndex;
 uint256 hashGenesisBlock;
 
-static CBigNum bnProofOfWorkLimit(~uint256(0) >> 20); // SpreadCoin: starting difficulty is 1 / 2^20
+static uint256 bnProofOfWorkLimit(~uint256(0) >> 20); // SpreadCoin: starting difficulty is 1 / 2^20
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
 uint256 nBestChainWork = 0;
@@ -136,13 +138,6 @@ bool static GetTransaction(const uint256& hashTx, CWalletTx& wtx)
     return false;
 }
 
-// erases transaction with the given hash from all wallets
-void static EraseFromWallets(uint256 hash)
-{
-    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
-        pwallet->EraseFromWallet(hash);
-}
-
 // make sure all wallets know about the given transaction, in the given block
 void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate)
 {
@@ -661,6 +656,80 @@ int64 CTransaction::GetMinFee(unsigned int nBlockSize, bool fAllowFree,
     return nMinFee;
 }
 
+CTxMemPoolEntry::CTxMemPoolEntry()
+{
+    nFee = 0;
+    nTxSize = 0;
+    nTime = 0;
+    dPriority = 0.0;
+    nHeight = 0;
+    nValueInChain = 0;
+    nUsageSize = 0;
+    nCountWithAncestors = 0;
+    nSizeWithAncestors = 0;
+    nFeesWithAncestors = 0;
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& txIn, int64 nFeeIn, int64 nTimeIn,
+                                 double dPriorityIn, unsigned int nHeightIn, int64 nValueInChainIn) :
+    tx(txIn), nFee(nFeeIn), nTime(nTimeIn), dPriority(dPriorityIn), nHeight(nHeightIn), nValueInChain(nValueInChainIn)
+{
+    hash = tx.GetHash();
+    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+
+    nUsageSize = memusage::DynamicUsage(tx.vin) + memusage::DynamicUsage(tx.vout);
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        nUsageSize += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&txin.scriptSig));
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        nUsageSize += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&txout.scriptPubKey));
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nFeesWithAncestors = nFee;
+}
+
+double CTxMemPoolEntry::GetPriority(unsigned int nCurrentHeight) const
+{
+    if (nTxSize == 0 || nCurrentHeight <= nHeight)
+        return dPriority;
+    return dPriority + ((double)(nCurrentHeight - nHeight) * nValueInChain) / nTxSize;
+}
+
+double CTxMemPoolEntry::GetFeeRate() const
+{
+    if (nTxSize == 0)
+        return 0.0;
+    return (double)nFee * 1000.0 / nTxSize;
+}
+
+double CTxMemPoolEntry::GetAncestorScore() const
+{
+    if (nSizeWithAncestors == 0)
+        return 0.0;
+    return (double)nFeesWithAncestors * 1000.0 / nSizeWithAncestors;
+}
+
+void CTxMemPoolEntry::SetAncestorState(uint64 nCount, uint64 nSize, int64 nFees)
+{
+    nCountWithAncestors = nCount;
+    nSizeWithAncestors = nSize;
+    nFeesWithAncestors = nFees;
+}
+
+// Functor for indexed_transaction_set::modify
+struct update_ancestor_state
+{
+    update_ancestor_state(uint64 nCountIn, uint64 nSizeIn, int64 nFeesIn) :
+        nCount(nCountIn), nSize(nSizeIn), nFees(nFeesIn) { }
+
+    void operator()(CTxMemPoolEntry &e) { e.SetAncestorState(nCount, nSize, nFees); }
+
+private:
+    uint64 nCount;
+    uint64 nSize;
+    int64 nFees;
+};
+
 void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 {
     LOCK(cs);
@@ -676,6 +745,15 @@ void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 
 bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckInputs, bool fLimitFree,
                         bool* pfMissingInputs)
+{
+    CTxMemPoolEntry entry;
+    if (!prepare(state, tx, fCheckInputs, fLimitFree, pfMissingInputs, entry, NULL))
+        return false;
+    return commit(state, entry);
+}
+
+bool CTxMemPool::prepare(CValidationState &state, CTransaction &tx, bool fCheckInputs, bool fLimitFree,
+                         bool* pfMissingInputs, CTxMemPoolEntry &entry, std::vector<CScriptCheck> *pvChecks)
 {
     if (pfMissingInputs)
         *pfMissingInputs = false;
@@ -706,33 +784,17 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
     }
 
     // Check for conflicts with in-memory transactions
-    CTransaction* ptxOld = NULL;
+    // (replacing them with a newer version is disabled for now)
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
         COutPoint outpoint = tx.vin[i].prevout;
         if (mapNextTx.count(outpoint))
-        {
-            // Disable replacement feature for now
             return false;
-
-            // Allow replacing with a newer version of the same transaction
-            if (i != 0)
-                return false;
-            ptxOld = mapNextTx[outpoint].ptx;
-            if (ptxOld->IsFinal())
-                return false;
-            if (!tx.IsNewerThan(*ptxOld))
-                return false;
-            for (unsigned int i = 0; i < tx.vin.size(); i++)
-            {
-                COutPoint outpoint = tx.vin[i].prevout;
-                if (!mapNextTx.count(outpoint) || mapNextTx[outpoint].ptx != ptxOld)
-                    return false;
-            }
-            break;
-        }
     }
 
+    int64 nFees = 0;
+    double dPriority = 0;
+    int64 nValueInChain = 0;
     if (fCheckInputs)
     {
         CCoinsView dummy;
@@ -777,9 +839,22 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
         // you should add code here to check that the transaction does a
         // reasonable number of ECDSA signature verifications.
 
-        int64 nFees = tx.GetValueIn(view)-tx.GetValueOut();
+        nFees = tx.GetValueIn(view)-tx.GetValueOut();
         unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
+        // Priority is sum(valuein * age) / txsize over the inputs that are
+        // already confirmed; unconfirmed inputs start aging once mined.
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            const CCoins &coins = view.GetCoins(txin.prevout.hash);
+            if (coins.nHeight == MEMPOOL_HEIGHT)
+                continue;
+            int64 nValueIn = coins.vout[txin.prevout.n].nValue;
+            nValueInChain += nValueIn;
+            dPriority += (double)nValueIn * (nBestHeight - coins.nHeight + 1);
+        }
+        dPriority /= nSize;
+
         // Don't accept it if it can't get into a block
         int64 txMinFee = tx.GetMinFee(1, true, GMF_RELAY);
         if (fLimitFree && nFees < txMinFee)
@@ -787,6 +862,13 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
                          hash.ToString().c_str(),
                          nFees, txMinFee);
 
+        // Nor if it pays less than what was evicted from a full pool lately
+        int64 nPoolMinFee = GetMinFee(nSize);
+        if (nPoolMinFee > 0 && nFees < nPoolMinFee)
+            return error("CTxMemPool::accept() : memory pool min fee not met %s, %"PRI64d" < %"PRI64d,
+                         hash.ToString().c_str(),
+                         nFees, nPoolMinFee);
+
         // Continuously rate-limit free transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
@@ -812,27 +894,49 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx, bool fCheckIn
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!tx.CheckInputs(state, view, true, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC))
+        // With pvChecks the script checks are only collected, for the caller to run.
+        if (!tx.CheckInputs(state, view, true, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, pvChecks))
         {
             return error("CTxMemPool::accept() : ConnectInputs failed %s", hash.ToString().c_str());
         }
     }
 
+    entry = CTxMemPoolEntry(tx, nFees, GetTime(), dPriority, nBestHeight, nValueInChain);
+    return true;
+}
+
+bool CTxMemPool::commit(CValidationState &state, const CTxMemPoolEntry &entry)
+{
+    const CTransaction& tx = entry.GetTx();
+    const uint256& hash = entry.GetHash();
+
     // Store transaction in memory
+    std::vector<uint256> vRemoved;
     {
         LOCK(cs);
-        if (ptxOld)
-        {
-            printf("CTxMemPool::accept() : replacing tx %s with new version\n", ptxOld->GetHash().ToString().c_str());
-            remove(*ptxOld);
-        }
-        addUnchecked(hash, tx);
+        // Something else may have claimed the inputs since prepare()
+        if (mapTx.count(hash))
+            return false;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            if (mapNextTx.count(txin.prevout))
+                return false;
+
+        addUnchecked(hash, entry);
+
+        // Keep the pool within its time and memory limits
+        Expire(GetTime() - nExpiry, vRemoved);
+        if (DynamicMemoryUsage() > nSizeLimit)
+            TrimToSize(nSizeLimit, vRemoved);
     }
 
+    // Evicted transactions stay in the wallet, which will rebroadcast them
+    BOOST_FOREACH(const uint256& hashRemoved, vRemoved)
+        if (hashRemoved != hash)
+            UpdatedTransaction(hashRemoved);
+    if (!exists(hash))
+        return error("CTxMemPool::accept() : memory pool full, fee too low for %s", hash.ToString().c_str());
+
     ///// are we sure this is ok when loading transactions or restoring block txes
-    // If updated, erase old tx from wallet
-    if (ptxOld)
-        EraseFromWallets(ptxOld->GetHash());
     SyncWithWallets(hash, tx, NULL, true);
 
     return true;
@@ -1066,19 +1170,95 @@ int GetInputAge(CTxIn& vin)
 }
 
 
-bool CTxMemPool::addUnchecked(const uint256& hash, const CTransaction &tx)
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
 {
     // Add to memory pool without checking anything.  Don't call this directly,
     // call CTxMemPool::accept to properly check the transaction first.
     {
-        mapTx[hash] = tx;
+        LOCK(cs);
+        indexed_transaction_set::iterator it = mapTx.insert(entry).first;
+        nTotalTxSize += entry.GetTxSize();
+        nCachedInnerUsage += entry.DynamicMemoryUsage();
+        const CTransaction& tx = it->GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
-            mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+            mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+        UpdateAncestorState(hash);
+
+        // A transaction re-added after a reorg may already have children in
+        // the pool; their packages now include it.
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        setDescendants.erase(hash);
+        BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+            UpdateAncestorState(hashDescendant);
         nTransactionsUpdated++;
     }
     return true;
 }
 
+void CTxMemPool::CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors)
+{
+    LOCK(cs);
+    indexed_transaction_set::iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return;
+
+    std::vector<const CTransaction*> vWork(1, &it->GetTx());
+    while (!vWork.empty())
+    {
+        const CTransaction* ptx = vWork.back();
+        vWork.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin)
+        {
+            const uint256& hashParent = txin.prevout.hash;
+            if (setAncestors.count(hashParent))
+                continue;
+            indexed_transaction_set::iterator itParent = mapTx.find(hashParent);
+            if (itParent == mapTx.end())
+                continue;
+            setAncestors.insert(hashParent);
+            vWork.push_back(&itParent->GetTx());
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants)
+{
+    LOCK(cs);
+    std::vector<uint256> vWork(1, hash);
+    while (!vWork.empty())
+    {
+        uint256 hashTx = vWork.back();
+        vWork.pop_back();
+        if (!setDescendants.insert(hashTx).second)
+            continue;
+        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
+        for (; it != mapNextTx.end() && it->first.hash == hashTx; ++it)
+            vWork.push_back(it->second.ptx->GetHash());
+    }
+}
+
+void CTxMemPool::UpdateAncestorState(const uint256& hash)
+{
+    indexed_transaction_set::iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return;
+
+    std::set<uint256> setAncestors;
+    CalculateAncestors(hash, setAncestors);
+
+    uint64 nCount = 1;
+    uint64 nSize = it->GetTxSize();
+    int64 nFees = it->GetFee();
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+    {
+        indexed_transaction_set::iterator itAncestor = mapTx.find(hashAncestor);
+        nCount++;
+        nSize += itAncestor->GetTxSize();
+        nFees += itAncestor->GetFee();
+    }
+    mapTx.modify(it, update_ancestor_state(nCount, nSize, nFees));
+}
 
 bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
 {
@@ -1093,11 +1273,26 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
                     remove(*it->second.ptx, true);
             }
         }
-        if (mapTx.count(hash))
+        indexed_transaction_set::iterator it = mapTx.find(hash);
+        if (it != mapTx.end())
         {
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            // Children left behind (the transaction was mined) lose it from
+            // their ancestor packages
+            std::set<uint256> setDescendants;
+            if (!fRecursive)
+            {
+                CalculateDescendants(hash, setDescendants);
+                setDescendants.erase(hash);
+            }
+
+            BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
                 mapNextTx.erase(txin.prevout);
-            mapTx.erase(hash);
+            nTotalTxSize -= it->GetTxSize();
+            nCachedInnerUsage -= it->DynamicMemoryUsage();
+            mapTx.erase(it);
+
+            BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+                UpdateAncestorState(hashDescendant);
             nTransactionsUpdated++;
         }
     }
@@ -1119,11 +1314,134 @@ bool CTxMemPool::removeConflicts(const CTransaction &tx)
     return true;
 }
 
+int CTxMemPool::Expire(int64 nTime, std::vector<uint256>& vRemoved)
+{
+    LOCK(cs);
+    indexed_transaction_set::index<entry_time_index>::type& byTime = mapTx.get<entry_time_index>();
+    std::vector<CTransaction> vExpired;
+    for (indexed_transaction_set::index<entry_time_index>::type::iterator it = byTime.begin();
+         it != byTime.end() && it->GetTime() < nTime; ++it)
+        vExpired.push_back(it->GetTx());
+
+    int nRemoved = 0;
+    BOOST_FOREACH(const CTransaction& tx, vExpired)
+    {
+        if (!exists(tx.GetHash()))
+            continue; // already gone as a descendant of an earlier one
+        std::set<uint256> setDescendants;
+        CalculateDescendants(tx.GetHash(), setDescendants);
+        remove(tx, true);
+        vRemoved.insert(vRemoved.end(), setDescendants.begin(), setDescendants.end());
+        nRemoved += setDescendants.size();
+    }
+    if (nRemoved > 0)
+        printf("CTxMemPool::Expire() : removed %d transactions\n", nRemoved);
+    return nRemoved;
+}
+
+void CTxMemPool::TrimToSize(size_t nSizeLimit, std::vector<uint256>& vRemoved)
+{
+    LOCK(cs);
+    int nRemoved = 0;
+    while (!mapTx.empty() && DynamicMemoryUsage() > nSizeLimit)
+    {
+        // Evict a transaction together with everything that depends on it.
+        // Among the few cheapest transactions pick the one whose package
+        // (itself plus descendants) pays the lowest fee rate, so a child
+        // paying for its parent keeps the parent in the pool.
+        indexed_transaction_set::index<fee_rate_index>::type& byFeeRate = mapTx.get<fee_rate_index>();
+        indexed_transaction_set::index<fee_rate_index>::type::iterator itEvict = byFeeRate.end();
+        std::set<uint256> setEvict;
+        double dEvictFeeRate = 0;
+        indexed_transaction_set::index<fee_rate_index>::type::iterator it = byFeeRate.begin();
+        for (int nCandidates = 0; it != byFeeRate.end() && nCandidates < 10; ++it, ++nCandidates)
+        {
+            std::set<uint256> setPackage;
+            CalculateDescendants(it->GetHash(), setPackage);
+            uint64 nPackageSize = 0;
+            int64 nPackageFees = 0;
+            BOOST_FOREACH(const uint256& hashTx, setPackage)
+            {
+                indexed_transaction_set::iterator itTx = mapTx.find(hashTx);
+                nPackageSize += itTx->GetTxSize();
+                nPackageFees += itTx->GetFee();
+            }
+            double dFeeRate = (double)nPackageFees * 1000.0 / nPackageSize;
+            if (itEvict == byFeeRate.end() || dFeeRate < dEvictFeeRate)
+            {
+                itEvict = it;
+                setEvict.swap(setPackage);
+                dEvictFeeRate = dFeeRate;
+            }
+        }
+
+        CTransaction tx = itEvict->GetTx();
+        remove(tx, true);
+        vRemoved.insert(vRemoved.end(), setEvict.begin(), setEvict.end());
+        nRemoved += setEvict.size();
+
+        // Whatever comes in next has to pay more than what just left
+        double dMinFee = dEvictFeeRate + CTransaction::nMinRelayTxFee;
+        GetMinFeeRate(); // bring the decay up to date
+        if (dMinFee > dRollingMinFee)
+        {
+            dRollingMinFee = dMinFee;
+            nLastRollingFeeUpdate = GetTime();
+        }
+    }
+    if (nRemoved > 0)
+        printf("CTxMemPool::TrimToSize() : evicted %d transactions\n", nRemoved);
+}
+
+void CTxMemPool::SetLimits(size_t nSizeLimitIn, int64 nExpiryIn)
+{
+    LOCK(cs);
+    nSizeLimit = nSizeLimitIn;
+    nExpiry = nExpiryIn;
+}
+
+double CTxMemPool::GetMinFeeRate()
+{
+    LOCK(cs);
+    if (dRollingMinFee == 0)
+        return 0;
+
+    int64 nNow = GetTime();
+    if (nNow > nLastRollingFeeUpdate)
+    {
+        double dHalfLife = ROLLING_FEE_HALFLIFE;
+        size_t nUsage = DynamicMemoryUsage();
+        if (nUsage < nSizeLimit / 4)
+            dHalfLife /= 4;
+        else if (nUsage < nSizeLimit / 2)
+            dHalfLife /= 2;
+        dRollingMinFee /= pow(2.0, (nNow - nLastRollingFeeUpdate) / dHalfLife);
+        nLastRollingFeeUpdate = nNow;
+
+        if (dRollingMinFee < CTransaction::nMinRelayTxFee / 2)
+        {
+            dRollingMinFee = 0;
+            return 0;
+        }
+    }
+    return std::max(dRollingMinFee, (double)CTransaction::nMinRelayTxFee);
+}
+
+size_t CTxMemPool::DynamicMemoryUsage()
+{
+    LOCK(cs);
+    // Four ordered indexes in mapTx, plus the spent outpoints
+    return memusage::MultiIndexNodeUsage<CTxMemPoolEntry>(4) * mapTx.size() +
+           memusage::DynamicUsage(mapNextTx) + nCachedInnerUsage;
+}
+
 void CTxMemPool::clear()
 {
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    nTotalTxSize = 0;
+    nCachedInnerUsage = 0;
     ++nTransactionsUpdated;
 }
 
@@ -1133,8 +1451,8 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTransaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        vtxid.push_back((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back(mi->GetHash());
 }
 
 
@@ -1209,10 +1527,15 @@ bool CMerkleTx::IsAcceptable(bool fCheckInputs, bool fLimitFree)
 
 bool CWalletTx::AcceptWalletTransaction(bool fCheckInputs)
 {
+    // Read them back before taking mempool.cs if they were left in the
+    // wallet store
+    std::vector<CMerkleTx> vtxPrevLoaded;
+    if (fPrevUnloaded)
+        pwallet->ReadPrev(GetHash(), vtxPrevLoaded);
     {
         LOCK(mempool.cs);
         // Add previous supporting transactions first
-        BOOST_FOREACH(CMerkleTx& tx, vtxPrev)
+        BOOST_FOREACH(CMerkleTx& tx, fPrevUnloaded ? vtxPrevLoaded : vtxPrev)
         {
             if (!tx.IsCoinBase())
             {
@@ -1318,9 +1641,9 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return pblockindex;
 }
 
-bool CBlock::ReadFromDisk(const CBlockIndex* pindex)
+bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReuseStorage)
 {
-    if (!ReadFromDisk(pindex->GetBlockPos()))
+    if (!ReadFromDisk(pindex->GetBlockPos(), fReuseStorage))
         return false;
     if (GetHash() != pindex->GetBlockHash())
         return error("CBlock::ReadFromDisk() : GetHash() doesn't match index");
@@ -1397,24 +1720,29 @@ unsigned int static GetNextWorkRequired(const CBlockIndex* pLastBlock, const CBl
 
     pLastBlock = pLastBlock->pprev;
     const CBlockIndex *pCurBlock = pLastBlock;
-    CBigNum bnNew = 0;
+    // nInterval<<256 doesn't fit in 256 bits, so the average is taken in 512
+    uint512 bnNew = 0;
     for (int i = 0; i < nInterval; i++)
     {
-        bnNew += CBigNum().SetCompact(invertCompact(pCurBlock->nBits));
+        uint256 bnWork;
+        bnWork.SetCompact(invertCompact(pCurBlock->nBits));
+        bnNew += uint512(bnWork);
         pCurBlock = pCurBlock->pprev;
     }
-    bnNew = (CBigNum(nInterval)<<256) / bnNew;
+    uint512 bnAverage = nInterval;
+    bnAverage <<= 256;
+    bnAverage /= bnNew;
 
     const int nActualTimespan = clampTimespan(pLastBlock->GetBlockTime() - pCurBlock->GetBlockTime(), nTargetTimespan/3, nTargetTimespan*3);
 
     // Retarget
-    bnNew *= nActualTimespan;
-    bnNew /= nTargetTimespan;
+    bnAverage *= nActualTimespan;
+    bnAverage /= uint512(nTargetTimespan);
 
-    if (bnNew > bnProofOfWorkLimit)
-        bnNew = bnProofOfWorkLimit;
+    if (bnAverage > uint512(bnProofOfWorkLimit))
+        return bnProofOfWorkLimit.GetCompact();
 
-    return bnNew.GetCompact();
+    return bnAverage.trim256().GetCompact();
 }
 
 CPubKey CBlockHeader::GetRewardAddress() const
@@ -1427,6 +1755,39 @@ CPubKey CBlockHeader::GetRewardAddress() const
     return PubKey;
 }
 
+// Miner key IDs by hash of (hash for signature, miner signature). Headers are
+// checked again on orphan processing, AcceptBlock and every ReadFromDisk.
+static const unsigned int MAX_REWARD_KEY_CACHE = 5000;
+static map<uint256, CKeyID> mapRewardKeyCache;
+static deque<uint256> vRewardKeyCacheOrder;
+static CCriticalSection cs_rewardKeyCache;
+
+CKeyID CBlockHeader::GetRewardKeyID() const
+{
+    uint256 hashForSignature = GetHashForSignature();
+    uint256 hashKey = Hash(BEGIN(hashForSignature), END(hashForSignature), MinerSignature.begin(), MinerSignature.end());
+    {
+        LOCK(cs_rewardKeyCache);
+        map<uint256, CKeyID>::iterator mi = mapRewardKeyCache.find(hashKey);
+        if (mi != mapRewardKeyCache.end())
+            return mi->second;
+    }
+
+    CKeyID KeyID = GetRewardAddress().GetID();
+
+    LOCK(cs_rewardKeyCache);
+    if (mapRewardKeyCache.insert(make_pair(hashKey, KeyID)).second)
+    {
+        vRewardKeyCacheOrder.push_back(hashKey);
+        if (vRewardKeyCacheOrder.size() > MAX_REWARD_KEY_CACHE)
+        {
+            mapRewardKeyCache.erase(vRewardKeyCacheOrder.front());
+            vRewardKeyCacheOrder.pop_front();
+        }
+    }
+    return KeyID;
+}
+
 const uint32_t NONCE_MASK = 0x3F;
 
 uint256 CBlockHeader::GetHashForSignature() const
@@ -1556,15 +1917,16 @@ uint256 CBlock::HashPoKData(const CBufferStream<MAX_BLOCK_SIZE>& PoKData)
 
 bool CBlock::CheckProofOfWorkLite() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > bnProofOfWorkLimit)
+    if (fNegative || fOverflow || bnTarget == 0 || bnTarget > bnProofOfWorkLimit)
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount (except for the genesis block)
-    if (GetPoWHash() > bnTarget.getuint256() && GetHash() != hashGenesisBlock)
+    if (GetPoWHash() > bnTarget && GetHash() != hashGenesisBlock)
         return error("CheckProofOfWork() : hash doesn't match nBits");
 
     if (nHeight <= getSecondHardforkBlock() || nHeight < Checkpoints::LastCheckPoint())
@@ -1597,7 +1959,7 @@ bool CBlock::CheckProofOfWorkLite() const
         return error("CheckSignature() : coinbase address is not pubkeyhash");
 
     // Check miner's signature
-    if (GetRewardAddress().GetID() != KeyID)
+    if (GetRewardKeyID() != KeyID)
         return error("CheckSignature() : incorrect signature");
 
     return true;
@@ -1647,7 +2009,7 @@ void static InvalidChainFound(CBlockIndex* pindexNew)
     if (pindexNew->nChainWork > nBestInvalidWork)
     {
         nBestInvalidWork = pindexNew->nChainWork;
-        pblocktree->WriteBestInvalidWork(CBigNum(nBestInvalidWork));
+        pblocktree->WriteBestInvalidWork(nBestInvalidWork);
         uiInterface.NotifyBlocksChanged();
     }
     printf("InvalidChainFound: invalid block=%s  height=%d  log2_work=%.8g  date=%s\n",
@@ -1657,7 +2019,7 @@ void static InvalidChainFound(CBlockIndex* pindexNew)
     printf("InvalidChainFound:  current best=%s  height=%d  log2_work=%.8g  date=%s\n",
       hashBestChain.ToString().c_str(), nBestHeight, log(nBestChainWork.getdouble())/log(2.0),
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexBest->GetBlockTime()).c_str());
-    if (pindexBest && nBestInvalidWork > nBestChainWork + (pindexBest->GetBlockWork() * 6).getuint256())
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWork() * 6)
         printf("InvalidChainFound: Warning: Displayed transactions may not be correct! You may need to upgrade, or other nodes may need to upgrade.\n");
 }
 
@@ -1835,11 +2197,16 @@ bool CTransaction::HaveInputs(CCoinsViewCache &inputs) const
 
 bool CScriptCheck::operator()() const {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, NULL, pSigHashCache.get()))
         return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString().c_str());
     return true;
 }
 
+bool CScriptCheck::CheckDeferred(std::vector<CCompactSigCheck> &vSigs) const {
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    return VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, &vSigs, pSigHashCache.get());
+}
+
 bool VerifySignature(const CCoins& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
 {
     return CScriptCheck(txFrom, txTo, nIn, flags, nHashType)();
@@ -1899,12 +2266,18 @@ bool CTransaction::CheckInputs(CValidationState &state, CCoinsViewCache &inputs,
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Serialize the parts of the signature hashes the inputs have in
+            // common once, instead of the whole transaction for every input
+            boost::shared_ptr<const CSigHashCache> pSigHashCache;
+            if (vin.size() > 1)
+                pSigHashCache.reset(new CSigHashCache(*this));
+
             for (unsigned int i = 0; i < vin.size(); i++) {
                 const COutPoint &prevout = vin[i].prevout;
                 const CCoins &coins = inputs.GetCoins(prevout.hash);
 
                 // Verify signature
-                CScriptCheck check(coins, *this, i, flags, 0);
+                CScriptCheck check(coins, *this, i, flags, 0, pSigHashCache);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2040,6 +2413,43 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
+/** Script checks of a worker's batch get their signatures recovered all at
+ *  once (see VerifyCompactBatch). The scripts are first run with signature
+ *  checks deferred; a check whose script fails that way, or that turns out
+ *  to have an invalid signature, is run again the normal way. That finds
+ *  the failing input and gives the right result for scripts that expect a
+ *  signature not to match.
+ */
+template<> bool RunCheckBatch(std::vector<CScriptCheck> &vChecks)
+{
+    std::vector<CCompactSigCheck> vSigs;
+    std::vector<size_t> vSigsEnd(vChecks.size());
+    std::vector<bool> vScriptOk(vChecks.size());
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+    {
+        vScriptOk[i] = vChecks[i].CheckDeferred(vSigs);
+        vSigsEnd[i] = vSigs.size();
+    }
+
+    std::vector<bool> vSigValid;
+    VerifyCompactBatch(vSigs, &vSigValid);
+
+    size_t nSigsBegin = 0;
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+    {
+        bool fOk = vScriptOk[i];
+        for (size_t j = nSigsBegin; j < vSigsEnd[i] && fOk; j++)
+            fOk = vSigValid[j];
+        if (fOk && !(vChecks[i].GetFlags() & SCRIPT_VERIFY_NOCACHE))
+            for (size_t j = nSigsBegin; j < vSigsEnd[i]; j++)
+                signatureCache.Set(vSigs[j].hash, vSigs[j].vchSig, vSigs[j].pubKeyHash);
+        nSigsBegin = vSigsEnd[i];
+        if (!fOk && !vChecks[i]())
+            return false;
+    }
+    return true;
+}
+
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
@@ -2400,7 +2810,7 @@ bool CBlock::AddToBlockIndex(CValidationState &state, const CDiskBlockPos &pos)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
     }
     pindexNew->nTx = vtx.size();
-    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork().getuint256();
+    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork();
     pindexNew->nChainTx = (pindexNew->pprev ? pindexNew->pprev->nChainTx : 0) + pindexNew->nTx;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
@@ -3146,7 +3556,7 @@ bool static LoadBlockIndexDB()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork();
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
             setBlockIndexValid.insert(pindex);
@@ -3159,9 +3569,7 @@ bool static LoadBlockIndexDB()
         printf("LoadBlockIndexDB(): last block file info: %s\n", infoLastBlockFile.ToString().c_str());
 
     // Load nBestInvalidWork, OK if it doesn't exist
-    CBigNum bnBestInvalidWork;
-    pblocktree->ReadBestInvalidWork(bnBestInvalidWork);
-    nBestInvalidWork = bnBestInvalidWork.getuint256();
+    pblocktree->ReadBestInvalidWork(nBestInvalidWork);
 
     // Check whether we need to continue reindexing
     bool fReindexing = false;
@@ -3215,14 +3623,14 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
+    CBlock block;
     for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
     {
         boost::this_thread::interruption_point();
         if (pindex->nHeight < nBestHeight-nCheckDepth)
             break;
-        CBlock block;
         // check level 0: read from disk
-        if (!block.ReadFromDisk(pindex))
+        if (!block.ReadFromDisk(pindex, true))
             return error("VerifyDB() : *** block.ReadFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
         // check level 1: verify block validity
         if (nCheckLevel >= 1 && !block.CheckBlock(state, true, true, false))
@@ -3258,8 +3666,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         while (pindex != pindexBest) {
             boost::this_thread::interruption_point();
             pindex = pindex->pnext;
-            CBlock block;
-            if (!block.ReadFromDisk(pindex))
+            if (!block.ReadFromDisk(pindex, true))
                 return error("VerifyDB() : *** block.ReadFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
             if (!block.ConnectBlock(state, pindex, coins))
                 return error("VerifyDB() : *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
@@ -3467,6 +3874,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
             }
         }
         uint64 nRewind = blkdat.GetPos();
+        CBlock block; // decoded into over and over, see UnserializeReusing
         while (blkdat.good() && !blkdat.eof()) {
             boost::this_thread::interruption_point();
             GetMessageStart(pchMessageStart);
@@ -3495,8 +3903,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 // read block
                 uint64 nBlockPos = blkdat.GetPos();
                 blkdat.SetLimit(nBlockPos + nSize);
-                CBlock block;
-                blkdat >> block;
+                block.UnserializeReusing(blkdat);
                 nRewind = blkdat.GetPos();
 
                 // process block
@@ -3560,7 +3967,7 @@ string GetWarnings(string strFor)
     }
 
     // Longer invalid proof-of-work chain
-    if (pindexBest && nBestInvalidWork > nBestChainWork + (pindexBest->GetBlockWork() * 6).getuint256())
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWork() * 6)
     {
         nPriority = 2000;
         strStatusBar = strRPC = _("Warning: Displayed transactions may not be correct! You may need to upgrade, or other nodes may need to upgrade.");
@@ -3712,24 +4119,18 @@ void static ProcessGetData(CNode* pfrom)
             }
             else if (inv.IsKnownType())
             {
-                // Send stream from relay memory
+                // Send the shared message from relay memory, caching
+                // memory pool transactions on the first request
                 bool pushed = false;
-                {
-                    LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        pushed = true;
+                if (inv.type == MSG_TX) {
+                    CSharedMessage msg = relayCache.Get(inv.hash);
+                    if (!msg) {
+                        LOCK(mempool.cs);
+                        if (mempool.exists(inv.hash))
+                            msg = relayCache.Add(inv.hash, mempool.lookup(inv.hash));
                     }
-                }
-                if (!pushed && inv.type == MSG_TX) {
-                    LOCK(mempool.cs);
-                    if (mempool.exists(inv.hash)) {
-                        CTransaction tx = mempool.lookup(inv.hash);
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << tx;
-                        pfrom->PushMessage("tx", ss);
+                    if (msg) {
+                        pfrom->PushSharedMessage(msg);
                         pushed = true;
                     }
                 }
@@ -3760,7 +4161,225 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
+// Relay a transaction that entered the memory pool and retry the orphans
+// that were waiting for it
+void static TransactionAccepted(CNode* pfrom, const CTransaction& tx)
+{
+    vector<uint256> vWorkQueue;
+    vector<uint256> vEraseQueue;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    RelayTransaction(tx, inv.hash);
+    mapAlreadyAskedFor.erase(inv);
+    vWorkQueue.push_back(inv.hash);
+    vEraseQueue.push_back(inv.hash);
+
+    printf("AcceptToMemoryPool: %s %s : accepted %s (poolsz %"PRIszu")\n",
+        pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
+        tx.GetHash().ToString().c_str(),
+        mempool.mapTx.size());
+
+    // Recursively process any orphan transactions that depended on this one
+    for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+    {
+        uint256 hashPrev = vWorkQueue[i];
+        for (set<uint256>::iterator mi = mapOrphanTransactionsByPrev[hashPrev].begin();
+             mi != mapOrphanTransactionsByPrev[hashPrev].end();
+             ++mi)
+        {
+            const uint256& orphanHash = *mi;
+            CTransaction& orphanTx = mapOrphanTransactions[orphanHash];
+            bool fMissingInputs2 = false;
+            // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+            // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+            // anyone relaying LegitTxX banned)
+            CValidationState stateDummy;
+
+            if (orphanTx.AcceptToMemoryPool(stateDummy, true, true, &fMissingInputs2))
+            {
+                printf("   accepted orphan tx %s\n", orphanHash.ToString().c_str());
+                RelayTransaction(orphanTx, orphanHash);
+                mapAlreadyAskedFor.erase(CInv(MSG_TX, orphanHash));
+                vWorkQueue.push_back(orphanHash);
+                vEraseQueue.push_back(orphanHash);
+            }
+            else if (!fMissingInputs2)
+            {
+                // invalid or too-little-fee orphan
+                vEraseQueue.push_back(orphanHash);
+                printf("   removed orphan tx %s\n", orphanHash.ToString().c_str());
+            }
+        }
+    }
+
+    BOOST_FOREACH(uint256 hash, vEraseQueue)
+        EraseOrphanTx(hash);
+}
+
+// Keep a transaction with missing inputs as an orphan, and punish the peer
+// for invalid ones
+void static TransactionRejected(CNode* pfrom, const CTransaction& tx, CValidationState& state, bool fMissingInputs)
+{
+    if (fMissingInputs)
+    {
+        AddOrphanTx(tx);
+
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+        unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
+        if (nEvicted > 0)
+            printf("mapOrphan overflow, removed %u tx\n", nEvicted);
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        printf("%s from %s %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
+            pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str());
+        if (nDoS > 0)
+            pfrom->Misbehaving(nDoS);
+    }
+}
+
+// Transactions received from peers and waiting for ProcessPendingTransactions,
+// each holding a reference to its peer. Protected by cs_main.
+static vector<pair<CNode*, CTransaction> > vPendingTx;
+
+// A pending transaction that passed every check except its scripts
+struct CPreparedTx
+{
+    CNode* pfrom;
+    CTransaction* ptx;
+    CTxMemPoolEntry entry;
+    std::vector<CScriptCheck> vChecks;
+};
+
+// Run the script checks of all prepared transactions on the script-check
+// threads, then admit the transactions in arrival order
+void static CommitPreparedTransactions(std::vector<CPreparedTx>& vPrepared)
+{
+    if (vPrepared.empty())
+        return;
+
+    int64 nStart = GetTimeMicros();
+    unsigned int nInputs = 0;
+    bool fAllOk;
+    {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        BOOST_FOREACH(CPreparedTx& prepared, vPrepared)
+        {
+            nInputs += prepared.vChecks.size();
+            control.Add(prepared.vChecks);
+        }
+        fAllOk = control.Wait();
+    }
+
+    if (fAllOk)
+    {
+        BOOST_FOREACH(CPreparedTx& prepared, vPrepared)
+        {
+            CValidationState state;
+            if (mempool.commit(state, prepared.entry))
+                TransactionAccepted(prepared.pfrom, *prepared.ptx);
+            else
+                TransactionRejected(prepared.pfrom, *prepared.ptx, state, false);
+        }
+    }
+    else
+    {
+        // Some script failed. Find out which by checking the batch again
+        // one transaction at a time, which also gives the exact DoS score
+        // for each of them. The fee checks passed in the first prepare(),
+        // which also charged the free transaction rate limiter, so they
+        // are not run again.
+        BOOST_FOREACH(CPreparedTx& prepared, vPrepared)
+        {
+            bool fMissingInputs = false;
+            CValidationState state;
+            CTxMemPoolEntry entry;
+            if (mempool.prepare(state, *prepared.ptx, true, false, &fMissingInputs, entry, NULL) &&
+                mempool.commit(state, prepared.entry))
+                TransactionAccepted(prepared.pfrom, *prepared.ptx);
+            else
+                TransactionRejected(prepared.pfrom, *prepared.ptx, state, fMissingInputs);
+        }
+    }
+
+    int64 nTime = GetTimeMicros() - nStart;
+    if (fBenchmark)
+        printf("- Verify %u transactions (%u txins): %.2fms (%.0f tx/s)\n", (unsigned)vPrepared.size(), nInputs,
+               0.001 * nTime, nTime <= 0 ? 0 : 1000000.0 * vPrepared.size() / nTime);
+    vPrepared.clear();
+}
+
+void QueuePendingTransaction(CNode* pfrom, const CTransaction& tx)
+{
+    {
+        LOCK(cs_vNodes);
+        pfrom->AddRef();
+    }
+    vPendingTx.push_back(make_pair(pfrom, tx));
+}
+
+void ProcessPendingTransactions()
+{
+    LOCK(cs_main);
+    if (vPendingTx.empty())
+        return;
+
+    vector<pair<CNode*, CTransaction> > vBatch;
+    vBatch.swap(vPendingTx);
+
+    // Prepared transactions hold script checks referencing vBatch, so it
+    // must not be resized from here on
+    std::vector<CPreparedTx> vPrepared;
+    vPrepared.reserve(vBatch.size());
+    std::set<uint256> setPrepared;
+    std::set<COutPoint> setPreparedSpent;
+    for (unsigned int i = 0; i < vBatch.size(); i++)
+    {
+        CNode* pfrom = vBatch[i].first;
+        CTransaction& tx = vBatch[i].second;
+
+        // A transaction spending from or double-spending a prepared one
+        // has to wait until those are in the pool, so the outcome is the
+        // same as when processing the batch one transaction at a time
+        bool fDependsOnPrepared = false;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            if (setPrepared.count(txin.prevout.hash) || setPreparedSpent.count(txin.prevout))
+                fDependsOnPrepared = true;
+        if (fDependsOnPrepared)
+        {
+            CommitPreparedTransactions(vPrepared);
+            setPrepared.clear();
+            setPreparedSpent.clear();
+        }
+
+        vPrepared.push_back(CPreparedTx());
+        CPreparedTx& prepared = vPrepared.back();
+        prepared.pfrom = pfrom;
+        prepared.ptx = &tx;
+
+        bool fMissingInputs = false;
+        CValidationState state;
+        if (!mempool.prepare(state, tx, true, true, &fMissingInputs, prepared.entry, &prepared.vChecks))
+        {
+            vPrepared.pop_back();
+            TransactionRejected(pfrom, tx, state, fMissingInputs);
+            continue;
+        }
+        setPrepared.insert(prepared.entry.GetHash());
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            setPreparedSpent.insert(txin.prevout);
+    }
+    CommitPreparedTransactions(vPrepared);
+
+    {
+        LOCK(cs_vNodes);
+        for (unsigned int i = 0; i < vBatch.size(); i++)
+            vBatch[i].first->Release();
+    }
+}
+
+bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStreamView& vRecv)
 {
     RandAddSeedPerfmon();
     if (fDebug)
@@ -4307,81 +4926,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
-        CDataStream vMsg(vRecv);
         CTransaction tx;
         vRecv >> tx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        bool fMissingInputs = false;
-        CValidationState state;
-        if (tx.AcceptToMemoryPool(state, true, true, &fMissingInputs))
-        {
-            RelayTransaction(tx, inv.hash);
-            mapAlreadyAskedFor.erase(inv);
-            vWorkQueue.push_back(inv.hash);
-            vEraseQueue.push_back(inv.hash);
-
-            printf("AcceptToMemoryPool: %s %s : accepted %s (poolsz %"PRIszu")\n",
-                pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
-                tx.GetHash().ToString().c_str(),
-                mempool.mapTx.size());
-
-            // Recursively process any orphan transactions that depended on this one
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                uint256 hashPrev = vWorkQueue[i];
-                for (set<uint256>::iterator mi = mapOrphanTransactionsByPrev[hashPrev].begin();
-                     mi != mapOrphanTransactionsByPrev[hashPrev].end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash];
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-                    if (tx.AcceptToMemoryPool(stateDummy, true, true, &fMissingInputs2))
-                    {
-                        printf("   accepted orphan tx %s\n", orphanHash.ToString().c_str());
-                        RelayTransaction(orphanTx, orphanHash);
-                        mapAlreadyAskedFor.erase(CInv(MSG_TX, orphanHash));
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        // invalid or too-little-fee orphan
-                        vEraseQueue.push_back(orphanHash);
-                        printf("   removed orphan tx %s\n", orphanHash.ToString().c_str());
-                    }
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
+        if (nScriptCheckThreads)
         {
-            AddOrphanTx(tx);
-
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
-            if (nEvicted > 0)
-                printf("mapOrphan overflow, removed %u tx\n", nEvicted);
+            // Verified together with the other transactions received in
+            // this round of the message handler, see ProcessPendingTransactions
+            QueuePendingTransaction(pfrom, tx);
         }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
+        else
         {
-            printf("%s from %s %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
-                pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str());
-            if (nDoS > 0)
-                pfrom->Misbehaving(nDoS);
+            bool fMissingInputs = false;
+            CValidationState state;
+            if (tx.AcceptToMemoryPool(state, true, true, &fMissingInputs))
+                TransactionAccepted(pfrom, tx);
+            else
+                TransactionRejected(pfrom, tx, state, fMissingInputs);
         }
     }
 
@@ -4628,7 +5192,7 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
+        CDataStreamView vRecv = msg.GetDataStream();
         uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
         unsigned int nChecksum = 0;
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
@@ -4878,58 +5442,147 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 // SpreadCoinMiner
 //
 
-// Some explaining would be appreciated
-class COrphan
-{
-public:
-    CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
+uint64 nLastBlockTx = 0;
+uint64 nLastBlockSize = 0;
 
-    COrphan(CTransaction* ptxIn)
-    {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
-    }
+// Ancestor package statistics of a pool transaction, less the ancestors
+// that are already in the block being assembled
+struct CModifiedEntry
+{
+    uint64 nCountWithAncestors;
+    uint64 nSizeWithAncestors;
+    int64 nFeesWithAncestors;
 
-    void print() const
+    double GetScore() const
     {
-        printf("COrphan(hash=%s, dPriority=%.1f, dFeePerKb=%.1f)\n",
-               ptx->GetHash().ToString().c_str(), dPriority, dFeePerKb);
-        BOOST_FOREACH(uint256 hash, setDependsOn)
-            printf("   setDependsOn %s\n", hash.ToString().c_str());
+        if (nSizeWithAncestors == 0)
+            return 0.0;
+        return (double)nFeesWithAncestors * 1000.0 / nSizeWithAncestors;
     }
 };
 
+// Running state of the block being assembled from the memory pool
+struct CBlockAssembly
+{
+    CBlockTemplate* pblocktemplate;
+    CCoinsViewCache* pview;
+    CBlockIndex* pindexPrev;
+    unsigned int nBlockMaxSize;
+    uint64 nBlockSize;
+    uint64 nBlockTx;
+    int nBlockSigOps;
+    int64 nFees;
+    bool fPrintPriority;
+    std::set<uint256> setInBlock;
+
+    // Transactions that will not be tried again
+    std::set<uint256> setFailed;
+    // Pool transactions with ancestors in the block. Their entries in the
+    // pool's ancestor score index are stale; setModifiedScore orders the
+    // ones still waiting to be tried by their up to date score.
+    std::map<uint256, CModifiedEntry> mapModified;
+    std::set<std::pair<double, uint256> > setModifiedScore;
+};
 
-uint64 nLastBlockTx = 0;
-uint64 nLastBlockSize = 0;
-
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, CTransaction*> TxPriority;
-class TxPriorityCompare
+// Take a transaction that was just added to the block out of the ancestor
+// packages of its descendants in the pool
+static void UpdatePackagesForAdded(CBlockAssembly& assembly, const CTxMemPoolEntry& entry)
 {
-    bool byFee;
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    std::set<uint256> setDescendants;
+    mempool.CalculateDescendants(entry.GetHash(), setDescendants);
+    BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
     {
-        if (byFee)
+        if (hashDescendant == entry.GetHash() || assembly.setInBlock.count(hashDescendant) || assembly.setFailed.count(hashDescendant))
+            continue;
+
+        std::map<uint256, CModifiedEntry>::iterator it = assembly.mapModified.find(hashDescendant);
+        if (it == assembly.mapModified.end())
         {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+            const CTxMemPoolEntry& descendant = *mempool.mapTx.find(hashDescendant);
+            CModifiedEntry modified;
+            modified.nCountWithAncestors = descendant.GetCountWithAncestors();
+            modified.nSizeWithAncestors = descendant.GetSizeWithAncestors();
+            modified.nFeesWithAncestors = descendant.GetFeesWithAncestors();
+            it = assembly.mapModified.insert(make_pair(hashDescendant, modified)).first;
         }
         else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
+            assembly.setModifiedScore.erase(make_pair(it->second.GetScore(), hashDescendant));
+
+        it->second.nCountWithAncestors -= 1;
+        it->second.nSizeWithAncestors -= entry.GetTxSize();
+        it->second.nFeesWithAncestors -= entry.GetFee();
+        assembly.setModifiedScore.insert(make_pair(it->second.GetScore(), hashDescendant));
     }
-};
+}
+
+// Append a memory pool transaction to the block if it fits and its inputs
+// are available, either in the chain or earlier in the block.
+static bool AddToBlock(CBlockAssembly& assembly, const CTxMemPoolEntry& entry)
+{
+    const CTransaction& tx = entry.GetTx();
+    if (tx.IsCoinBase() || !tx.IsFinal())
+        return false;
+
+    // Size limits
+    unsigned int nTxSize = entry.GetTxSize();
+    if (assembly.nBlockSize + nTxSize >= assembly.nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nTxSigOps = tx.GetLegacySigOpCount();
+    if (assembly.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    CCoinsViewCache& view = *assembly.pview;
+    if (!tx.HaveInputs(view))
+        return false;
 
+    int64 nTxFees = tx.GetValueIn(view)-tx.GetValueOut();
+
+    nTxSigOps += tx.GetP2SHSigOpCount(view);
+    if (assembly.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    CValidationState state;
+    if (!tx.CheckInputs(state, view, true, SCRIPT_VERIFY_P2SH))
+        return false;
+
+    CTxUndo txundo;
+    tx.UpdateCoins(state, view, txundo, assembly.pindexPrev->nHeight+1, entry.GetHash());
+
+    // Added
+    assembly.pblocktemplate->block.vtx.push_back(tx);
+    assembly.pblocktemplate->vTxFees.push_back(nTxFees);
+    assembly.pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+    assembly.nBlockSize += nTxSize;
+    ++assembly.nBlockTx;
+    assembly.nBlockSigOps += nTxSigOps;
+    assembly.nFees += nTxFees;
+    assembly.setInBlock.insert(entry.GetHash());
+    UpdatePackagesForAdded(assembly, entry);
+
+    if (assembly.fPrintPriority)
+    {
+        printf("priority %.1f feeperkb %.1f txid %s\n",
+               entry.GetPriority(assembly.pindexPrev->nHeight), entry.GetFeeRate(),
+               entry.GetHash().ToString().c_str());
+    }
+    return true;
+}
+
+// Heap order for the high-priority area, highest priority on top
+static bool ComparePriority(const std::pair<double, const CTxMemPoolEntry*>& a,
+                            const std::pair<double, const CTxMemPoolEntry*>& b)
+{
+    if (a.first == b.first)
+        return a.second->GetHash() > b.second->GetHash();
+    return a.first < b.first;
+}
+
+static bool CompareAncestorCount(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b)
+{
+    return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+}
 
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 {
@@ -5061,181 +5714,168 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 
         // Collect memory pool transactions into the block
         {
-            // Priority order to process transactions
-            list<COrphan> vOrphan; // list memory doesn't move
-            map<uint256, vector<COrphan*> > mapDependers;
-            bool fPrintPriority = GetBoolArg("-printpriority");
-
-            // This vector will be sorted into a priority queue:
-            vector<TxPriority> vecPriority;
-            vecPriority.reserve(mempool.mapTx.size());
-            for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+            CBlockAssembly assembly;
+            assembly.pblocktemplate = pblocktemplate.get();
+            assembly.pview = &view;
+            assembly.pindexPrev = pindexPrev;
+            assembly.nBlockMaxSize = nBlockMaxSize;
+            assembly.nBlockSize = 1000;
+            assembly.nBlockTx = 0;
+            assembly.nBlockSigOps = 100;
+            assembly.nFees = 0;
+            assembly.fPrintPriority = GetBoolArg("-printpriority");
+
+            // High-priority area: transactions included regardless of the fees
+            // they pay. Priority keeps changing with the chain height, so
+            // there is no index for it; one pass picks the qualifying
+            // transactions without unconfirmed parents into a heap, and
+            // children are queued behind their parents as those get in. It
+            // is skipped with -blockprioritysize=0.
+            if (nBlockPrioritySize > 0)
             {
-                CTransaction& tx = (*mi).second;
-                if (tx.IsCoinBase() || !tx.IsFinal())
-                    continue;
+                const double dPriorityMin = COIN * 576 / 250;
+                unsigned int nHeight = pindexPrev->nHeight;
+                vector<pair<double, const CTxMemPoolEntry*> > vecPriority;
+                for (indexed_transaction_set::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+                {
+                    if (mi->GetCountWithAncestors() > 1)
+                        continue;
+                    double dPriority = mi->GetPriority(nHeight);
+                    if (dPriority >= dPriorityMin)
+                        vecPriority.push_back(make_pair(dPriority, &(*mi)));
+                }
+                std::make_heap(vecPriority.begin(), vecPriority.end(), ComparePriority);
 
-                COrphan* porphan = NULL;
-                double dPriority = 0;
-                int64 nTotalIn = 0;
-                bool fMissingInputs = false;
-                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                std::set<uint256> setQueued;
+                while (!vecPriority.empty())
                 {
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
+                    std::pop_heap(vecPriority.begin(), vecPriority.end(), ComparePriority);
+                    const CTxMemPoolEntry& entry = *vecPriority.back().second;
+                    vecPriority.pop_back();
+
+                    if (assembly.nBlockSize + entry.GetTxSize() >= nBlockPrioritySize)
+                        break;
+                    if (!AddToBlock(assembly, entry))
+                        continue;
+
+                    // Queue the children that have all their pool parents in the block now
+                    const uint256& hash = entry.GetHash();
+                    std::map<COutPoint, CInPoint>::iterator it = mempool.mapNextTx.lower_bound(COutPoint(hash, 0));
+                    for (; it != mempool.mapNextTx.end() && it->first.hash == hash; ++it)
                     {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
+                        const CTransaction& txChild = *it->second.ptx;
+                        uint256 hashChild = txChild.GetHash();
+                        if (setQueued.count(hashChild))
+                            continue;
+
+                        bool fParentsInBlock = true;
+                        BOOST_FOREACH(const CTxIn& txin, txChild.vin)
                         {
-                            printf("ERROR: mempool transaction missing input %s\n", txin.prevout.hash.ToString().c_str());
-                            if (!fTestNet && fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
+                            if (mempool.exists(txin.prevout.hash) && !assembly.setInBlock.count(txin.prevout.hash))
+                            {
+                                fParentsInBlock = false;
+                                break;
+                            }
                         }
+                        if (!fParentsInBlock)
+                            continue;
 
-                        // Has to wait for dependencies
-                        if (!porphan)
+                        setQueued.insert(hashChild);
+                        const CTxMemPoolEntry& child = *mempool.mapTx.find(hashChild);
+                        double dPriority = child.GetPriority(nHeight);
+                        if (dPriority >= dPriorityMin)
                         {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
+                            vecPriority.push_back(make_pair(dPriority, &child));
+                            std::push_heap(vecPriority.begin(), vecPriority.end(), ComparePriority);
                         }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
-                        continue;
                     }
-                    const CCoins &coins = view.GetCoins(txin.prevout.hash);
-
-                    int64 nValueIn = coins.vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
-
-                    int nConf = pindexPrev->nHeight - coins.nHeight + 1;
-
-                    dPriority += (double)nValueIn * nConf;
-                }
-                if (fMissingInputs) continue;
-
-                // Priority is sum(valuein * age) / txsize
-                unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-                dPriority /= nTxSize;
-
-                // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-                // client code rounds up the size to the nearest 1K. That's good, because it gives an
-                // incentive to create smaller transactions.
-                double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
-
-                if (porphan)
-                {
-                    porphan->dPriority = dPriority;
-                    porphan->dFeePerKb = dFeePerKb;
                 }
-                else
-                    vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &(*mi).second));
             }
 
-            // Collect transactions into block
-            uint64 nBlockSize = 1000;
-            uint64 nBlockTx = 0;
-            int nBlockSigOps = 100;
-            bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-            TxPriorityCompare comparer(fSortedByFee);
-            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-            // Create coinbase tx
-            CTransaction txMerged;
-
-            while (!vecPriority.empty())
+            // Fill the rest of the block by ancestor package fee rate. Each
+            // package is the transaction plus the ancestors not yet in the
+            // block, added parents first. The next package is the best of the
+            // pool's ancestor score index and of the transactions whose
+            // packages shrank as their ancestors went in, so the work done
+            // here is proportional to what ends up in the block.
+            typedef indexed_transaction_set::index<ancestor_score_index>::type::reverse_iterator score_iterator;
+            indexed_transaction_set::index<ancestor_score_index>::type& byScore = mempool.mapTx.get<ancestor_score_index>();
+            score_iterator mi = byScore.rbegin();
+            unsigned int nConsecutiveFailed = 0;
+            while (true)
             {
-                // Take highest priority transaction off the priority queue:
-                double dPriority = vecPriority.front().get<0>();
-                double dFeePerKb = vecPriority.front().get<1>();
-                CTransaction& tx = *(vecPriority.front().get<2>());
-
-                std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                vecPriority.pop_back();
-
-                // Size limits
-                unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-                if (nBlockSize + nTxSize >= nBlockMaxSize)
-                    continue;
-
-                // Legacy limits on sigOps:
-                unsigned int nTxSigOps = tx.GetLegacySigOpCount();
-                if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                    continue;
-
-                // Skip free transactions if we're past the minimum block size:
-                if (fSortedByFee && (dFeePerKb < CTransaction::nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                    continue;
-
-                // Prioritize by fee once past the priority size or we run out of high-priority
-                // transactions:
-                if (!fSortedByFee &&
-                    ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 576 / 250)))
+                // Pool entries with ancestors in the block are tried from setModifiedScore
+                while (mi != byScore.rend() &&
+                       (assembly.setInBlock.count(mi->GetHash()) ||
+                        assembly.setFailed.count(mi->GetHash()) ||
+                        assembly.mapModified.count(mi->GetHash())))
+                    ++mi;
+
+                const CTxMemPoolEntry* pentry;
+                uint64 nPackageCount, nPackageSize;
+                int64 nPackageFees;
+                if (!assembly.setModifiedScore.empty() &&
+                    (mi == byScore.rend() || assembly.setModifiedScore.rbegin()->first > mi->GetAncestorScore()))
                 {
-                    fSortedByFee = true;
-                    comparer = TxPriorityCompare(fSortedByFee);
-                    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    std::set<std::pair<double, uint256> >::iterator itBest = --assembly.setModifiedScore.end();
+                    const CModifiedEntry& modified = assembly.mapModified[itBest->second];
+                    pentry = &(*mempool.mapTx.find(itBest->second));
+                    nPackageCount = modified.nCountWithAncestors;
+                    nPackageSize = modified.nSizeWithAncestors;
+                    nPackageFees = modified.nFeesWithAncestors;
+                    assembly.setModifiedScore.erase(itBest);
                 }
+                else if (mi != byScore.rend())
+                {
+                    pentry = &(*mi);
+                    nPackageCount = mi->GetCountWithAncestors();
+                    nPackageSize = mi->GetSizeWithAncestors();
+                    nPackageFees = mi->GetFeesWithAncestors();
+                    ++mi;
+                }
+                else
+                    break;
 
-                if (!tx.HaveInputs(view))
-                    continue;
-
-                int64 nTxFees = tx.GetValueIn(view)-tx.GetValueOut();
-
-                nTxSigOps += tx.GetP2SHSigOpCount(view);
-                if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                    continue;
+                // Everything after this pays less; stop once past the minimum block size
+                double dFeePerKb = double(nPackageFees) / (double(nPackageSize)/1000.0);
+                if (dFeePerKb < CTransaction::nMinTxFee && assembly.nBlockSize + nPackageSize >= nBlockMinSize)
+                    break;
 
-                CValidationState state;
-                if (!tx.CheckInputs(state, view, true, SCRIPT_VERIFY_P2SH))
+                if (assembly.nBlockSize + nPackageSize >= nBlockMaxSize)
+                {
+                    assembly.setFailed.insert(pentry->GetHash());
+                    // Give up on the remaining packages once the block is nearly full
+                    if (++nConsecutiveFailed > 50 && assembly.nBlockSize > nBlockMaxSize - 1000)
+                        break;
                     continue;
+                }
+                nConsecutiveFailed = 0;
 
-                CTxUndo txundo;
-                uint256 hash = tx.GetHash();
-                tx.UpdateCoins(state, view, txundo, pindexPrev->nHeight+1, hash);
-
-                // Added
-                pblock->vtx.push_back(tx);
-
-                //* END MERGE *//
-                pblocktemplate->vTxFees.push_back(nTxFees);
-                pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-                nBlockSize += nTxSize;
-                ++nBlockTx;
-                nBlockSigOps += nTxSigOps;
-                nFees += nTxFees;
-
-                if (fPrintPriority)
+                std::vector<const CTxMemPoolEntry*> vPackage(1, pentry);
+                if (nPackageCount > 1)
                 {
-                    printf("priority %.1f feeperkb %.1f txid %s\n",
-                           dPriority, dFeePerKb, tx.GetHash().ToString().c_str());
+                    std::set<uint256> setAncestors;
+                    mempool.CalculateAncestors(pentry->GetHash(), setAncestors);
+                    BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+                        if (!assembly.setInBlock.count(hashAncestor))
+                            vPackage.push_back(&(*mempool.mapTx.find(hashAncestor)));
+                    std::sort(vPackage.begin(), vPackage.end(), CompareAncestorCount);
                 }
 
-                // Add transactions that depend on this one to the priority queue
-                if (mapDependers.count(hash))
+                BOOST_FOREACH(const CTxMemPoolEntry* pentryAdd, vPackage)
                 {
-                    BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
+                    if (!AddToBlock(assembly, *pentryAdd))
                     {
-                        if (!porphan->setDependsOn.empty())
-                        {
-                            porphan->setDependsOn.erase(hash);
-                            if (porphan->setDependsOn.empty())
-                            {
-                                vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                                std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                            }
-                        }
+                        assembly.setFailed.insert(pentry->GetHash());
+                        break;
                     }
                 }
             }
 
+            uint64 nBlockSize = assembly.nBlockSize;
+            uint64 nBlockTx = assembly.nBlockTx;
+            nFees = assembly.nFees;
+
             nLastBlockTx = nBlockTx;
             nLastBlockSize = nBlockSize;
             printf("CreateNewBlock(): total size %"PRI64u"\n", nBlockSize);
@@ -5287,6 +5927,7 @@ static void IncrementExtraNonce(CBlock* pblock, unsigned int& nExtraNonce)
     }
     ++nExtraNonce;
     pblock->vtx[0].vin[0].scriptSig = (CScript() << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
+    pblock->vtx[0].ClearCache();
     assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
 
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
@@ -5306,7 +5947,7 @@ CBlockTemplate* CreateNewBlockWithKey(CKeyID pubkeyid)
 bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey* preservekey)
 {
     uint256 hash = pblock->GetHash();
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
     if (!pblock->CheckProofOfWork())
         return false;
@@ -5405,7 +6046,7 @@ void static SpreadCoinMiner(CWallet *pwallet)
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
         loop
         {
             unsigned int nHashesDone = 0;
@@ -5418,7 +6059,7 @@ void static SpreadCoinMiner(CWallet *pwallet)
                     memcpy(pMinerSignature, pblock->MinerSignature.begin(), pblock->MinerSignature.size());
                     pblock->hashWholeBlock = CBlock::HashPoKData(PoKData);
                 }
-                bool Good = pblock->GetPoWHash() <= hashTarget && pblock->GetRewardAddress() == pubkey;
+                bool Good = pblock->GetPoWHash() <= hashTarget && pblock->GetRewardKeyID() == pubkey.GetID();
 
                 if (Good)
                 {
@@ -5481,7 +6122,7 @@ void static SpreadCoinMiner(CWallet *pwallet)
             if (fTestNet)
             {
                 // Changing pblock->nTime can change work required on testnet:
-                hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = uint256().SetCompact(pblock->nBits);
             }
         }
     } }
@@ -10,11 +10,16 @@
 #include "net.h"
 #include "script.h"
 #include "hashblock.h"
+#include "sha256.h"
 #include "base58.h"
 
 #include <list>
 #include <algorithm>
 #include <boost/lexical_cast.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/ordered_index.hpp>
 
 //#define static_assert(numeric_limits<double>::max_exponent() > 8, "your double sux");
 
@@ -58,6 +63,12 @@ static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/4;         // 50KB
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = MAX_BLOCK_SIZE;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 17000;
+/** Default for -maxmempool, maximum megabytes of memory the memory pool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 100;
+/** Default for -mempoolexpiry, hours after which unconfirmed transactions leave the memory pool */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Seconds for the memory pool's minimum fee to halve after an eviction */
+static const unsigned int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 /** The maximum allowed number of signature check operations in a block (network rule) */
@@ -195,6 +206,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Queue a transaction received from a peer for ProcessPendingTransactions. Must hold cs_main. */
+void QueuePendingTransaction(CNode* pfrom, const CTransaction& tx);
+/** Verify the transactions received from peers since the last call, with their scripts checked in parallel */
+void ProcessPendingTransactions();
 //** Get age of an input */
 int GetInputAge(CTxIn& vin);
 /** Run the miner threads */
@@ -300,11 +315,11 @@ struct CDiskTxPos : public CDiskBlockPos
 class CInPoint
 {
 public:
-    CTransaction* ptx;
+    const CTransaction* ptx;
     unsigned int n;
 
     CInPoint() { SetNull(); }
-    CInPoint(CTransaction* ptxIn, unsigned int nIn) { ptx = ptxIn; n = nIn; }
+    CInPoint(const CTransaction* ptxIn, unsigned int nIn) { ptx = ptxIn; n = nIn; }
     void SetNull() { ptx = NULL; n = (unsigned int) -1; }
     bool IsNull() const { return (ptx == NULL && n == (unsigned int) -1); }
 };
@@ -522,18 +537,52 @@ public:
     std::vector<CTxOut> vout;
     unsigned int nLockTime;
 
+private:
+    // memory only: the hash and serialized size, remembered once the
+    // transaction is complete (see UpdateCache)
+    uint256 hashCached;
+    unsigned int nSizeCached;
+
+public:
     CTransaction()
     {
         SetNull();
     }
 
+    // A copy may be modified without the original's knowledge, so it
+    // starts without the cache
+    CTransaction(const CTransaction& tx) :
+        nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime)
+    {
+        ClearCache();
+    }
+
+    CTransaction& operator=(const CTransaction& tx)
+    {
+        nVersion = tx.nVersion;
+        vin = tx.vin;
+        vout = tx.vout;
+        nLockTime = tx.nLockTime;
+        ClearCache();
+        return *this;
+    }
+
     IMPLEMENT_SERIALIZE
     (
-        READWRITE(this->nVersion);
-        nVersion = this->nVersion;
-        READWRITE(vin);
-        READWRITE(vout);
-        READWRITE(nLockTime);
+        if (fGetSize && nSizeCached != 0)
+        {
+            nSerSize = nSizeCached;
+        }
+        else
+        {
+            READWRITE(this->nVersion);
+            nVersion = this->nVersion;
+            READWRITE(vin);
+            READWRITE(vout);
+            READWRITE(nLockTime);
+        }
+        if (fRead)
+            const_cast<CTransaction*>(this)->UpdateCache();
     )
 
     void SetNull()
@@ -542,6 +591,27 @@ public:
         vin.clear();
         vout.clear();
         nLockTime = 0;
+        ClearCache();
+    }
+
+    /** Remember the hash and serialized size, so GetHash() and
+     *  GetSerializeSize() don't have to serialize the transaction again.
+     *  Done for every transaction that is deserialized, which is how nearly
+     *  all of them enter the node. Copies don't inherit the cache, but code
+     *  that modifies a deserialized transaction in place must call
+     *  ClearCache().
+     */
+    void UpdateCache()
+    {
+        ClearCache();
+        nSizeCached = ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION);
+        hashCached = SerializeHash(*this);
+    }
+
+    void ClearCache()
+    {
+        hashCached = 0;
+        nSizeCached = 0;
     }
 
     bool IsNull() const
@@ -551,6 +621,8 @@ public:
 
     uint256 GetHash() const
     {
+        if (hashCached != 0)
+            return hashCached;
         return SerializeHash(*this);
     }
 
@@ -1145,21 +1217,31 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    // Shared by the checks of all inputs of ptxTo
+    boost::shared_ptr<const CSigHashCache> pSigHashCache;
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSigHashCache>& pSigHashCacheIn = boost::shared_ptr<const CSigHashCache>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), pSigHashCache(pSigHashCacheIn) { }
 
     bool operator()() const;
 
+    // Run the scripts without checking the signatures that miss the
+    // signature cache; they are appended to vSigs instead (see RunCheckBatch)
+    bool CheckDeferred(std::vector<CCompactSigCheck> &vSigs) const;
+
+    unsigned int GetFlags() const { return nFlags; }
+
     void swap(CScriptCheck &check) {
         scriptPubKey.swap(check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        pSigHashCache.swap(check.pSigHashCache);
     }
 };
 
@@ -1520,6 +1602,10 @@ public:
     // Get miner's public key
     CPubKey GetRewardAddress() const;
 
+    // Get the ID of the miner's public key. Recovered keys are cached by
+    // signature, so checking the same header again doesn't redo the recovery.
+    CKeyID GetRewardKeyID() const;
+
     // Hash that is signed with miner's public key in MinerSignature.
     uint256 GetHashForSignature() const;
 
@@ -1563,6 +1649,19 @@ public:
         payee = CScript();
     }
 
+    /** Deserialize a block from s into this object, reusing the memory
+     *  of the transactions it held before (see CReuseStream). For loops
+     *  that look at many blocks one after the other. */
+    template<typename Stream>
+    void UnserializeReusing(Stream& s)
+    {
+        CBlockHeader::SetNull();
+        vMerkleTree.clear();
+        payee = CScript();
+        CReuseStream<Stream> reuse(s);
+        reuse >> *this;
+    }
+
     // Hash used for proof-of-work
     uint256 GetPoWHash() const;
 
@@ -1587,17 +1686,24 @@ public:
     uint256 BuildMerkleTree() const
     {
         vMerkleTree.clear();
+        size_t nTotal = vtx.size();
+        for (size_t nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+            nTotal += (nSize + 1) / 2;
+        vMerkleTree.reserve(nTotal);
         BOOST_FOREACH(const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            // The pairs of a level lie next to each other, so they can go
+            // to SHA256D64 in one piece; an odd last node is paired with itself
+            int nPairs = nSize / 2;
+            int nNext = vMerkleTree.size();
+            vMerkleTree.resize(nNext + (nSize + 1) / 2);
+            SHA256D64(vMerkleTree[nNext].begin(), vMerkleTree[j].begin(), nPairs);
+            if (nSize & 1)
+                vMerkleTree[nNext + nPairs] = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                                   BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -1668,9 +1774,10 @@ public:
         return true;
     }
 
-    bool ReadFromDisk(const CDiskBlockPos &pos)
+    bool ReadFromDisk(const CDiskBlockPos &pos, bool fReuseStorage = false)
     {
-        SetNull();
+        if (!fReuseStorage)
+            SetNull();
 
         // Open history file to read
         CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
@@ -1679,7 +1786,10 @@ public:
 
         // Read block
         try {
-            filein >> *this;
+            if (fReuseStorage)
+                UnserializeReusing(filein);
+            else
+                filein >> *this;
         }
         catch (std::exception &e) {
             return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
@@ -1730,7 +1840,7 @@ public:
     bool ConnectBlock(CValidationState &state, CBlockIndex *pindex, CCoinsViewCache &coins, bool fJustCheck=false);
 
     // Read a block from disk
-    bool ReadFromDisk(const CBlockIndex* pindex);
+    bool ReadFromDisk(const CBlockIndex* pindex, bool fReuseStorage = false);
 
     // Add this block to the block index, and if necessary, switch the active block chain to this
     bool AddToBlockIndex(CValidationState &state, const CDiskBlockPos &pos);
@@ -1987,13 +2097,16 @@ public:
         return (int64)nTime;
     }
 
-    CBigNum GetBlockWork() const
+    uint256 GetBlockWork() const
     {
-        CBigNum bnTarget;
-        bnTarget.SetCompact(nBits);
-        if (bnTarget <= 0)
+        bool fNegative, fOverflow;
+        uint256 bnTarget;
+        bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+        if (fNegative || fOverflow || bnTarget == 0)
             return 0;
-        return (CBigNum(1)<<256) / (bnTarget+1);
+        // 2**256 / (bnTarget+1) doesn't fit in 256 bits, but it is equal
+        // to ~bnTarget / (bnTarget+1) + 1
+        return (~bnTarget / (bnTarget + 1)) + 1;
     }
 
     bool IsInMainChain() const
@@ -2332,23 +2445,196 @@ public:
 
 
 
+/** A transaction in the memory pool, together with the fee, size and
+ * ancestor package statistics used to order it for block assembly.
+ * Everything is computed once when the transaction enters the pool.
+ */
+class CTxMemPoolEntry
+{
+private:
+    CTransaction tx;
+    uint256 hash;
+    int64 nFee;              // fee paid by this transaction alone
+    unsigned int nTxSize;    // serialized size
+    int64 nTime;             // local time when entering the pool
+    double dPriority;        // priority when entering the pool
+    unsigned int nHeight;    // chain height when entering the pool
+    int64 nValueInChain;     // sum of the inputs that were already confirmed on entry
+    size_t nUsageSize;       // heap memory used by the transaction
+
+    // Statistics of this transaction plus all of its unconfirmed ancestors
+    uint64 nCountWithAncestors;
+    uint64 nSizeWithAncestors;
+    int64 nFeesWithAncestors;
+
+public:
+    CTxMemPoolEntry();
+    CTxMemPoolEntry(const CTransaction& txIn, int64 nFeeIn, int64 nTimeIn,
+                    double dPriorityIn, unsigned int nHeightIn, int64 nValueInChainIn = 0);
+
+    const CTransaction& GetTx() const { return tx; }
+    const uint256& GetHash() const { return hash; }
+    int64 GetFee() const { return nFee; }
+    unsigned int GetTxSize() const { return nTxSize; }
+    int64 GetTime() const { return nTime; }
+    unsigned int GetHeight() const { return nHeight; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+
+    // Priority at a later chain height: confirmed inputs keep aging
+    double GetPriority(unsigned int nCurrentHeight) const;
+
+    // Fee per 1000 bytes of this transaction alone
+    double GetFeeRate() const;
+
+    // Fee per 1000 bytes of the package formed by this transaction and its
+    // unconfirmed ancestors; that is what a miner earns for including it.
+    double GetAncestorScore() const;
+
+    uint64 GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64 GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    int64 GetFeesWithAncestors() const { return nFeesWithAncestors; }
+
+    void SetAncestorState(uint64 nCount, uint64 nSize, int64 nFees);
+};
+
+// Orderings of the memory pool indexes. Ties are broken on the txid so
+// that every index has a deterministic order.
+struct CompareTxMemPoolEntryByFeeRate
+{
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double fa = a.GetFeeRate(), fb = b.GetFeeRate();
+        if (fa == fb)
+            return a.GetHash() < b.GetHash();
+        return fa < fb;
+    }
+};
+
+struct CompareTxMemPoolEntryByAncestorScore
+{
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double fa = a.GetAncestorScore(), fb = b.GetAncestorScore();
+        if (fa == fb)
+            return a.GetHash() < b.GetHash();
+        return fa < fb;
+    }
+};
+
+struct CompareTxMemPoolEntryByEntryTime
+{
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        if (a.GetTime() == b.GetTime())
+            return a.GetHash() < b.GetHash();
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Index tags
+struct txid_index {};
+struct fee_rate_index {};
+struct ancestor_score_index {};
+struct entry_time_index {};
+
+typedef boost::multi_index_container<
+    CTxMemPoolEntry,
+    boost::multi_index::indexed_by<
+        // sorted by txid
+        boost::multi_index::ordered_unique<
+            boost::multi_index::tag<txid_index>,
+            boost::multi_index::const_mem_fun<CTxMemPoolEntry, const uint256&, &CTxMemPoolEntry::GetHash>
+        >,
+        // sorted by fee rate, lowest first
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<fee_rate_index>,
+            boost::multi_index::identity<CTxMemPoolEntry>,
+            CompareTxMemPoolEntryByFeeRate
+        >,
+        // sorted by ancestor package fee rate, lowest first
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score_index>,
+            boost::multi_index::identity<CTxMemPoolEntry>,
+            CompareTxMemPoolEntryByAncestorScore
+        >,
+        // sorted by entry time, oldest first
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<entry_time_index>,
+            boost::multi_index::identity<CTxMemPoolEntry>,
+            CompareTxMemPoolEntryByEntryTime
+        >
+    >
+> indexed_transaction_set;
+
+/** The memory pool of transactions that may be included in the next block.
+ * Entries are kept in an indexed_transaction_set, so block assembly can walk
+ * them in ancestor score order instead of re-sorting the whole pool.
+ */
 class CTxMemPool
 {
 public:
     mutable CCriticalSection cs;
-    std::map<uint256, CTransaction> mapTx;
+    indexed_transaction_set mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
 
     bool accept(CValidationState &state, CTransaction &tx, bool fCheckInputs, bool fLimitFree, bool* pfMissingInputs);
+    // The two halves of accept(): prepare() runs every check and fills in the
+    // pool entry; when pvChecks is given the script checks are appended to it
+    // instead of being run. commit() then stores the entry. The script checks
+    // reference tx, which has to stay alive until they have run.
+    bool prepare(CValidationState &state, CTransaction &tx, bool fCheckInputs, bool fLimitFree, bool* pfMissingInputs,
+                 CTxMemPoolEntry &entry, std::vector<CScriptCheck> *pvChecks);
+    bool commit(CValidationState &state, const CTxMemPoolEntry &entry);
     bool acceptable(CValidationState &state, CTransaction &tx, bool fCheckInputs, bool fLimitFree, bool* pfMissingInputs);
     bool acceptableInputs(CValidationState &state, CTransaction &tx, bool fLimitFree);
-    bool addUnchecked(const uint256& hash, const CTransaction &tx);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
 
+    // Collect the txids of all in-pool ancestors of a pool transaction
+    void CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors);
+    // Collect the txids of all in-pool descendants of a transaction
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants);
+
+    // Remove transactions (and their descendants) that entered the pool
+    // before nTime. Returns the number of transactions removed.
+    int Expire(int64 nTime, std::vector<uint256>& vRemoved);
+    // Evict the packages with the lowest fee rate until the pool uses at
+    // most nSizeLimit bytes of memory. Raises the minimum fee above the
+    // fee rate of what was evicted.
+    void TrimToSize(size_t nSizeLimit, std::vector<uint256>& vRemoved);
+
+    // Limits commit() keeps the pool within: memory usage in bytes and the
+    // age of the entries in seconds
+    void SetLimits(size_t nSizeLimitIn, int64 nExpiryIn);
+    size_t GetSizeLimit()
+    {
+        LOCK(cs);
+        return nSizeLimit;
+    }
+
+    // Fee per 1000 bytes a transaction has to pay to get in: 0 while the
+    // pool has not been full recently. It rises when TrimToSize evicts
+    // transactions and then halves every ROLLING_FEE_HALFLIFE, faster once
+    // the pool has room again.
+    double GetMinFeeRate();
+    int64 GetMinFee(unsigned int nBytes)
+    {
+        return (int64)(GetMinFeeRate() * nBytes / 1000.0);
+    }
+
+    // Estimated heap memory used by the pool
+    size_t DynamicMemoryUsage();
+    // Sum of the serialized sizes of all pool transactions
+    uint64 GetTotalTxSize()
+    {
+        LOCK(cs);
+        return nTotalTxSize;
+    }
+
     unsigned long size()
     {
         LOCK(cs);
@@ -2360,10 +2646,26 @@ public:
         return (mapTx.count(hash) != 0);
     }
 
-    CTransaction& lookup(uint256 hash)
+    // Only call this for transactions known to be in the pool (see exists)
+    const CTransaction& lookup(uint256 hash)
     {
-        return mapTx[hash];
+        return mapTx.find(hash)->GetTx();
     }
+
+    CTxMemPool() : nTotalTxSize(0), nCachedInnerUsage(0),
+                   nSizeLimit((size_t)DEFAULT_MAX_MEMPOOL_SIZE * 1000000), nExpiry(DEFAULT_MEMPOOL_EXPIRY * 60 * 60),
+                   dRollingMinFee(0), nLastRollingFeeUpdate(0) { }
+
+private:
+    uint64 nTotalTxSize;       // sum of the entries' serialized sizes
+    size_t nCachedInnerUsage;  // sum of the entries' dynamic memory usage
+    size_t nSizeLimit;         // -maxmempool in bytes
+    int64 nExpiry;             // -mempoolexpiry in seconds
+    double dRollingMinFee;     // see GetMinFeeRate
+    int64 nLastRollingFeeUpdate;
+
+    // Recompute the ancestor package statistics of a pool transaction
+    void UpdateAncestorState(const uint256& hash);
 };
 
 extern CTxMemPool mempool;
@@ -0,0 +1,66 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include <stddef.h>
+#include <map>
+#include <set>
+#include <vector>
+
+/** Estimates of the heap memory used by standard containers.
+ * These are approximations: they assume a malloc that rounds allocations
+ * up to 16 bytes with one word of overhead, like glibc on 64-bit systems.
+ */
+namespace memusage
+{
+
+/** Memory used by a single malloc of the given size */
+static inline size_t MallocUsage(size_t alloc)
+{
+    if (alloc == 0)
+        return 0;
+    if (sizeof(void*) == 8)
+        return ((alloc + 31) >> 4) << 4;
+    return ((alloc + 15) >> 3) << 3;
+}
+
+// Node layout of the red-black tree behind std::map and std::set
+struct stl_tree_node
+{
+private:
+    int color;
+    void* parent;
+    void* left;
+    void* right;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+template<typename X>
+static inline size_t DynamicUsage(const std::set<X>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node) + sizeof(X)) * s.size();
+}
+
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::map<X, Y>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node) + sizeof(std::pair<const X, Y>)) * m.size();
+}
+
+/** Memory used by the node of a boost::multi_index_container with nIndexes ordered indexes */
+template<typename X>
+static inline size_t MultiIndexNodeUsage(int nIndexes)
+{
+    return MallocUsage(sizeof(X) + nIndexes * 3 * sizeof(void*));
+}
+
+}
+
+#endif // BITCOIN_MEMUSAGE_H
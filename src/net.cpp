@@ -55,9 +55,7 @@ int nMaxConnections = 125;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
-deque<pair<int64, CInv> > vRelayExpiration;
-CCriticalSection cs_mapRelay;
+CRelayCache relayCache;
 limitedmap<CInv, int64> mapAlreadyAskedFor(MAX_INV_SZ);
 
 static deque<string> vOneShots;
@@ -660,19 +658,20 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        CDataStreamView ssHeader(hdrbuf, hdrbuf + CMessageHeader::HEADER_SIZE, nType, nVersion);
+        ssHeader >> hdr;
     }
     catch (std::exception &e) {
         return -1;
@@ -708,13 +707,29 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+unsigned int FinishMessageHeader(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSharedMessage>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSerializeData &data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -1606,6 +1621,9 @@ void ThreadMessageHandler()
             boost::this_thread::interruption_point();
         }
 
+        // Verify the transactions received in this round as one batch
+        ProcessPendingTransactions();
+
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
@@ -1878,30 +1896,74 @@ instance_of_cnetcleanup;
 
 
 
-void RelayTransaction(const CTransaction& tx, const uint256& hash)
+void CRelayCache::Expire(int64 nNow)
 {
+    while (!vExpiration.empty() && vExpiration.front().first < nNow)
+    {
+        // Every message is queued once; one that was added again since has
+        // a later expiration time and goes to the back of the queue
+        std::map<uint256, std::pair<int64, CSharedMessage> >::iterator mi = mapMessages.find(vExpiration.front().second);
+        if (mi->second.first < nNow)
+        {
+            nTotalBytes -= mi->second.second->size();
+            mapMessages.erase(mi);
+        }
+        else
+            vExpiration.push_back(std::make_pair(mi->second.first, mi->first));
+        vExpiration.pop_front();
+    }
+}
+
+CSharedMessage CRelayCache::Get(const uint256& hash) const
+{
+    LOCK(cs);
+    std::map<uint256, std::pair<int64, CSharedMessage> >::const_iterator mi = mapMessages.find(hash);
+    if (mi == mapMessages.end())
+        return CSharedMessage();
+    return mi->second.second;
+}
+
+CSharedMessage CRelayCache::Add(const uint256& hash, const CTransaction& tx)
+{
+    int64 nNow = GetTime();
+    LOCK(cs);
+    Expire(nNow);
+
+    std::pair<int64, CSharedMessage>& entry = mapMessages[hash];
+    entry.first = nNow + RELAY_EXPIRY;
+    if (entry.second)
+        return entry.second;
+    vExpiration.push_back(std::make_pair(entry.first, hash));
+
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, hash, ss);
+    ss.reserve(CMessageHeader::HEADER_SIZE + ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    ss << CMessageHeader("tx", 0) << tx;
+    FinishMessageHeader(ss);
+
+    boost::shared_ptr<CSerializeData> pdata(new CSerializeData());
+    ss.GetAndClear(*pdata);
+    entry.second = pdata;
+    nTotalBytes += pdata->size();
+    return entry.second;
+}
+
+size_t CRelayCache::size() const
+{
+    LOCK(cs);
+    return mapMessages.size();
+}
+
+size_t CRelayCache::GetTotalBytes() const
+{
+    LOCK(cs);
+    return nTotalBytes;
 }
 
-void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss)
+void RelayTransaction(const CTransaction& tx, const uint256& hash)
 {
     CInv inv(MSG_TX, hash);
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
+    relayCache.Add(hash, tx);
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
@@ -8,6 +8,7 @@
 #include <deque>
 #include <boost/array.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <openssl/rand.h>
 
 #ifndef WIN32
@@ -46,6 +47,13 @@ void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
 
+/** A complete wire message, header included. Messages that go to many peers
+ * are built once and the same buffer is queued to each of them. */
+typedef boost::shared_ptr<const CSerializeData> CSharedMessage;
+
+/** Fill in the payload size and checksum of the message header at the start of ss */
+unsigned int FinishMessageHeader(CDataStream& ss);
+
 typedef int NodeId;
 
 enum
@@ -81,9 +89,6 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
-extern std::deque<std::pair<int64, CInv> > vRelayExpiration;
-extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64> mapAlreadyAskedFor;
 
 extern std::vector<std::string> vAddedNodes;
@@ -119,15 +124,19 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    // received message data; nothing secret travels over the network, so
+    // this doesn't need the zero-after-free allocator of CDataStream
+    std::vector<char> vRecv;
     unsigned int nDataPos;
 
-    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    int nType;
+    int nVersion;
+
+    CNetMessage(int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
@@ -142,8 +151,13 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
-        vRecv.SetVersion(nVersionIn);
+        nVersion = nVersionIn;
+    }
+
+    /** Stream reading the message data in place */
+    CDataStreamView GetDataStream() const
+    {
+        return CDataStreamView(vRecv, nType, nVersion);
     }
 
     int readHeader(const char *pch, unsigned int nBytes);
@@ -165,7 +179,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64 nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSharedMessage> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -434,30 +448,29 @@ public:
         if (ssSend.size() == 0)
             return;
 
-        // Set the size
-        unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-        memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-        // Set the checksum
-        uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-        unsigned int nChecksum = 0;
-        memcpy(&nChecksum, &hash, sizeof(nChecksum));
-        assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-        memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+        unsigned int nSize = FinishMessageHeader(ssSend);
 
         if (fDebug) {
             printf("(%d bytes)\n", nSize);
         }
 
-        std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-        ssSend.GetAndClear(*it);
-        nSendSize += (*it).size();
+        boost::shared_ptr<CSerializeData> pdata(new CSerializeData());
+        ssSend.GetAndClear(*pdata);
+        PushSharedMessage(pdata);
+
+        LEAVE_CRITICAL_SECTION(cs_vSend);
+    }
+
+    /** Queue a finished message without copying it */
+    void PushSharedMessage(const CSharedMessage& msg)
+    {
+        LOCK(cs_vSend);
+        vSendMsg.push_back(msg);
+        nSendSize += msg->size();
 
         // If write queue empty, attempt "optimistic write"
-        if (it == vSendMsg.begin())
+        if (vSendMsg.size() == 1)
             SocketSendData(this);
-
-        LEAVE_CRITICAL_SECTION(cs_vSend);
     }
 
     void PushVersion();
@@ -654,8 +667,39 @@ public:
 class CTransaction;
 class CTxIn;
 class CTxOut;
+
+/** "tx" messages of recently relayed or requested transactions. Each one is
+ * serialized once and shared by the send queues of all peers it goes to. */
+class CRelayCache
+{
+private:
+    mutable CCriticalSection cs;
+    // hash -> (expiration time, message)
+    std::map<uint256, std::pair<int64, CSharedMessage> > mapMessages;
+    // (expiration time when queued, hash), one for each message
+    std::deque<std::pair<int64, uint256> > vExpiration;
+    size_t nTotalBytes;
+
+    void Expire(int64 nNow);
+
+public:
+    /** Seconds a message is kept after it was last added */
+    static const int64 RELAY_EXPIRY = 15 * 60;
+
+    CRelayCache() : nTotalBytes(0) {}
+
+    /** The cached message for a transaction, or NULL */
+    CSharedMessage Get(const uint256& hash) const;
+    /** Cache the message for tx, serializing it only if it isn't cached yet */
+    CSharedMessage Add(const uint256& hash, const CTransaction& tx);
+
+    size_t size() const;
+    size_t GetTotalBytes() const;
+};
+
+extern CRelayCache relayCache;
+
 void RelayTransaction(const CTransaction& tx, const uint256& hash);
-void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss);
 void RelayDarkSendElectionEntry(const CTxIn vin, const CService addr, const std::vector<unsigned char> vchSig, const int64 nNow, const CPubKey pubkey, const CPubKey pubkey2, const int count, const int current, const int64 lastUpdated);
 void RelayDarkSendElectionEntryPing(const CTxIn vin, const std::vector<unsigned char> vchSig, const int64 nNow, const bool stop);
 
@@ -97,6 +97,16 @@ static void InitMessage(const std::string &message)
     printf("init message: %s\n", message.c_str());
 }
 
+static void ShowProgress(const std::string &title, int nProgress)
+{
+    // Only while the splash screen is up, the main window shows its own
+    if(splashref && splashref->isVisible())
+    {
+        splashref->showMessage(QString::fromStdString(title) + QString(" %1%").arg(nProgress), Qt::AlignBottom|Qt::AlignHCenter, QColor(55,55,55));
+        qApp->processEvents();
+    }
+}
+
 /*
    Translate string to current locale using Qt.
  */
@@ -195,6 +205,7 @@ int main(int argc, char *argv[])
     uiInterface.ThreadSafeMessageBox.connect(ThreadSafeMessageBox);
     uiInterface.ThreadSafeAskFee.connect(ThreadSafeAskFee);
     uiInterface.InitMessage.connect(InitMessage);
+    uiInterface.ShowProgress.connect(ShowProgress);
     uiInterface.Translate.connect(Translate);
 
     // Show help message immediately after parsing command-line options (for "-lang") and setting locale,
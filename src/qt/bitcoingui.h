@@ -27,6 +27,7 @@ QT_BEGIN_NAMESPACE
 class QLabel;
 class QModelIndex;
 class QProgressBar;
+class QProgressDialog;
 class QStackedWidget;
 class QUrl;
 class QListWidget;
@@ -114,6 +115,7 @@ private:
     TransactionView *transactionView;
     RPCConsole *rpcConsole;
     BlockExplorer* blockExplorer;
+    QProgressDialog *progressDialog;
 
     QMovie *syncIconMovie;
     /** Keep track of previous number of blocks, to detect progress */
@@ -204,6 +206,9 @@ private slots:
 
     /** called by a timer to check if fRequestShutdown has been set **/
     void detectShutdown();
+
+    /** Show progress dialog e.g. for a wallet rescan */
+    void showProgress(const QString &title, int nProgress);
 };
 
 #endif // BITCOINGUI_H
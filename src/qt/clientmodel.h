@@ -78,6 +78,9 @@ signals:
     //! Asynchronous message notification
     void message(const QString &title, const QString &message, unsigned int style);
 
+    //! Progress of a long running core operation, 0 to 100
+    void showProgress(const QString &title, int nProgress);
+
 public slots:
     void updateTimer();
     void updateNumConnections(int numConnections);
@@ -0,0 +1,326 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "txdb.h"
+#include "bitcoinrpc.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+//
+// Read-only REST interface, enabled with -rest.
+//
+// GET /rest/block/<hash>.<bin|hex>
+// GET /rest/headers/<count>/<hash>.<bin|hex>
+// GET /rest/tx/<txid>.<bin|hex>
+// GET /rest/getutxos[/checkmempool]/<txid>-<n>/<txid>-<n>/....<bin|hex>
+//
+// Blocks are copied from the block files in chunks, as the bytes stored
+// there are the bytes the P2P network sends. cs_main is only held to look
+// things up in the block index and the coins view, never while reading
+// files or writing to the connection. Connections are served on their own
+// threads (-restthreads), see ServiceConnection.
+//
+
+static const unsigned int MAX_REST_HEADERS = 2000;
+static const unsigned int MAX_REST_OUTPOINTS = 100;
+static const unsigned int REST_BLOCK_CHUNK_SIZE = 64 * 1024;
+
+enum RetFormat
+{
+    RF_BINARY,
+    RF_HEX,
+};
+
+/** An unspent output as /rest/getutxos returns it */
+struct CRestCoin
+{
+    int nTxVer;
+    int nHeight;
+    CTxOut out;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    )
+};
+
+static bool RESTReply(ostream& stream, int nStatus, const string& strMsg, bool fKeepAlive)
+{
+    stream << HTTPReplyHeader(nStatus, fKeepAlive, strMsg.size(), "text/plain") << strMsg << std::flush;
+    return fKeepAlive;
+}
+
+static bool RESTReplyData(ostream& stream, RetFormat rf, const char* pbegin, const char* pend, bool fKeepAlive)
+{
+    if (rf == RF_HEX)
+        return RESTReply(stream, HTTP_OK, HexStr(pbegin, pend) + "\n", fKeepAlive);
+    stream << HTTPReplyHeader(HTTP_OK, fKeepAlive, pend - pbegin, "application/octet-stream");
+    stream.write(pbegin, pend - pbegin);
+    stream << std::flush;
+    return fKeepAlive;
+}
+
+static bool ParseHashStr(const string& str, uint256& hash)
+{
+    if (str.size() != 64 || !IsHex(str))
+        return false;
+    hash.SetHex(str);
+    return true;
+}
+
+/** Split "<path>.<format>" into its parts */
+static bool ParseDataFormat(const string& strReq, string& strPath, RetFormat& rf)
+{
+    size_t nDot = strReq.rfind('.');
+    if (nDot == string::npos)
+        return false;
+    string strFormat = strReq.substr(nDot + 1);
+    if (strFormat == "bin")
+        rf = RF_BINARY;
+    else if (strFormat == "hex")
+        rf = RF_HEX;
+    else
+        return false;
+    strPath = strReq.substr(0, nDot);
+    return true;
+}
+
+/** Like GetTransaction(), but with -txindex the block file is read without cs_main */
+static bool ReadTransaction(const uint256& hash, CTransaction& tx)
+{
+    {
+        LOCK(mempool.cs);
+        if (mempool.exists(hash))
+        {
+            tx = mempool.lookup(hash);
+            return true;
+        }
+    }
+
+    if (!fTxIndex)
+    {
+        uint256 hashBlock;
+        return GetTransaction(hash, tx, hashBlock, true);
+    }
+
+    CDiskTxPos postx;
+    if (!pblocktree->ReadTxIndex(hash, postx))
+        return false;
+    CAutoFile filein = CAutoFile(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadTransaction() : OpenBlockFile failed");
+    try {
+        CBlockHeader header;
+        filein >> header;
+        fseek(filein, postx.nTxOffset, SEEK_CUR);
+        filein >> tx;
+    }
+    catch (std::exception &e) {
+        return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+    }
+    if (tx.GetHash() != hash)
+        return error("%s() : txid mismatch", __PRETTY_FUNCTION__);
+    return true;
+}
+
+static bool rest_block(ostream& stream, const vector<string>& vPath, RetFormat rf, bool fKeepAlive)
+{
+    uint256 hash;
+    if (vPath.size() != 1 || !ParseHashStr(vPath[0], hash))
+        return RESTReply(stream, HTTP_BAD_REQUEST, "Invalid hash\n", false);
+
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+            return RESTReply(stream, HTTP_NOT_FOUND, "Block not found\n", fKeepAlive);
+        pos = mi->second->GetBlockPos();
+    }
+
+    // Block files are only ever appended to, so pos stays valid without the
+    // lock. The block is preceded by the message start and its size.
+    CDiskBlockPos posSize(pos.nFile, pos.nPos - sizeof(unsigned int));
+    CAutoFile filein = CAutoFile(OpenBlockFile(posSize, true), SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = 0;
+    try {
+        if (filein)
+            filein >> nSize;
+    }
+    catch (std::exception &e) {
+        nSize = 0;
+    }
+    if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+        return RESTReply(stream, HTTP_INTERNAL_SERVER_ERROR, "Can't read block from disk\n", false);
+
+    // Copy the block to the connection a chunk at a time
+    stream << HTTPReplyHeader(HTTP_OK, fKeepAlive, rf == RF_HEX ? 2 * nSize + 1 : nSize,
+                              rf == RF_HEX ? "text/plain" : "application/octet-stream");
+    vector<char> vchChunk(std::min(nSize, REST_BLOCK_CHUNK_SIZE));
+    for (unsigned int nDone = 0; nDone < nSize; )
+    {
+        unsigned int nChunk = std::min(nSize - nDone, REST_BLOCK_CHUNK_SIZE);
+        if (fread(&vchChunk[0], 1, nChunk, filein) != nChunk)
+        {
+            // The header is out already, all that is left is to cut the reply short
+            printf("ERROR: rest_block() : reading block %s failed\n", hash.ToString().c_str());
+            stream << std::flush;
+            return false;
+        }
+        if (rf == RF_HEX)
+            stream << HexStr(vchChunk.begin(), vchChunk.begin() + nChunk);
+        else
+            stream.write(&vchChunk[0], nChunk);
+        nDone += nChunk;
+    }
+    if (rf == RF_HEX)
+        stream << "\n";
+    stream << std::flush;
+    return fKeepAlive;
+}
+
+static bool rest_headers(ostream& stream, const vector<string>& vPath, RetFormat rf, bool fKeepAlive)
+{
+    uint256 hash;
+    if (vPath.size() != 2 || !ParseHashStr(vPath[1], hash))
+        return RESTReply(stream, HTTP_BAD_REQUEST, "Usage: /rest/headers/<count>/<hash>.<bin|hex>\n", false);
+    int nCount = atoi(vPath[0]);
+    if (nCount < 1 || (unsigned int)nCount > MAX_REST_HEADERS)
+        return RESTReply(stream, HTTP_BAD_REQUEST, strprintf("Header count out of range: %s\n", vPath[0].c_str()), false);
+
+    // The headers from hash on along the best chain, none if it isn't on it
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (mi == mapBlockIndex.end() ? NULL : mi->second);
+        vector<CBlockHeader> vHeaders;
+        for (; pindex && pindex->IsInMainChain() && (int)vHeaders.size() < nCount; pindex = pindex->pnext)
+            vHeaders.push_back(pindex->GetBlockHeader());
+        ss << vHeaders;
+    }
+
+    return RESTReplyData(stream, rf, &ss[0], &ss[0] + ss.size(), fKeepAlive);
+}
+
+static bool rest_tx(ostream& stream, const vector<string>& vPath, RetFormat rf, bool fKeepAlive)
+{
+    uint256 hash;
+    if (vPath.size() != 1 || !ParseHashStr(vPath[0], hash))
+        return RESTReply(stream, HTTP_BAD_REQUEST, "Invalid hash\n", false);
+
+    CTransaction tx;
+    if (!ReadTransaction(hash, tx))
+        return RESTReply(stream, HTTP_NOT_FOUND, "Transaction not found\n", fKeepAlive);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    return RESTReplyData(stream, rf, &ss[0], &ss[0] + ss.size(), fKeepAlive);
+}
+
+static bool rest_getutxos(ostream& stream, const vector<string>& vPathIn, RetFormat rf, bool fKeepAlive)
+{
+    vector<string> vPath(vPathIn);
+    bool fCheckMemPool = false;
+    if (!vPath.empty() && vPath[0] == "checkmempool")
+    {
+        fCheckMemPool = true;
+        vPath.erase(vPath.begin());
+    }
+    if (vPath.empty() || vPath.size() > MAX_REST_OUTPOINTS)
+        return RESTReply(stream, HTTP_BAD_REQUEST, strprintf("Between 1 and %u outpoints are needed\n", MAX_REST_OUTPOINTS), false);
+
+    vector<COutPoint> vOutPoints;
+    BOOST_FOREACH(const string& str, vPath)
+    {
+        size_t nDash = str.find('-');
+        uint256 hash;
+        int n;
+        if (nDash == string::npos || !ParseHashStr(str.substr(0, nDash), hash) ||
+            (n = atoi(str.substr(nDash + 1))) < 0 || strprintf("%d", n) != str.substr(nDash + 1))
+            return RESTReply(stream, HTTP_BAD_REQUEST, strprintf("Invalid outpoint: %s\n", str.c_str()), false);
+        vOutPoints.push_back(COutPoint(hash, n));
+    }
+
+    // One bit per outpoint, set if it is unspent, followed by the unspent ones
+    vector<unsigned char> vBitmap((vOutPoints.size() + 7) / 8, 0);
+    vector<CRestCoin> vOuts;
+    int nHeight;
+    uint256 hashBest;
+    {
+        LOCK2(cs_main, mempool.cs);
+        CCoinsViewMemPool viewMemPool(*pcoinsTip, mempool);
+        CCoinsView& view = fCheckMemPool ? (CCoinsView&)viewMemPool : (CCoinsView&)*pcoinsTip;
+        for (unsigned int i = 0; i < vOutPoints.size(); i++)
+        {
+            const COutPoint& outpoint = vOutPoints[i];
+            CCoins coins;
+            if (!view.GetCoins(outpoint.hash, coins))
+                continue;
+            if (fCheckMemPool)
+                mempool.pruneSpent(outpoint.hash, coins);
+            if (outpoint.n >= coins.vout.size() || coins.vout[outpoint.n].IsNull())
+                continue;
+            CRestCoin coin;
+            coin.nTxVer = coins.nVersion;
+            coin.nHeight = coins.nHeight;
+            coin.out = coins.vout[outpoint.n];
+            vOuts.push_back(coin);
+            vBitmap[i / 8] |= (1 << (i % 8));
+        }
+        nHeight = pcoinsTip->GetBestBlock()->nHeight;
+        hashBest = pcoinsTip->GetBestBlock()->GetBlockHash();
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nHeight << hashBest << vBitmap << vOuts;
+    return RESTReplyData(stream, rf, &ss[0], &ss[0] + ss.size(), fKeepAlive);
+}
+
+typedef bool (*restfn_type)(ostream& stream, const vector<string>& vPath, RetFormat rf, bool fKeepAlive);
+
+static const struct
+{
+    const char* name;
+    restfn_type handler;
+} vRESTHandlers[] =
+{
+    { "block",    &rest_block },
+    { "headers",  &rest_headers },
+    { "tx",       &rest_tx },
+    { "getutxos", &rest_getutxos },
+};
+
+bool HTTPReq_REST(ostream& stream, const string& strMethod, const string& strURI, bool fKeepAlive)
+{
+    if (strMethod != "GET")
+        return RESTReply(stream, HTTP_BAD_REQUEST, "Only GET is supported\n", false);
+
+    string strPath;
+    RetFormat rf;
+    if (!ParseDataFormat(strURI.substr(6), strPath, rf))
+        return RESTReply(stream, HTTP_NOT_FOUND, "Output format not found (available: bin, hex)\n", false);
+
+    vector<string> vPath;
+    boost::split(vPath, strPath, boost::is_any_of("/"));
+    for (unsigned int i = 0; i < sizeof(vRESTHandlers) / sizeof(vRESTHandlers[0]); i++)
+    {
+        if (vPath[0] != vRESTHandlers[i].name)
+            continue;
+        vPath.erase(vPath.begin());
+        try {
+            return vRESTHandlers[i].handler(stream, vPath, rf, fKeepAlive);
+        }
+        catch (std::exception& e) {
+            return RESTReply(stream, HTTP_INTERNAL_SERVER_ERROR, string(e.what()) + "\n", false);
+        }
+    }
+    return RESTReply(stream, HTTP_NOT_FOUND, "Not found\n", false);
+}
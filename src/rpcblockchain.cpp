@@ -5,6 +5,8 @@
 
 #include "main.h"
 #include "bitcoinrpc.h"
+#include "jsonwriter.h"
+#include "sigcache.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -43,31 +45,32 @@ double GetDifficulty(const CBlockIndex* blockindex)
 }
 
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex)
+void BlockToJSON(const CBlock& block, const CBlockIndex* blockindex, CJSONWriter& writer)
 {
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    writer.BeginObject();
+    writer.Pair("hash", block.GetHash().GetHex());
     CMerkleTx txGen(block.vtx[0]);
     txGen.SetMerkleBranch(&block);
-    result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    Array txs;
+    writer.Pair("confirmations", (int)txGen.GetDepthInMainChain());
+    writer.Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Pair("height", blockindex->nHeight);
+    writer.Pair("version", block.nVersion);
+    writer.Pair("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        txs.push_back(tx.GetHash().GetHex());
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", (boost::int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (boost::uint64_t)block.nNonce));
-    result.push_back(Pair("bits", HexBits(block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+        writer.Write(tx.GetHash().GetHex());
+    writer.EndArray();
+    writer.Pair("time", (int64)block.GetBlockTime());
+    writer.Pair("nonce", (uint64)block.nNonce);
+    writer.Pair("bits", HexBits(block.nBits));
+    writer.Pair("difficulty", GetDifficulty(blockindex));
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        writer.Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-    return result;
+        writer.Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex());
+    writer.EndObject();
 }
 
 
@@ -118,7 +121,7 @@ Value settxfee(const Array& params, bool fHelp)
     return true;
 }
 
-Value getrawmempool(const Array& params, bool fHelp)
+void getrawmempool_json(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
@@ -128,11 +131,65 @@ Value getrawmempool(const Array& params, bool fHelp)
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
 
-    Array a;
+    writer.reserve(vtxid.size() * 67 + 2);
+    writer.BeginArray();
     BOOST_FOREACH(const uint256& hash, vtxid)
-        a.push_back(hash.ToString());
+        writer.Write(hash.ToString());
+    writer.EndArray();
+}
+
+Value getrawmempool(const Array& params, bool fHelp)
+{
+    return ValueFromStream(&getrawmempool_json, params, fHelp);
+}
+
+Value getmempoolinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmempoolinfo\n"
+            "Returns an object containing memory pool statistics:\n"
+            "  size: number of transactions\n"
+            "  bytes: sum of the transactions' serialized sizes\n"
+            "  usage: estimated memory usage in bytes\n"
+            "  maxmempool: memory usage limit in bytes\n"
+            "  mempoolminfee: fee per 1000 bytes needed to enter the pool, 0 unless it was full recently");
 
-    return a;
+    Object ret;
+    ret.push_back(Pair("size", (boost::int64_t)mempool.size()));
+    ret.push_back(Pair("bytes", (boost::int64_t)mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (boost::int64_t)mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("maxmempool", (boost::int64_t)mempool.GetSizeLimit()));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount((int64)mempool.GetMinFeeRate())));
+
+    return ret;
+}
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns an object containing signature cache statistics:\n"
+            "  entries: number of cached signatures\n"
+            "  capacity: maximum number of cached signatures\n"
+            "  hits: lookups that found the signature\n"
+            "  misses: lookups that did not\n"
+            "  hitrate: hits / (hits + misses)\n"
+            "  inserts: signatures added to the cache");
+
+    CSignatureCache::Stats stats = signatureCache.GetStats();
+    uint64 nLookups = stats.nHits + stats.nMisses;
+
+    Object ret;
+    ret.push_back(Pair("entries", (boost::int64_t)stats.nEntries));
+    ret.push_back(Pair("capacity", (boost::int64_t)stats.nCapacity));
+    ret.push_back(Pair("hits", (boost::int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (boost::int64_t)stats.nMisses));
+    ret.push_back(Pair("hitrate", nLookups ? (double)stats.nHits / nLookups : 0.0));
+    ret.push_back(Pair("inserts", (boost::int64_t)stats.nInserts));
+
+    return ret;
 }
 
 Value getblockhash(const Array& params, bool fHelp)
@@ -150,7 +207,7 @@ Value getblockhash(const Array& params, bool fHelp)
     return pblockindex->phashBlock->GetHex();
 }
 
-Value getblock(const Array& params, bool fHelp)
+void getblock_json(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -177,11 +234,16 @@ Value getblock(const Array& params, bool fHelp)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        writer.Write(HexStr(ssBlock.begin(), ssBlock.end()));
+        return;
     }
 
-    return blockToJSON(block, pblockindex);
+    BlockToJSON(block, pblockindex, writer);
+}
+
+Value getblock(const Array& params, bool fHelp)
+{
+    return ValueFromStream(&getblock_json, params, fHelp);
 }
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
@@ -94,3 +94,23 @@ Value dumpprivkey(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Private key for address " + strAddress + " is not known");
     return CBitcoinSecret(vchSecret).ToString();
 }
+
+Value getrescaninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns the progress of a running wallet rescan, e.g. one started by importprivkey.\n"
+            "Answers while the rescan holds the wallet, unlike most other calls.");
+
+    Object obj;
+    int nHeight, nEndHeight;
+    bool fRescanning = pwalletMain->GetRescanProgress(nHeight, nEndHeight);
+    obj.push_back(Pair("rescanning", fRescanning));
+    if (fRescanning)
+    {
+        obj.push_back(Pair("height",    nHeight));
+        obj.push_back(Pair("endheight", nEndHeight));
+    }
+    return obj;
+}
@@ -257,7 +257,7 @@ Value getwork(const Array& params, bool fHelp)
         pblock->UpdateTime(pindexPrev);
         pblock->nNonce = 0;
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << *pblock;
@@ -439,7 +439,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     Object aux;
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
     Array aMutable;
     if (aMutable.empty())
@@ -0,0 +1,118 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef RPCQUEUE_H
+#define RPCQUEUE_H
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+
+/** Queue of RPC calls waiting for a worker thread.
+  *
+  * The connection threads only read requests and write replies, the calls
+  * themselves run on the workers. Besides the calls an idle worker is about
+  * to pick up, the queue holds at most nMaxDepth calls waiting for a busy
+  * one; once it is full Enqueue() refuses more rather than letting them pile
+  * up behind a backlog that may never clear. With nMaxDepth 0 a call is only
+  * taken if a worker is free to run it straight away.
+  */
+class CRPCWorkQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<boost::function<void()> > queue;
+    size_t nMaxDepth;
+    size_t nIdle;
+    bool fRunning;
+
+public:
+    CRPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), nIdle(0), fRunning(true) {}
+
+    /** Queue a call, returns false if the queue is full or stopped */
+    bool Enqueue(const boost::function<void()>& job)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning || queue.size() >= nIdle + nMaxDepth)
+            return false;
+        queue.push_back(job);
+        cond.notify_one();
+        return true;
+    }
+
+    /** Worker thread body. Returns once the queue is stopped and whatever
+      * was still queued has run, so no connection is left waiting. */
+    void Thread()
+    {
+        while (true)
+        {
+            boost::function<void()> job;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (fRunning && queue.empty())
+                {
+                    nIdle++;
+                    cond.wait(lock);
+                    nIdle--;
+                }
+                if (queue.empty())
+                    return;
+                job.swap(queue.front());
+                queue.pop_front();
+            }
+            job();
+        }
+    }
+
+    /** Refuse new calls and let the workers exit once the queue is empty */
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+    size_t Depth()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+};
+
+/** Lets a connection wait for the calls it queued */
+class CRPCPending
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    int nPending;
+
+public:
+    CRPCPending() : nPending(0) {}
+
+    void Add()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nPending++;
+    }
+
+    void Done()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (--nPending == 0)
+            cond.notify_all();
+    }
+
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nPending > 0)
+            cond.wait(lock);
+    }
+};
+
+#endif
@@ -10,6 +10,7 @@
 #include "bitcoinrpc.h"
 #include "init.h"
 #include "base58.h"
+#include "jsonwriter.h"
 
 using namespace std;
 using namespace boost;
@@ -35,23 +36,23 @@ void EnsureWalletIsUnlocked()
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Please enter the wallet passphrase with walletpassphrase first.");
 }
 
-void WalletTxToJSON(const CWalletTx& wtx, Object& entry)
+void WalletTxToJSON(const CWalletTx& wtx, CJSONWriter& entry)
 {
     int confirms = wtx.GetDepthInMainChain();
-    entry.push_back(Pair("confirmations", confirms));
+    entry.Pair("confirmations", confirms);
     if (wtx.IsCoinBase())
-        entry.push_back(Pair("generated", true));
+        entry.Pair("generated", true);
     if (confirms)
     {
-        entry.push_back(Pair("blockhash", wtx.hashBlock.GetHex()));
-        entry.push_back(Pair("blockindex", wtx.nIndex));
-        entry.push_back(Pair("blocktime", (boost::int64_t)(mapBlockIndex[wtx.hashBlock]->nTime)));
+        entry.Pair("blockhash", wtx.hashBlock.GetHex());
+        entry.Pair("blockindex", wtx.nIndex);
+        entry.Pair("blocktime", (int64)(mapBlockIndex[wtx.hashBlock]->nTime));
     }
-    entry.push_back(Pair("txid", wtx.GetHash().GetHex()));
-    entry.push_back(Pair("time", (boost::int64_t)wtx.GetTxTime()));
-    entry.push_back(Pair("timereceived", (boost::int64_t)wtx.nTimeReceived));
+    entry.Pair("txid", wtx.GetHash().GetHex());
+    entry.Pair("time", (int64)wtx.GetTxTime());
+    entry.Pair("timereceived", (int64)wtx.nTimeReceived);
     BOOST_FOREACH(const PAIRTYPE(string,string)& item, wtx.mapValue)
-        entry.push_back(Pair(item.first, item.second));
+        entry.Pair(item.first, item.second);
 }
 
 string AccountFromValue(const Value& value)
@@ -673,28 +674,10 @@ Value sendfrom(const Array& params, bool fHelp)
 }
 
 
-Value sendmany(const Array& params, bool fHelp)
+// The {address:amount,...} object of sendmany and sendpayouts
+static int64 ParseSendTo(const Object& sendTo, vector<pair<CScript, int64> >& vecSend)
 {
-    if (fHelp || params.size() < 2 || params.size() > 4)
-        throw runtime_error(
-            "sendmany <fromaccount> {address:amount,...} [minconf=1] [comment]\n"
-            "amounts are double-precision floating point numbers"
-            + HelpRequiringPassphrase());
-
-    string strAccount = AccountFromValue(params[0]);
-    Object sendTo = params[1].get_obj();
-    int nMinDepth = 1;
-    if (params.size() > 2)
-        nMinDepth = params[2].get_int();
-
-    CWalletTx wtx;
-    wtx.strFromAccount = strAccount;
-    if (params.size() > 3 && params[3].type() != null_type && !params[3].get_str().empty())
-        wtx.mapValue["comment"] = params[3].get_str();
-
     set<CBitcoinAddress> setAddress;
-    vector<pair<CScript, int64> > vecSend;
-
     int64 totalAmount = 0;
     BOOST_FOREACH(const Pair& s, sendTo)
     {
@@ -713,6 +696,30 @@ Value sendmany(const Array& params, bool fHelp)
 
         vecSend.push_back(make_pair(scriptPubKey, nAmount));
     }
+    return totalAmount;
+}
+
+Value sendmany(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 4)
+        throw runtime_error(
+            "sendmany <fromaccount> {address:amount,...} [minconf=1] [comment]\n"
+            "amounts are double-precision floating point numbers"
+            + HelpRequiringPassphrase());
+
+    string strAccount = AccountFromValue(params[0]);
+    Object sendTo = params[1].get_obj();
+    int nMinDepth = 1;
+    if (params.size() > 2)
+        nMinDepth = params[2].get_int();
+
+    CWalletTx wtx;
+    wtx.strFromAccount = strAccount;
+    if (params.size() > 3 && params[3].type() != null_type && !params[3].get_str().empty())
+        wtx.mapValue["comment"] = params[3].get_str();
+
+    vector<pair<CScript, int64> > vecSend;
+    int64 totalAmount = ParseSendTo(sendTo, vecSend);
 
     EnsureWalletIsUnlocked();
 
@@ -734,6 +741,55 @@ Value sendmany(const Array& params, bool fHelp)
     return wtx.GetHash().GetHex();
 }
 
+Value sendpayouts(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 4)
+        throw runtime_error(
+            "sendpayouts <fromaccount> {address:amount,...} [minconf=1] [comment]\n"
+            "Like sendmany, for more recipients than fit in one transaction. They are\n"
+            "split over as many transactions as needed, which are recorded together.\n"
+            "Returns the ids of the transactions.\n"
+            "amounts are double-precision floating point numbers"
+            + HelpRequiringPassphrase());
+
+    string strAccount = AccountFromValue(params[0]);
+    Object sendTo = params[1].get_obj();
+    int nMinDepth = 1;
+    if (params.size() > 2)
+        nMinDepth = params[2].get_int();
+    string strComment;
+    if (params.size() > 3 && params[3].type() != null_type)
+        strComment = params[3].get_str();
+
+    vector<pair<CScript, int64> > vecSend;
+    int64 totalAmount = ParseSendTo(sendTo, vecSend);
+
+    EnsureWalletIsUnlocked();
+
+    // Check funds
+    int64 nBalance = GetAccountBalance(strAccount, nMinDepth);
+    if (totalAmount > nBalance)
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Account has insufficient funds");
+
+    // Send
+    CPayoutBatch batch;
+    string strFailReason;
+    if (!pwalletMain->CreatePayouts(vecSend, batch, strFailReason))
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, strFailReason);
+    Array ret;
+    BOOST_FOREACH(CWalletTx& wtx, batch.vwtx)
+    {
+        wtx.strFromAccount = strAccount;
+        if (!strComment.empty())
+            wtx.mapValue["comment"] = strComment;
+        ret.push_back(wtx.GetHash().GetHex());
+    }
+    if (!pwalletMain->CommitPayouts(batch))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Transaction commit failed");
+
+    return ret;
+}
+
 //
 // Used by addmultisigaddress / createmultisig:
 //
@@ -977,7 +1033,9 @@ Value listreceivedbyaccount(const Array& params, bool fHelp)
     return ListReceived(params, true);
 }
 
-void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, Array& ret)
+/** Append the entries of a wallet transaction to vEntries, each written on
+ *  its own by a part of writer, so callers can pick and reorder them */
+void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, const CJSONWriter& writer, deque<CJSONWriter>& vEntries)
 {
     int64 nFee;
     string strSentAccount;
@@ -993,15 +1051,17 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
     {
         BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& s, listSent)
         {
-            Object entry;
-            entry.push_back(Pair("account", strSentAccount));
-            entry.push_back(Pair("address", CBitcoinAddress(s.first).ToString()));
-            entry.push_back(Pair("category", "send"));
-            entry.push_back(Pair("amount", ValueFromAmount(-s.second)));
-            entry.push_back(Pair("fee", ValueFromAmount(-nFee)));
+            vEntries.push_back(writer.NewPart());
+            CJSONWriter& entry = vEntries.back();
+            entry.BeginObject();
+            entry.Pair("account", strSentAccount);
+            entry.Pair("address", CBitcoinAddress(s.first).ToString());
+            entry.Pair("category", "send");
+            entry.Pair("amount", ValueFromAmount(-s.second));
+            entry.Pair("fee", ValueFromAmount(-nFee));
             if (fLong)
                 WalletTxToJSON(wtx, entry);
-            ret.push_back(entry);
+            entry.EndObject();
         }
     }
 
@@ -1015,47 +1075,51 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
                 account = pwalletMain->mapAddressBook[r.first];
             if (fAllAccounts || (account == strAccount))
             {
-                Object entry;
-                entry.push_back(Pair("account", account));
-                entry.push_back(Pair("address", CBitcoinAddress(r.first).ToString()));
+                vEntries.push_back(writer.NewPart());
+                CJSONWriter& entry = vEntries.back();
+                entry.BeginObject();
+                entry.Pair("account", account);
+                entry.Pair("address", CBitcoinAddress(r.first).ToString());
                 if (wtx.IsCoinBase())
                 {
                     if (wtx.GetDepthInMainChain() < 1)
-                        entry.push_back(Pair("category", "orphan"));
+                        entry.Pair("category", "orphan");
                     else if (wtx.GetBlocksToMaturity() > 0)
-                        entry.push_back(Pair("category", "immature"));
+                        entry.Pair("category", "immature");
                     else
-                        entry.push_back(Pair("category", "generate"));
+                        entry.Pair("category", "generate");
                 }
                 else
-                    entry.push_back(Pair("category", "receive"));
-                entry.push_back(Pair("amount", ValueFromAmount(r.second)));
+                    entry.Pair("category", "receive");
+                entry.Pair("amount", ValueFromAmount(r.second));
                 if (fLong)
                     WalletTxToJSON(wtx, entry);
-                ret.push_back(entry);
+                entry.EndObject();
             }
         }
     }
 }
 
-void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Array& ret)
+void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, const CJSONWriter& writer, deque<CJSONWriter>& vEntries)
 {
     bool fAllAccounts = (strAccount == string("*"));
 
     if (fAllAccounts || acentry.strAccount == strAccount)
     {
-        Object entry;
-        entry.push_back(Pair("account", acentry.strAccount));
-        entry.push_back(Pair("category", "move"));
-        entry.push_back(Pair("time", (boost::int64_t)acentry.nTime));
-        entry.push_back(Pair("amount", ValueFromAmount(acentry.nCreditDebit)));
-        entry.push_back(Pair("otheraccount", acentry.strOtherAccount));
-        entry.push_back(Pair("comment", acentry.strComment));
-        ret.push_back(entry);
+        vEntries.push_back(writer.NewPart());
+        CJSONWriter& entry = vEntries.back();
+        entry.BeginObject();
+        entry.Pair("account", acentry.strAccount);
+        entry.Pair("category", "move");
+        entry.Pair("time", (int64)acentry.nTime);
+        entry.Pair("amount", ValueFromAmount(acentry.nCreditDebit));
+        entry.Pair("otheraccount", acentry.strOtherAccount);
+        entry.Pair("comment", acentry.strComment);
+        entry.EndObject();
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+void listtransactions_json(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -1077,7 +1141,7 @@ Value listtransactions(const Array& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
-    Array ret;
+    deque<CJSONWriter> vEntries;
 
     std::list<CAccountingEntry> acentries;
     CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
@@ -1087,30 +1151,30 @@ Value listtransactions(const Array& params, bool fHelp)
     {
         CWalletTx *const pwtx = (*it).second.first;
         if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret);
+            ListTransactions(*pwtx, strAccount, 0, true, writer, vEntries);
         CAccountingEntry *const pacentry = (*it).second.second;
         if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
+            AcentryToJSON(*pacentry, strAccount, writer, vEntries);
 
-        if ((int)ret.size() >= (nCount+nFrom)) break;
+        if ((int)vEntries.size() >= (nCount+nFrom)) break;
     }
-    // ret is newest to oldest
-
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-    Array::iterator first = ret.begin();
-    std::advance(first, nFrom);
-    Array::iterator last = ret.begin();
-    std::advance(last, nFrom+nCount);
-
-    if (last != ret.end()) ret.erase(last, ret.end());
-    if (first != ret.begin()) ret.erase(ret.begin(), first);
-
-    std::reverse(ret.begin(), ret.end()); // Return oldest to newest
+    // vEntries is newest to oldest
+
+    if (nFrom > (int)vEntries.size())
+        nFrom = vEntries.size();
+    if ((nFrom + nCount) > (int)vEntries.size())
+        nCount = vEntries.size() - nFrom;
+
+    // Return oldest to newest
+    writer.BeginArray();
+    for (int i = nFrom + nCount - 1; i >= nFrom; i--)
+        writer.Append(vEntries[i]);
+    writer.EndArray();
+}
 
-    return ret;
+Value listtransactions(const Array& params, bool fHelp)
+{
+    return ValueFromStream(&listtransactions_json, params, fHelp);
 }
 
 Value listaccounts(const Array& params, bool fHelp)
@@ -1163,7 +1227,7 @@ Value listaccounts(const Array& params, bool fHelp)
     return ret;
 }
 
-Value listsinceblock(const Array& params, bool fHelp)
+void listsinceblock_json(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp)
         throw runtime_error(
@@ -1191,14 +1255,14 @@ Value listsinceblock(const Array& params, bool fHelp)
 
     int depth = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
 
-    Array transactions;
+    deque<CJSONWriter> vEntries;
 
     for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
     {
-        CWalletTx tx = (*it).second;
+        const CWalletTx& tx = (*it).second;
 
         if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
+            ListTransactions(tx, "*", 0, true, writer, vEntries);
     }
 
     uint256 lastblock;
@@ -1219,14 +1283,22 @@ Value listsinceblock(const Array& params, bool fHelp)
         lastblock = block ? block->GetBlockHash() : 0;
     }
 
-    Object ret;
-    ret.push_back(Pair("transactions", transactions));
-    ret.push_back(Pair("lastblock", lastblock.GetHex()));
+    writer.BeginObject();
+    writer.Key("transactions");
+    writer.BeginArray();
+    BOOST_FOREACH(const CJSONWriter& entry, vEntries)
+        writer.Append(entry);
+    writer.EndArray();
+    writer.Pair("lastblock", lastblock.GetHex());
+    writer.EndObject();
+}
 
-    return ret;
+Value listsinceblock(const Array& params, bool fHelp)
+{
+    return ValueFromStream(&listsinceblock_json, params, fHelp);
 }
 
-Value gettransaction(const Array& params, bool fHelp)
+void gettransaction_json(const Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
@@ -1236,7 +1308,6 @@ Value gettransaction(const Array& params, bool fHelp)
     uint256 hash;
     hash.SetHex(params[0].get_str());
 
-    Object entry;
     if (!pwalletMain->mapWallet.count(hash))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
     const CWalletTx& wtx = pwalletMain->mapWallet[hash];
@@ -1246,17 +1317,26 @@ Value gettransaction(const Array& params, bool fHelp)
     int64 nNet = nCredit - nDebit;
     int64 nFee = (wtx.IsFromMe() ? wtx.GetValueOut() - nDebit : 0);
 
-    entry.push_back(Pair("amount", ValueFromAmount(nNet - nFee)));
+    writer.BeginObject();
+    writer.Pair("amount", ValueFromAmount(nNet - nFee));
     if (wtx.IsFromMe())
-        entry.push_back(Pair("fee", ValueFromAmount(nFee)));
-
-    WalletTxToJSON(wtx, entry);
-
-    Array details;
-    ListTransactions(wtx, "*", 0, false, details);
-    entry.push_back(Pair("details", details));
+        writer.Pair("fee", ValueFromAmount(nFee));
+
+    WalletTxToJSON(wtx, writer);
+
+    deque<CJSONWriter> vDetails;
+    ListTransactions(wtx, "*", 0, false, writer, vDetails);
+    writer.Key("details");
+    writer.BeginArray();
+    BOOST_FOREACH(const CJSONWriter& detail, vDetails)
+        writer.Append(detail);
+    writer.EndArray();
+    writer.EndObject();
+}
 
-    return entry;
+Value gettransaction(const Array& params, bool fHelp)
+{
+    return ValueFromStream(&gettransaction_json, params, fHelp);
 }
 
 
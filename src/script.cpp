@@ -3,7 +3,6 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 using namespace boost;
@@ -13,10 +12,12 @@ using namespace boost;
 #include "bignum.h"
 #include "key.h"
 #include "main.h"
+#include "sigcache.h"
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags,
+              vector<CCompactSigCheck>* pvDeferredSigs = NULL, const CSigHashCache* pSigHashCache = NULL);
 
 
 
@@ -245,7 +246,8 @@ bool IsCanonicalSignature(const valtype &vchSig) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                vector<CCompactSigCheck>* pvDeferredSigs, const CSigHashCache* pSigHashCache)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -294,7 +296,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 return false; // Disabled opcodes.
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4)
-                stack.push_back(vchPushValue);
+            {
+                // GetOp refills vchPushValue, so its buffer can be handed over
+                stack.push_back(valtype());
+                stack.back().swap(vchPushValue);
+            }
             else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -799,7 +805,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                     bool fSuccess = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                     if (fSuccess)
-                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pvDeferredSigs, pSigHashCache);
 
                     popstack(stack);
                     popstack(stack);
@@ -858,10 +864,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         valtype& vchSig    = stacktop(-isig);
                         valtype& vchPubKey = stacktop(-ikey);
 
-                        // Check signature
+                        // Check signature. These are never deferred: which
+                        // signature goes with which key depends on the results.
                         bool fOk = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                         if (fOk)
-                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, NULL, pSigHashCache);
 
                         if (fOk) {
                             isig++;
@@ -980,68 +987,47 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     return ss.GetHash();
 }
 
-
-// Valid signature cache, to avoid doing expensive ECDSA signature checking
-// twice for every transaction (once when accepted into memory pool, and
-// again when accepted into the block chain)
-
-class CSignatureCache
+CSigHashCache::CSigHashCache(const CTransaction& txTo) : ptxTo(&txTo)
 {
-private:
-     // sigdata_type is (signature hash, signature, public key hash):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, uint160> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
-
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const uint160& pubKey)
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    CDataStream tail(SER_GETHASH, 0);
+    vPrefix.reserve(txTo.vin.size());
+    vTailPos.reserve(txTo.vin.size());
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        vPrefix.push_back(ss);
+        CTxIn txinBlank(txin.prevout, CScript(), txin.nSequence);
+        ss << txinBlank;
+        tail << txinBlank;
+        vTailPos.push_back(tail.size());
     }
+    tail << txTo.vout << txTo.nLockTime;
+    vchTail.assign(tail.begin(), tail.end());
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const uint160& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+uint256 CSigHashCache::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const
+{
+    if ((nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE ||
+        (nHashType & SIGHASH_ANYONECANPAY) || nIn >= vPrefix.size())
+        return ::SignatureHash(scriptCode, *ptxTo, nIn, nHashType);
 
-        while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, uint160()));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+    // Same as SignatureHash(), without touching the other inputs
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+    const CTxIn& txin = ptxTo->vin[nIn];
+    CHashWriter ss = vPrefix[nIn];
+    ss << txin.prevout << scriptCode << txin.nSequence;
+    ss.write((const char*)&vchTail[vTailPos[nIn]], vchTail.size() - vTailPos[nIn]);
+    ss << nHashType;
+    return ss.GetHash();
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
-    }
-};
 
 bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, vector<CCompactSigCheck>* pvDeferredSigs,
+              const CSigHashCache* pSigHashCache)
 {
-    static CSignatureCache signatureCache;
-
     // Hash type is one byte tacked on to the end of the signature
     if (vchSig.empty())
         return false;
@@ -1052,11 +1038,21 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubK
     vchSig.pop_back();
 
     uint160 PubKeyHash(vchPubKey);
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash;
+    if (pSigHashCache)
+        sighash = pSigHashCache->SignatureHash(scriptCode, nIn, nHashType);
+    else
+        sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, PubKeyHash))
         return true;
 
+    if (pvDeferredSigs)
+    {
+        pvDeferredSigs->push_back(CCompactSigCheck(sighash, vchSig, PubKeyHash));
+        return true;
+    }
+
     CPubKey RecoveredPubKey;
     if (!RecoveredPubKey.RecoverCompact(sighash, vchSig))
         return false;
@@ -1474,15 +1470,98 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
     return true;
 }
 
+// EvalScript's limit on the number of stack and altstack elements
+static const unsigned int MAX_STACK_SIZE = 1000;
+
+// Push the data of a scriptSig made only of data pushes, the way EvalScript
+// would, as long as the stack stays within nMaxStack elements. Returns false
+// for anything else, including scripts EvalScript rejects, so the caller can
+// leave those to the interpreter.
+static bool PushScriptData(const CScript& script, vector<valtype>& stack, unsigned int nMaxStack)
+{
+    if (script.size() > 10000)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    while (pc < script.end())
+    {
+        if (!script.GetOp(pc, opcode, vchPushValue))
+            return false;
+        if (opcode > OP_PUSHDATA4 || vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if (stack.size() >= nMaxStack)
+            return false;
+        stack.push_back(valtype());
+        stack.back().swap(vchPushValue);
+    }
+    return true;
+}
+
+// Spends of the standard templates, checked without the interpreter loop.
+// Returns false if the scripts don't fit the fast path, otherwise fResult
+// is what the full evaluation in VerifyScript would return.
+static bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                                 unsigned int flags, int nHashType, vector<CCompactSigCheck>* pvDeferredSigs,
+                                 const CSigHashCache* pSigHashCache, bool& fResult)
+{
+    // <sig> | <pubkey hash> OP_CHECKSIG. Only a minimally pushed signature of
+    // the one size that can be valid: then it can't match anything that
+    // OP_CHECKSIG would delete from scriptPubKey, and scriptPubKey has no
+    // OP_CODESEPARATOR, so it is the script code as it is.
+    if (scriptPubKey.IsPayToPubKeyHash())
+    {
+        static const unsigned int SIGNATURE_SIZE = 66; // compact signature and hash type
+        if (scriptSig.size() != SIGNATURE_SIZE + 1 || scriptSig[0] != SIGNATURE_SIZE)
+            return false;
+        valtype vchSig(scriptSig.begin() + 1, scriptSig.end());
+        valtype vchPubKey(scriptPubKey.begin() + 1, scriptPubKey.begin() + 21);
+        fResult = (!(flags & SCRIPT_VERIFY_STRICTENC) || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
+        if (fResult)
+            fResult = CheckSig(vchSig, vchPubKey, scriptPubKey, txTo, nIn, nHashType, flags, pvDeferredSigs, pSigHashCache);
+        return true;
+    }
+
+    // <data> ... <serialized script> | OP_HASH160 <script hash> OP_EQUAL. The
+    // stack doesn't have to be copied, and only the redeem script needs the
+    // interpreter.
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
+    {
+        // Evaluating scriptPubKey pushes the script hash on top of the
+        // scriptSig's data, and that has to fit on the stack too
+        vector<valtype> stack;
+        if (!PushScriptData(scriptSig, stack, MAX_STACK_SIZE - 1))
+            return false;
+        fResult = false;
+        if (stack.empty())
+            return true;
+        uint160 hashScript = Hash160(stack.back());
+        if (memcmp(hashScript.begin(), &scriptPubKey[2], 20) != 0)
+            return true;
+        CScript scriptRedeem(stack.back().begin(), stack.back().end());
+        popstack(stack);
+        if (!EvalScript(stack, scriptRedeem, txTo, nIn, flags, nHashType, pvDeferredSigs, pSigHashCache))
+            return true;
+        fResult = !stack.empty() && CastToBool(stack.back());
+        return true;
+    }
+
+    return false;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, vector<CCompactSigCheck>* pvDeferredSigs, const CSigHashCache* pSigHashCache)
 {
+    bool fResult;
+    if (VerifyStandardScript(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType, pvDeferredSigs, pSigHashCache, fResult))
+        return fResult;
+
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, pvDeferredSigs, pSigHashCache))
         return false;
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, pvDeferredSigs, pSigHashCache))
         return false;
     if (stack.empty())
         return false;
@@ -1505,7 +1584,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, pvDeferredSigs, pSigHashCache))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1520,6 +1599,7 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
+    txTo.ClearCache();
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
@@ -1739,6 +1819,14 @@ bool CScript::IsPayToScriptHash() const
             this->at(22) == OP_EQUAL);
 }
 
+bool CScript::IsPayToPubKeyHash() const
+{
+    // <20-byte public key hash> OP_CHECKSIG, see CScriptVisitor
+    return (this->size() == 22 &&
+            this->at(0) == 0x14 &&
+            this->at(21) == OP_CHECKSIG);
+}
+
 class CScriptVisitor : public boost::static_visitor<bool>
 {
 private:
@@ -530,6 +530,7 @@ public:
     unsigned int GetSigOpCount(const CScript& scriptSig) const;
 
     bool IsPayToScriptHash() const;
+    bool IsPayToPubKeyHash() const;
 
     // Called by CTransaction::IsStandard
     bool IsPushOnly() const
@@ -593,7 +594,34 @@ public:
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** Precomputed parts of the SIGHASH_ALL signature hashes of a transaction,
+ *  built once and shared by the script checks of all its inputs. Instead of
+ *  copying and re-serializing the whole transaction for every input, the
+ *  hash resumes from the state after the blanked inputs in front of it and
+ *  finishes with a buffer holding everything behind it. Other hash types
+ *  still go through SignatureHash().
+ */
+class CSigHashCache
+{
+private:
+    const CTransaction *ptxTo;
+    // Hash state after the version and the blanked inputs before input i
+    std::vector<CHashWriter> vPrefix;
+    // All inputs blanked, followed by the outputs and nLockTime
+    std::vector<unsigned char> vchTail;
+    // Where the part of vchTail behind input i starts
+    std::vector<unsigned int> vTailPos;
+
+public:
+    CSigHashCache(const CTransaction& txTo);
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+// If pvDeferredSigs is given, OP_CHECKSIG(VERIFY) signatures missing from the
+// signature cache are not checked but assumed valid and appended to it; the
+// result only holds if all of them pass VerifyCompactBatch afterwards.
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                std::vector<CCompactSigCheck>* pvDeferredSigs = NULL, const CSigHashCache* pSigHashCache = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -604,7 +632,8 @@ bool ExtractDestinationAndMine(const CKeyStore &keystore, const CScript& scriptP
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                  std::vector<CCompactSigCheck>* pvDeferredSigs = NULL, const CSigHashCache* pSigHashCache = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
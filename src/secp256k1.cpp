@@ -0,0 +1,984 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "secp256k1.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <boost/thread/once.hpp>
+
+// Arithmetic on secp256k1 for public key recovery. Everything here works on
+// public data, so nothing tries to run in constant time.
+
+namespace {
+
+// Numbers are four 64-bit limbs, least significant first
+static const int LIMBS = 4;
+
+// Field prime p = 2^256 - 2^32 - 977
+static const uint64_t P[LIMBS] = {
+    0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL
+};
+
+// 2^256 mod p
+static const uint64_t PC = 0x1000003D1ULL;
+
+// Group order n
+static const uint64_t N[LIMBS] = {
+    0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL
+};
+
+// 2^256 - n
+static const uint64_t NC[3] = {
+    0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 0x0000000000000001ULL
+};
+
+static const uint64_t GX[LIMBS] = {
+    0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL, 0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL
+};
+static const uint64_t GY[LIMBS] = {
+    0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL, 0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL
+};
+
+// The endomorphism (x, y) -> (beta * x, y) multiplies points by lambda
+static const uint64_t LAMBDA[LIMBS] = {
+    0xDF02967C1B23BD72ULL, 0x122E22EA20816678ULL, 0xA5261C028812645AULL, 0x5363AD4CC05C30E0ULL
+};
+static const uint64_t BETA[LIMBS] = {
+    0xC1396C28719501EEULL, 0x9CF0497512F58995ULL, 0x6E64479EAC3434E9ULL, 0x7AE96A2B657C0710ULL
+};
+
+// Constants for splitting a scalar k into k1 + k2 * lambda with k1 and k2
+// around 128 bits: -b1, -b2 and the rounded quotients g1 = 2^384 * b2 / n,
+// g2 = 2^384 * -b1 / n of the reduced lattice basis
+static const uint64_t MINUS_B1[LIMBS] = {
+    0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0, 0
+};
+static const uint64_t MINUS_B2[LIMBS] = {
+    0xD765CDA83DB1562CULL, 0x8A280AC50774346DULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL
+};
+static const uint64_t G1[LIMBS] = {
+    0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL
+};
+static const uint64_t G2[LIMBS] = {
+    0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL
+};
+
+// Low 64 bits of a * b + c + d; the high 64 bits go to hi. Cannot overflow.
+static inline uint64_t MulAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t& hi)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 t = (unsigned __int128)a * b + c + d;
+    hi = (uint64_t)(t >> 64);
+    return (uint64_t)t;
+#else
+    uint64_t al = (uint32_t)a, ah = a >> 32, bl = (uint32_t)b, bh = b >> 32;
+    uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    uint64_t lo = (mid << 32) | (uint32_t)ll;
+    uint64_t h = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    lo += c;
+    h += lo < c;
+    lo += d;
+    h += lo < d;
+    hi = h;
+    return lo;
+#endif
+}
+
+static int Cmp(const uint64_t* a, const uint64_t* b)
+{
+    for (int i = LIMBS - 1; i >= 0; i--)
+    {
+        if (a[i] < b[i])
+            return -1;
+        if (a[i] > b[i])
+            return 1;
+    }
+    return 0;
+}
+
+static bool IsZero(const uint64_t* a)
+{
+    return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+static uint64_t Add(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < LIMBS; i++)
+    {
+        uint64_t s = a[i] + c;
+        c = s < c;
+        r[i] = s + b[i];
+        c += r[i] < s;
+    }
+    return c;
+}
+
+static uint64_t Sub(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < LIMBS; i++)
+    {
+        uint64_t d = b[i] + c;
+        c = d < c;
+        c += a[i] < d;
+        r[i] = a[i] - d;
+    }
+    return c;
+}
+
+static void SetInt(uint64_t* r, uint64_t a)
+{
+    r[0] = a;
+    r[1] = r[2] = r[3] = 0;
+}
+
+static void ShiftRight(uint64_t* r, int n)
+{
+    for (int i = 0; i < LIMBS; i++)
+        r[i] = (r[i] >> n) | (i < LIMBS - 1 ? r[i + 1] << (64 - n) : 0);
+}
+
+static void SetBytes(uint64_t* r, const unsigned char* p32)
+{
+    for (int i = 0; i < LIMBS; i++)
+    {
+        const unsigned char* p = &p32[24 - 8 * i];
+        r[i] = 0;
+        for (int j = 0; j < 8; j++)
+            r[i] = (r[i] << 8) | p[j];
+    }
+}
+
+static void GetBytes(unsigned char* p32, const uint64_t* a)
+{
+    for (int i = 0; i < LIMBS; i++)
+    {
+        unsigned char* p = &p32[24 - 8 * i];
+        for (int j = 0; j < 8; j++)
+            p[j] = a[i] >> (56 - 8 * j);
+    }
+}
+
+// Add a * b to the three word accumulator (c0, c1, c2)
+static inline void MulAcc(uint64_t a, uint64_t b, uint64_t& c0, uint64_t& c1, uint64_t& c2)
+{
+    uint64_t hi;
+    c0 = MulAdd(a, b, c0, 0, hi);
+    c1 += hi;
+    c2 += c1 < hi;
+}
+
+// Full 256x256 -> 512 bit product, one column at a time
+static void Mul512(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    MulAcc(a[0], b[0], c0, c1, c2);
+    r[0] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(a[0], b[1], c0, c1, c2);
+    MulAcc(a[1], b[0], c0, c1, c2);
+    r[1] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(a[0], b[2], c0, c1, c2);
+    MulAcc(a[1], b[1], c0, c1, c2);
+    MulAcc(a[2], b[0], c0, c1, c2);
+    r[2] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(a[0], b[3], c0, c1, c2);
+    MulAcc(a[1], b[2], c0, c1, c2);
+    MulAcc(a[2], b[1], c0, c1, c2);
+    MulAcc(a[3], b[0], c0, c1, c2);
+    r[3] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(a[1], b[3], c0, c1, c2);
+    MulAcc(a[2], b[2], c0, c1, c2);
+    MulAcc(a[3], b[1], c0, c1, c2);
+    r[4] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(a[2], b[3], c0, c1, c2);
+    MulAcc(a[3], b[2], c0, c1, c2);
+    r[5] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(a[3], b[3], c0, c1, c2);
+    r[6] = c0;
+    r[7] = c1;
+}
+
+// Halve x modulo the odd number m
+static void HalveMod(uint64_t* x, const uint64_t* m)
+{
+    uint64_t c = 0;
+    if (x[0] & 1)
+        c = Add(x, x, m);
+    ShiftRight(x, 1);
+    x[LIMBS - 1] |= c << 63;
+}
+
+// Inverse of a modulo the odd number m by the binary extended Euclidean
+// algorithm; a must be non-zero and reduced
+static void InvMod(uint64_t* r, const uint64_t* a, const uint64_t* m)
+{
+    if (IsZero(a))
+    {
+        SetInt(r, 0);
+        return;
+    }
+    uint64_t u[LIMBS], v[LIMBS], x1[LIMBS], x2[LIMBS], one[LIMBS];
+    memcpy(u, a, sizeof(u));
+    memcpy(v, m, sizeof(v));
+    SetInt(x1, 1);
+    SetInt(x2, 0);
+    SetInt(one, 1);
+    while (Cmp(u, one) != 0 && Cmp(v, one) != 0)
+    {
+        while (!(u[0] & 1))
+        {
+            ShiftRight(u, 1);
+            HalveMod(x1, m);
+        }
+        while (!(v[0] & 1))
+        {
+            ShiftRight(v, 1);
+            HalveMod(x2, m);
+        }
+        if (Cmp(u, v) >= 0)
+        {
+            Sub(u, u, v);
+            if (Sub(x1, x1, x2))
+                Add(x1, x1, m);
+        }
+        else
+        {
+            Sub(v, v, u);
+            if (Sub(x2, x2, x1))
+                Add(x2, x2, m);
+        }
+    }
+    memcpy(r, Cmp(u, one) == 0 ? x1 : x2, LIMBS * sizeof(uint64_t));
+}
+
+//
+// Field elements, always fully reduced
+//
+
+struct fe
+{
+    uint64_t n[LIMBS];
+};
+
+static void FeSet(fe& r, const uint64_t* a)
+{
+    memcpy(r.n, a, sizeof(r.n));
+}
+
+static void FeSetInt(fe& r, uint64_t a)
+{
+    SetInt(r.n, a);
+}
+
+static bool FeIsZero(const fe& a)
+{
+    return IsZero(a.n);
+}
+
+static bool FeEqual(const fe& a, const fe& b)
+{
+    return memcmp(a.n, b.n, sizeof(a.n)) == 0;
+}
+
+static bool FeIsOdd(const fe& a)
+{
+    return a.n[0] & 1;
+}
+
+static void FeAdd(fe& r, const fe& a, const fe& b)
+{
+    if (Add(r.n, a.n, b.n) || Cmp(r.n, P) >= 0)
+        Sub(r.n, r.n, P);
+}
+
+static void FeSub(fe& r, const fe& a, const fe& b)
+{
+    if (Sub(r.n, a.n, b.n))
+        Add(r.n, r.n, P);
+}
+
+static void FeNeg(fe& r, const fe& a)
+{
+    if (FeIsZero(a))
+        r = a;
+    else
+        Sub(r.n, P, a.n);
+}
+
+// Reduce a 512 bit number modulo p, using 2^256 = PC (mod p)
+static void FeReduce(fe& r, const uint64_t* l)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < LIMBS; i++)
+        r.n[i] = MulAdd(l[LIMBS + i], PC, l[i], c, c);
+
+    // Fold the remaining top bits in the same way
+    r.n[0] = MulAdd(c, PC, r.n[0], 0, c);
+    for (int i = 1; i < LIMBS && c; i++)
+    {
+        r.n[i] += c;
+        c = r.n[i] < c;
+    }
+    if (c)
+    {
+        // The sum wrapped, which leaves a small value: add 2^256 mod p once more
+        r.n[0] += PC;
+        for (int i = 1; i < LIMBS && r.n[i - 1] < PC; i++)
+            if (++r.n[i])
+                break;
+    }
+    if (Cmp(r.n, P) >= 0)
+        Sub(r.n, r.n, P);
+}
+
+static void FeMul(fe& r, const fe& a, const fe& b)
+{
+    uint64_t l[2 * LIMBS];
+    Mul512(l, a.n, b.n);
+    FeReduce(r, l);
+}
+
+static void FeSqr(fe& r, const fe& a)
+{
+    FeMul(r, a, a);
+}
+
+// Exponentiation with a fixed 4-bit window
+static void FePow(fe& r, const fe& a, const uint64_t* e)
+{
+    fe table[16];
+    FeSetInt(table[0], 1);
+    for (int i = 1; i < 16; i++)
+        FeMul(table[i], table[i - 1], a);
+    fe acc = table[0];
+    for (int i = 63; i >= 0; i--)
+    {
+        for (int j = 0; j < 4; j++)
+            FeSqr(acc, acc);
+        int nDigit = (e[i / 16] >> (4 * (i % 16))) & 15;
+        if (nDigit)
+            FeMul(acc, acc, table[nDigit]);
+    }
+    r = acc;
+}
+
+static void FeInv(fe& r, const fe& a)
+{
+    InvMod(r.n, a.n, P);
+}
+
+// Square root, if there is one; p = 3 mod 4 so it is a^((p+1)/4)
+static bool FeSqrt(fe& r, const fe& a)
+{
+    uint64_t e[LIMBS], one[LIMBS];
+    SetInt(one, 1);
+    Add(e, P, one);
+    ShiftRight(e, 2);
+    fe s, check;
+    FePow(s, a, e);
+    FeSqr(check, s);
+    if (!FeEqual(check, a))
+        return false;
+    r = s;
+    return true;
+}
+
+//
+// Scalars modulo the group order
+//
+
+static void ScalarReduce(uint64_t* r, const uint64_t* l)
+{
+    // Fold with 2^256 = NC (mod n) until the high half is empty
+    uint64_t t[2 * LIMBS];
+    memcpy(t, l, sizeof(t));
+    while (!IsZero(&t[LIMBS]))
+    {
+        uint64_t u[2 * LIMBS];
+        memcpy(u, t, LIMBS * sizeof(uint64_t));
+        memset(&u[LIMBS], 0, LIMBS * sizeof(uint64_t));
+        for (int i = 0; i < LIMBS; i++)
+        {
+            if (!t[LIMBS + i])
+                continue;
+            uint64_t c = 0;
+            int k = i;
+            for (int j = 0; j < 3; j++, k++)
+                u[k] = MulAdd(t[LIMBS + i], NC[j], u[k], c, c);
+            for (; c && k < 2 * LIMBS; k++)
+            {
+                u[k] += c;
+                c = u[k] < c;
+            }
+        }
+        memcpy(t, u, sizeof(t));
+    }
+    while (Cmp(t, N) >= 0)
+        Sub(t, t, N);
+    memcpy(r, t, LIMBS * sizeof(uint64_t));
+}
+
+static void ScalarMul(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint64_t l[2 * LIMBS];
+    Mul512(l, a, b);
+    ScalarReduce(r, l);
+}
+
+static void ScalarInv(uint64_t* r, const uint64_t* a)
+{
+    InvMod(r, a, N);
+}
+
+static void ScalarNeg(uint64_t* r, const uint64_t* a)
+{
+    if (IsZero(a))
+        SetInt(r, 0);
+    else
+        Sub(r, N, a);
+}
+
+static void ScalarAdd(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    if (Add(r, a, b) || Cmp(r, N) >= 0)
+        Sub(r, r, N);
+}
+
+// Whether a is above n / 2, so its negation is the shorter number
+static bool ScalarIsHigh(const uint64_t* a)
+{
+    uint64_t half[LIMBS];
+    memcpy(half, N, sizeof(half));
+    ShiftRight(half, 1);
+    return Cmp(a, half) > 0;
+}
+
+// Rounded (a * b) >> 384
+static void MulShift384(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint64_t l[2 * LIMBS], round[LIMBS];
+    Mul512(l, a, b);
+    r[0] = l[6];
+    r[1] = l[7];
+    r[2] = r[3] = 0;
+    SetInt(round, l[5] >> 63);
+    Add(r, r, round);
+}
+
+// Split k into k1 + k2 * lambda (mod n)
+static void ScalarSplitLambda(uint64_t* k1, uint64_t* k2, const uint64_t* k)
+{
+    uint64_t c1[LIMBS], c2[LIMBS], minusLambda[LIMBS];
+    MulShift384(c1, k, G1);
+    MulShift384(c2, k, G2);
+    ScalarMul(c1, c1, MINUS_B1);
+    ScalarMul(c2, c2, MINUS_B2);
+    ScalarAdd(k2, c1, c2);
+    ScalarNeg(minusLambda, LAMBDA);
+    ScalarMul(k1, k2, minusLambda);
+    ScalarAdd(k1, k1, k);
+}
+
+//
+// Points: affine (ge) and Jacobian (gej), with y^2 = x^3 + 7
+//
+
+struct ge
+{
+    fe x, y;
+    bool fInfinity;
+};
+
+struct gej
+{
+    fe x, y, z;
+    bool fInfinity;
+};
+
+static void GejSetInfinity(gej& r)
+{
+    r.fInfinity = true;
+}
+
+static void GejSetGe(gej& r, const ge& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    FeSetInt(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+static void GejDouble(gej& r, const gej& a)
+{
+    if (a.fInfinity || FeIsZero(a.y))
+    {
+        GejSetInfinity(r);
+        return;
+    }
+    fe A, B, C, D, E, F, t;
+    FeSqr(A, a.x);
+    FeSqr(B, a.y);
+    FeSqr(C, B);
+    // D = 2 * ((X + B)^2 - A - C)
+    FeAdd(t, a.x, B);
+    FeSqr(t, t);
+    FeSub(t, t, A);
+    FeSub(t, t, C);
+    FeAdd(D, t, t);
+    // E = 3 * A, F = E^2
+    FeAdd(E, A, A);
+    FeAdd(E, E, A);
+    FeSqr(F, E);
+    // Z3 = 2 * Y * Z, computed first in case r aliases a
+    FeMul(t, a.y, a.z);
+    FeAdd(r.z, t, t);
+    // X3 = F - 2 * D
+    FeSub(r.x, F, D);
+    FeSub(r.x, r.x, D);
+    // Y3 = E * (D - X3) - 8 * C
+    FeSub(t, D, r.x);
+    FeMul(t, E, t);
+    FeAdd(C, C, C);
+    FeAdd(C, C, C);
+    FeAdd(C, C, C);
+    FeSub(r.y, t, C);
+    r.fInfinity = false;
+}
+
+static void GejAdd(gej& r, const gej& a, const gej& b)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    fe z1z1, z2z2, u1, u2, s1, s2, h, rr, t;
+    FeSqr(z1z1, a.z);
+    FeSqr(z2z2, b.z);
+    FeMul(u1, a.x, z2z2);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s1, a.y, b.z);
+    FeMul(s1, s1, z2z2);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    FeSub(h, u2, u1);
+    FeSub(rr, s2, s1);
+    if (FeIsZero(h))
+    {
+        if (FeIsZero(rr))
+            GejDouble(r, a);
+        else
+            GejSetInfinity(r);
+        return;
+    }
+    fe h2, h3, u1h2;
+    FeSqr(h2, h);
+    FeMul(h3, h, h2);
+    FeMul(u1h2, u1, h2);
+    FeMul(t, a.z, b.z);
+    FeMul(r.z, t, h);
+    // X3 = R^2 - H^3 - 2 * U1 * H^2
+    FeSqr(r.x, rr);
+    FeSub(r.x, r.x, h3);
+    FeSub(r.x, r.x, u1h2);
+    FeSub(r.x, r.x, u1h2);
+    // Y3 = R * (U1 * H^2 - X3) - S1 * H^3
+    FeSub(t, u1h2, r.x);
+    FeMul(t, rr, t);
+    FeMul(s1, s1, h3);
+    FeSub(r.y, t, s1);
+    r.fInfinity = false;
+}
+
+// Add an affine point, saving the multiplications by its z = 1
+static void GejAddGe(gej& r, const gej& a, const ge& b)
+{
+    if (a.fInfinity)
+    {
+        GejSetGe(r, b);
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    fe z1z1, u2, s2, h, rr, t;
+    FeSqr(z1z1, a.z);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    FeSub(h, u2, a.x);
+    FeSub(rr, s2, a.y);
+    if (FeIsZero(h))
+    {
+        if (FeIsZero(rr))
+            GejDouble(r, a);
+        else
+            GejSetInfinity(r);
+        return;
+    }
+    fe h2, h3, u1h2, y1 = a.y;
+    FeSqr(h2, h);
+    FeMul(h3, h, h2);
+    FeMul(u1h2, a.x, h2);
+    FeMul(r.z, a.z, h);
+    FeSqr(r.x, rr);
+    FeSub(r.x, r.x, h3);
+    FeSub(r.x, r.x, u1h2);
+    FeSub(r.x, r.x, u1h2);
+    FeSub(t, u1h2, r.x);
+    FeMul(t, rr, t);
+    FeMul(y1, y1, h3);
+    FeSub(r.y, t, y1);
+    r.fInfinity = false;
+}
+
+// Convert many points to affine coordinates with a single field inversion
+static void GeSetAllGej(ge* r, const gej* a, size_t n)
+{
+    std::vector<fe> vProd(n);
+    fe acc;
+    FeSetInt(acc, 1);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!a[i].fInfinity)
+            FeMul(acc, acc, a[i].z);
+        vProd[i] = acc;
+    }
+    fe inv;
+    FeInv(inv, acc);
+    for (size_t i = n; i-- > 0; )
+    {
+        if (a[i].fInfinity)
+        {
+            r[i].fInfinity = true;
+            continue;
+        }
+        // inv is now 1 / (z_0 * ... * z_i)
+        fe zi, zi2, zi3;
+        if (i > 0)
+            FeMul(zi, inv, vProd[i - 1]);
+        else
+            zi = inv;
+        FeMul(inv, inv, a[i].z);
+        FeSqr(zi2, zi);
+        FeMul(zi3, zi2, zi);
+        FeMul(r[i].x, a[i].x, zi2);
+        FeMul(r[i].y, a[i].y, zi3);
+        r[i].fInfinity = false;
+    }
+}
+
+//
+// Multiplication
+//
+
+// The generator table holds j * 16^i * G for every 4-bit window i and digit
+// j, so multiplying G costs one mixed addition per non-zero window and no
+// doublings. It is 64 * 15 affine points, about 60KB, built on first use.
+static const int G_WINDOWS = 64;
+static const int G_DIGITS = 16;
+static ge (*pGeneratorTable)[G_DIGITS] = NULL;
+static boost::once_flag generatorTableOnce = BOOST_ONCE_INIT;
+
+static void BuildGeneratorTable()
+{
+    std::vector<gej> vPoints(G_WINDOWS * G_DIGITS);
+    gej base;
+    base.fInfinity = false;
+    FeSet(base.x, GX);
+    FeSet(base.y, GY);
+    FeSetInt(base.z, 1);
+    for (int i = 0; i < G_WINDOWS; i++)
+    {
+        gej* row = &vPoints[i * G_DIGITS];
+        GejSetInfinity(row[0]);
+        row[1] = base;
+        for (int j = 2; j < G_DIGITS; j++)
+            GejAdd(row[j], row[j - 1], base);
+        for (int k = 0; k < 4; k++)
+            GejDouble(base, base);
+    }
+    ge (*table)[G_DIGITS] = new ge[G_WINDOWS][G_DIGITS];
+    GeSetAllGej(&table[0][0], &vPoints[0], vPoints.size());
+    pGeneratorTable = table;
+}
+
+// r = k * G
+static void MulGenerator(gej& r, const uint64_t* k)
+{
+    boost::call_once(BuildGeneratorTable, generatorTableOnce);
+    GejSetInfinity(r);
+    for (int i = 0; i < G_WINDOWS; i++)
+    {
+        int nDigit = (k[i / 16] >> (4 * (i % 16))) & 15;
+        if (nDigit)
+            GejAddGe(r, r, pGeneratorTable[i][nDigit]);
+    }
+}
+
+// Width-5 non-adjacent form: digits are zero or odd in [-15, 15], and any
+// non-zero digit is followed by at least four zeros
+static const int WNAF_WINDOW = 5;
+
+static int ComputeWNAF(int* wnaf, const uint64_t* a)
+{
+    uint64_t k[LIMBS];
+    memcpy(k, a, sizeof(k));
+    int nLen = 0;
+    while (!IsZero(k))
+    {
+        int nDigit = 0;
+        if (k[0] & 1)
+        {
+            nDigit = k[0] & ((1 << WNAF_WINDOW) - 1);
+            if (nDigit >= (1 << (WNAF_WINDOW - 1)))
+                nDigit -= (1 << WNAF_WINDOW);
+            uint64_t d[LIMBS];
+            if (nDigit > 0)
+            {
+                SetInt(d, nDigit);
+                Sub(k, k, d);
+            }
+            else
+            {
+                SetInt(d, -nDigit);
+                Add(k, k, d);
+            }
+        }
+        wnaf[nLen++] = nDigit;
+        ShiftRight(k, 1);
+    }
+    return nLen;
+}
+
+// Add digit * table point, where table holds the odd multiples in affine
+// coordinates and the point is negated if fNegate is set
+static void GejAddDigit(gej& r, const ge* table, int nDigit, bool fNegate)
+{
+    if (nDigit == 0)
+        return;
+    const ge& p = table[(abs(nDigit) - 1) / 2];
+    if ((nDigit < 0) == fNegate)
+    {
+        GejAddGe(r, r, p);
+    }
+    else
+    {
+        ge neg = p;
+        FeNeg(neg.y, p.y);
+        GejAddGe(r, r, neg);
+    }
+}
+
+// Odd multiples a, 3a, 5a, ..., 15a used by MulDouble
+static const int TABLE_SIZE = 1 << (WNAF_WINDOW - 2);
+
+static void BuildOddMultiples(gej* table, const ge& a)
+{
+    gej a2;
+    GejSetGe(table[0], a);
+    GejDouble(a2, table[0]);
+    for (int i = 1; i < TABLE_SIZE; i++)
+        GejAdd(table[i], table[i - 1], a2);
+}
+
+// r = na * a + ng * G, with table the affine odd multiples of a
+static void MulDouble(gej& r, const ge* table, const uint64_t* na, const uint64_t* ng)
+{
+    // lambda * (x, y) = (beta * x, y)
+    ge tableLambda[TABLE_SIZE];
+    fe beta;
+    FeSet(beta, BETA);
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        tableLambda[i] = table[i];
+        FeMul(tableLambda[i].x, table[i].x, beta);
+    }
+
+    // na = n1 + n2 * lambda, with n1 and n2 half as long as na, so the
+    // two halves share half as many doublings
+    uint64_t n1[LIMBS], n2[LIMBS];
+    ScalarSplitLambda(n1, n2, na);
+    bool fNeg1 = ScalarIsHigh(n1);
+    bool fNeg2 = ScalarIsHigh(n2);
+    if (fNeg1)
+        ScalarNeg(n1, n1);
+    if (fNeg2)
+        ScalarNeg(n2, n2);
+
+    int wnaf1[257], wnaf2[257];
+    int nLen1 = ComputeWNAF(wnaf1, n1);
+    int nLen2 = ComputeWNAF(wnaf2, n2);
+
+    GejSetInfinity(r);
+    for (int i = std::max(nLen1, nLen2) - 1; i >= 0; i--)
+    {
+        GejDouble(r, r);
+        if (i < nLen1)
+            GejAddDigit(r, table, wnaf1[i], fNeg1);
+        if (i < nLen2)
+            GejAddDigit(r, tableLambda, wnaf2[i], fNeg2);
+    }
+
+    gej g;
+    MulGenerator(g, ng);
+    GejAdd(r, r, g);
+}
+
+// Per-signature state of a batch recovery
+struct RecoverState
+{
+    bool fOk;
+    ge R;
+    uint64_t rn[LIMBS], s[LIMBS], e[LIMBS];
+};
+
+// Follows ECDSA_SIG_recover_key_GFp in key.cpp up to the point where r has
+// to be inverted, including its handling of out of range r and s
+static bool RecoverPrepare(RecoverState& st, const uint256& hash, const unsigned char* p64, int rec)
+{
+    if (rec < 0 || rec >= 3)
+        return false;
+
+    uint64_t r[LIMBS];
+    SetBytes(r, &p64[0]);
+    SetBytes(st.s, &p64[32]);
+    SetBytes(st.e, hash.begin());
+
+    // x = r + (rec / 2) * n must be a field element
+    uint64_t x[LIMBS];
+    memcpy(x, r, sizeof(x));
+    if (rec / 2 && Add(x, x, N))
+        return false;
+    if (Cmp(x, P) >= 0)
+        return false;
+
+    // Decompress R, picking y by its parity
+    FeSet(st.R.x, x);
+    fe rhs, seven;
+    FeSqr(rhs, st.R.x);
+    FeMul(rhs, rhs, st.R.x);
+    FeSetInt(seven, 7);
+    FeAdd(rhs, rhs, seven);
+    if (!FeSqrt(st.R.y, rhs))
+        return false;
+    if (FeIsOdd(st.R.y) != (rec % 2 == 1))
+    {
+        if (FeIsZero(st.R.y))
+            return false;
+        FeNeg(st.R.y, st.R.y);
+    }
+    st.R.fInfinity = false;
+
+    memcpy(st.rn, r, sizeof(st.rn));
+    if (Cmp(st.rn, N) >= 0)
+        Sub(st.rn, st.rn, N);
+    if (IsZero(st.rn))
+        return false;
+    if (Cmp(st.s, N) >= 0)
+        Sub(st.s, st.s, N);
+    if (Cmp(st.e, N) >= 0)
+        Sub(st.e, st.e, N);
+    return true;
+}
+
+} // anonymous namespace
+
+bool Secp256k1RecoverCompact(const uint256& hash, const unsigned char* p64, int rec, unsigned char pubkey[33])
+{
+    const unsigned char* pp64 = p64;
+    char fValid;
+    Secp256k1RecoverCompactBatch(1, &hash, &pp64, &rec, (unsigned char (*)[33])pubkey, &fValid);
+    return fValid != 0;
+}
+
+void Secp256k1RecoverCompactBatch(size_t n, const uint256* hashes, const unsigned char* const* p64s, const int* recs,
+                                  unsigned char (*pubkeys)[33], char* fValid)
+{
+    if (n == 0)
+        return;
+
+    std::vector<RecoverState> vState(n);
+    for (size_t i = 0; i < n; i++)
+        vState[i].fOk = RecoverPrepare(vState[i], hashes[i], p64s[i], recs[i]);
+
+    // Invert every r with a single inversion (Montgomery's trick): invert
+    // the product of all of them, then peel the factors off one by one
+    std::vector<uint64_t> vProd(n * LIMBS);
+    uint64_t acc[LIMBS], inv[LIMBS];
+    SetInt(acc, 1);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (vState[i].fOk)
+            ScalarMul(acc, acc, vState[i].rn);
+        memcpy(&vProd[i * LIMBS], acc, sizeof(acc));
+    }
+    ScalarInv(inv, acc);
+    for (size_t i = n; i-- > 0; )
+    {
+        RecoverState& st = vState[i];
+        if (!st.fOk)
+            continue;
+        // inv is now 1 / (r_0 * ... * r_i)
+        uint64_t rinv[LIMBS];
+        if (i > 0)
+            ScalarMul(rinv, inv, &vProd[(i - 1) * LIMBS]);
+        else
+            memcpy(rinv, inv, sizeof(rinv));
+        ScalarMul(inv, inv, st.rn);
+        // u2 = s / r is kept in s, u1 = -e / r in e
+        ScalarMul(st.s, st.s, rinv);
+        ScalarMul(st.e, st.e, rinv);
+        ScalarNeg(st.e, st.e);
+    }
+
+    // The odd multiples of every R, converted to affine coordinates together
+    // so the main loops can use the cheaper mixed additions
+    std::vector<gej> vTable(n * TABLE_SIZE);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (vState[i].fOk)
+            BuildOddMultiples(&vTable[i * TABLE_SIZE], vState[i].R);
+        else
+            for (int j = 0; j < TABLE_SIZE; j++)
+                GejSetInfinity(vTable[i * TABLE_SIZE + j]);
+    }
+    std::vector<ge> vTableAffine(n * TABLE_SIZE);
+    GeSetAllGej(&vTableAffine[0], &vTable[0], vTable.size());
+
+    // Q = (s / r) * R - (e / r) * G
+    std::vector<gej> vQ(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (vState[i].fOk)
+            MulDouble(vQ[i], &vTableAffine[i * TABLE_SIZE], vState[i].s, vState[i].e);
+        else
+            GejSetInfinity(vQ[i]);
+    }
+    std::vector<ge> vQAffine(n);
+    GeSetAllGej(&vQAffine[0], &vQ[0], n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const ge& Q = vQAffine[i];
+        fValid[i] = vState[i].fOk && !Q.fInfinity;
+        if (!fValid[i])
+            continue;
+        pubkeys[i][0] = FeIsOdd(Q.y) ? 0x03 : 0x02;
+        GetBytes(&pubkeys[i][1], Q.x.n);
+    }
+}
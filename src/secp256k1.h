@@ -0,0 +1,26 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SECP256K1_H
+#define BITCOIN_SECP256K1_H
+
+#include "uint256.h"
+
+/** Recover the public key from a compact signature (see CKey::SignCompact)
+ * using native secp256k1 arithmetic instead of OpenSSL.
+ * p64 holds r and s, rec is the recovery id taken from the header byte.
+ * On success the compressed public key is written to pubkey.
+ * Accepts exactly the signatures the OpenSSL implementation accepts.
+ */
+bool Secp256k1RecoverCompact(const uint256& hash, const unsigned char* p64, int rec, unsigned char pubkey[33]);
+
+/** Recover the public keys of n compact signatures at once. The result is
+ * the same as calling Secp256k1RecoverCompact on each of them: fValid[i]
+ * is nonzero if pubkeys[i] was recovered. The modular inversions of the
+ * whole batch are shared (Montgomery's trick), so this is cheaper per
+ * signature than recovering them one by one.
+ */
+void Secp256k1RecoverCompactBatch(size_t n, const uint256* hashes, const unsigned char* const* p64s, const int* recs,
+                                  unsigned char (*pubkeys)[33], char* fValid);
+
+#endif // BITCOIN_SECP256K1_H
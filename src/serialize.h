@@ -27,6 +27,8 @@ typedef unsigned long long  uint64;
 
 class CScript;
 class CDataStream;
+class CDataStreamView;
+template<typename Stream> class CReuseStream;
 class CAutoFile;
 static const unsigned int MAX_SIZE = 0x02000000;
 
@@ -381,6 +383,8 @@ template<typename Stream, typename T, typename A> inline void Serialize(Stream&
 template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const boost::true_type&);
 template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const boost::false_type&);
 template<typename Stream, typename T, typename A> inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion);
+template<typename T, typename A> void Unserialize_impl(CDataStreamView& is, std::vector<T, A>& v, int nType, int nVersion, const boost::true_type&);
+template<typename Stream, typename T, typename A> void Unserialize_impl(CReuseStream<Stream>& is, std::vector<T, A>& v, int nType, int nVersion, const boost::false_type&);
 
 // others derived from vector
 extern inline unsigned int GetSerializeSize(const CScript& v, int nType, int nVersion);
@@ -1099,6 +1103,225 @@ public:
 
 
 
+/** Read-only stream over a buffer owned by someone else, such as a received
+ * network message. Reading from it is like reading from a CDataStream, but
+ * nothing is copied until the data reaches the objects being deserialized.
+ * The buffer must outlive the view.
+ */
+class CDataStreamView
+{
+protected:
+    const char* pbegin;
+    const char* pend;
+    short state;
+    short exceptmask;
+public:
+    int nType;
+    int nVersion;
+
+    CDataStreamView(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn)
+    {
+        Init(pbeginIn, pendIn, nTypeIn, nVersionIn);
+    }
+
+    CDataStreamView(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn)
+    {
+        const char* p = vchIn.empty() ? NULL : &vchIn[0];
+        Init(p, p + vchIn.size(), nTypeIn, nVersionIn);
+    }
+
+    void Init(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn)
+    {
+        assert(pendIn >= pbeginIn);
+        pbegin = pbeginIn;
+        pend = pendIn;
+        nType = nTypeIn;
+        nVersion = nVersionIn;
+        state = 0;
+        exceptmask = std::ios::badbit | std::ios::failbit;
+    }
+
+    //
+    // Vector subset
+    //
+    const char* begin() const                       { return pbegin; }
+    const char* end() const                         { return pend; }
+    size_t size() const                             { return pend - pbegin; }
+    bool empty() const                              { return pend == pbegin; }
+    const char& operator[](size_t pos) const        { return pbegin[pos]; }
+
+    //
+    // Stream subset
+    //
+    void setstate(short bits, const char* psz)
+    {
+        state |= bits;
+        if (state & exceptmask)
+            throw std::ios_base::failure(psz);
+    }
+
+    bool eof() const             { return size() == 0; }
+    bool fail() const            { return state & (std::ios::badbit | std::ios::failbit); }
+    bool good() const            { return !eof() && (state == 0); }
+    void clear(short n)          { state = n; }
+    short exceptions()           { return exceptmask; }
+    short exceptions(short mask) { short prev = exceptmask; exceptmask = mask; setstate(0, "CDataStreamView"); return prev; }
+    int in_avail()               { return size(); }
+
+    void SetType(int n)          { nType = n; }
+    int GetType()                { return nType; }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion()             { return nVersion; }
+    void ReadVersion()           { *this >> nVersion; }
+
+    /** Hand out the next nSize bytes without copying them. Returns NULL and
+     *  sets the fail state if there aren't that many left. */
+    const char* consume(unsigned int nSize)
+    {
+        if (nSize > size())
+        {
+            pbegin = pend;
+            setstate(std::ios::failbit, "CDataStreamView::read() : end of data");
+            return NULL;
+        }
+        const char* p = pbegin;
+        pbegin += nSize;
+        return p;
+    }
+
+    CDataStreamView& read(char* pch, int nSize)
+    {
+        assert(nSize >= 0);
+        unsigned int nAvail = size();
+        const char* p = consume(nSize);
+        if (p == NULL)
+        {
+            memset(pch, 0, nSize);
+            p = pbegin - nAvail;
+            nSize = nAvail;
+        }
+        if (nSize > 0)
+            memcpy(pch, p, nSize);
+        return (*this);
+    }
+
+    CDataStreamView& ignore(int nSize)
+    {
+        assert(nSize >= 0);
+        consume(nSize);
+        return (*this);
+    }
+
+    template<typename T>
+    CDataStreamView& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+template<typename T, typename A>
+void Unserialize_impl(CDataStreamView& is, std::vector<T, A>& v, int nType, int nVersion, const boost::true_type&)
+{
+    // Everything is already in memory, so a bogus size can't make us
+    // allocate more than the remaining message; copy straight from it.
+    unsigned int nSize = ReadCompactSize(is);
+    unsigned int nAvail = is.size();
+    const char* p = is.consume(nSize <= nAvail / sizeof(T) ? nSize * sizeof(T) : nAvail + 1);
+    if (p == NULL)
+        v.clear();
+    else if (sizeof(T) == 1)
+        v.assign((const T*)p, (const T*)p + nSize);
+    else
+    {
+        v.resize(nSize);
+        if (nSize > 0)
+            memcpy(&v[0], p, nSize * sizeof(T));
+    }
+}
+
+
+
+
+
+
+
+
+
+
+/** Reads from another stream, but deserializes vectors of objects into the
+ * elements that are already there instead of destroying them and building
+ * new ones. The vectors and scripts inside those elements keep their
+ * memory, so decoding one block after another into the same CBlock stops
+ * allocating once it has seen the largest block, rather than making a
+ * couple of allocations per input, output and script. Every serialized
+ * field is overwritten; memory-only members of the reused objects are not
+ * reset, so only use this for types that are fully described by their
+ * serialization (see CBlock::UnserializeReusing).
+ */
+template<typename Stream>
+class CReuseStream
+{
+protected:
+    Stream& stream;
+public:
+    int nType;
+    int nVersion;
+
+    explicit CReuseStream(Stream& streamIn) : stream(streamIn), nType(streamIn.nType), nVersion(streamIn.nVersion)
+    {
+    }
+
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CReuseStream& read(char* pch, size_t nSize)
+    {
+        stream.read(pch, nSize);
+        return (*this);
+    }
+
+    template<typename T>
+    CReuseStream& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+template<typename Stream, typename T, typename A>
+void Unserialize_impl(CReuseStream<Stream>& is, std::vector<T, A>& v, int nType, int nVersion, const boost::false_type&)
+{
+    unsigned int nSize = ReadCompactSize(is);
+    if (v.size() > nSize)
+        v.resize(nSize);
+    // Grow in steps like the generic version, so a bogus size fails on
+    // missing data before it makes us allocate a lot
+    unsigned int i = 0;
+    unsigned int nMid = 0;
+    while (nMid < nSize)
+    {
+        nMid += 5000000 / sizeof(T);
+        if (nMid > nSize)
+            nMid = nSize;
+        if (v.size() < nMid)
+            v.resize(nMid);
+        for (; i < nMid; i++)
+            Unserialize(is, v[i], nType, nVersion);
+    }
+}
+
+
+
+
+
+
+
+
+
+
 /** Out stream writting to the buffer with known size.
  */
 template<unsigned int N>
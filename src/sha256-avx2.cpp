@@ -0,0 +1,34 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Built with -mavx2; without it this file only provides a stub that
+// SHA256AutoDetect never selects.
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include "sha256_multiway.h"
+#endif
+
+namespace sha256_avx2
+{
+#if defined(__AVX2__)
+extern const bool fCompiled = true;
+
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+
+void TransformD64_8way(unsigned char* out, const unsigned char* in)
+{
+    MultiwayTransformD64<v8u32, 8>(out, in);
+}
+#else
+extern const bool fCompiled = false;
+
+void TransformD64_8way(unsigned char* out, const unsigned char* in)
+{
+    assert(!"sha256-avx2.cpp was built without AVX2");
+}
+#endif
+}
@@ -0,0 +1,161 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Built with -msse4.1 -msha; without them this file only provides a stub
+// that SHA256AutoDetect never selects.
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+namespace sha256_shani
+{
+#if defined(__SHA__) && defined(__SSE4_1__)
+extern const bool fCompiled = true;
+
+namespace
+{
+
+const uint32_t K[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// SHA256(SHA256(x)) for 64-byte x: the block after the input is always
+// this padding, and the second hash always ends with this one
+const unsigned char pchPad64[64] = { 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0 };
+const unsigned char pchPad32[32] = { 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0 };
+
+/** Four rounds on each of two states. g is the group of rounds, known at
+ *  compile time so the branches and array indexes go away. */
+template<int g>
+inline void Rounds(__m128i* s0, __m128i* s1, __m128i (*w)[4], const unsigned char* const* p)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i k = _mm_load_si128((const __m128i*)&K[4 * g]);
+    for (int l = 0; l < 2; l++)
+    {
+        __m128i& wg = w[l][g % 4];
+        if (g < 4)
+            wg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p[l] + 16 * g)), MASK);
+        __m128i msg = _mm_add_epi32(wg, k);
+        s1[l] = _mm_sha256rnds2_epu32(s1[l], s0[l], msg);
+        if (g >= 3 && g < 15)
+        {
+            // message words for the next group of four rounds
+            __m128i& wn = w[l][(g + 1) % 4];
+            wn = _mm_add_epi32(wn, _mm_alignr_epi8(wg, w[l][(g + 3) % 4], 4));
+            wn = _mm_sha256msg2_epu32(wn, wg);
+        }
+        msg = _mm_shuffle_epi32(msg, 0x0E);
+        s0[l] = _mm_sha256rnds2_epu32(s0[l], s1[l], msg);
+        if (g >= 1 && g < 13)
+            w[l][(g + 3) % 4] = _mm_sha256msg1_epu32(w[l][(g + 3) % 4], wg);
+    }
+}
+
+/** Compress one 64-byte block into each of two states, interleaving the
+ *  instructions of the two so they hide each other's latency. States are
+ *  kept in the ABEF/CDGH order the SHA instructions work on. */
+inline void Transform2(__m128i* abef, __m128i* cdgh, const unsigned char* p0, const unsigned char* p1)
+{
+    const unsigned char* p[2] = { p0, p1 };
+    __m128i s0[2] = { abef[0], abef[1] };
+    __m128i s1[2] = { cdgh[0], cdgh[1] };
+    __m128i w[2][4];
+
+    Rounds<0>(s0, s1, w, p);
+    Rounds<1>(s0, s1, w, p);
+    Rounds<2>(s0, s1, w, p);
+    Rounds<3>(s0, s1, w, p);
+    Rounds<4>(s0, s1, w, p);
+    Rounds<5>(s0, s1, w, p);
+    Rounds<6>(s0, s1, w, p);
+    Rounds<7>(s0, s1, w, p);
+    Rounds<8>(s0, s1, w, p);
+    Rounds<9>(s0, s1, w, p);
+    Rounds<10>(s0, s1, w, p);
+    Rounds<11>(s0, s1, w, p);
+    Rounds<12>(s0, s1, w, p);
+    Rounds<13>(s0, s1, w, p);
+    Rounds<14>(s0, s1, w, p);
+    Rounds<15>(s0, s1, w, p);
+
+    for (int l = 0; l < 2; l++)
+    {
+        abef[l] = _mm_add_epi32(abef[l], s0[l]);
+        cdgh[l] = _mm_add_epi32(cdgh[l], s1[l]);
+    }
+}
+
+inline void LoadIV(__m128i& abef, __m128i& cdgh)
+{
+    __m128i dcba = _mm_loadu_si128((const __m128i*)&IV[0]);
+    __m128i hgfe = _mm_loadu_si128((const __m128i*)&IV[4]);
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    abef = _mm_alignr_epi8(cdab, efgh, 8);
+    cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+}
+
+/** Write the state as the 32-byte big endian digest */
+inline void StoreDigest(unsigned char* out, __m128i abef, __m128i cdgh)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    __m128i dcba = _mm_blend_epi16(feba, dchg, 0xF0);
+    __m128i hgfe = _mm_alignr_epi8(dchg, feba, 8);
+    _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(dcba, MASK));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_shuffle_epi8(hgfe, MASK));
+}
+
+}
+
+void TransformD64_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i abef[2], cdgh[2];
+    LoadIV(abef[0], cdgh[0]);
+    LoadIV(abef[1], cdgh[1]);
+    Transform2(abef, cdgh, in, in + 64);
+    Transform2(abef, cdgh, pchPad64, pchPad64);
+
+    unsigned char buf[2][64];
+    for (int l = 0; l < 2; l++)
+    {
+        StoreDigest(buf[l], abef[l], cdgh[l]);
+        memcpy(buf[l] + 32, pchPad32, 32);
+        LoadIV(abef[l], cdgh[l]);
+    }
+    Transform2(abef, cdgh, buf[0], buf[1]);
+    StoreDigest(out, abef[0], cdgh[0]);
+    StoreDigest(out + 32, abef[1], cdgh[1]);
+}
+#else
+extern const bool fCompiled = false;
+
+void TransformD64_2way(unsigned char* out, const unsigned char* in)
+{
+    assert(!"sha256-shani.cpp was built without SHA-NI");
+}
+#endif
+}
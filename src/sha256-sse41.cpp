@@ -0,0 +1,34 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Built with -msse4.1; without it this file only provides a stub that
+// SHA256AutoDetect never selects.
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__SSE4_1__)
+#include "sha256_multiway.h"
+#endif
+
+namespace sha256_sse41
+{
+#if defined(__SSE4_1__)
+extern const bool fCompiled = true;
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+
+void TransformD64_4way(unsigned char* out, const unsigned char* in)
+{
+    MultiwayTransformD64<v4u32, 4>(out, in);
+}
+#else
+extern const bool fCompiled = false;
+
+void TransformD64_4way(unsigned char* out, const unsigned char* in)
+{
+    assert(!"sha256-sse41.cpp was built without SSE4.1");
+}
+#endif
+}
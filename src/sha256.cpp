@@ -0,0 +1,147 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+#include "hash.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// The SIMD kernels, each in a file built for its instruction set. A file
+// built without the needed compiler flags only has a stub and says so in
+// fCompiled.
+namespace sha256_sse41
+{
+extern const bool fCompiled;
+void TransformD64_4way(unsigned char* out, const unsigned char* in);
+}
+namespace sha256_avx2
+{
+extern const bool fCompiled;
+void TransformD64_8way(unsigned char* out, const unsigned char* in);
+}
+namespace sha256_shani
+{
+extern const bool fCompiled;
+void TransformD64_2way(unsigned char* out, const unsigned char* in);
+}
+
+namespace
+{
+
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    uint256 hash = Hash(in, in + 64);
+    memcpy(out, hash.begin(), 32);
+}
+
+typedef void (*TransformD64Multi)(unsigned char* out, const unsigned char* in);
+
+// Set once by SHA256AutoDetect
+TransformD64Multi TransformD64_2way = NULL;
+TransformD64Multi TransformD64_4way = NULL;
+TransformD64Multi TransformD64_8way = NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+bool AVXEnabledByOS()
+{
+    // The OS has to save the YMM registers on context switches (XCR0 bits 1 and 2)
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks)
+{
+    if (TransformD64_8way)
+    {
+        while (nBlocks >= 8)
+        {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            nBlocks -= 8;
+        }
+    }
+    if (TransformD64_4way)
+    {
+        while (nBlocks >= 4)
+        {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            nBlocks -= 4;
+        }
+    }
+    if (TransformD64_2way)
+    {
+        while (nBlocks >= 2)
+        {
+            TransformD64_2way(out, in);
+            out += 64;
+            in += 128;
+            nBlocks -= 2;
+        }
+    }
+    while (nBlocks > 0)
+    {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        nBlocks -= 1;
+    }
+}
+
+std::string SHA256AutoDetect()
+{
+    TransformD64_2way = NULL;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+
+    std::string strImpl;
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t eax, ebx, ecx, edx;
+    bool fSSE41 = false, fAVX2 = false, fSHANI = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        fSSE41 = (ecx >> 19) & 1;
+        bool fOSXSAVE = (ecx >> 27) & 1;
+        bool fAVX = (ecx >> 28) & 1;
+        if (__get_cpuid_max(0, NULL) >= 7)
+        {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            fAVX2 = ((ebx >> 5) & 1) && fOSXSAVE && fAVX && AVXEnabledByOS();
+            fSHANI = (ebx >> 29) & 1;
+        }
+    }
+
+    // SHA-NI beats the multi-way code where it's available; the single
+    // hashes that are left over go through OpenSSL, which uses SHA-NI too.
+    if (fSHANI && fSSE41 && sha256_shani::fCompiled)
+    {
+        TransformD64_2way = sha256_shani::TransformD64_2way;
+        strImpl = "shani(2way)";
+    }
+    else
+    {
+        if (fSSE41 && sha256_sse41::fCompiled)
+        {
+            TransformD64_4way = sha256_sse41::TransformD64_4way;
+            strImpl = "sse41(4way)";
+        }
+        if (fAVX2 && sha256_avx2::fCompiled)
+        {
+            TransformD64_8way = sha256_avx2::TransformD64_8way;
+            strImpl += std::string(strImpl.empty() ? "" : ",") + "avx2(8way)";
+        }
+    }
+#endif
+    return strImpl.empty() ? "openssl" : strImpl;
+}
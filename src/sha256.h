@@ -0,0 +1,23 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SHA256_H
+#define BITCOIN_SHA256_H
+
+#include <stddef.h>
+#include <string>
+
+/** Double SHA-256 of nBlocks 64-byte inputs: the 32 bytes at out + 32*i
+ * become SHA256(SHA256(in + 64*i, 64)). That is the cost of every merkle
+ * tree node, and doing many of them at once lets SIMD code hash several
+ * inputs in parallel.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks);
+
+/** Choose the fastest SHA256D64 code this CPU can run (SHA-NI, 8-way AVX2,
+ * 4-way SSE4.1, or plain OpenSSL) and return a description of it. Call once
+ * at startup, before other threads use SHA256D64.
+ */
+std::string SHA256AutoDetect();
+
+#endif // BITCOIN_SHA256_H
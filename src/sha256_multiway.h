@@ -0,0 +1,137 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SHA256_MULTIWAY_H
+#define BITCOIN_SHA256_MULTIWAY_H
+
+#include <stdint.h>
+
+// Double SHA-256 of N 64-byte inputs in the N lanes of a vector of 32-bit
+// words, written with GCC vector extensions. Only included by the files that
+// are built for a particular instruction set (sha256-sse41.cpp and friends).
+// Everything here has internal linkage, so the linker can't substitute the
+// AVX2 build of a helper for the SSE4.1 one or the other way around.
+namespace
+{
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+template<typename V, int N>
+inline V Broadcast(uint32_t x)
+{
+    V v;
+    for (int j = 0; j < N; j++)
+        v[j] = x;
+    return v;
+}
+
+template<typename V>
+inline V Ror(V x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+template<typename V>
+inline void Round(V a, V b, V c, V& d, V e, V f, V g, V& h, V kw)
+{
+    V t1 = h + (Ror(e, 6) ^ Ror(e, 11) ^ Ror(e, 25)) + (g ^ (e & (f ^ g))) + kw;
+    V t2 = (Ror(a, 2) ^ Ror(a, 13) ^ Ror(a, 22)) + ((a & b) | (c & (a | b)));
+    d += t1;
+    h = t1 + t2;
+}
+
+/** One SHA-256 compression of the message words w[0..15] into s */
+template<typename V, int N>
+inline void Compress(V* s, V* w)
+{
+    for (int i = 16; i < 64; i++)
+    {
+        V s0 = Ror(w[i - 15], 7) ^ Ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        V s1 = Ror(w[i - 2], 17) ^ Ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 8)
+    {
+        Round(a, b, c, d, e, f, g, h, w[i + 0] + Broadcast<V, N>(K[i + 0]));
+        Round(h, a, b, c, d, e, f, g, w[i + 1] + Broadcast<V, N>(K[i + 1]));
+        Round(g, h, a, b, c, d, e, f, w[i + 2] + Broadcast<V, N>(K[i + 2]));
+        Round(f, g, h, a, b, c, d, e, w[i + 3] + Broadcast<V, N>(K[i + 3]));
+        Round(e, f, g, h, a, b, c, d, w[i + 4] + Broadcast<V, N>(K[i + 4]));
+        Round(d, e, f, g, h, a, b, c, w[i + 5] + Broadcast<V, N>(K[i + 5]));
+        Round(c, d, e, f, g, h, a, b, w[i + 6] + Broadcast<V, N>(K[i + 6]));
+        Round(b, c, d, e, f, g, h, a, w[i + 7] + Broadcast<V, N>(K[i + 7]));
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+/** out + 32*j = SHA256(SHA256(in + 64*j)) for the N lanes j */
+template<typename V, int N>
+void MultiwayTransformD64(unsigned char* out, const unsigned char* in)
+{
+    V w[64];
+    V s[8];
+
+    // The input itself
+    for (int i = 0; i < 8; i++)
+        s[i] = Broadcast<V, N>(IV[i]);
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < N; j++)
+            w[i][j] = ReadBE32(in + 64 * j + 4 * i);
+    Compress<V, N>(s, w);
+
+    // Its padding: a one bit and the length of 512 bits
+    w[0] = Broadcast<V, N>(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = Broadcast<V, N>(0);
+    w[15] = Broadcast<V, N>(512);
+    Compress<V, N>(s, w);
+
+    // The second hash, of the 32-byte digest and its padding
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = s[i];
+        s[i] = Broadcast<V, N>(IV[i]);
+    }
+    w[8] = Broadcast<V, N>(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = Broadcast<V, N>(0);
+    w[15] = Broadcast<V, N>(256);
+    Compress<V, N>(s, w);
+
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < N; j++)
+            WriteBE32(out + 32 * j + 4 * i, s[i][j]);
+}
+
+}
+
+#endif // BITCOIN_SHA256_MULTIWAY_H
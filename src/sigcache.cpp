@@ -0,0 +1,159 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+#include "util.h"
+
+#include <string.h>
+#include <openssl/sha.h>
+
+CSignatureCache signatureCache;
+
+CSignatureCache::CSignatureCache() : nBuckets(0), nInserts(0), nUsed(0)
+{
+}
+
+void CSignatureCache::Setup(int64 nEntries)
+{
+    nonce = GetRandHash();
+    nBuckets = nEntries > 0 ? (size_t)((nEntries + BUCKET_SIZE - 1) / BUCKET_SIZE) : 0;
+    size_t nWords = nBuckets * BUCKET_SIZE * ENTRY_WORDS;
+    pTable.reset(nWords ? new boost::atomic<uint64>[nWords] : NULL);
+    for (size_t i = 0; i < nWords; i++)
+        pTable[i].store(0, boost::memory_order_relaxed);
+    for (unsigned int i = 0; i < SHARDS; i++)
+    {
+        vCounters[i].nHits = 0;
+        vCounters[i].nMisses = 0;
+    }
+    nInserts = 0;
+    nUsed = 0;
+}
+
+void CSignatureCache::ComputeEntry(uint64* pEntry, const uint256& hash, const std::vector<unsigned char>& vchSig, const uint160& pubKeyHash) const
+{
+    uint256 entry;
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, nonce.begin(), nonce.size());
+    SHA256_Update(&ctx, hash.begin(), hash.size());
+    SHA256_Update(&ctx, pubKeyHash.begin(), pubKeyHash.size());
+    if (!vchSig.empty())
+        SHA256_Update(&ctx, &vchSig[0], vchSig.size());
+    SHA256_Final(entry.begin(), &ctx);
+    memcpy(pEntry, entry.begin(), ENTRY_WORDS * sizeof(uint64));
+}
+
+bool CSignatureCache::Contains(size_t nBucket, const uint64* pEntry) const
+{
+    const boost::atomic<uint64>* p = &pTable[nBucket * BUCKET_SIZE * ENTRY_WORDS];
+    for (unsigned int i = 0; i < BUCKET_SIZE; i++, p += ENTRY_WORDS)
+    {
+        bool fMatch = true;
+        for (unsigned int j = 0; j < ENTRY_WORDS; j++)
+            if (p[j].load(boost::memory_order_relaxed) != pEntry[j])
+                fMatch = false;
+        if (fMatch)
+            return true;
+    }
+    return false;
+}
+
+bool CSignatureCache::Get(const uint256& hash, const std::vector<unsigned char>& vchSig, const uint160& pubKeyHash)
+{
+    if (nBuckets == 0)
+        return false;
+
+    uint64 pEntry[ENTRY_WORDS];
+    ComputeEntry(pEntry, hash, vchSig, pubKeyHash);
+    size_t nBucket = pEntry[0] % nBuckets;
+    Shard& shard = vShards[nBucket % SHARDS];
+    Counters& counters = vCounters[nBucket % SHARDS];
+
+    bool fFound;
+    while (true)
+    {
+        unsigned int nSeq = shard.nSequence.load(boost::memory_order_acquire);
+        if (nSeq & 1)
+            continue; // a writer is in the middle of an update
+        fFound = Contains(nBucket, pEntry);
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (shard.nSequence.load(boost::memory_order_relaxed) == nSeq)
+            break;
+    }
+
+    if (fFound)
+        counters.nHits.fetch_add(1, boost::memory_order_relaxed);
+    else
+        counters.nMisses.fetch_add(1, boost::memory_order_relaxed);
+    return fFound;
+}
+
+void CSignatureCache::Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const uint160& pubKeyHash)
+{
+    if (nBuckets == 0)
+        return;
+
+    uint64 pEntry[ENTRY_WORDS];
+    ComputeEntry(pEntry, hash, vchSig, pubKeyHash);
+    size_t nBucket = pEntry[0] % nBuckets;
+    Shard& shard = vShards[nBucket % SHARDS];
+
+    boost::mutex::scoped_lock lock(shard.cs);
+    if (Contains(nBucket, pEntry))
+        return;
+
+    // Take a free slot if there is one, otherwise overwrite the slot picked
+    // by the salted digest. Attackers can't know which entry that is, so they
+    // can't flush the cache with a set of pre-generated signatures.
+    boost::atomic<uint64>* pBucket = &pTable[nBucket * BUCKET_SIZE * ENTRY_WORDS];
+    unsigned int nSlot = pEntry[1] % BUCKET_SIZE;
+    bool fFree = false;
+    for (unsigned int i = 0; i < BUCKET_SIZE && !fFree; i++)
+    {
+        fFree = true;
+        for (unsigned int j = 0; j < ENTRY_WORDS; j++)
+            if (pBucket[i * ENTRY_WORDS + j].load(boost::memory_order_relaxed) != 0)
+                fFree = false;
+        if (fFree)
+            nSlot = i;
+    }
+
+    unsigned int nSeq = shard.nSequence.load(boost::memory_order_relaxed);
+    shard.nSequence.store(nSeq + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    for (unsigned int j = 0; j < ENTRY_WORDS; j++)
+        pBucket[nSlot * ENTRY_WORDS + j].store(pEntry[j], boost::memory_order_relaxed);
+    shard.nSequence.store(nSeq + 2, boost::memory_order_release);
+
+    nInserts.fetch_add(1, boost::memory_order_relaxed);
+    if (fFree)
+        nUsed.fetch_add(1, boost::memory_order_relaxed);
+}
+
+CSignatureCache::Stats CSignatureCache::GetStats() const
+{
+    Stats stats;
+    stats.nHits = 0;
+    stats.nMisses = 0;
+    for (unsigned int i = 0; i < SHARDS; i++)
+    {
+        stats.nHits += vCounters[i].nHits.load(boost::memory_order_relaxed);
+        stats.nMisses += vCounters[i].nMisses.load(boost::memory_order_relaxed);
+    }
+    stats.nInserts = nInserts.load(boost::memory_order_relaxed);
+    stats.nEntries = nUsed.load(boost::memory_order_relaxed);
+    stats.nCapacity = nBuckets * BUCKET_SIZE;
+    return stats;
+}
+
+void InitSignatureCache()
+{
+    // Since there are a maximum of 20,000 signature operations per block
+    // 50,000 is a reasonable default.
+    int64 nEntries = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+    signatureCache.Setup(nEntries);
+    printf("Using %"PRI64d" entries (%"PRIszu" bytes) for the signature cache\n",
+           (int64)signatureCache.GetStats().nCapacity, signatureCache.GetStats().nCapacity * 32);
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2014 The SpreadCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SIGCACHE_H
+#define BITCOIN_SIGCACHE_H
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "uint256.h"
+
+/** Default number of entries in the signature cache (32 bytes each) */
+static const int64 DEFAULT_MAX_SIG_CACHE_SIZE = 50000;
+
+/** Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain).
+ *
+ * Entries are 32-byte digests of (signature hash, signature, public key hash)
+ * salted with a per-process random nonce, so an attacker can't predict where
+ * an entry lands or which one it replaces. The table is allocated once by
+ * Setup() and never grows. It is split into shards: writers take the shard's
+ * mutex, readers don't lock at all and instead retry if the shard's sequence
+ * number changed while they were looking.
+ */
+class CSignatureCache
+{
+public:
+    /** Entries compared on every lookup */
+    static const unsigned int BUCKET_SIZE = 4;
+    static const unsigned int SHARDS = 64;
+    /** 64-bit words in a 32-byte digest */
+    static const unsigned int ENTRY_WORDS = 4;
+
+    struct Stats
+    {
+        uint64 nHits;
+        uint64 nMisses;
+        uint64 nInserts;
+        size_t nEntries;
+        size_t nCapacity;
+    };
+
+    CSignatureCache();
+
+    /** Allocate room for nEntries digests and pick a new salt. Must be called
+     * before the cache is used from more than one thread; nEntries <= 0
+     * disables the cache. */
+    void Setup(int64 nEntries);
+
+    bool Get(const uint256& hash, const std::vector<unsigned char>& vchSig, const uint160& pubKeyHash);
+    void Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const uint160& pubKeyHash);
+
+    Stats GetStats() const;
+
+private:
+    struct Shard
+    {
+        boost::mutex cs;
+        boost::atomic<unsigned int> nSequence;
+        Shard() : nSequence(0) {}
+    };
+
+    /** Lookup counts of one shard. Every lookup bumps one, so they are kept
+     * apart from the shards' sequence numbers that readers poll, and padded
+     * so that threads counting in different shards don't share a cache line. */
+    struct Counters
+    {
+        boost::atomic<uint64> nHits;
+        boost::atomic<uint64> nMisses;
+        char padding[64 - 2 * sizeof(boost::atomic<uint64>)];
+        Counters() : nHits(0), nMisses(0) {}
+    };
+
+    uint256 nonce;
+    size_t nBuckets;
+    // nBuckets * BUCKET_SIZE digests of 4 words each; all zero means empty
+    boost::scoped_array<boost::atomic<uint64> > pTable;
+    Shard vShards[SHARDS];
+    Counters vCounters[SHARDS];
+
+    boost::atomic<uint64> nInserts;
+    boost::atomic<uint64> nUsed;
+
+    void ComputeEntry(uint64* pEntry, const uint256& hash, const std::vector<unsigned char>& vchSig, const uint160& pubKeyHash) const;
+    bool Contains(size_t nBucket, const uint64* pEntry) const;
+};
+
+/** The cache used by CheckSig() */
+extern CSignatureCache signatureCache;
+
+/** Size signatureCache from -maxsigcachesize */
+void InitSignatureCache();
+
+#endif // BITCOIN_SIGCACHE_H
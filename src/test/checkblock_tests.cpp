@@ -63,4 +63,115 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(RewardKeyID)
+{
+    CKey key;
+    key.MakeNewKey();
+
+    CBlockHeader header;
+    header.nHeight = getSecondHardforkBlock() + 1;
+    header.nTime = 1400000000;
+    header.hashMerkleRoot = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.SignCompact(header.GetHashForSignature(), vchSig));
+    memcpy(header.MinerSignature.begin(), &vchSig[0], header.MinerSignature.size());
+
+    BOOST_CHECK(header.GetRewardAddress() == key.GetPubKey());
+    BOOST_CHECK(header.GetRewardKeyID() == key.GetPubKey().GetID());
+    // The second lookup comes from the cache and must agree
+    BOOST_CHECK(header.GetRewardKeyID() == key.GetPubKey().GetID());
+
+    // A different header under the same signature recovers another key
+    header.nTime++;
+    BOOST_CHECK(header.GetRewardKeyID() != key.GetPubKey().GetID());
+    BOOST_CHECK(header.GetRewardKeyID() == header.GetRewardAddress().GetID());
+}
+
+static CBlock RandomBlock(int nTx, unsigned int nHeight)
+{
+    CBlock block;
+    block.nHeight = nHeight;
+    block.nTime = 1400000000 + GetRandInt(1000);
+    block.hashPrevBlock = GetRandHash();
+    block.hashWholeBlock = GetRandHash();
+    block.vtx.resize(nTx);
+    for (int i = 0; i < nTx; i++)
+    {
+        CTransaction& tx = block.vtx[i];
+        tx.vin.resize(1 + GetRandInt(3));
+        BOOST_FOREACH(CTxIn& txin, tx.vin)
+        {
+            txin.prevout = COutPoint(GetRandHash(), GetRandInt(4));
+            txin.scriptSig << std::vector<unsigned char>(66 + GetRandInt(40), 1);
+        }
+        tx.vout.resize(1 + GetRandInt(3));
+        BOOST_FOREACH(CTxOut& txout, tx.vout)
+        {
+            txout.nValue = GetRandInt(1000000);
+            txout.scriptPubKey << std::vector<unsigned char>(20 + GetRandInt(20), 2) << OP_CHECKSIG;
+        }
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(UnserializeReusing)
+{
+    // A block file with blocks of different sizes, some of them before the
+    // hard fork that added the miner signature to the header
+    boost::filesystem::path pathBlocks = GetTempPath() / strprintf("blk_reuse_%i.dat", (int)GetRand(100000));
+    static const int BLOCKS = 40;
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < BLOCKS; i++)
+        vBlocks.push_back(RandomBlock(1 + GetRandInt(i % 4 == 0 ? 400 : 40), getSecondHardforkBlock() + i - BLOCKS / 2));
+    {
+        CAutoFile fileout = CAutoFile(fopen(pathBlocks.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(fileout);
+        BOOST_FOREACH(const CBlock& block, vBlocks)
+            fileout << block;
+    }
+
+    // Decoding into the same object gives the same blocks as decoding
+    // into a new one each time
+    CBlock blockReused;
+    blockReused.vMerkleTree.push_back(0); // must not survive
+    {
+        CAutoFile filein = CAutoFile(fopen(pathBlocks.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_FOREACH(const CBlock& block, vBlocks)
+        {
+            blockReused.UnserializeReusing(filein);
+            BOOST_CHECK(blockReused.vMerkleTree.empty());
+            BOOST_CHECK(blockReused.GetHash() == block.GetHash());
+            BOOST_CHECK(blockReused.BuildMerkleTree() == block.hashMerkleRoot);
+            BOOST_CHECK_EQUAL(blockReused.vtx.size(), block.vtx.size());
+            BOOST_CHECK(SerializeHash(blockReused) == SerializeHash(block));
+        }
+    }
+
+    // Time reading the whole file a few times both ways
+    static const int ROUNDS = 5;
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        CAutoFile filein = CAutoFile(fopen(pathBlocks.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        for (int j = 0; j < BLOCKS; j++)
+        {
+            CBlock block;
+            filein >> block;
+        }
+    }
+    int64 nFresh = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        CAutoFile filein = CAutoFile(fopen(pathBlocks.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        for (int j = 0; j < BLOCKS; j++)
+            blockReused.UnserializeReusing(filein);
+    }
+    int64 nReused = GetTimeMicros() - nStart;
+    BOOST_TEST_MESSAGE(strprintf("%d blocks: %"PRI64d"us decoding into new blocks, %"PRI64d"us reusing one",
+                                 BLOCKS * ROUNDS, nFresh, nReused));
+    boost::filesystem::remove(pathBlocks);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
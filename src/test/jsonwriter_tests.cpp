@@ -0,0 +1,220 @@
+#include <locale.h>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "bitcoinrpc.h"
+#include "jsonwriter.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(jsonwriter_tests)
+
+static Object SampleObject(const Array& arrNested)
+{
+    Object obj;
+    obj.push_back(Pair("int", -12));
+    obj.push_back(Pair("int64", (boost::int64_t)-9223372036854775807LL));
+    obj.push_back(Pair("uint64", (boost::uint64_t)18446744073709551615ULL));
+    obj.push_back(Pair("real", -0.5));
+    obj.push_back(Pair("amount", ValueFromAmount(21000000 * COIN)));
+    obj.push_back(Pair("tiny", 1e-9));
+    obj.push_back(Pair("null", Value::null));
+    obj.push_back(Pair("bool", false));
+    obj.push_back(Pair("esc\"\\\b\f\n\r\t\x01", string("caf\xc3\xa9 \x7f end")));
+    if (!arrNested.empty())
+        obj.push_back(Pair("nested", arrNested));
+    return obj;
+}
+
+// SampleObject() with an array around a copy of it, written piece by piece
+static void WriteSample(CJSONWriter& writer)
+{
+    writer.BeginObject();
+    writer.Pair("int", -12);
+    writer.Pair("int64", -9223372036854775807LL);
+    writer.Pair("uint64", 18446744073709551615ULL);
+    writer.Pair("real", -0.5);
+    writer.Pair("amount", ValueFromAmount(21000000 * COIN));
+    writer.Pair("tiny", 1e-9);
+    writer.Key("null");
+    writer.WriteNull();
+    writer.Pair("bool", false);
+    writer.Pair("esc\"\\\b\f\n\r\t\x01", "caf\xc3\xa9 \x7f end");
+    writer.Key("nested");
+    writer.BeginArray();
+    writer.BeginObject();
+    writer.EndObject();
+    writer.BeginArray();
+    writer.EndArray();
+    CJSONWriter part = writer.NewPart();
+    part.Write(SampleObject(Array()));
+    writer.Append(part);
+    writer.Write(string());
+    writer.EndArray();
+    writer.EndObject();
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_values)
+{
+    Array arr;
+    arr.push_back(Object());
+    arr.push_back(Array());
+    arr.push_back(SampleObject(Array()));
+    arr.push_back("");
+    Object obj = SampleObject(arr);
+    string strExpected = write_string(Value(obj), false);
+
+    // Values are written exactly as json_spirit writes them
+    CJSONWriter writer;
+    writer.Write(Value(obj));
+    BOOST_CHECK_EQUAL(writer.str(), strExpected);
+
+    // and so is the same object written piece by piece
+    CJSONWriter writerStream;
+    WriteSample(writerStream);
+    BOOST_CHECK_EQUAL(writerStream.str(), strExpected);
+
+    // Building a Value instead gives the same Value
+    CJSONWriter writerValue(true);
+    WriteSample(writerValue);
+    BOOST_CHECK(writerValue.str().empty());
+    BOOST_CHECK_EQUAL(write_string(writerValue.value(), false), strExpected);
+    BOOST_CHECK_EQUAL(find_value(writerValue.value().get_obj(), "int").get_int(), -12);
+    BOOST_CHECK_EQUAL(find_value(writerValue.value().get_obj(), "amount").get_real(), 21000000.0);
+
+    CJSONWriter writerRaw;
+    writerRaw.BeginArray();
+    writerRaw.WriteRaw(strExpected);
+    writerRaw.WriteRaw(strExpected);
+    writerRaw.EndArray();
+    BOOST_CHECK_EQUAL(writerRaw.str(), "[" + strExpected + "," + strExpected + "]");
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_reals)
+{
+    // Amounts, other reals and the edge cases of writing amounts as integers
+    vector<double> vReal;
+    static const int64 vAmount[] = { 0, 1, -1, 50 * COIN, COIN / 3, -21000000 * COIN, 99999999999999LL, 100000000000000LL, 2100000000000000LL };
+    BOOST_FOREACH(int64 nAmount, vAmount)
+        vReal.push_back(ValueFromAmount(nAmount).get_real());
+    static const double vOther[] = { -0.0, 1e-9, -1e-9, 5e-9, -5e-9, 0.1, 1e7, -1e7, 9999999.999999995, 1234567890123.5, 1e300, 3.14159265358979 };
+    vReal.insert(vReal.end(), vOther, vOther + sizeof(vOther) / sizeof(vOther[0]));
+    for (int i = 0; i < 1000; i++)
+        vReal.push_back(ValueFromAmount((int64)GetRand(2100000000000000LL) * (i % 2 ? 1 : -1)).get_real());
+
+    // The decimal point is a point whatever the GUI set LC_NUMERIC to
+    string strLocale = setlocale(LC_NUMERIC, NULL);
+    static const char* vLocale[] = { "de_DE.UTF-8", "de_DE", "fr_FR.UTF-8", "German" };
+    BOOST_FOREACH(const char* pszLocale, vLocale)
+        if (setlocale(LC_NUMERIC, pszLocale))
+            break;
+    BOOST_FOREACH(double d, vReal)
+    {
+        CJSONWriter writer;
+        writer.Write(d);
+        BOOST_CHECK_EQUAL(writer.str(), write_string(Value(d), false));
+        BOOST_CHECK(writer.str().find(',') == string::npos);
+    }
+    setlocale(LC_NUMERIC, strLocale.c_str());
+}
+
+// A block the way getblock used to put it together
+static Object BlockToObject(const CBlock& block, const CBlockIndex* blockindex)
+{
+    Object result;
+    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    CMerkleTx txGen(block.vtx[0]);
+    txGen.SetMerkleBranch(&block);
+    result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
+    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+    result.push_back(Pair("height", blockindex->nHeight));
+    result.push_back(Pair("version", block.nVersion));
+    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    Array txs;
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        txs.push_back(tx.GetHash().GetHex());
+    result.push_back(Pair("tx", txs));
+    result.push_back(Pair("time", (boost::int64_t)block.GetBlockTime()));
+    result.push_back(Pair("nonce", (boost::uint64_t)block.nNonce));
+    result.push_back(Pair("bits", HexBits(block.nBits)));
+    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+
+    if (blockindex->pprev)
+        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    if (blockindex->pnext)
+        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_large)
+{
+    static const int ROUNDS = 10;
+
+    // A large block, both ways. The block is deserialized so the
+    // transaction ids are cached and only the JSON is measured.
+    CBlock blockNew;
+    blockNew.vtx.resize(5000);
+    for (unsigned int i = 0; i < blockNew.vtx.size(); i++)
+        blockNew.vtx[i].nLockTime = i;
+    blockNew.nBits = 0x1d00ffff;
+    blockNew.nNonce = 0xfedcba98;
+    blockNew.hashMerkleRoot = blockNew.BuildMerkleTree();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << blockNew;
+    CBlock block;
+    ss >> block;
+    CBlockIndex index;
+    index.nHeight = 12345;
+    index.nBits = block.nBits;
+
+    string strTree, strStream;
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+        strTree = write_string(Value(BlockToObject(block, &index)), false);
+    int64 nTree = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        CJSONWriter writer;
+        BlockToJSON(block, &index, writer);
+        strStream = writer.str();
+    }
+    int64 nStream = GetTimeMicros() - nStart;
+    BOOST_CHECK_EQUAL(strStream, strTree);
+    BOOST_TEST_MESSAGE(strprintf("getblock of %"PRIszu" transactions: %"PRI64d"us with a Value tree, %"PRI64d"us streamed",
+                                 block.vtx.size(), nTree / ROUNDS, nStream / ROUNDS));
+
+    // A large memory pool's transaction ids
+    vector<uint256> vtxid;
+    for (int i = 0; i < 50000; i++)
+        vtxid.push_back(GetRandHash());
+    nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        Array a;
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            a.push_back(hash.ToString());
+        strTree = write_string(Value(a), false);
+    }
+    nTree = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        CJSONWriter writer;
+        writer.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            writer.Write(hash.ToString());
+        writer.EndArray();
+        strStream = writer.str();
+    }
+    nStream = GetTimeMicros() - nStart;
+    BOOST_CHECK(strStream == strTree);
+    BOOST_TEST_MESSAGE(strprintf("getrawmempool of %"PRIszu" transactions: %"PRI64d"us with a Value tree, %"PRI64d"us streamed",
+                                 vtxid.size(), nTree / ROUNDS, nStream / ROUNDS));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
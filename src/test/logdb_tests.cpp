@@ -0,0 +1,310 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+#include "logdb.h"
+#include "walletdb.h"
+#include "wallet.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(logdb_tests)
+
+static CSerializeData Data(const string& str)
+{
+    return CSerializeData(str.begin(), str.end());
+}
+
+static string Str(const CSerializeData& vch)
+{
+    return string(vch.begin(), vch.end());
+}
+
+static string ReadStr(const CLogDB& logdb, const string& strKey)
+{
+    CSerializeData vchValue;
+    if (!logdb.Read(Data(strKey), vchValue))
+        return "<none>";
+    return Str(vchValue);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_records)
+{
+    boost::filesystem::path pathBase = GetDataDir() / "logdb_records";
+    BOOST_CHECK(!CLogDB::Exists(pathBase));
+    {
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        BOOST_CHECK(CLogDB::Exists(pathBase));
+        BOOST_CHECK(logdb.Write(Data("a"), Data("1")));
+        BOOST_CHECK(logdb.Write(Data("b"), Data("2")));
+        BOOST_CHECK(logdb.Write(Data("b"), Data("3")));
+        BOOST_CHECK(!logdb.Write(Data("b"), Data("4"), false));
+        BOOST_CHECK(logdb.Write(Data("c"), Data("5")));
+        BOOST_CHECK(logdb.Erase(Data("c")));
+        BOOST_CHECK(logdb.Erase(Data("nothing")));
+
+        CLogBatch batch;
+        batch.Write(Data("d"), Data("6"));
+        batch.Write(Data("e"), Data("7"));
+        batch.Erase(Data("e"));
+        batch.Erase(Data("a"));
+        BOOST_CHECK(logdb.WriteBatch(batch));
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "d"), "6");
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "e"), "<none>");
+
+        // Bytes compare unsigned and prefixes first, as in Berkeley DB
+        BOOST_CHECK(logdb.Write(Data("\x7f"), Data("low")));
+        BOOST_CHECK(logdb.Write(Data("\x80"), Data("high")));
+        BOOST_CHECK(logdb.Write(Data("dd"), Data("8")));
+        vector<string> vKeys;
+        CSerializeData vchKey, vchValue;
+        bool fInclusive = true;
+        while (logdb.Seek(vchKey, fInclusive, vchKey, vchValue))
+        {
+            vKeys.push_back(Str(vchKey));
+            fInclusive = false;
+        }
+        BOOST_CHECK_EQUAL(vKeys.size(), 5U);
+        if (vKeys.size() == 5)
+        {
+            BOOST_CHECK_EQUAL(vKeys[0], "b");
+            BOOST_CHECK_EQUAL(vKeys[1], "d");
+            BOOST_CHECK_EQUAL(vKeys[2], "dd");
+            BOOST_CHECK_EQUAL(vKeys[3], "\x7f");
+            BOOST_CHECK_EQUAL(vKeys[4], "\x80");
+        }
+        BOOST_CHECK(logdb.Seek(Data("c"), true, vchKey, vchValue) && Str(vchKey) == "d");
+        BOOST_CHECK(logdb.Seek(Data("d"), false, vchKey, vchValue) && Str(vchKey) == "dd");
+    }
+
+    // Everything is replayed from the log
+    CLogDB logdb;
+    BOOST_CHECK(logdb.Open(pathBase));
+    BOOST_CHECK_EQUAL(logdb.GetRecordCount(), 5U);
+    BOOST_CHECK_EQUAL(ReadStr(logdb, "a"), "<none>");
+    BOOST_CHECK_EQUAL(ReadStr(logdb, "b"), "3");
+    BOOST_CHECK_EQUAL(ReadStr(logdb, "c"), "<none>");
+    BOOST_CHECK_EQUAL(ReadStr(logdb, "d"), "6");
+    BOOST_CHECK_EQUAL(ReadStr(logdb, "\x80"), "high");
+
+    // Closed, it can still be read but not written
+    logdb.Close();
+    BOOST_CHECK_EQUAL(ReadStr(logdb, "b"), "3");
+    BOOST_CHECK(!logdb.Write(Data("f"), Data("9")));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_torn_write)
+{
+    boost::filesystem::path pathBase = GetDataDir() / "logdb_torn";
+    boost::filesystem::path pathLog = pathBase.string() + ".log";
+    {
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        BOOST_CHECK(logdb.Write(Data("first"), Data("1")));
+        BOOST_CHECK(logdb.Write(Data("second"), Data(string(100, 'x'))));
+    }
+
+    // The last record only made it halfway
+    boost::filesystem::resize_file(pathLog, boost::filesystem::file_size(pathLog) - 50);
+    {
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "first"), "1");
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "second"), "<none>");
+        BOOST_CHECK(logdb.Write(Data("third"), Data("3")));
+    }
+
+    // The torn end was cut off, so what was written after it is still there
+    {
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "first"), "1");
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "third"), "3");
+    }
+
+    // A damaged record isn't dropped, not even the last one: the store
+    // doesn't open and the file is left alone
+    {
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        BOOST_CHECK(logdb.Write(Data("fourth"), Data("4")));
+    }
+    uint64 nLogSize = boost::filesystem::file_size(pathLog);
+
+    // The last byte is in the payload of the last record, and one byte
+    // before that record (header, operation, "fourth" and "4") is in the one
+    // before it. The top byte of that one's size (header, operation,
+    // "third" and "3" before the last record) would make it run past the
+    // end of the file, which mustn't be taken for a torn write either.
+    static const long vOffset[] = { -1, -(12 + 1 + 7 + 2) - 1, -(12 + 1 + 7 + 2) - (12 + 1 + 6 + 2) + 3 };
+    BOOST_FOREACH(long nOffset, vOffset)
+    {
+        FILE* file = fopen(pathLog.string().c_str(), "r+b");
+        BOOST_REQUIRE(file);
+        fseek(file, nOffset, SEEK_END);
+        int c = fgetc(file);
+        fseek(file, nOffset, SEEK_END);
+        fputc(c ^ 0x55, file);
+        fclose(file);
+        {
+            CLogDB logdb;
+            BOOST_CHECK(!logdb.Open(pathBase));
+            BOOST_CHECK(!logdb.IsOpen());
+            BOOST_CHECK_EQUAL(logdb.GetRecordCount(), 0U);
+        }
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(pathLog), nLogSize);
+
+        // Repaired, everything is there again
+        file = fopen(pathLog.string().c_str(), "r+b");
+        BOOST_REQUIRE(file);
+        fseek(file, nOffset, SEEK_END);
+        fputc(c, file);
+        fclose(file);
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "third"), "3");
+        BOOST_CHECK_EQUAL(ReadStr(logdb, "fourth"), "4");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(logdb_compact)
+{
+    boost::filesystem::path pathBase = GetDataDir() / "logdb_compact";
+    map<string, string> mapExpected;
+    {
+        CLogDB logdb;
+        BOOST_CHECK(logdb.Open(pathBase));
+        for (int i = 0; i < 30000; i++)
+        {
+            string strKey = strprintf("key%d", GetRandInt(100));
+            string strValue = strprintf("%d", i) + string(200, 'v');
+            BOOST_CHECK(logdb.Write(Data(strKey), Data(strValue)));
+            mapExpected[strKey] = strValue;
+        }
+        BOOST_CHECK(logdb.NeedsCompaction());
+        BOOST_CHECK(logdb.Compact());
+        BOOST_CHECK_EQUAL(logdb.GetLogSize(), 0U);
+        BOOST_CHECK(!logdb.NeedsCompaction());
+        BOOST_CHECK(boost::filesystem::file_size(pathBase.string() + ".snapshot") < 100 * 300);
+        BOOST_CHECK(logdb.Write(Data("after"), Data("compaction")));
+        mapExpected["after"] = "compaction";
+    }
+
+    CLogDB logdb;
+    BOOST_CHECK(logdb.Open(pathBase));
+    BOOST_CHECK_EQUAL(logdb.GetRecordCount(), mapExpected.size());
+    for (map<string, string>::iterator it = mapExpected.begin(); it != mapExpected.end(); ++it)
+        BOOST_CHECK(ReadStr(logdb, (*it).first) == (*it).second);
+    logdb.Close();
+
+    // Loading a store the size of a wallet with 100k transactions
+    boost::filesystem::path pathLarge = GetDataDir() / "logdb_large";
+    CLogDataMap mapRecords;
+    for (int i = 0; i < 100000; i++)
+    {
+        uint256 hash = GetRandHash();
+        mapRecords[Data(strprintf("tx%s", hash.ToString().c_str()))] = CSerializeData(300, (char)i);
+    }
+    BOOST_CHECK(CLogDB::WriteSnapshot(pathLarge.string() + ".snapshot", mapRecords));
+    CLogDB logdbLarge;
+    int64 nStart = GetTimeMillis();
+    BOOST_CHECK(logdbLarge.Open(pathLarge));
+    BOOST_TEST_MESSAGE(strprintf("loaded %"PRIszu" records in %"PRI64d"ms", logdbLarge.GetRecordCount(), GetTimeMillis() - nStart));
+    BOOST_CHECK_EQUAL(logdbLarge.GetRecordCount(), mapRecords.size());
+}
+
+static CWalletTx MakeWalletTx(CWallet& wallet, const CKey& key)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    return CWalletTx(&wallet, tx);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_wallet)
+{
+    const string strFile = "wallet_migrate.dat";
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hashTx1, hashTx2;
+    {
+        // A Berkeley DB wallet
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+        BOOST_CHECK(wallet.SetAddressBookName(key.GetPubKey().GetID(), "migrated"));
+        CWalletTx wtx = MakeWalletTx(wallet, key);
+        hashTx1 = wtx.GetHash();
+        BOOST_CHECK(wallet.AddToWallet(wtx));
+    }
+
+    BOOST_CHECK(CWalletDB::MigrateToLog(strFile));
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / strFile));
+    BOOST_CHECK(boost::filesystem::exists(GetDataDir() / (strFile + ".migrated")));
+    BOOST_CHECK(bitdb.OpenLogDb(strFile));
+    BOOST_CHECK(!CWalletDB::MigrateToLog(strFile));
+    {
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        BOOST_CHECK(wallet.HaveKey(key.GetPubKey().GetID()));
+        BOOST_CHECK(wallet.mapAddressBook[key.GetPubKey().GetID()] == "migrated");
+        BOOST_CHECK(wallet.mapWallet.count(hashTx1));
+
+        // New writes go to the log
+        CWalletTx wtx = MakeWalletTx(wallet, key);
+        hashTx2 = wtx.GetHash();
+        BOOST_CHECK(wallet.AddToWallet(wtx));
+
+        CWalletDB walletdb(strFile);
+        CAccountingEntry acentry;
+        acentry.strAccount = "acct";
+        acentry.nCreditDebit = 5 * COIN;
+        acentry.nTime = GetAdjustedTime();
+        acentry.nOrderPos = wallet.IncOrderPosNext();
+        BOOST_CHECK(walletdb.WriteAccountingEntry(acentry));
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("acct"), 5 * COIN);
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("acct2"), 0);
+
+        // A transaction sees its own writes and leaves no trace if aborted
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WriteName("somewhere", "aborted"));
+        BOOST_CHECK(walletdb.EraseTx(hashTx1));
+        BOOST_CHECK(walletdb.TxnAbort());
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WriteSetting("fTest", true));
+        bool fTest = false;
+        BOOST_CHECK(walletdb.ReadSetting("fTest", fTest) && fTest);
+        BOOST_CHECK(walletdb.TxnCommit());
+    }
+
+    // And everything is still there when it is loaded from disk again
+    bitdb.CloseLogDb(strFile);
+    BOOST_CHECK(bitdb.OpenLogDb(strFile));
+    {
+        CWallet wallet(strFile);
+        bool fFirstRun;
+        BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        BOOST_CHECK(wallet.HaveKey(key.GetPubKey().GetID()));
+        BOOST_CHECK(wallet.mapWallet.count(hashTx1));
+        BOOST_CHECK(wallet.mapWallet.count(hashTx2));
+        BOOST_CHECK(!wallet.mapAddressBook.count(CBitcoinAddress("somewhere").Get()));
+        CWalletDB walletdb(strFile);
+        bool fTest = false;
+        BOOST_CHECK(walletdb.ReadSetting("fTest", fTest) && fTest);
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("acct"), 5 * COIN);
+
+        // The rewrite done after encrypting compacts the store
+        BOOST_CHECK(CDB::Rewrite(strFile));
+        BOOST_CHECK_EQUAL(bitdb.GetLogDb(strFile)->GetLogSize(), 0U);
+    }
+    bitdb.CloseLogDb(strFile);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
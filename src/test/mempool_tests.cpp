@@ -0,0 +1,294 @@
+#include <boost/test/unit_test.hpp>
+
+#include "keystore.h"
+#include "main.h"
+#include "net.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+// Build a transaction spending output n of hashPrev
+static CTransaction MakeTx(const uint256& hashPrev, unsigned int n, int64 nValue)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].prevout.n = n;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = nValue;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(mempool_ancestor_state)
+{
+    CTxMemPool pool;
+
+    // parent <- child <- grandchild, plus an unrelated transaction
+    CTransaction txParent = MakeTx(GetRandHash(), 0, 10 * COIN);
+    CTransaction txChild = MakeTx(txParent.GetHash(), 0, 9 * COIN);
+    CTransaction txGrandChild = MakeTx(txChild.GetHash(), 0, 8 * COIN);
+    CTransaction txOther = MakeTx(GetRandHash(), 0, 5 * COIN);
+
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 20000, 0, 0.0, 1));
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 3000, 0, 0.0, 1));
+    pool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 5000, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    const CTxMemPoolEntry& grandChild = *pool.mapTx.find(txGrandChild.GetHash());
+    BOOST_CHECK_EQUAL(grandChild.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandChild.GetFeesWithAncestors(), 24000);
+
+    set<uint256> setAncestors;
+    pool.CalculateAncestors(txGrandChild.GetHash(), setAncestors);
+    BOOST_CHECK_EQUAL(setAncestors.size(), 2);
+    BOOST_CHECK(setAncestors.count(txParent.GetHash()));
+    BOOST_CHECK(setAncestors.count(txChild.GetHash()));
+
+    set<uint256> setDescendants;
+    pool.CalculateDescendants(txParent.GetHash(), setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 3);
+
+    // The child package has the best fee rate
+    BOOST_CHECK(pool.mapTx.get<ancestor_score_index>().rbegin()->GetHash() == txChild.GetHash());
+    // The parent alone has the worst one
+    BOOST_CHECK(pool.mapTx.get<fee_rate_index>().begin()->GetHash() == txParent.GetHash());
+
+    // Mining the parent shrinks the packages of what is left behind
+    pool.remove(txParent);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    const CTxMemPoolEntry& child = *pool.mapTx.find(txChild.GetHash());
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(child.GetFeesWithAncestors(), 20000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txGrandChild.GetHash())->GetCountWithAncestors(), 2);
+
+    // Re-adding it (as after a reorg) restores them
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txGrandChild.GetHash())->GetCountWithAncestors(), 3);
+
+    // Recursive removal takes the descendants along
+    pool.remove(txParent, true);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.mapNextTx.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_entry_priority)
+{
+    CTransaction tx = MakeTx(GetRandHash(), 0, COIN);
+    CTxMemPoolEntry entry(tx, 0, 0, 1.0, 100, COIN);
+
+    BOOST_CHECK_EQUAL(entry.GetPriority(100), 1.0);
+    BOOST_CHECK_EQUAL(entry.GetPriority(110), 1.0 + 10.0 * COIN / entry.GetTxSize());
+}
+
+BOOST_AUTO_TEST_CASE(mempool_expire_and_trim)
+{
+    CTxMemPool pool;
+    std::vector<uint256> vRemoved;
+
+    CTransaction txOld = MakeTx(GetRandHash(), 0, COIN);
+    CTransaction txOldChild = MakeTx(txOld.GetHash(), 0, COIN / 2);
+    CTransaction txNew = MakeTx(GetRandHash(), 0, COIN);
+    pool.addUnchecked(txOld.GetHash(), CTxMemPoolEntry(txOld, 10000, 1000, 0.0, 1));
+    pool.addUnchecked(txOldChild.GetHash(), CTxMemPoolEntry(txOldChild, 10000, 5000, 0.0, 1));
+    pool.addUnchecked(txNew.GetHash(), CTxMemPoolEntry(txNew, 10000, 5000, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), ::GetSerializeSize(txOld, SER_NETWORK, PROTOCOL_VERSION) * 3);
+
+    // Expiring a transaction takes its descendants along
+    BOOST_CHECK_EQUAL(pool.Expire(2000, vRemoved), 2);
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(txNew.GetHash()));
+    BOOST_CHECK(pool.mapNextTx.size() == 1);
+
+    // Trimming evicts the lowest fee rate package first
+    CTransaction txCheap = MakeTx(GetRandHash(), 0, COIN);
+    CTransaction txCheapChild = MakeTx(txCheap.GetHash(), 0, COIN / 2);
+    pool.addUnchecked(txCheap.GetHash(), CTxMemPoolEntry(txCheap, 100, 5000, 0.0, 1));
+    pool.addUnchecked(txCheapChild.GetHash(), CTxMemPoolEntry(txCheapChild, 200, 5000, 0.0, 1));
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 0);
+
+    vRemoved.clear();
+    pool.TrimToSize(nUsage - 1, vRemoved);
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2);
+    BOOST_CHECK(pool.exists(txNew.GetHash()));
+    BOOST_CHECK(!pool.exists(txCheap.GetHash()));
+    BOOST_CHECK(!pool.exists(txCheapChild.GetHash()));
+
+    vRemoved.clear();
+    pool.TrimToSize(0, vRemoved);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), 0);
+}
+
+
+// Put a transaction paying nOutputs outputs of nValue to key into the chain
+// state, without a block
+static CTransaction AddCoins(const CKey& key, unsigned int nOutputs, int64 nValue)
+{
+    CTransaction txFrom;
+    txFrom.vin.resize(1);
+    txFrom.vin[0].prevout.hash = GetRandHash();
+    txFrom.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++)
+    {
+        txFrom.vout[i].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+        txFrom.vout[i].nValue = nValue;
+    }
+    pcoinsTip->SetCoins(txFrom.GetHash(), CCoins(txFrom, nBestHeight));
+    return txFrom;
+}
+
+// Spend nCount outputs of txFrom starting at nFirst back to key, paying nFee
+static CTransaction SpendCoins(const CBasicKeyStore& keystore, const CKey& key, const CTransaction& txFrom,
+                               unsigned int nFirst, unsigned int nCount, int64 nFee)
+{
+    CTransaction tx;
+    int64 nValue = 0;
+    tx.vin.resize(nCount);
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        tx.vin[i].prevout = COutPoint(txFrom.GetHash(), nFirst + i);
+        nValue += txFrom.vout[nFirst + i].nValue;
+    }
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    tx.vout[0].nValue = nValue - nFee;
+    for (unsigned int i = 0; i < nCount; i++)
+        BOOST_CHECK(SignSignature(keystore, txFrom, tx, i));
+    return tx;
+}
+
+// Invalidate the signatures of a signed transaction
+static void BreakSignature(CTransaction& tx)
+{
+    tx.vout[0].nValue -= 1;
+    tx.ClearCache();
+}
+
+BOOST_AUTO_TEST_CASE(mempool_pending_batch)
+{
+    LOCK(cs_main);
+    CNode::ClearBanned();
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CTransaction txFrom = AddCoins(key, 50, COIN);
+
+    CAddress addr(CService("10.1.2.3", GetDefaultPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    // A valid transaction, one with a bad signature, one spending the
+    // first and an unrelated valid one, all in the same batch
+    CTransaction txA = SpendCoins(keystore, key, txFrom, 0, 1, COIN / 100);
+    CTransaction txBad = SpendCoins(keystore, key, txFrom, 1, 1, COIN / 100);
+    BreakSignature(txBad);
+    CTransaction txChild = SpendCoins(keystore, key, txA, 0, 1, COIN / 100);
+    CTransaction txB = SpendCoins(keystore, key, txFrom, 2, 1, COIN / 100);
+    QueuePendingTransaction(&node, txA);
+    QueuePendingTransaction(&node, txBad);
+    QueuePendingTransaction(&node, txChild);
+    QueuePendingTransaction(&node, txB);
+    ProcessPendingTransactions();
+
+    BOOST_CHECK(mempool.exists(txA.GetHash()));
+    BOOST_CHECK(!mempool.exists(txBad.GetHash()));
+    BOOST_CHECK(mempool.exists(txChild.GetHash()));
+    BOOST_CHECK(mempool.exists(txB.GetHash()));
+    BOOST_CHECK(CNode::IsBanned(addr));
+    BOOST_CHECK_EQUAL(node.GetRefCount(), 0);
+
+    // A batch without failures
+    CTransaction txC = SpendCoins(keystore, key, txFrom, 3, 1, COIN / 100);
+    CTransaction txD = SpendCoins(keystore, key, txFrom, 4, 1, COIN / 100);
+    QueuePendingTransaction(&node, txC);
+    QueuePendingTransaction(&node, txD);
+    ProcessPendingTransactions();
+    BOOST_CHECK(mempool.exists(txC.GetHash()));
+    BOOST_CHECK(mempool.exists(txD.GetHash()));
+
+    // A free transaction in a batch that falls back to serial checking is
+    // charged to the rate limiter once: at 10000 bytes per window there is
+    // still room for another free transaction afterwards.
+    mapArgs["-limitfreerelay"] = "1";
+    SetMockTime(GetTime() + 1000000); // let the limiter forget earlier free transactions
+    CTransaction txFree = SpendCoins(keystore, key, txFrom, 10, 40, 0);
+    BOOST_CHECK(::GetSerializeSize(txFree, SER_NETWORK, PROTOCOL_VERSION) > 5000);
+    CTransaction txBad2 = SpendCoins(keystore, key, txFrom, 5, 1, COIN / 100);
+    BreakSignature(txBad2);
+    QueuePendingTransaction(&node, txFree);
+    QueuePendingTransaction(&node, txBad2);
+    ProcessPendingTransactions();
+    BOOST_CHECK(mempool.exists(txFree.GetHash()));
+    BOOST_CHECK(!mempool.exists(txBad2.GetHash()));
+
+    CTransaction txFree2 = SpendCoins(keystore, key, txFrom, 6, 1, 0);
+    QueuePendingTransaction(&node, txFree2);
+    ProcessPendingTransactions();
+    BOOST_CHECK(mempool.exists(txFree2.GetHash()));
+
+    SetMockTime(0);
+    mapArgs.erase("-limitfreerelay");
+    mempool.clear();
+    CNode::ClearBanned();
+}
+
+
+BOOST_AUTO_TEST_CASE(mempool_rolling_fee)
+{
+    SetMockTime(GetTime());
+    CTxMemPool pool;
+    BOOST_CHECK_EQUAL(pool.GetMinFeeRate(), 0);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1000), 0);
+
+    // Evicting a transaction raises the minimum fee above its fee rate
+    CTransaction tx = MakeTx(GetRandHash(), 0, COIN);
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 100000, GetTime(), 0.0, 1));
+    double dMinFee = pool.mapTx.find(tx.GetHash())->GetFeeRate() + CTransaction::nMinRelayTxFee;
+    std::vector<uint256> vRemoved;
+    pool.TrimToSize(0, vRemoved);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.GetMinFeeRate(), dMinFee);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1000), (int64)dMinFee);
+
+    // It halves four times as fast while the pool is nearly empty
+    SetMockTime(GetTime() + ROLLING_FEE_HALFLIFE / 4);
+    BOOST_CHECK_CLOSE(pool.GetMinFeeRate(), dMinFee / 2, 0.001);
+
+    // and is gone once below half the relay fee
+    SetMockTime(GetTime() + ROLLING_FEE_HALFLIFE * 10);
+    BOOST_CHECK_EQUAL(pool.GetMinFeeRate(), 0);
+
+    // Transactions paying less than the minimum are turned away
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CTransaction txFrom = AddCoins(key, 1, 10 * COIN);
+    CTransaction txSpend = SpendCoins(keystore, key, txFrom, 0, 1, COIN / 100);
+    CTransaction txExpensive = MakeTx(GetRandHash(), 0, COIN);
+    {
+        LOCK(cs_main);
+        mempool.addUnchecked(txExpensive.GetHash(), CTxMemPoolEntry(txExpensive, COIN, GetTime(), 0.0, 1));
+        vRemoved.clear();
+        mempool.TrimToSize(0, vRemoved);
+        CValidationState state;
+        BOOST_CHECK(!txSpend.AcceptToMemoryPool(state, true, true));
+        BOOST_CHECK(!mempool.exists(txSpend.GetHash()));
+
+        SetMockTime(GetTime() + ROLLING_FEE_HALFLIFE * 20);
+        BOOST_CHECK(txSpend.AcceptToMemoryPool(state, true, true));
+        BOOST_CHECK(mempool.exists(txSpend.GetHash()));
+        mempool.clear();
+    }
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "net.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(relay_tests)
+
+BOOST_AUTO_TEST_CASE(relay_cache_shares_messages)
+{
+    CRelayCache cache;
+
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+    uint256 hash = tx.GetHash();
+
+    BOOST_CHECK(!cache.Get(hash));
+    CSharedMessage msg = cache.Add(hash, tx);
+    BOOST_CHECK(msg);
+
+    // Adding it again returns the same buffer instead of serializing again
+    BOOST_CHECK(cache.Add(hash, tx) == msg);
+    BOOST_CHECK(cache.Get(hash) == msg);
+    BOOST_CHECK_EQUAL(cache.size(), 1);
+    BOOST_CHECK_EQUAL(cache.GetTotalBytes(), msg->size());
+
+    // The buffer is a complete "tx" message
+    CDataStream ss(msg->begin(), msg->end(), SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr;
+    CTransaction txRead;
+    ss >> hdr >> txRead;
+    BOOST_CHECK(hdr.IsValid());
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "tx");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK(txRead.GetHash() == hash);
+    BOOST_CHECK(ss.empty());
+}
+
+BOOST_AUTO_TEST_CASE(relay_cache_expiry)
+{
+    CRelayCache cache;
+    int64 nStartTime = GetTime();
+    SetMockTime(nStartTime);
+
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    CTransaction tx2(tx);
+    tx2.vout[0].nValue = 2 * COIN;
+
+    // Adding it again keeps it longer
+    cache.Add(tx.GetHash(), tx);
+    SetMockTime(nStartTime + CRelayCache::RELAY_EXPIRY / 2);
+    for (int i = 0; i < 100; i++)
+        cache.Add(tx.GetHash(), tx);
+    SetMockTime(nStartTime + CRelayCache::RELAY_EXPIRY + 1);
+    cache.Add(tx2.GetHash(), tx2);
+    BOOST_CHECK(cache.Get(tx.GetHash()));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+
+    // until the last time plus the expiry has passed
+    SetMockTime(nStartTime + CRelayCache::RELAY_EXPIRY * 3 / 2 + 1);
+    cache.Add(tx2.GetHash(), tx2);
+    BOOST_CHECK(!cache.Get(tx.GetHash()));
+    BOOST_CHECK_EQUAL(cache.size(), 1);
+    BOOST_CHECK_EQUAL(cache.GetTotalBytes(), cache.Get(tx2.GetHash())->size());
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
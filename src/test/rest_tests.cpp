@@ -0,0 +1,175 @@
+#include <boost/test/unit_test.hpp>
+
+#include <sstream>
+
+#include "bitcoinrpc.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(rest_tests)
+
+// Make a request, returns the status code and puts the body in strBody
+static int RESTRequest(const string& strURI, string& strBody, bool* pfKeepAlive = NULL, const string& strMethod = "GET")
+{
+    stringstream ss;
+    bool fKeepAlive = HTTPReq_REST(ss, strMethod, strURI, true);
+    if (pfKeepAlive)
+        *pfKeepAlive = fKeepAlive;
+    string strReply = ss.str();
+    size_t nBody = strReply.find("\r\n\r\n");
+    BOOST_REQUIRE(nBody != string::npos);
+    strBody = strReply.substr(nBody + 4);
+    BOOST_CHECK(strReply.find(strprintf("Content-Length: %"PRIszu"\r\n", strBody.size())) != string::npos);
+    return atoi(strReply.substr(9, 3));
+}
+
+BOOST_AUTO_TEST_CASE(rest_block)
+{
+    CBlockIndex* pindex = pindexGenesisBlock;
+    BOOST_REQUIRE(pindex);
+    CBlock block;
+    BOOST_REQUIRE(block.ReadFromDisk(pindex));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    string strBlock = ssBlock.str();
+
+    // The stored bytes are what the network sends
+    string strBody;
+    bool fKeepAlive = false;
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + pindex->GetBlockHash().GetHex() + ".bin", strBody, &fKeepAlive), HTTP_OK);
+    BOOST_CHECK(strBody == strBlock);
+    BOOST_CHECK(fKeepAlive);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + pindex->GetBlockHash().GetHex() + ".hex", strBody), HTTP_OK);
+    BOOST_CHECK_EQUAL(strBody, HexStr(strBlock.begin(), strBlock.end()) + "\n");
+
+    CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    vector<CBlockHeader> vHeaders;
+    for (; pindex && vHeaders.size() < 5; pindex = pindex->pnext)
+        vHeaders.push_back(pindex->GetBlockHeader());
+    ssHeaders << vHeaders;
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/5/" + hashGenesisBlock.GetHex() + ".bin", strBody), HTTP_OK);
+    BOOST_CHECK(strBody == ssHeaders.str());
+
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + GetRandHash().GetHex() + ".bin", strBody, &fKeepAlive), HTTP_NOT_FOUND);
+    BOOST_CHECK(fKeepAlive);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/0/" + hashGenesisBlock.GetHex() + ".bin", strBody), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/2001/" + hashGenesisBlock.GetHex() + ".bin", strBody), HTTP_BAD_REQUEST);
+}
+
+BOOST_AUTO_TEST_CASE(rest_requests)
+{
+    string strBody;
+    bool fKeepAlive = true;
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/tx/" + GetRandHash().GetHex() + ".bin", strBody), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/tx/1234.bin", strBody, &fKeepAlive), HTTP_BAD_REQUEST);
+    BOOST_CHECK(!fKeepAlive);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + hashGenesisBlock.GetHex() + ".json", strBody), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + hashGenesisBlock.GetHex(), strBody), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/nosuchthing/" + hashGenesisBlock.GetHex() + ".bin", strBody), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + hashGenesisBlock.GetHex() + ".bin", strBody, NULL, "POST"), HTTP_BAD_REQUEST);
+
+    // Unknown outpoints are reported as spent
+    uint256 hash = GetRandHash();
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/getutxos/checkmempool/" + hash.GetHex() + "-0/" + hash.GetHex() + "-1.bin", strBody), HTTP_OK);
+    CDataStream ss(strBody.data(), strBody.data() + strBody.size(), SER_NETWORK, PROTOCOL_VERSION);
+    int nHeight;
+    uint256 hashBest;
+    vector<unsigned char> vBitmap;
+    ss >> nHeight >> hashBest >> vBitmap;
+    BOOST_CHECK_EQUAL(nHeight, pindexBest->nHeight);
+    BOOST_CHECK(hashBest == pindexBest->GetBlockHash());
+    BOOST_REQUIRE_EQUAL(vBitmap.size(), 1U);
+    BOOST_CHECK_EQUAL(vBitmap[0], 0);
+    BOOST_CHECK_EQUAL(ReadCompactSize(ss), 0U);
+    BOOST_CHECK(ss.empty());
+
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/getutxos/" + hash.GetHex() + ".bin", strBody), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/getutxos/" + hash.GetHex() + "-x.bin", strBody), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/getutxos/checkmempool.bin", strBody), HTTP_BAD_REQUEST);
+}
+
+
+BOOST_AUTO_TEST_CASE(rest_tx_utxos)
+{
+    // Unspent outputs of a confirmed transaction
+    CTransaction txFrom;
+    txFrom.vin.resize(1);
+    txFrom.vin[0].prevout.hash = GetRandHash();
+    txFrom.vout.resize(2);
+    txFrom.vout[0].scriptPubKey = CScript() << OP_1;
+    txFrom.vout[0].nValue = COIN;
+    txFrom.vout[1].scriptPubKey = CScript() << OP_2;
+    txFrom.vout[1].nValue = 2 * COIN;
+    {
+        LOCK(cs_main);
+        pcoinsTip->SetCoins(txFrom.GetHash(), CCoins(txFrom, pindexBest->nHeight));
+    }
+
+    // and a memory pool transaction spending the first one
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_3;
+    tx.vout[0].nValue = COIN / 2;
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, COIN / 2, GetTime(), 0.0, pindexBest->nHeight));
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    string strTx = ssTx.str();
+    string strBody;
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/tx/" + tx.GetHash().GetHex() + ".bin", strBody), HTTP_OK);
+    BOOST_CHECK(strBody == strTx);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/tx/" + tx.GetHash().GetHex() + ".hex", strBody), HTTP_OK);
+    BOOST_CHECK_EQUAL(strBody, HexStr(strTx.begin(), strTx.end()) + "\n");
+
+    // Both outputs are unspent in the chain, the pool transaction's isn't
+    string strOutPoints = txFrom.GetHash().GetHex() + "-0/" + tx.GetHash().GetHex() + "-0/" + txFrom.GetHash().GetHex() + "-1";
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/getutxos/" + strOutPoints + ".bin", strBody), HTTP_OK);
+    {
+        CDataStream ss(strBody.data(), strBody.data() + strBody.size(), SER_NETWORK, PROTOCOL_VERSION);
+        int nHeight;
+        uint256 hashBest;
+        vector<unsigned char> vBitmap;
+        ss >> nHeight >> hashBest >> vBitmap;
+        BOOST_REQUIRE_EQUAL(vBitmap.size(), 1U);
+        BOOST_CHECK_EQUAL(vBitmap[0], 5);
+        BOOST_REQUIRE_EQUAL(ReadCompactSize(ss), 2U);
+        for (int i = 0; i < 2; i++)
+        {
+            int nTxVer, nCoinHeight;
+            CTxOut out;
+            ss >> nTxVer >> nCoinHeight >> out;
+            BOOST_CHECK_EQUAL(nTxVer, txFrom.nVersion);
+            BOOST_CHECK_EQUAL(nCoinHeight, pindexBest->nHeight);
+            BOOST_CHECK(out == txFrom.vout[i]);
+        }
+        BOOST_CHECK(ss.empty());
+    }
+
+    // Counting the pool, the first output is spent and the new one unspent
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/getutxos/checkmempool/" + strOutPoints + ".bin", strBody), HTTP_OK);
+    {
+        CDataStream ss(strBody.data(), strBody.data() + strBody.size(), SER_NETWORK, PROTOCOL_VERSION);
+        int nHeight;
+        uint256 hashBest;
+        vector<unsigned char> vBitmap;
+        ss >> nHeight >> hashBest >> vBitmap;
+        BOOST_REQUIRE_EQUAL(vBitmap.size(), 1U);
+        BOOST_CHECK_EQUAL(vBitmap[0], 6);
+        BOOST_REQUIRE_EQUAL(ReadCompactSize(ss), 2U);
+        int nTxVer, nCoinHeight;
+        CTxOut out;
+        ss >> nTxVer >> nCoinHeight >> out;
+        BOOST_CHECK(out == tx.vout[0]);
+        ss >> nTxVer >> nCoinHeight >> out;
+        BOOST_CHECK(out == txFrom.vout[1]);
+        BOOST_CHECK(ss.empty());
+    }
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
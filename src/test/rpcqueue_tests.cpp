@@ -0,0 +1,138 @@
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "bitcoinrpc.h"
+#include "rpcqueue.h"
+#include "sync.h"
+#include "util.h"
+
+using namespace std;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(rpcqueue_tests)
+
+static void CountJob(CCriticalSection* pcs, int* pnCount)
+{
+    LOCK(*pcs);
+    (*pnCount)++;
+}
+
+BOOST_AUTO_TEST_CASE(rpcqueue_depth)
+{
+    CRPCWorkQueue queue(2);
+    CCriticalSection cs;
+    int nCount = 0;
+    BOOST_CHECK(queue.Enqueue(boost::bind(&CountJob, &cs, &nCount)));
+    BOOST_CHECK(queue.Enqueue(boost::bind(&CountJob, &cs, &nCount)));
+    BOOST_CHECK(!queue.Enqueue(boost::bind(&CountJob, &cs, &nCount)));
+    BOOST_CHECK_EQUAL(queue.Depth(), 2U);
+
+    // Stopping refuses new calls but still runs the queued ones
+    queue.Interrupt();
+    BOOST_CHECK(!queue.Enqueue(boost::bind(&CountJob, &cs, &nCount)));
+    boost::thread_group threadGroup;
+    threadGroup.create_thread(boost::bind(&CRPCWorkQueue::Thread, &queue));
+    threadGroup.join_all();
+    BOOST_CHECK_EQUAL(nCount, 2);
+    BOOST_CHECK_EQUAL(queue.Depth(), 0U);
+}
+
+static void BlockingJob(CRPCPending* pstarted, CRPCPending* pgate)
+{
+    pstarted->Done();
+    pgate->Wait();
+}
+
+BOOST_AUTO_TEST_CASE(rpcqueue_no_backlog)
+{
+    // Without a queue, a call is only taken while a worker is free
+    CRPCWorkQueue queue(0);
+    CRPCPending started, gate;
+    started.Add();
+    gate.Add();
+    BOOST_CHECK(!queue.Enqueue(boost::bind(&BlockingJob, &started, &gate)));
+
+    boost::thread_group threadGroup;
+    threadGroup.create_thread(boost::bind(&CRPCWorkQueue::Thread, &queue));
+    bool fQueued = false;
+    for (int i = 0; i < 500 && !fQueued; i++)
+    {
+        fQueued = queue.Enqueue(boost::bind(&BlockingJob, &started, &gate));
+        if (!fQueued)
+            MilliSleep(10);
+    }
+    BOOST_REQUIRE(fQueued);
+    started.Wait();
+    BOOST_CHECK(!queue.Enqueue(boost::bind(&BlockingJob, &started, &gate)));
+    BOOST_CHECK_EQUAL(queue.Depth(), 0U);
+
+    gate.Done();
+    queue.Interrupt();
+    threadGroup.join_all();
+}
+
+static Object Request(const string& strMethod, const Array& params, int nId)
+{
+    Object request;
+    request.push_back(Pair("method", strMethod));
+    request.push_back(Pair("params", params));
+    request.push_back(Pair("id", nId));
+    return request;
+}
+
+BOOST_AUTO_TEST_CASE(rpcqueue_batch)
+{
+    CRPCWorkQueue queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&CRPCWorkQueue::Thread, &queue));
+
+    // Replies come back in request order, errors in their own entries
+    Array vReq;
+    for (int i = 0; i < 100; i++)
+    {
+        if (i % 10 == 9)
+            vReq.push_back(Request("nosuchmethod", Array(), i));
+        else
+            vReq.push_back(Request("help", Array(1, "getinfo"), i));
+    }
+    vReq.push_back(Value("not a request"));
+    Value valReply;
+    BOOST_CHECK(read_string(JSONRPCExecBatch(vReq, false, &queue), valReply));
+    const Array& vReply = valReply.get_array();
+    BOOST_CHECK_EQUAL(vReply.size(), vReq.size());
+    for (int i = 0; i < 100; i++)
+    {
+        const Object& reply = vReply[i].get_obj();
+        BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), i);
+        if (i % 10 == 9)
+        {
+            BOOST_CHECK(find_value(reply, "result").type() == null_type);
+            BOOST_CHECK_EQUAL(find_value(find_value(reply, "error").get_obj(), "code").get_int(), (int)RPC_METHOD_NOT_FOUND);
+        }
+        else
+            BOOST_CHECK(find_value(reply, "result").get_str().find("getinfo") == 0);
+    }
+    BOOST_CHECK_EQUAL(find_value(find_value(vReply.back().get_obj(), "error").get_obj(), "code").get_int(), (int)RPC_INVALID_REQUEST);
+
+    // A batch of calls that don't hold cs_main, in this thread and on the
+    // workers. More than the queue holds, so some run here either way.
+    Array vLoad;
+    for (int i = 0; i < 200; i++)
+        vLoad.push_back(Request("help", Array(), i));
+    int64 nStart = GetTimeMicros();
+    string strSerial = JSONRPCExecBatch(vLoad, false, NULL);
+    int64 nSerial = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    BOOST_CHECK(JSONRPCExecBatch(vLoad, false, &queue) == strSerial);
+    int64 nParallel = GetTimeMicros() - nStart;
+    BOOST_TEST_MESSAGE(strprintf("batch of %"PRIszu" help calls: %"PRI64d"us in one thread, %"PRI64d"us with 4 workers",
+                                 vLoad.size(), nSerial, nParallel));
+
+    queue.Interrupt();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -20,6 +20,7 @@ using namespace json_spirit;
 using namespace boost::algorithm;
 
 extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+extern bool CastToBool(const vector<unsigned char>& vch);
 
 static const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
 
@@ -196,6 +197,143 @@ BOOST_AUTO_TEST_CASE(script_PushData)
     BOOST_CHECK(pushdata4Stack == directStack);
 }
 
+// Full interpreter evaluation, without the fast paths of VerifyScript
+static bool EvalScripts(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo)
+{
+    vector<vector<unsigned char> > stack;
+    if (!EvalScript(stack, scriptSig, txTo, 0, flags, 0))
+        return false;
+    if (!EvalScript(stack, scriptPubKey, txTo, 0, flags, 0))
+        return false;
+    return !stack.empty() && CastToBool(stack.back());
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_fastpath)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(scriptPubKey.IsPayToPubKeyHash());
+
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+    uint256 hash = SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL);
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+
+    CScript scriptSig;
+    scriptSig << vchSig;
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0));
+    BOOST_CHECK(EvalScripts(scriptSig, scriptPubKey, txTo));
+
+    // Wrong signature, wrong hash type, extra data and a non-minimal push
+    // must give the same answer as the interpreter
+    vector<CScript> vBad;
+    vector<unsigned char> vchBad = vchSig;
+    vchBad[10] ^= 1;
+    vBad.push_back(CScript() << vchBad);
+    vchBad = vchSig;
+    vchBad.back() = SIGHASH_NONE;
+    vBad.push_back(CScript() << vchBad);
+    vBad.push_back(CScript() << OP_1 << vchSig);
+    CScript scriptPushData1;
+    scriptPushData1.push_back(OP_PUSHDATA1);
+    scriptPushData1.push_back(vchSig.size());
+    scriptPushData1.insert(scriptPushData1.end(), vchSig.begin(), vchSig.end());
+    vBad.push_back(scriptPushData1);
+    BOOST_FOREACH(const CScript& script, vBad)
+        BOOST_CHECK_EQUAL(VerifyScript(script, scriptPubKey, txTo, 0, flags, 0), EvalScripts(script, scriptPubKey, txTo));
+
+    // The same key behind pay-to-script-hash
+    CScript scriptP2SH;
+    scriptP2SH.SetDestination(scriptPubKey.GetID());
+    uint256 hashP2SH = SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hashP2SH, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    CScript scriptSigP2SH;
+    scriptSigP2SH << vchSig << static_cast<vector<unsigned char> >(scriptPubKey);
+    BOOST_CHECK(VerifyScript(scriptSigP2SH, scriptP2SH, txTo, 0, flags, 0));
+    scriptSigP2SH = CScript() << vchSig << static_cast<vector<unsigned char> >(scriptP2SH);
+    BOOST_CHECK(!VerifyScript(scriptSigP2SH, scriptP2SH, txTo, 0, flags, 0));
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_fastpath_stacksize)
+{
+    // Pay-to-script-hash of an empty redeem script, spent with many pushes.
+    // The interpreter allows 1000 stack elements, counting the script hash
+    // scriptPubKey pushes, and the fast path must agree.
+    CScript scriptEmpty;
+    CScript scriptP2SH;
+    scriptP2SH.SetDestination(scriptEmpty.GetID());
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+
+    static const int nPushes[] = { 998, 999, 1000, 1001 };
+    BOOST_FOREACH(int n, nPushes)
+    {
+        CScript scriptSig;
+        for (int i = 0; i < n - 1; i++)
+            scriptSig << vector<unsigned char>(1, 1);
+        scriptSig << static_cast<vector<unsigned char> >(scriptEmpty);
+        BOOST_CHECK_EQUAL(VerifyScript(scriptSig, scriptP2SH, txTo, 0, flags, 0), n < 1000);
+        BOOST_CHECK_EQUAL(VerifyScript(scriptSig, scriptP2SH, txTo, 0, flags, 0), EvalScripts(scriptSig, scriptP2SH, txTo));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_benchmark)
+{
+    // Interpreter speed on the script_valid.json vectors
+    Array tests = read_json("script_valid.json");
+    vector<pair<CScript, CScript> > vScripts;
+    BOOST_FOREACH(Value& tv, tests)
+    {
+        Array test = tv.get_array();
+        if (test.size() >= 2)
+            vScripts.push_back(make_pair(ParseScript(test[0].get_str()), ParseScript(test[1].get_str())));
+    }
+    static const int ROUNDS = 100;
+    CTransaction tx;
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < ROUNDS; i++)
+        for (unsigned int j = 0; j < vScripts.size(); j++)
+            VerifyScript(vScripts[j].first, vScripts[j].second, tx, 0, flags, SIGHASH_NONE);
+    int64 nVectors = GetTimeMicros() - nStart;
+
+    // A pay-to-pubkey-hash spend whose signature is in the signature cache,
+    // so this measures the script handling only
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    vector<unsigned char> vchSig;
+    key.Sign(SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL), vchSig);
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    CScript scriptSig;
+    scriptSig << vchSig;
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0));
+    static const int SPENDS = 10000;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < SPENDS; i++)
+        VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0);
+    int64 nSpends = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < SPENDS; i++)
+        EvalScripts(scriptSig, scriptPubKey, txTo);
+    int64 nInterpreted = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE(strprintf("script_valid.json: %.1fus per round of %"PRIszu" scripts", (double)nVectors / ROUNDS, vScripts.size()));
+    BOOST_TEST_MESSAGE(strprintf("pay-to-pubkey-hash: %.2fus per spend, %.2fus through the interpreter",
+                                 (double)nSpends / SPENDS, (double)nInterpreted / SPENDS));
+}
+
 CScript
 sign_multisig(CScript scriptPubKey, std::vector<CKey> keys, CTransaction transaction)
 {
@@ -0,0 +1,138 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "key.h"
+#include "secp256k1.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+// Recover with both implementations and check they agree, including on failure
+static void CheckRecovery(const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    CPubKey pubkeyNative, pubkeyOpenSSL;
+    bool fNative = pubkeyNative.RecoverCompact(hash, vchSig);
+    bool fOpenSSL = pubkeyOpenSSL.RecoverCompactOpenSSL(hash, vchSig) && pubkeyOpenSSL.IsValid();
+    BOOST_CHECK_EQUAL(fNative, fOpenSSL);
+    if (fNative && fOpenSSL)
+        BOOST_CHECK(pubkeyNative == pubkeyOpenSSL);
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_recover_signed)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        CKey key;
+        key.MakeNewKey();
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.SignCompact(hash, vchSig));
+
+        CPubKey pubkey;
+        BOOST_CHECK(pubkey.RecoverCompact(hash, vchSig));
+        BOOST_CHECK(pubkey == key.GetPubKey());
+        CheckRecovery(hash, vchSig);
+
+        // A different message recovers a different key
+        CPubKey pubkeyOther;
+        uint256 hashOther = GetRandHash();
+        if (pubkeyOther.RecoverCompact(hashOther, vchSig))
+            BOOST_CHECK(pubkeyOther != pubkey);
+        CheckRecovery(hashOther, vchSig);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_recover_random)
+{
+    // Arbitrary r, s and recovery ids, including out of range values
+    for (int i = 0; i < 300; i++)
+    {
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig(65);
+        uint256 r = GetRandHash(), s = GetRandHash();
+        memcpy(&vchSig[1], r.begin(), 32);
+        memcpy(&vchSig[33], s.begin(), 32);
+        if (i % 3 == 0)
+            memset(&vchSig[1], 0, 16); // small enough for the second x candidate
+        if (i % 7 == 0)
+            memset(&vchSig[33], 0, 32);
+        if (i % 11 == 0)
+            memset(&vchSig[1], 0xFF, 32);
+        vchSig[0] = 26 + i % 6;
+        CheckRecovery(hash, vchSig);
+    }
+
+    // r = 0 and r = n
+    vector<unsigned char> vchSig(65, 0x11);
+    vchSig[0] = 27;
+    memset(&vchSig[1], 0, 32);
+    CheckRecovery(GetRandHash(), vchSig);
+    static const unsigned char order[32] = {
+        0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,
+        0xBA,0xAE,0xDC,0xE6,0xAF,0x48,0xA0,0x3B,0xBF,0xD2,0x5E,0x8C,0xD0,0x36,0x41,0x41
+    };
+    memcpy(&vchSig[1], order, 32);
+    CheckRecovery(GetRandHash(), vchSig);
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_verify_batch)
+{
+    // Valid signatures mixed with a wrong key, a wrong message, a garbage
+    // signature and a truncated one
+    vector<CCompactSigCheck> vChecks;
+    for (int i = 0; i < 40; i++)
+    {
+        CKey key;
+        key.MakeNewKey();
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.SignCompact(hash, vchSig));
+        vChecks.push_back(CCompactSigCheck(hash, vchSig, key.GetPubKey().GetID()));
+    }
+    BOOST_CHECK(VerifyCompactBatch(vChecks));
+
+    vChecks[3].pubKeyHash = vChecks[4].pubKeyHash;
+    vChecks[10].hash = GetRandHash();
+    vChecks[20].vchSig[5] ^= 1;
+    vChecks[30].vchSig.resize(64);
+    vector<bool> vValid;
+    BOOST_CHECK(!VerifyCompactBatch(vChecks, &vValid));
+    BOOST_CHECK_EQUAL(vValid.size(), vChecks.size());
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+    {
+        CPubKey pubkey;
+        bool fValid = pubkey.RecoverCompact(vChecks[i].hash, vChecks[i].vchSig) && pubkey.GetID() == vChecks[i].pubKeyHash;
+        BOOST_CHECK_EQUAL(vValid[i], fValid);
+        BOOST_CHECK_EQUAL(vValid[i], i != 3 && i != 10 && i != 20 && i != 30);
+    }
+
+    BOOST_CHECK(VerifyCompactBatch(vector<CCompactSigCheck>()));
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_recover_benchmark)
+{
+    CKey key;
+    key.MakeNewKey();
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig;
+    key.SignCompact(hash, vchSig);
+
+    static const int COUNT = 500;
+    CPubKey pubkey;
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < COUNT; i++)
+        pubkey.RecoverCompact(hash, vchSig);
+    int64 nNative = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < COUNT; i++)
+        pubkey.RecoverCompactOpenSSL(hash, vchSig);
+    int64 nOpenSSL = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE(strprintf("secp256k1 recovery: native %.0f/s, OpenSSL %.0f/s",
+                                 COUNT * 1e6 / std::max(nNative, (int64)1), COUNT * 1e6 / std::max(nOpenSSL, (int64)1)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
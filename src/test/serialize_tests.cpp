@@ -42,4 +42,53 @@ BOOST_AUTO_TEST_CASE(varints)
 
 }
 
+BOOST_AUTO_TEST_CASE(datastream_view)
+{
+    vector<unsigned char> vch(300);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = i;
+    vector<int> vInts(10, 0x01020304);
+    string str("view");
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vch << vInts << str << VARINT(123456) << (uint64)42;
+    vector<char> vBuf(ss.begin(), ss.end());
+
+    // The view reads exactly what CDataStream reads
+    CDataStreamView view(vBuf, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(view.size(), vBuf.size());
+    vector<unsigned char> vch2;
+    vector<int> vInts2;
+    string str2;
+    int n = 0;
+    uint64 n64 = 0;
+    view >> vch2 >> vInts2 >> str2 >> VARINT(n) >> n64;
+    BOOST_CHECK(vch2 == vch);
+    BOOST_CHECK(vInts2 == vInts);
+    BOOST_CHECK_EQUAL(str2, str);
+    BOOST_CHECK_EQUAL(n, 123456);
+    BOOST_CHECK_EQUAL(n64, 42);
+    BOOST_CHECK(view.empty());
+
+    // Running out of data throws like CDataStream does, also in the middle
+    // of a vector whose size claims more than is left
+    for (unsigned int nCut = 0; nCut < 310; nCut += 7)
+    {
+        CDataStreamView viewShort(&vBuf[0], &vBuf[0] + nCut, SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_CHECK_THROW(viewShort >> vch2 >> vInts2, std::ios_base::failure);
+    }
+    CDataStreamView viewEmpty(vector<char>(), SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_THROW(viewEmpty >> n, std::ios_base::failure);
+
+    // A message of many small scripts, the way blocks and transactions are
+    vector<vector<unsigned char> > vScripts(2000, vector<unsigned char>(25, 0x76));
+    CDataStream ssMsg(SER_NETWORK, PROTOCOL_VERSION);
+    ssMsg << vScripts;
+    vector<char> vMsg(ssMsg.begin(), ssMsg.end());
+    CDataStreamView viewMsg(vMsg, SER_NETWORK, PROTOCOL_VERSION);
+    vector<vector<unsigned char> > vOut;
+    viewMsg >> vOut;
+    BOOST_CHECK(vOut == vScripts);
+    BOOST_CHECK(viewMsg.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,86 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "sha256.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+// The merkle root the way BuildMerkleTree used to compute it
+static uint256 MerkleRootPairwise(const vector<uint256>& vLeaves)
+{
+    vector<uint256> vTree(vLeaves);
+    int j = 0;
+    for (int nSize = vLeaves.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (int i = 0; i < nSize; i += 2)
+        {
+            int i2 = std::min(i+1, nSize-1);
+            vTree.push_back(Hash(BEGIN(vTree[j+i]),  END(vTree[j+i]),
+                                 BEGIN(vTree[j+i2]), END(vTree[j+i2])));
+        }
+        j += nSize;
+    }
+    return (vTree.empty() ? 0 : vTree.back());
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    BOOST_TEST_MESSAGE("SHA256D64 uses " + SHA256AutoDetect());
+
+    // Every count up to a few times the widest kernel, so each of them and
+    // the leftovers are exercised
+    vector<unsigned char> vIn(64 * 40);
+    for (unsigned int i = 0; i < vIn.size(); i++)
+        vIn[i] = GetRandInt(256);
+    for (unsigned int n = 0; n <= 40; n++)
+    {
+        vector<unsigned char> vOut(32 * n + 32, 0xff);
+        SHA256D64(&vOut[0], &vIn[0], n);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            uint256 hash = Hash(vIn.begin() + 64 * i, vIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(&vOut[32 * i], hash.begin(), 32) == 0);
+        }
+        // nothing written past the end
+        BOOST_CHECK(vOut[32 * n] == 0xff);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(merkle_root)
+{
+    for (int nTx = 1; nTx < 70; nTx++)
+    {
+        CBlock block;
+        block.vtx.resize(nTx);
+        vector<uint256> vLeaves;
+        for (int i = 0; i < nTx; i++)
+        {
+            block.vtx[i].nLockTime = GetRandInt(1000000);
+            vLeaves.push_back(block.vtx[i].GetHash());
+        }
+        BOOST_CHECK(block.BuildMerkleTree() == MerkleRootPairwise(vLeaves));
+        // branches are taken from the same tree
+        int nIndex = GetRandInt(nTx);
+        BOOST_CHECK(CBlock::CheckMerkleBranch(vLeaves[nIndex], block.GetMerkleBranch(nIndex), nIndex) == block.BuildMerkleTree());
+    }
+
+    // A tree of a few thousand transactions, with ids cached from
+    // deserialization as in a received block
+    CBlock blockNew;
+    blockNew.vtx.resize(2000);
+    for (unsigned int i = 0; i < blockNew.vtx.size(); i++)
+        blockNew.vtx[i].nLockTime = i;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << blockNew;
+    CBlock block;
+    ss >> block;
+    vector<uint256> vLeaves;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        vLeaves.push_back(tx.GetHash());
+    BOOST_CHECK(block.BuildMerkleTree() == MerkleRootPairwise(vLeaves));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,85 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "hash.h"
+#include "sigcache.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+static uint160 RandomKeyHash()
+{
+    uint256 hash = GetRandHash();
+    return Hash160(hash.begin(), hash.end());
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    CSignatureCache cache;
+    cache.Setup(1000);
+    BOOST_CHECK_EQUAL(cache.GetStats().nCapacity, 1000);
+
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig(65, 0x42);
+    uint160 pubKeyHash = RandomKeyHash();
+
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubKeyHash));
+    cache.Set(hash, vchSig, pubKeyHash);
+    BOOST_CHECK(cache.Get(hash, vchSig, pubKeyHash));
+
+    // Any change to the signed data misses
+    vector<unsigned char> vchOtherSig(vchSig);
+    vchOtherSig[10] ^= 1;
+    BOOST_CHECK(!cache.Get(hash, vchOtherSig, pubKeyHash));
+    BOOST_CHECK(!cache.Get(GetRandHash(), vchSig, pubKeyHash));
+    BOOST_CHECK(!cache.Get(hash, vchSig, RandomKeyHash()));
+
+    // Setting the same signature again doesn't take another slot
+    cache.Set(hash, vchSig, pubKeyHash);
+    CSignatureCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nEntries, 1);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1);
+    BOOST_CHECK_EQUAL(stats.nHits, 1);
+    BOOST_CHECK_EQUAL(stats.nMisses, 4);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_fixed_size)
+{
+    CSignatureCache cache;
+    cache.Setup(64);
+
+    vector<unsigned char> vchSig(65, 0x42);
+    uint160 pubKeyHash;
+    vector<uint256> vHashes;
+    for (int i = 0; i < 1000; i++)
+    {
+        vHashes.push_back(GetRandHash());
+        cache.Set(vHashes.back(), vchSig, pubKeyHash);
+    }
+
+    // Old entries were overwritten rather than the table growing
+    CSignatureCache::Stats stats = cache.GetStats();
+    BOOST_CHECK(stats.nEntries <= stats.nCapacity);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1000);
+    int nFound = 0;
+    BOOST_FOREACH(const uint256& hash, vHashes)
+        if (cache.Get(hash, vchSig, pubKeyHash))
+            nFound++;
+    BOOST_CHECK(nFound > 0 && nFound <= 64);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_disabled)
+{
+    CSignatureCache cache;
+    cache.Setup(0);
+
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig(65, 0x42);
+    cache.Set(hash, vchSig, uint160());
+    BOOST_CHECK(!cache.Get(hash, vchSig, uint160()));
+    BOOST_CHECK_EQUAL(cache.GetStats().nCapacity, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,66 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+static CScript RandomScript()
+{
+    static const opcodetype ops[] = { OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR };
+    CScript script;
+    int nOps = GetRandInt(10);
+    for (int i = 0; i < nOps; i++)
+        script << ops[GetRandInt(sizeof(ops) / sizeof(ops[0]))];
+    return script;
+}
+
+static CTransaction RandomTransaction(int nInputs, int nOutputs)
+{
+    CTransaction tx;
+    tx.nVersion = GetRandInt(3);
+    tx.nLockTime = GetRandInt(2) ? GetRandInt(1000000) : 0;
+    tx.vin.resize(nInputs);
+    for (int i = 0; i < nInputs; i++)
+    {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), GetRandInt(4));
+        tx.vin[i].scriptSig = RandomScript();
+        tx.vin[i].nSequence = GetRandInt(2) ? GetRandInt(1000000) : std::numeric_limits<unsigned int>::max();
+    }
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++)
+    {
+        tx.vout[i].nValue = GetRandInt(100000000);
+        tx.vout[i].scriptPubKey = RandomScript();
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(sighash_cache_matches)
+{
+    static const int hashTypes[] = {
+        SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 0, 4, 0x21,
+        SIGHASH_ALL | SIGHASH_ANYONECANPAY, SIGHASH_NONE | SIGHASH_ANYONECANPAY, SIGHASH_SINGLE | SIGHASH_ANYONECANPAY
+    };
+    for (int i = 0; i < 50; i++)
+    {
+        // Enough inputs now and then to need a longer compact size
+        int nInputs = 1 + (i % 10 == 0 ? 260 : GetRandInt(8));
+        CTransaction tx = RandomTransaction(nInputs, 1 + GetRandInt(5));
+        CSigHashCache cache(tx);
+        for (int j = 0; j < 20; j++)
+        {
+            CScript scriptCode = RandomScript();
+            unsigned int nIn = GetRandInt(nInputs + 1); // sometimes out of range
+            int nHashType = hashTypes[GetRandInt(sizeof(hashTypes) / sizeof(hashTypes[0]))];
+            BOOST_CHECK(cache.SignatureHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, tx, nIn, nHashType));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
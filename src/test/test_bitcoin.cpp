@@ -6,6 +6,8 @@
 #include "txdb.h"
 #include "main.h"
 #include "wallet.h"
+#include "sigcache.h"
+#include "sha256.h"
 #include "util.h"
 
 CWallet* pwalletMain;
@@ -22,6 +24,7 @@ struct TestingSetup {
     TestingSetup() {
         fPrintToDebugger = true; // don't want to write to debug.log file
         noui_connect();
+        SHA256AutoDetect();
         bitdb.MakeMock();
         pathTemp = GetTempPath() / strprintf("test_spreadcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
         boost::filesystem::create_directories(pathTemp);
@@ -34,6 +37,7 @@ struct TestingSetup {
         pwalletMain = new CWallet("wallet.dat");
         pwalletMain->LoadWallet(fFirstRun);
         RegisterWallet(pwalletMain);
+        InitSignatureCache();
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
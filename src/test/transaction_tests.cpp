@@ -167,6 +167,7 @@ BOOST_AUTO_TEST_CASE(basic_transaction_tests)
 
     // Check that duplicate txins fail
     tx.vin.push_back(tx.vin[0]);
+    tx.ClearCache();
     BOOST_CHECK_MESSAGE(!tx.CheckTransaction(state) || !state.IsValid(), "Transaction with duplicate txins should be invalid.");
 }
 
@@ -273,4 +274,86 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!t.IsStandard());
 }
 
+BOOST_AUTO_TEST_CASE(tx_cached_hash)
+{
+    CTransaction txNew;
+    txNew.vin.resize(2);
+    txNew.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txNew.vin[0].scriptSig << std::vector<unsigned char>(66, 1);
+    txNew.vin[1].prevout = COutPoint(GetRandHash(), 3);
+    txNew.vin[1].scriptSig << std::vector<unsigned char>(66, 2);
+    txNew.vout.resize(2);
+    txNew.vout[0].nValue = 10*CENT;
+    txNew.vout[0].scriptPubKey << OP_1;
+    txNew.vout[1].nValue = 20*CENT;
+    txNew.vout[1].scriptPubKey << OP_2;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << txNew;
+    unsigned int nSize = ss.size();
+    CTransaction tx;
+    ss >> tx;
+    BOOST_CHECK(tx.GetHash() == txNew.GetHash());
+    BOOST_CHECK(tx.GetHash() == SerializeHash(txNew));
+    BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), nSize);
+
+    // Copies don't carry the cache, so they can be modified freely
+    CTransaction txCopy(tx);
+    txCopy.nLockTime++;
+    BOOST_CHECK(txCopy.GetHash() == SerializeHash(txCopy));
+    BOOST_CHECK(txCopy.GetHash() != tx.GetHash());
+    CTransaction txAssigned;
+    txAssigned = tx;
+    txAssigned.vout[0].nValue++;
+    BOOST_CHECK(txAssigned.GetHash() == SerializeHash(txAssigned));
+    BOOST_CHECK(txAssigned.GetHash() != tx.GetHash());
+    BOOST_CHECK(tx.GetHash() == txNew.GetHash());
+
+    // Modified transactions must drop the cache
+    tx.vout[0].nValue = 11*CENT;
+    tx.vin.push_back(tx.vin[0]);
+    tx.ClearCache();
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2 << tx;
+    BOOST_CHECK(tx.GetHash() != txNew.GetHash());
+    BOOST_CHECK(tx.GetHash() == Hash(ss2.begin(), ss2.end()));
+    BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), ss2.size());
+
+    // Connecting a block asks for every transaction's hash several times
+    // (duplicate check, merkle root, coins and undo updates) and for its
+    // size once; compare deserialized transactions against copies built in
+    // memory, which have to be serialized again on every call.
+    static const int TXS = 1000;
+    static const int LOOKUPS = 4;
+    vector<CTransaction> vReceived(TXS);
+    vector<CTransaction> vBuilt(TXS, txNew);
+    for (int i = 0; i < TXS; i++)
+    {
+        vBuilt[i].nLockTime = i;
+        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+        ssTx << vBuilt[i];
+        ssTx >> vReceived[i];
+    }
+    uint256 hashSum = 0;
+    int64 nStart = GetTimeMicros();
+    BOOST_FOREACH(const CTransaction& txi, vBuilt)
+    {
+        hashSum ^= (uint64)::GetSerializeSize(txi, SER_NETWORK, PROTOCOL_VERSION);
+        for (int i = 0; i < LOOKUPS; i++)
+            hashSum ^= txi.GetHash();
+    }
+    int64 nBuilt = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    BOOST_FOREACH(const CTransaction& txi, vReceived)
+    {
+        hashSum ^= (uint64)::GetSerializeSize(txi, SER_NETWORK, PROTOCOL_VERSION);
+        for (int i = 0; i < LOOKUPS; i++)
+            hashSum ^= txi.GetHash();
+    }
+    int64 nReceived = GetTimeMicros() - nStart;
+    // Both passes see the same transactions, so everything cancels out
+    BOOST_CHECK(hashSum == 0);
+    BOOST_TEST_MESSAGE(strprintf("%d transactions: %"PRI64d"us uncached, %"PRI64d"us cached", TXS, nBuilt, nReceived));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
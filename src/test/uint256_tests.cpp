@@ -1,6 +1,8 @@
 #include <boost/test/unit_test.hpp>
 
+#include "main.h"
 #include "uint256.h"
+#include "util.h"
 
 BOOST_AUTO_TEST_SUITE(uint256_tests)
 
@@ -15,4 +17,114 @@ BOOST_AUTO_TEST_CASE(uint256_equality)
     BOOST_CHECK(num1+num2 == num3+num2);
 }
 
+BOOST_AUTO_TEST_CASE(uint256_SetCompact)
+{
+    // The same values as bignum_SetCompact
+    uint256 num;
+    bool fNegative, fOverflow;
+    num.SetCompact(0, &fNegative, &fOverflow);
+    BOOST_CHECK(num == 0 && !fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0U);
+
+    num.SetCompact(0x00123456);
+    BOOST_CHECK(num == 0);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0U);
+
+    num.SetCompact(0x01123456);
+    BOOST_CHECK(num == 0x12);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x01120000U);
+
+    num = 0x80;
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x02008000U);
+
+    num.SetCompact(0x01fedcba, &fNegative, &fOverflow);
+    BOOST_CHECK(num == 0x7e && fNegative && !fOverflow);
+
+    num.SetCompact(0x02123456);
+    BOOST_CHECK(num == 0x1234);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x02123400U);
+
+    num.SetCompact(0x03123456);
+    BOOST_CHECK(num == 0x123456);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x03123456U);
+
+    num.SetCompact(0x04123456);
+    BOOST_CHECK(num == 0x12345600);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x04123456U);
+
+    num.SetCompact(0x05009234);
+    BOOST_CHECK(num == 0x92340000);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x05009234U);
+
+    num.SetCompact(0x20123456, &fNegative, &fOverflow);
+    BOOST_CHECK(num == uint256("0x1234560000000000000000000000000000000000000000000000000000000000"));
+    BOOST_CHECK(!fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x20123456U);
+
+    num.SetCompact(0x21123456, &fNegative, &fOverflow);
+    BOOST_CHECK(!fNegative && fOverflow);
+
+    num.SetCompact(0xff123456, &fNegative, &fOverflow);
+    BOOST_CHECK(!fNegative && fOverflow);
+}
+
+BOOST_AUTO_TEST_CASE(uint256_arith)
+{
+    BOOST_CHECK_THROW(uint256(1) / uint256(0), uint_error);
+    BOOST_CHECK(uint256(0).bits() == 0);
+    BOOST_CHECK(uint256(1).bits() == 1);
+    BOOST_CHECK((~uint256(0)).bits() == 256);
+    BOOST_CHECK((~uint256(0) >> 20).bits() == 236);
+
+    // Random operands of every size against OpenSSL
+    for (int i = 0; i < 2000; i++)
+    {
+        uint256 a = GetRandHash() >> GetRandInt(256);
+        uint256 b = GetRandHash() >> GetRandInt(256);
+        uint32_t c = GetRandInt(1 << 30);
+        CBigNum bnA(a), bnB(b);
+        CBigNum bnModulus = CBigNum(1) << 256;
+        BOOST_CHECK((a * c) == ((bnA * CBigNum(c)) % bnModulus).getuint256());
+        BOOST_CHECK((a * b) == ((bnA * bnB) % bnModulus).getuint256());
+        if (b != 0)
+            BOOST_CHECK((a / b) == (bnA / bnB).getuint256());
+        BOOST_CHECK_EQUAL(a.GetCompact(), bnA.GetCompact());
+
+        unsigned int nBits = bnA.GetCompact();
+        BOOST_CHECK(uint256().SetCompact(nBits) == CBigNum().SetCompact(nBits).getuint256());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(uint256_blockwork)
+{
+    // GetBlockWork used to compute 2**256 / (target+1) with CBigNum
+    std::vector<unsigned int> vBits;
+    for (int i = 0; i < 1000; i++)
+        vBits.push_back((GetRandHash() >> GetRandInt(220)).GetCompact());
+    vBits.push_back(0x1e0fffff);
+    vBits.push_back(0x1d00ffff);
+    vBits.push_back(0x01010000);
+
+    std::vector<uint256> vWork;
+    BOOST_FOREACH(unsigned int nBits, vBits)
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        vWork.push_back(((CBigNum(1)<<256) / (bnTarget+1)).getuint256());
+    }
+
+    for (unsigned int i = 0; i < vBits.size(); i++)
+    {
+        CBlockIndex index;
+        index.nBits = vBits[i];
+        BOOST_CHECK(index.GetBlockWork() == vWork[i]);
+    }
+
+    CBlockIndex index;
+    index.nBits = 0x04923456;
+    BOOST_CHECK(index.GetBlockWork() == 0);
+    index.nBits = 0;
+    BOOST_CHECK(index.GetBlockWork() == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
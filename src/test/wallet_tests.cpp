@@ -2,6 +2,7 @@
 
 #include "main.h"
 #include "wallet.h"
+#include "util.h"
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -291,4 +292,546 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     }
 }
 
+// A wallet of nCoins small mature coins, like a pool's, a thousand to a transaction
+static void MakeLargeWallet(int nCoins, int64 nGranularity, vector<CWalletTx*>& vTx, vector<COutput>& vCoinsLarge)
+{
+    for (int i = 0; i < nCoins; i++)
+    {
+        if (i % 1000 == 0)
+        {
+            CTransaction tx;
+            tx.nLockTime = i;
+            vTx.push_back(new CWalletTx(&wallet, tx));
+        }
+        CWalletTx* wtx = vTx.back();
+        int64 nValue = CENT + GetRandInt(COIN / nGranularity) * nGranularity;
+        wtx->vout.push_back(CTxOut(nValue, CScript()));
+        vCoinsLarge.push_back(COutput(wtx, wtx->vout.size() - 1, 6*24));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_large)
+{
+    CoinSet setCoinsRet;
+    int64 nValueRet;
+
+    vector<CWalletTx*> vTx;
+    vector<COutput> vCoinsLarge;
+    MakeLargeWallet(10000, 1, vTx, vCoinsLarge);
+
+    // less than the largest coins, a hundred of them, more than a thousand
+    // of them
+    int64 vTargets[] = { COIN / 2, 100 * COIN, 1500 * COIN };
+    BOOST_FOREACH(int64 nTarget, vTargets)
+    {
+        BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, 1, 6, vCoinsLarge, setCoinsRet, nValueRet));
+        BOOST_CHECK(nValueRet >= nTarget);
+        int64 nTotal = 0;
+        BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoinsRet)
+            nTotal += coin.first->vout[coin.second].nValue;
+        BOOST_CHECK_EQUAL(nTotal, nValueRet);
+    }
+    BOOST_FOREACH(CWalletTx* wtx, vTx)
+        delete wtx;
+
+    // Whole cents often add up to the amount exactly
+    vTx.clear();
+    vCoinsLarge.clear();
+    MakeLargeWallet(10000, CENT, vTx, vCoinsLarge);
+    for (int i = 0; i < 10; i++)
+    {
+        int64 nTarget = (150 + GetRandInt(1000)) * CENT;
+        BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, 1, 6, vCoinsLarge, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, nTarget);
+    }
+    BOOST_FOREACH(CWalletTx* wtx, vTx)
+        delete wtx;
+}
+
+BOOST_AUTO_TEST_CASE(ismine_index)
+{
+    CWallet wallet;
+    std::vector<CKey> vKeys(4);
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+    {
+        vKeys[i].MakeNewKey(i % 2 == 0);
+        if (i < 2)
+            wallet.AddKeyPubKey(vKeys[i], vKeys[i].GetPubKey());
+        else
+            wallet.LoadKey(vKeys[i], vKeys[i].GetPubKey());
+    }
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+
+    // Redeem scripts with all keys ours, and with one key that isn't
+    std::vector<CKeyID> vMultiMine, vMultiPartly;
+    for (int i = 0; i < 2; i++)
+        vMultiMine.push_back(vKeys[i].GetPubKey().GetID());
+    vMultiPartly = vMultiMine;
+    vMultiPartly.push_back(keyOther.GetPubKey().GetID());
+    CScript scriptMultiMine, scriptMultiPartly;
+    scriptMultiMine.SetMultisig(1, vMultiMine);
+    scriptMultiPartly.SetMultisig(1, vMultiPartly);
+    wallet.AddCScript(scriptMultiMine);
+    wallet.LoadCScript(scriptMultiPartly);
+
+    std::vector<CScript> vScripts;
+    BOOST_FOREACH(const CKey& key, vKeys)
+    {
+        CScript script;
+        script.SetDestination(key.GetPubKey().GetID());
+        vScripts.push_back(script);
+        // the same key hash behind an unusual push
+        CScript scriptPushData1;
+        scriptPushData1.push_back(OP_PUSHDATA1);
+        scriptPushData1.insert(scriptPushData1.end(), script.begin(), script.end());
+        vScripts.push_back(scriptPushData1);
+    }
+    CScript script;
+    script.SetDestination(keyOther.GetPubKey().GetID());
+    vScripts.push_back(script);
+    script.SetDestination(scriptMultiMine.GetID());
+    vScripts.push_back(script);
+    script.SetDestination(scriptMultiPartly.GetID());
+    vScripts.push_back(script);
+    vScripts.push_back(scriptMultiMine);
+    vScripts.push_back(scriptMultiPartly);
+    vScripts.push_back(CScript() << OP_RETURN);
+    vScripts.push_back(CScript());
+    vScripts.push_back(CScript() << std::vector<unsigned char>(20, 2) << OP_CHECKSIG);
+    vScripts.push_back(CScript() << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUAL);
+
+    int nMine = 0;
+    BOOST_FOREACH(const CScript& scriptPubKey, vScripts)
+    {
+        CTxOut txout(1, scriptPubKey);
+        BOOST_CHECK_EQUAL(wallet.IsMine(txout), IsMine(wallet, scriptPubKey));
+        nMine += wallet.IsMine(txout);
+    }
+    BOOST_CHECK_EQUAL(nMine, 2 * (int)vKeys.size() + 2);
+
+    // The common case of an output that isn't ours
+    CTxOut txoutOther(1, vScripts[2 * vKeys.size()]);
+    BOOST_CHECK(!IsMine(wallet, txoutOther.scriptPubKey));
+    BOOST_CHECK(!wallet.IsMine(txoutOther));
+}
+
+// The balances the way they used to be computed, from every transaction
+static void BalancesFromHistory(const CWallet& wallet, int64& nBalance, int64& nUnconfirmed, int64& nImmature, unsigned int& nCoins)
+{
+    LOCK(wallet.cs_wallet);
+    nBalance = nUnconfirmed = nImmature = 0;
+    nCoins = 0;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = (*it).second;
+        if (wtx.IsConfirmed())
+            nBalance += wtx.GetAvailableCredit(false);
+        if (!wtx.IsFinal() || !wtx.IsConfirmed())
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+        nImmature += wtx.GetImmatureCredit(false);
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (wtx.IsFinal() && !wtx.IsSpent(i) && IsMine(wallet, wtx.vout[i].scriptPubKey) && wtx.vout[i].nValue >= nMinimumInputValue)
+                nCoins++;
+    }
+}
+
+static void CheckBalances(const CWallet& wallet)
+{
+    int64 nBalance, nUnconfirmed, nImmature;
+    unsigned int nCoins;
+    BalancesFromHistory(wallet, nBalance, nUnconfirmed, nImmature, nCoins);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+    vector<COutput> vAvailable;
+    wallet.AvailableCoins(vAvailable, false);
+    BOOST_CHECK_EQUAL(vAvailable.size(), nCoins);
+}
+
+BOOST_AUTO_TEST_CASE(balances)
+{
+    CWallet walletBalances("wallet_balances.dat");
+    CKey key, keyLater;
+    key.MakeNewKey(true);
+    keyLater.MakeNewKey(true);
+    walletBalances.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptMine, scriptLater, scriptOther;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+    scriptLater.SetDestination(keyLater.GetPubKey().GetID());
+    scriptOther << std::vector<unsigned char>(20, 2) << OP_CHECKSIG;
+    CheckBalances(walletBalances);
+
+    // Payments to us, some with an output to a key we only get later
+    static const int PAYMENTS = 300;
+    std::vector<COutPoint> vMine;
+    int64 nReceived = 0;
+    for (int i = 0; i < PAYMENTS; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.resize(3);
+        tx.vout[0].nValue = 1 + GetRandInt(1000000);
+        tx.vout[0].scriptPubKey = scriptMine;
+        tx.vout[1].nValue = 1 + GetRandInt(1000000);
+        tx.vout[1].scriptPubKey = (i % 10 == 0 ? scriptLater : scriptOther);
+        tx.vout[2].nValue = 1 + GetRandInt(1000000);
+        tx.vout[2].scriptPubKey = scriptOther;
+        nReceived += tx.vout[0].nValue;
+        vMine.push_back(COutPoint(tx.GetHash(), 0));
+        BOOST_CHECK(walletBalances.AddToWalletIfInvolvingMe(tx.GetHash(), tx, NULL, true));
+    }
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), nReceived);
+    CheckBalances(walletBalances);
+
+    // Spend some of them, with change back to us
+    for (int i = 0; i < PAYMENTS / 3; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(2);
+        for (int j = 0; j < 2; j++)
+        {
+            tx.vin[j].prevout = vMine.back();
+            vMine.pop_back();
+        }
+        tx.vout.resize(2);
+        tx.vout[0].nValue = 1;
+        tx.vout[0].scriptPubKey = scriptOther;
+        tx.vout[1].nValue = 1 + GetRandInt(1000);
+        tx.vout[1].scriptPubKey = scriptMine;
+        BOOST_CHECK(walletBalances.AddToWalletIfInvolvingMe(tx.GetHash(), tx, NULL, true));
+        if (i % 10 == 0)
+            CheckBalances(walletBalances);
+    }
+    CheckBalances(walletBalances);
+
+    // Outputs of transactions we already have turn into ours
+    int64 nBefore = walletBalances.GetUnconfirmedBalance();
+    walletBalances.AddKeyPubKey(keyLater, keyLater.GetPubKey());
+    walletBalances.MarkDirty(); // as importprivkey does
+    BOOST_CHECK(walletBalances.GetUnconfirmedBalance() > nBefore);
+    CheckBalances(walletBalances);
+
+    // A key no transaction pays to, as from a key pool top-up, changes nothing
+    CKey keyUnused;
+    keyUnused.MakeNewKey(true);
+    walletBalances.AddKeyPubKey(keyUnused, keyUnused.GetPubKey());
+    CheckBalances(walletBalances);
+
+    // A bare multisig output is ours once we have all of its keys
+    CKey keyMulti1, keyMulti2;
+    keyMulti1.MakeNewKey(true);
+    keyMulti2.MakeNewKey(false);
+    std::vector<CKeyID> vMulti;
+    vMulti.push_back(keyMulti1.GetPubKey().GetID());
+    vMulti.push_back(keyMulti2.GetPubKey().GetID());
+    CTransaction txMulti;
+    txMulti.vin.resize(1);
+    txMulti.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txMulti.vout.resize(2);
+    txMulti.vout[0].nValue = 1000;
+    txMulti.vout[0].scriptPubKey = scriptMine;
+    txMulti.vout[1].nValue = 5000;
+    txMulti.vout[1].scriptPubKey.SetMultisig(1, vMulti);
+    BOOST_CHECK(walletBalances.AddToWalletIfInvolvingMe(txMulti.GetHash(), txMulti, NULL, true));
+    nBefore = walletBalances.GetUnconfirmedBalance();
+    walletBalances.AddKeyPubKey(keyMulti1, keyMulti1.GetPubKey());
+    walletBalances.MarkDirty();
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), nBefore);
+    walletBalances.AddKeyPubKey(keyMulti2, keyMulti2.GetPubKey());
+    walletBalances.MarkDirty();
+    BOOST_CHECK_EQUAL(walletBalances.GetUnconfirmedBalance(), nBefore + 5000);
+    CheckBalances(walletBalances);
+
+    // Polling the balances again is answered from the cache, with the
+    // same result
+    CheckBalances(walletBalances);
+}
+
+BOOST_AUTO_TEST_CASE(payouts)
+{
+    CWallet walletPayouts("wallet_payouts.dat");
+    CKey key;
+    key.MakeNewKey(true);
+    walletPayouts.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    // Coins of one coin each, in a block on top of the chain
+    CBlock block;
+    block.hashPrevBlock = pindexBest->GetBlockHash();
+    block.vtx.resize(1000);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        block.vtx[i].vin.resize(1);
+        block.vtx[i].vin[0].prevout = COutPoint(GetRandHash(), 0);
+        block.vtx[i].vout.push_back(CTxOut(COIN, scriptMine));
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    uint256 hashBlock = block.GetHash();
+    CBlockIndex index;
+    index.phashBlock = &hashBlock;
+    index.pprev = pindexBest;
+    index.nHeight = pindexBest->nHeight + 1;
+    index.hashMerkleRoot = block.hashMerkleRoot;
+    mapBlockIndex[hashBlock] = &index;
+    CBlockIndex* pindexPrevBest = pindexBest;
+    pindexBest = &index;
+    nBestHeight = index.nHeight;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        CWalletTx wtx(&walletPayouts, tx);
+        wtx.SetMerkleBranch(&block);
+        walletPayouts.AddToWallet(wtx);
+    }
+    BOOST_CHECK_EQUAL(walletPayouts.GetBalance(), 1000 * COIN);
+
+    // More recipients than fit in one transaction
+    vector<pair<CScript, int64> > vecSend;
+    int64 nValue = 0;
+    for (int i = 0; i < 3000; i++)
+    {
+        uint256 hash = GetRandHash();
+        uint160 hashRecipient;
+        memcpy(hashRecipient.begin(), hash.begin(), 20);
+        CScript scriptPubKey;
+        scriptPubKey.SetDestination(CKeyID(hashRecipient));
+        vecSend.push_back(make_pair(scriptPubKey, COIN / 10 + GetRandInt(COIN / 10)));
+        nValue += vecSend.back().second;
+    }
+    CPayoutBatch batch;
+    string strFailReason;
+    BOOST_CHECK(walletPayouts.CreatePayouts(vecSend, batch, strFailReason));
+    BOOST_CHECK(batch.vwtx.size() > 1);
+
+    // Everyone is paid once, every input is signed and fees add up
+    multiset<pair<CScript, int64> > setToPay(vecSend.begin(), vecSend.end());
+    set<COutPoint> setSpent;
+    int64 nFee = 0;
+    BOOST_FOREACH(const CWalletTx& wtx, batch.vwtx)
+    {
+        BOOST_CHECK(::GetSerializeSize(*(CTransaction*)&wtx, SER_NETWORK, PROTOCOL_VERSION) < MAX_STANDARD_TX_SIZE);
+        int64 nValueIn = 0;
+        for (unsigned int i = 0; i < wtx.vin.size(); i++)
+        {
+            const COutPoint& prevout = wtx.vin[i].prevout;
+            BOOST_CHECK(setSpent.insert(prevout).second);
+            const CWalletTx& wtxFrom = walletPayouts.mapWallet[prevout.hash];
+            nValueIn += wtxFrom.vout[prevout.n].nValue;
+            BOOST_CHECK(VerifySignature(CCoins(wtxFrom, index.nHeight), wtx, i, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0));
+        }
+        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        {
+            multiset<pair<CScript, int64> >::iterator it = setToPay.find(make_pair(txout.scriptPubKey, txout.nValue));
+            if (it != setToPay.end())
+                setToPay.erase(it);
+            else
+                BOOST_CHECK(walletPayouts.IsMine(txout));
+        }
+        nFee += nValueIn - wtx.GetValueOut();
+    }
+    BOOST_CHECK(setToPay.empty());
+    BOOST_CHECK_EQUAL(nFee, batch.nFee);
+
+    // Recorded all together. Broadcasting fails, the coins aren't in the
+    // coins database.
+    walletPayouts.CommitPayouts(batch);
+    BOOST_CHECK_EQUAL(walletPayouts.GetBalance() + walletPayouts.GetUnconfirmedBalance(), 1000 * COIN - nValue - nFee);
+    CWallet walletReloaded("wallet_payouts.dat");
+    bool fFirstRun;
+    BOOST_CHECK(walletReloaded.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    BOOST_FOREACH(const CWalletTx& wtx, batch.vwtx)
+        BOOST_CHECK(walletReloaded.mapWallet.count(wtx.GetHash()));
+    BOOST_FOREACH(const COutPoint& prevout, setSpent)
+        BOOST_CHECK(walletReloaded.mapWallet[prevout.hash].IsSpent(prevout.n));
+
+    pindexBest = pindexPrevBest;
+    nBestHeight = pindexBest->nHeight;
+    mapBlockIndex.erase(hashBlock);
+}
+
+BOOST_AUTO_TEST_CASE(lazy_load)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    // A confirmed transaction with its supporting transactions
+    CWalletTx wtx;
+    wtx.vin.resize(1);
+    wtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    wtx.vout.push_back(CTxOut(COIN, scriptMine));
+    wtx.vtxPrev.resize(3);
+    for (unsigned int i = 0; i < wtx.vtxPrev.size(); i++)
+        wtx.vtxPrev[i].nLockTime = i + 1;
+    wtx.hashBlock = GetRandHash();
+    uint256 hash = wtx.GetHash();
+    {
+        CWallet walletLazy("wallet_lazy.dat");
+        bool fFirstRun;
+        BOOST_CHECK(walletLazy.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        walletLazy.AddKeyPubKey(key, key.GetPubKey());
+        wtx.BindWallet(&walletLazy);
+        BOOST_CHECK(walletLazy.AddToWallet(wtx));
+    }
+
+    {
+        CWallet walletLazy("wallet_lazy.dat");
+        walletLazy.fLazyLoad = true;
+        bool fFirstRun;
+        BOOST_CHECK(walletLazy.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        BOOST_CHECK(walletLazy.mapWallet.count(hash));
+        CWalletTx& wtxLoaded = walletLazy.mapWallet[hash];
+        BOOST_CHECK(wtxLoaded.vtxPrev.empty());
+        BOOST_CHECK(wtxLoaded.fPrevUnloaded);
+
+        // Read back on demand, the second time from the cache
+        for (int i = 0; i < 2; i++)
+        {
+            vector<CMerkleTx> vtxPrevLoaded;
+            const vector<CMerkleTx>& vtxPrev = wtxLoaded.GetPrev(vtxPrevLoaded);
+            BOOST_CHECK_EQUAL(vtxPrev.size(), 3U);
+            if (vtxPrev.size() == 3)
+                BOOST_CHECK(vtxPrev[2].GetHash() == wtx.vtxPrev[2].GetHash());
+        }
+
+        // Writing it back doesn't lose them
+        wtxLoaded.MarkSpent(0);
+        BOOST_CHECK(wtxLoaded.WriteToDisk());
+
+        // One whose stored record can't be read isn't written without them
+        CWalletTx wtxMissing(wtxLoaded);
+        wtxMissing.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        BOOST_CHECK(wtxMissing.fPrevUnloaded);
+        BOOST_CHECK(!wtxMissing.WriteToDisk());
+        vector<CMerkleTx> vtxPrevMissing;
+        BOOST_CHECK(!CWalletDB("wallet_lazy.dat").ReadPrev(wtxMissing.GetHash(), vtxPrevMissing));
+    }
+
+    CWallet walletFull("wallet_lazy.dat");
+    bool fFirstRun;
+    BOOST_CHECK(walletFull.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    const CWalletTx& wtxFull = walletFull.mapWallet[hash];
+    BOOST_CHECK(!wtxFull.fPrevUnloaded);
+    BOOST_CHECK(wtxFull.IsSpent(0));
+    BOOST_CHECK_EQUAL(wtxFull.vtxPrev.size(), 3U);
+}
+
+// The rescan as it used to be: one block after the other, every transaction
+// through AddToWalletIfInvolvingMe
+static int ScanSequentially(CWallet& wallet, CBlockIndex* pindexStart)
+{
+    int ret = 0;
+    LOCK(wallet.cs_wallet);
+    for (CBlockIndex* pindex = pindexStart; pindex; pindex = pindex->pnext)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            continue;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            if (wallet.AddToWalletIfInvolvingMe(tx.GetHash(), tx, &block, true))
+                ret++;
+        }
+    }
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(rescan)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    // A chain where some transactions pay us and later ones spend those
+    // coins, which only shows when the blocks are committed in order
+    static const int BLOCKS = 200;
+    std::vector<CBlock> vBlocks(BLOCKS);
+    std::vector<COutPoint> vMine;
+    for (int i = 0; i < BLOCKS; i++)
+    {
+        CBlock& block = vBlocks[i];
+        block.nHeight = i;
+        block.nTime = 1400000000 + i;
+        block.hashPrevBlock = (i > 0 ? vBlocks[i-1].GetHash() : 0);
+        block.vtx.resize(1 + GetRandInt(20));
+        BOOST_FOREACH(CTransaction& tx, block.vtx)
+        {
+            tx.vin.resize(1);
+            if (!vMine.empty() && GetRandInt(4) == 0)
+            {
+                tx.vin[0].prevout = vMine.back();
+                vMine.pop_back();
+            }
+            else
+                tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            tx.vout.resize(1 + GetRandInt(2));
+            for (unsigned int n = 0; n < tx.vout.size(); n++)
+            {
+                tx.vout[n].nValue = 1 + GetRandInt(1000000);
+                if (GetRandInt(10) == 0)
+                {
+                    tx.vout[n].scriptPubKey = scriptMine;
+                    vMine.push_back(COutPoint(tx.GetHash(), n));
+                }
+                else
+                    tx.vout[n].scriptPubKey << std::vector<unsigned char>(20, 2) << OP_CHECKSIG;
+            }
+        }
+        block.hashMerkleRoot = block.BuildMerkleTree();
+    }
+
+    // Write them to a block file of their own and index them
+    std::vector<uint256> vHashes(BLOCKS);
+    std::vector<CBlockIndex> vIndex(BLOCKS);
+    CDiskBlockPos pos(900, 0);
+    for (int i = 0; i < BLOCKS; i++)
+    {
+        CDiskBlockPos posBlock = pos;
+        BOOST_CHECK(vBlocks[i].WriteToDisk(posBlock));
+        pos.nPos = posBlock.nPos + ::GetSerializeSize(vBlocks[i], SER_DISK, CLIENT_VERSION);
+
+        vHashes[i] = vBlocks[i].GetHash();
+        CBlockIndex& index = vIndex[i];
+        index.phashBlock = &vHashes[i];
+        index.nHeight = i;
+        index.nFile = posBlock.nFile;
+        index.nDataPos = posBlock.nPos;
+        index.nStatus = BLOCK_HAVE_DATA;
+        index.nTx = vBlocks[i].vtx.size();
+        index.nChainTx = (i > 0 ? vIndex[i-1].nChainTx : 0) + index.nTx;
+        if (i > 0)
+            vIndex[i-1].pnext = &index;
+    }
+
+    CWallet walletSequential("wallet_rescan_seq.dat");
+    CWallet walletParallel("wallet_rescan_par.dat");
+    walletSequential.AddKeyPubKey(key, key.GetPubKey());
+    walletParallel.AddKeyPubKey(key, key.GetPubKey());
+
+    int nSequential = ScanSequentially(walletSequential, &vIndex[0]);
+    int nParallel = walletParallel.ScanForWalletTransactions(&vIndex[0], true);
+
+    // Same transactions found, and the same coins spent
+    BOOST_CHECK(nSequential > 0);
+    BOOST_CHECK_EQUAL(nParallel, nSequential);
+    BOOST_CHECK_EQUAL(walletParallel.mapWallet.size(), walletSequential.mapWallet.size());
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CWalletTx)& item, walletSequential.mapWallet)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mi = walletParallel.mapWallet.find(item.first);
+        BOOST_CHECK(mi != walletParallel.mapWallet.end());
+        if (mi == walletParallel.mapWallet.end())
+            continue;
+        BOOST_CHECK(mi->second.hashBlock == item.second.hashBlock);
+        BOOST_CHECK(mi->second.vfSpent == item.second.vfSpent);
+    }
+    BOOST_CHECK(walletParallel.GetBalance() == walletSequential.GetBalance());
+
+    int nHeight, nEndHeight;
+    BOOST_CHECK(!walletParallel.GetRescanProgress(nHeight, nEndHeight));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
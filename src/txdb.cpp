@@ -73,14 +73,27 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
-bool CBlockTreeDB::ReadBestInvalidWork(CBigNum& bnBestInvalidWork)
+// The best invalid work used to be stored as a CBigNum, which serializes as
+// a vector of its little endian magnitude with no leading zeros and a sign
+// bit in the top byte. It is kept in that format, without the bignum.
+bool CBlockTreeDB::ReadBestInvalidWork(uint256& nBestInvalidWork)
 {
-    return Read('I', bnBestInvalidWork);
+    std::vector<unsigned char> vch;
+    if (!Read('I', vch))
+        return false;
+    nBestInvalidWork = 0;
+    if (vch.empty() || (vch.back() & 0x80))
+        return true;
+    memcpy(nBestInvalidWork.begin(), &vch[0], std::min(vch.size(), (size_t)nBestInvalidWork.size()));
+    return true;
 }
 
-bool CBlockTreeDB::WriteBestInvalidWork(const CBigNum& bnBestInvalidWork)
+bool CBlockTreeDB::WriteBestInvalidWork(const uint256& nBestInvalidWork)
 {
-    return Write('I', bnBestInvalidWork);
+    std::vector<unsigned char> vch(nBestInvalidWork.begin(), nBestInvalidWork.begin() + (nBestInvalidWork.bits() + 7) / 8);
+    if (!vch.empty() && (vch.back() & 0x80))
+        vch.push_back(0);
+    return Write('I', vch);
 }
 
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo &info) {
@@ -79,6 +79,9 @@ public:
     /** Progress message during initialization. */
     boost::signals2::signal<void (const std::string &message)> InitMessage;
 
+    /** Progress of a long running operation such as a wallet rescan, nProgress from 0 when it starts to 100 when it's done. */
+    boost::signals2::signal<void (const std::string &title, int nProgress)> ShowProgress;
+
     /** Translate a message to the native language of the user. */
     boost::signals2::signal<std::string (const char* psz)> Translate;
 
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,12 @@ typedef unsigned long long  uint64;
 
 inline int Testuint256AdHoc(std::vector<std::string> vArg);
 
+/** Errors thrown by the base_uint arithmetic */
+class uint_error : public std::runtime_error
+{
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
 
 
 /** Base class without constructors for uint256 and uint160.
@@ -179,6 +186,120 @@ public:
         return *this;
     }
 
+    base_uint& operator*=(uint32_t b32)
+    {
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    base_uint& operator*=(const base_uint& b)
+    {
+        base_uint a;
+        for (int i = 0; i < WIDTH; i++)
+            a.pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64 carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64 n = carry + a.pn[i + j] + (uint64)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
+    /** Long division with 32-bit digits (Knuth's algorithm D), the
+     *  remainder is dropped */
+    base_uint& operator/=(const base_uint& b)
+    {
+        int n = (b.bits() + 31) / 32;
+        int m = (bits() + 31) / 32;
+        if (n == 0)
+            throw uint_error("base_uint::operator/= : division by zero");
+        uint32_t un[WIDTH + 1], vn[WIDTH];
+        for (int i = 0; i < WIDTH; i++)
+            un[i] = pn[i];
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        if (m < n)
+            return *this;
+
+        if (n == 1)
+        {
+            uint64 rem = 0;
+            for (int i = m - 1; i >= 0; i--)
+            {
+                uint64 cur = (rem << 32) | un[i];
+                pn[i] = cur / b.pn[0];
+                rem = cur % b.pn[0];
+            }
+            return *this;
+        }
+
+        // Shift both so the top digit of the divisor has its high bit set,
+        // then each quotient digit estimate is off by at most two
+        int s = 32 - (b.bits() - 32 * (n - 1));
+        for (int i = n - 1; i > 0; i--)
+            vn[i] = (b.pn[i] << s) | (s ? (uint32_t)((uint64)b.pn[i-1] >> (32 - s)) : 0);
+        vn[0] = b.pn[0] << s;
+        un[m] = s ? (uint32_t)((uint64)un[m-1] >> (32 - s)) : 0;
+        for (int i = m - 1; i > 0; i--)
+            un[i] = (un[i] << s) | (s ? (uint32_t)((uint64)un[i-1] >> (32 - s)) : 0);
+        un[0] <<= s;
+
+        for (int j = m - n; j >= 0; j--)
+        {
+            uint64 num = ((uint64)un[j+n] << 32) | un[j+n-1];
+            uint64 qhat = num / vn[n-1];
+            uint64 rhat = num % vn[n-1];
+            while (qhat >> 32 || qhat * vn[n-2] > ((rhat << 32) | un[j+n-2]))
+            {
+                qhat--;
+                rhat += vn[n-1];
+                if (rhat >> 32)
+                    break;
+            }
+
+            // un[j..j+n] -= qhat * vn
+            int64 t = 0;
+            uint64 borrow = 0;
+            for (int i = 0; i < n; i++)
+            {
+                uint64 p = qhat * vn[i];
+                t = (int64)un[i+j] - (int64)borrow - (int64)(p & 0xffffffff);
+                un[i+j] = (uint32_t)t;
+                borrow = (p >> 32) - (t >> 32);
+            }
+            t = (int64)un[j+n] - (int64)borrow;
+            un[j+n] = (uint32_t)t;
+
+            pn[j] = (uint32_t)qhat;
+            if (t < 0)
+            {
+                // Subtracted one time too many, add back
+                pn[j]--;
+                uint64 carry = 0;
+                for (int i = 0; i < n; i++)
+                {
+                    uint64 sum = (uint64)un[i+j] + vn[i] + carry;
+                    un[i+j] = (uint32_t)sum;
+                    carry = sum >> 32;
+                }
+                un[j+n] += carry;
+            }
+        }
+        return *this;
+    }
+
 
     base_uint& operator++()
     {
@@ -375,6 +496,22 @@ public:
         return pn[2*n] | (uint64)pn[2*n+1] << 32;
     }
 
+    /** Position of the highest set bit plus one, 0 for zero */
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH-1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & (1U << nbits))
+                        return 32*pos + nbits + 1;
+                return 32*pos + 1;
+            }
+        }
+        return 0;
+    }
+
 //    unsigned int GetSerializeSize(int nType=0, int nVersion=PROTOCOL_VERSION) const
     unsigned int GetSerializeSize(int nType, int nVersion) const
     {
@@ -588,6 +725,59 @@ public:
         else
             *this = 0;
     }
+
+    /** The "compact" format is a representation of a whole number N
+     * using an unsigned 32bit number similar to a floating point format,
+     * the same one CBigNum::SetCompact reads: the high byte is the size in
+     * bytes, then a sign bit and a 23-bit mantissa. This type can't be
+     * negative or wider than 256 bits, so those cases are reported through
+     * pfNegative and pfOverflow instead, and the value is then meaningless.
+     */
+    uint256& SetCompact(unsigned int nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8*(3-nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8*(nSize-3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                         (nWord > 0xff && nSize > 33) ||
+                                         (nWord > 0xffff && nSize > 32));
+        return *this;
+    }
+
+    unsigned int GetCompact() const
+    {
+        unsigned int nSize = (bits() + 7) / 8;
+        unsigned int nCompact = 0;
+        if (nSize <= 3)
+            nCompact = Get64() << 8*(3-nSize);
+        else
+        {
+            base_uint256 bn = *this;
+            bn >>= 8*(nSize-3);
+            nCompact = bn.Get64();
+        }
+        // The 0x00800000 bit denotes the sign, so if it is already set
+        // divide the mantissa by 256 and increase the exponent
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        return nCompact;
+    }
 };
 
 inline bool operator==(const uint256& a, uint64 b)                           { return (base_uint256)a == b; }
@@ -638,6 +828,9 @@ inline const uint256 operator&(const uint256& a, const uint256& b)      { return
 inline const uint256 operator|(const uint256& a, const uint256& b)      { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const uint256& a, const uint256& b)      { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const uint256& b)      { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const uint256& a, uint32_t b)            { return uint256(a) *= b; }
+inline const uint256 operator*(const uint256& a, const uint256& b)      { return uint256(a) *= b; }
+inline const uint256 operator/(const uint256& a, const uint256& b)      { return uint256(a) /= b; }
 
 
 
@@ -691,6 +884,12 @@ public:
         return *this;
     }
 
+    explicit uint512(const uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = (i < uint256::WIDTH) ? b.pn[i] : 0;
+    }
+
     explicit uint512(const std::string& str)
     {
         SetHex(str);
@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "coincontrol.h"
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -46,10 +47,20 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
+void CWallet::AddToMyScripts(const CTxDestination& dest)
+{
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(dest);
+    LOCK(cs_KeyStore);
+    if (setMyScripts.insert(scriptPubKey).second)
+        vNewScripts.push_back(scriptPubKey);
+}
+
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    AddToMyScripts(pubkey.GetID());
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
@@ -58,10 +69,19 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     return true;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    AddToMyScripts(pubkey.GetID());
+    return true;
+}
+
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey, const vector<unsigned char> &vchCryptedSecret)
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    AddToMyScripts(vchPubKey.GetID());
     if (!fFileBacked)
         return true;
     {
@@ -76,18 +96,30 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey, const vector<unsigned char
 
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddToMyScripts(vchPubKey.GetID());
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    AddToMyScripts(redeemScript.GetID());
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
+bool CWallet::LoadCScript(const CScript& redeemScript)
+{
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    AddToMyScripts(redeemScript.GetID());
+    return true;
+}
+
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 {
     if (!IsLocked())
@@ -335,7 +367,7 @@ CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries,
     return txOrdered;
 }
 
-void CWallet::WalletUpdateSpent(const CTransaction &tx)
+void CWallet::WalletUpdateSpent(const CTransaction &tx, CWalletDB *pwalletdb)
 {
     // Anytime a signature is successfully verified, it's proof the outpoint is spent.
     // Update the wallet spent flag if it doesn't know due to wallet.dat being
@@ -354,7 +386,8 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx)
                 {
                     printf("WalletUpdateSpent found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkSpent(txin.prevout.n);
-                    wtx.WriteToDisk();
+                    UpdateUnspent(wtx);
+                    wtx.WriteToDisk(pwalletdb);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -368,10 +401,110 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fBalancesCached = false;
     }
 }
 
-bool CWallet::AddToWallet(const CWalletTx& wtxIn)
+static bool HasUnspentOutputsOfMine(const CWallet* pwallet, const CWalletTx& wtx)
+{
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        if (!wtx.IsSpent(i) && pwallet->IsMine(wtx.vout[i]))
+            return true;
+    return false;
+}
+
+// Add the scripts, in the form setMyScripts has them, that the keys or
+// redeem script solving scriptPubKey would be known by. A P2SH script we
+// have the redeem script of is not ours yet only for want of its keys, so
+// those are added too.
+static void AddSolvingScripts(const CWallet* pwallet, const CScript& scriptPubKey,
+                              boost::unordered_set<CScript, CScriptHasher>& setScripts, bool fRecurse = true)
+{
+    txnouttype type;
+    vector<vector<unsigned char> > vSolutions;
+    if (!Solver(scriptPubKey, type, vSolutions))
+        return;
+
+    CScript script;
+    switch (type)
+    {
+    case TX_PUBKEYHASH:
+        script.SetDestination(CKeyID(uint160(vSolutions[0])));
+        setScripts.insert(script);
+        break;
+    case TX_SCRIPTHASH:
+    {
+        CScriptID scriptID = CScriptID(uint160(vSolutions[0]));
+        script.SetDestination(scriptID);
+        setScripts.insert(script);
+        CScript redeemScript;
+        if (fRecurse && pwallet->GetCScript(scriptID, redeemScript))
+            AddSolvingScripts(pwallet, redeemScript, setScripts, false);
+        break;
+    }
+    case TX_MULTISIG:
+        for (unsigned int i = 1; i < vSolutions.size() - 1; i++)
+        {
+            script.SetDestination(CKeyID(uint160(vSolutions[i])));
+            setScripts.insert(script);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void CWallet::IndexOtherOutputs(const CWalletTx& wtx) const
+{
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        if (!IsMine(txout))
+            AddSolvingScripts(this, txout.scriptPubKey, setOtherScripts);
+}
+
+void CWallet::UpdateUnspent(const CWalletTx& wtx)
+{
+    fBalancesCached = false;
+    if (!fUnspentBuilt)
+        return;
+    if (HasUnspentOutputsOfMine(this, wtx))
+        setUnspent.insert(wtx.GetHash());
+    else
+        setUnspent.erase(wtx.GetHash());
+    IndexOtherOutputs(wtx);
+}
+
+void CWallet::SyncUnspent() const
+{
+    vector<CScript> vScripts;
+    {
+        LOCK(cs_KeyStore);
+        vScripts.swap(vNewScripts);
+    }
+    if (fUnspentBuilt)
+    {
+        // Keys topping up the key pool are not in any transaction yet
+        bool fOthersMine = false;
+        BOOST_FOREACH(const CScript& script, vScripts)
+            if (setOtherScripts.count(script))
+                fOthersMine = true;
+        if (!fOthersMine)
+            return;
+    }
+
+    // Outputs to keys that were just added may now be ours
+    setUnspent.clear();
+    setOtherScripts.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        if (HasUnspentOutputsOfMine(this, (*it).second))
+            setUnspent.insert(setUnspent.end(), (*it).first);
+        IndexOtherOutputs((*it).second);
+    }
+    fUnspentBuilt = true;
+    fBalancesCached = false;
+}
+
+bool CWallet::AddToWallet(const CWalletTx& wtxIn, CWalletDB *pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
     {
@@ -384,7 +517,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         if (fInsertedNew)
         {
             wtx.nTimeReceived = GetAdjustedTime();
-            wtx.nOrderPos = IncOrderPosNext();
+            wtx.nOrderPos = IncOrderPosNext(pwalletdb);
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
@@ -455,17 +588,20 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             }
             fUpdated |= wtx.UpdateSpent(wtxIn.vfSpent);
         }
+        UpdateUnspent(wtx);
 
         //// debug print
         printf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString().c_str(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
         // Write to disk
         if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk())
+            if (!wtx.WriteToDisk(pwalletdb))
                 return false;
 #ifndef QT_GUI
-        // If default receiving address gets used, replace it with a new one
-        if (vchDefaultKey.IsValid()) {
+        // If default receiving address gets used, replace it with a new one.
+        // Not while the caller has a database transaction open, taking a key
+        // from the pool would wait for it.
+        if (vchDefaultKey.IsValid() && !pwalletdb) {
             CScript scriptDefaultKey;
             scriptDefaultKey.SetDestination(vchDefaultKey.GetID());
             BOOST_FOREACH(const CTxOut& txout, wtx.vout)
@@ -483,7 +619,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         }
 #endif
         // since AddToWallet is called directly for self-originating transactions, check for consumption of own coins
-        WalletUpdateSpent(wtx);
+        WalletUpdateSpent(wtx, pwalletdb);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -532,11 +668,71 @@ bool CWallet::EraseFromWallet(uint256 hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        setUnspent.erase(hash);
+        fBalancesCached = false;
+    }
+    return true;
+}
+
+/** Transactions whose supporting transactions ReadPrev keeps in memory */
+static const unsigned int PREV_CACHE_SIZE = 1000;
+
+bool CWallet::ReadPrev(const uint256& hash, vector<CMerkleTx>& vtxPrevRet) const
+{
+    {
+        LOCK(cs_PrevCache);
+        map<uint256, pair<vector<CMerkleTx>, list<uint256>::iterator> >::iterator mi = mapPrevCache.find(hash);
+        if (mi != mapPrevCache.end())
+        {
+            listPrevCache.splice(listPrevCache.begin(), listPrevCache, (*mi).second.second);
+            vtxPrevRet = (*mi).second.first;
+            return true;
+        }
+    }
+
+    // Not under cs_PrevCache, the caller may hold locks the database takes
+    // after it
+    vtxPrevRet.clear();
+    if (!fFileBacked || !CWalletDB(strWalletFile, "r").ReadPrev(hash, vtxPrevRet))
+        return false;
+
+    LOCK(cs_PrevCache);
+    if (!mapPrevCache.count(hash))
+    {
+        listPrevCache.push_front(hash);
+        mapPrevCache[hash] = make_pair(vtxPrevRet, listPrevCache.begin());
+        if (listPrevCache.size() > PREV_CACHE_SIZE)
+        {
+            mapPrevCache.erase(listPrevCache.back());
+            listPrevCache.pop_back();
+        }
     }
     return true;
 }
 
 
+bool CWallet::IsMine(const CTxOut& txout) const
+{
+    const CScript& scriptPubKey = txout.scriptPubKey;
+    if (scriptPubKey.IsPayToPubKeyHash() || scriptPubKey.IsPayToScriptHash())
+    {
+        {
+            LOCK(cs_KeyStore);
+            if (!setMyScripts.count(scriptPubKey))
+                return false;
+        }
+        // Ours if we have the key. For a script it also takes the keys of
+        // the script, which may not all be there.
+        return scriptPubKey.IsPayToPubKeyHash() || ::IsMine(*this, scriptPubKey);
+    }
+
+    // Anything else can only be solved as a pay to key hash with an unusual
+    // push or as bare multisig, see Solver
+    if (scriptPubKey.empty() || (scriptPubKey.back() != OP_CHECKSIG && scriptPubKey.back() != OP_CHECKMULTISIG))
+        return false;
+    return ::IsMine(*this, scriptPubKey);
+}
+
 bool CWallet::IsMine(const CTxIn &txin) const
 {
     {
@@ -712,6 +908,7 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, int64& nReceived,
 void CWalletTx::AddSupportingTransactions()
 {
     vtxPrev.clear();
+    fPrevUnloaded = false;
 
     const int COPY_DEPTH = 3;
     if (SetMerkleBranch() < COPY_DEPTH)
@@ -723,6 +920,7 @@ void CWalletTx::AddSupportingTransactions()
         {
             LOCK(pwallet->cs_wallet);
             map<uint256, const CMerkleTx*> mapWalletPrev;
+            list<vector<CMerkleTx> > listPrevLoaded;
             set<uint256> setAlreadyDone;
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
@@ -736,7 +934,8 @@ void CWalletTx::AddSupportingTransactions()
                 if (mi != pwallet->mapWallet.end())
                 {
                     tx = (*mi).second;
-                    BOOST_FOREACH(const CMerkleTx& txWalletPrev, (*mi).second.vtxPrev)
+                    listPrevLoaded.push_back(vector<CMerkleTx>());
+                    BOOST_FOREACH(const CMerkleTx& txWalletPrev, (*mi).second.GetPrev(listPrevLoaded.back()))
                         mapWalletPrev[txWalletPrev.GetHash()] = &txWalletPrev;
                 }
                 else if (mapWalletPrev.count(hash))
@@ -763,11 +962,122 @@ void CWalletTx::AddSupportingTransactions()
     reverse(vtxPrev.begin(), vtxPrev.end());
 }
 
-bool CWalletTx::WriteToDisk()
+const vector<CMerkleTx>& CWalletTx::GetPrev(vector<CMerkleTx>& vtxPrevLoaded) const
+{
+    if (!fPrevUnloaded)
+        return vtxPrev;
+    pwallet->ReadPrev(GetHash(), vtxPrevLoaded);
+    return vtxPrevLoaded;
+}
+
+bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
 {
+    if (pwalletdb)
+        return pwalletdb->WriteTx(GetHash(), *this);
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+/** A block of a rescan, read and matched against the wallet's keys by a
+ *  worker and then committed by the scanning thread */
+struct CRescanBlock
+{
+    CBlock block;
+    bool fRead;
+    std::vector<bool> vMine; // vtx[i] pays to one of our keys
+    bool fReady;
+
+    CRescanBlock() : fRead(false), fReady(false) {}
+};
+
+/** Reads the blocks of a rescan ahead of the scanning thread, on several
+ *  threads, and does the IsMine matching of their outputs there. Blocks are
+ *  handed back in chain order. Only as many blocks as there are slots are in
+ *  flight, and their memory is reused for the next ones.
+ */
+class CRescanReader
+{
+private:
+    const CWallet& wallet;
+    const std::vector<CBlockIndex*>& vIndex;
+    std::vector<CRescanBlock> vSlots;
+
+    boost::mutex mutex;
+    boost::condition_variable condReady;
+    boost::condition_variable condFree;
+    unsigned int nNext;      // next block for a worker to take
+    unsigned int nReleased;  // blocks the scanning thread is done with
+    bool fQuit;
+    boost::thread_group threadGroup;
+
+    void ThreadRead()
+    {
+        RenameThread("bitcoin-rescan");
+        while (true)
+        {
+            unsigned int n;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fQuit && nNext < vIndex.size() && nNext >= nReleased + vSlots.size())
+                    condFree.wait(lock);
+                if (fQuit || nNext >= vIndex.size())
+                    return;
+                n = nNext++;
+            }
+
+            CRescanBlock& slot = vSlots[n % vSlots.size()];
+            slot.fRead = slot.block.ReadFromDisk(vIndex[n], true);
+            slot.vMine.assign(slot.fRead ? slot.block.vtx.size() : 0, false);
+            for (unsigned int i = 0; i < slot.vMine.size(); i++)
+                slot.vMine[i] = wallet.IsMine(slot.block.vtx[i]);
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                slot.fReady = true;
+            }
+            condReady.notify_all();
+        }
+    }
+
+public:
+    CRescanReader(const CWallet& walletIn, const std::vector<CBlockIndex*>& vIndexIn, int nThreads) :
+        wallet(walletIn), vIndex(vIndexIn), vSlots(16 * nThreads), nNext(0), nReleased(0), fQuit(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CRescanReader::ThreadRead, this));
+    }
+
+    ~CRescanReader()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fQuit = true;
+        }
+        condFree.notify_all();
+        threadGroup.join_all();
+    }
+
+    /** Wait for block n, which must be the one after the last released */
+    CRescanBlock& Get(unsigned int n)
+    {
+        CRescanBlock& slot = vSlots[n % vSlots.size()];
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!slot.fReady)
+            condReady.wait(lock);
+        return slot;
+    }
+
+    /** Done with block n, its slot can be read into again */
+    void Release(unsigned int n)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vSlots[n % vSlots.size()].fReady = false;
+            nReleased = n + 1;
+        }
+        condFree.notify_all();
+    }
+};
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
@@ -775,24 +1085,81 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
 
-    CBlockIndex* pindex = pindexStart;
+    // The callers hold cs_main, so the chain can't change under the readers
+    std::vector<CBlockIndex*> vIndex;
+    for (CBlockIndex* pindex = pindexStart; pindex; pindex = pindex->pnext)
+        vIndex.push_back(pindex);
+    if (vIndex.empty())
+        return 0;
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS));
+    double dTxStart = vIndex.front()->nChainTx;
+    double dTxTotal = std::max(1.0, vIndex.back()->nChainTx - dTxStart);
+    {
+        LOCK(cs_rescan);
+        nRescanHeight = vIndex.front()->nHeight;
+        nRescanEndHeight = vIndex.back()->nHeight;
+    }
+    uiInterface.ShowProgress(_("Rescanning..."), 0);
+    int nProgress = 0;
+    int64 nLastLog = GetTime();
     {
         LOCK(cs_wallet);
-        while (pindex)
+        CRescanReader reader(*this, vIndex, nThreads);
+        for (unsigned int n = 0; n < vIndex.size(); n++)
         {
-            CBlock block;
-            block.ReadFromDisk(pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            CRescanBlock& slot = reader.Get(n);
+            const CBlock& block = slot.block;
+            for (unsigned int i = 0; i < slot.vMine.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx.GetHash(), tx, &block, fUpdate))
+                // A transaction that doesn't pay us can still concern the
+                // wallet through its inputs or by being in it already. Both
+                // depend on what was committed before, so they are checked
+                // here, in chain order. Anything else would be a no-op for
+                // AddToWalletIfInvolvingMe.
+                const CTransaction& tx = block.vtx[i];
+                bool fInvolved = slot.vMine[i] || mapWallet.count(tx.GetHash());
+                for (unsigned int j = 0; !fInvolved && j < tx.vin.size(); j++)
+                    fInvolved = mapWallet.count(tx.vin[j].prevout.hash);
+                if (fInvolved && AddToWalletIfInvolvingMe(tx.GetHash(), tx, &block, fUpdate))
                     ret++;
             }
-            pindex = pindex->pnext;
+            reader.Release(n);
+
+            {
+                LOCK(cs_rescan);
+                nRescanHeight = vIndex[n]->nHeight;
+            }
+            int nProgressNew = (int)((vIndex[n]->nChainTx - dTxStart) * 99.0 / dTxTotal);
+            if (nProgressNew > nProgress)
+            {
+                nProgress = nProgressNew;
+                uiInterface.ShowProgress(_("Rescanning..."), std::max(1, nProgress));
+            }
+            if (GetTime() >= nLastLog + 60)
+            {
+                nLastLog = GetTime();
+                printf("Still rescanning. At block %d, %d%% done\n", vIndex[n]->nHeight, nProgress);
+            }
         }
     }
+    {
+        LOCK(cs_rescan);
+        nRescanHeight = -1;
+        nRescanEndHeight = -1;
+    }
+    uiInterface.ShowProgress(_("Rescanning..."), 100);
     return ret;
 }
 
+bool CWallet::GetRescanProgress(int& nHeight, int& nEndHeight) const
+{
+    LOCK(cs_rescan);
+    nHeight = nRescanHeight;
+    nEndHeight = nRescanEndHeight;
+    return nRescanHeight >= 0;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     bool fRepeat = true;
@@ -828,6 +1195,7 @@ void CWallet::ReacceptWalletTransactions()
                 {
                     printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkDirty();
+                    UpdateUnspent(wtx);
                     wtx.WriteToDisk();
                 }
             }
@@ -849,7 +1217,8 @@ void CWallet::ReacceptWalletTransactions()
 
 void CWalletTx::RelayWalletTransaction()
 {
-    BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
+    vector<CMerkleTx> vtxPrevLoaded;
+    BOOST_FOREACH(const CMerkleTx& tx, GetPrev(vtxPrevLoaded))
     {
         // Important: versions of bitcoin before 0.8.6 had a bug that inserted
         // empty transactions into the vtxPrev, which will cause the node to be
@@ -919,49 +1288,53 @@ void CWallet::ResendWalletTransactions()
 //
 
 
-int64 CWallet::GetBalance() const
+void CWallet::CacheBalances() const
 {
-    int64 nTotal = 0;
+    SyncUnspent();
+    if (fBalancesCached && pindexBalances == pindexBest)
+        return;
+
+    nBalanceCached = 0;
+    nUnconfirmedBalanceCached = 0;
+    nImmatureBalanceCached = 0;
+    bool fAllFinal = true;
+    BOOST_FOREACH(const uint256& hash, setUnspent)
     {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        const CWalletTx* pcoin = &mapWallet.find(hash)->second;
+        bool fFinal = pcoin->IsFinal();
+        if (fFinal && pcoin->IsConfirmed())
+            nBalanceCached += pcoin->GetAvailableCredit();
+        else
+            nUnconfirmedBalanceCached += pcoin->GetAvailableCredit();
+        nImmatureBalanceCached += pcoin->GetImmatureCredit();
+        fAllFinal &= fFinal;
     }
 
-    return nTotal;
+    // A transaction locked until some time can become final without a new
+    // block, so the balances are only kept when there is none
+    fBalancesCached = fAllFinal;
+    pindexBalances = pindexBest;
+}
+
+int64 CWallet::GetBalance() const
+{
+    LOCK(cs_wallet);
+    CacheBalances();
+    return nBalanceCached;
 }
 
 int64 CWallet::GetUnconfirmedBalance() const
 {
-    int64 nTotal = 0;
-    {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsFinal() || !pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK(cs_wallet);
+    CacheBalances();
+    return nUnconfirmedBalanceCached;
 }
 
 int64 CWallet::GetImmatureBalance() const
 {
-    int64 nTotal = 0;
-    {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK(cs_wallet);
+    CacheBalances();
+    return nImmatureBalanceCached;
 }
 
 // populate vCoins with vector of spendable COutputs
@@ -971,8 +1344,10 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        SyncUnspent();
+        BOOST_FOREACH(const uint256& hash, setUnspent)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
             const CWalletTx* pcoin = &(*it).second;
 
             if (!pcoin->IsFinal())
@@ -994,7 +1369,7 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<int64, pair<const CWalletTx*,unsigned int> > >vValue, int64 nTotalLower, int64 nTargetValue,
+static void ApproximateBestSubset(const vector<pair<int64, pair<const CWalletTx*,unsigned int> > >& vValue, int64 nTotalLower, int64 nTargetValue,
                                   vector<char>& vfBest, int64& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -1040,6 +1415,102 @@ static void ApproximateBestSubset(vector<pair<int64, pair<const CWalletTx*,unsig
     }
 }
 
+// Every pass of ApproximateBestSubset goes over all the candidates, which
+// is too slow for wallets with many thousands of small coins, like those of
+// pools paying out mined coins. Above this many SelectCoinsLarge is used.
+// It works on the candidates as sorted by value for each call; there is no
+// index of the wallet's coins kept in amount order.
+static const unsigned int MAX_APPROXIMATE_COINS = 1000;
+// Steps SelectCoinsExact may take before it gives up
+static const int MAX_EXACT_TRIES = 100000;
+
+/** Depth first search for coins adding up to exactly nTargetValue, with the
+ *  candidates sorted by descending value. Branches that can't reach the
+ *  target any more are cut, and it gives up after nMaxTries steps. */
+static bool SelectCoinsExact(const vector<pair<int64, pair<const CWalletTx*,unsigned int> > >& vValue, int64 nTargetValue,
+                             vector<char>& vfBest, int nMaxTries)
+{
+    // what the coins from i on add up to
+    vector<int64> vRemaining(vValue.size() + 1, 0);
+    for (int i = vValue.size() - 1; i >= 0; i--)
+        vRemaining[i] = vRemaining[i + 1] + vValue[i].first;
+
+    vector<char> vfIncluded(vValue.size(), false);
+    vector<unsigned int> vIncluded;
+    int64 nTotal = 0;
+    unsigned int i = 0;
+    for (int nTry = 0; nTry < nMaxTries; nTry++)
+    {
+        if (nTotal == nTargetValue)
+        {
+            vfBest = vfIncluded;
+            return true;
+        }
+
+        if (nTotal > nTargetValue || nTotal + vRemaining[i] < nTargetValue)
+        {
+            if (vIncluded.empty())
+                return false;
+
+            // Take the last coin out again and go on without it. Leaving
+            // out the coins of the same value after it too loses nothing,
+            // the sums with them were all tried with this one instead.
+            i = vIncluded.back();
+            vIncluded.pop_back();
+            vfIncluded[i] = false;
+            nTotal -= vValue[i].first;
+            int64 nValue = vValue[i].first;
+            while (i < vValue.size() && vValue[i].first == nValue)
+                i++;
+            continue;
+        }
+
+        vfIncluded[i] = true;
+        vIncluded.push_back(i);
+        nTotal += vValue[i].first;
+        i++;
+    }
+    return false;
+}
+
+/** ApproximateBestSubset for many candidates, sorted by descending value. A
+ *  transaction of standard size only has room for a few hundred inputs, so
+ *  unless the exact amount can be paid the largest coins are used. */
+static void SelectCoinsLarge(const vector<pair<int64, pair<const CWalletTx*,unsigned int> > >& vValue, int64 nTotalLower, int64 nTargetValue,
+                             vector<char>& vfBest, int64& nBest)
+{
+    if (SelectCoinsExact(vValue, nTargetValue, vfBest, MAX_EXACT_TRIES))
+    {
+        nBest = nTargetValue;
+        return;
+    }
+
+    vector<pair<int64, pair<const CWalletTx*,unsigned int> > > vLargest(vValue.begin(), vValue.begin() + MAX_APPROXIMATE_COINS);
+    int64 nTotalLargest = 0;
+    BOOST_FOREACH(const PAIRTYPE(int64, PAIRTYPE(const CWalletTx*, unsigned int))& coin, vLargest)
+        nTotalLargest += coin.first;
+    if (nTotalLargest >= nTargetValue)
+    {
+        vector<char> vfLargest;
+        ApproximateBestSubset(vLargest, nTotalLargest, nTargetValue, vfLargest, nBest, 1000);
+        if (nBest != nTargetValue && nTotalLargest >= nTargetValue + CENT)
+            ApproximateBestSubset(vLargest, nTotalLargest, nTargetValue + CENT, vfLargest, nBest, 1000);
+        vfBest.assign(vValue.size(), false);
+        copy(vfLargest.begin(), vfLargest.end(), vfBest.begin());
+        return;
+    }
+
+    // Largest first, leaving a cent of change if there's enough for it
+    int64 nTarget = (nTotalLower >= nTargetValue + CENT ? nTargetValue + CENT : nTargetValue);
+    vfBest.assign(vValue.size(), false);
+    nBest = 0;
+    for (unsigned int i = 0; i < vValue.size() && nBest < nTarget; i++)
+    {
+        vfBest[i] = true;
+        nBest += vValue[i].first;
+    }
+}
+
 bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const
 {
@@ -1055,7 +1526,7 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
 
     random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
 
-    BOOST_FOREACH(COutput output, vCoins)
+    BOOST_FOREACH(const COutput& output, vCoins)
     {
         const CWalletTx *pcoin = output.tx;
 
@@ -1108,9 +1579,14 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
     vector<char> vfBest;
     int64 nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    if (vValue.size() > MAX_APPROXIMATE_COINS)
+        SelectCoinsLarge(vValue, nTotalLower, nTargetValue, vfBest, nBest);
+    else
+    {
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1360,6 +1836,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 CWalletTx &coin = mapWallet[txin.prevout.hash];
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
+                UpdateUnspent(coin);
                 coin.WriteToDisk();
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
@@ -1383,6 +1860,291 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
     return true;
 }
 
+// Room left for the inputs in each transaction of a batch of payouts
+static const unsigned int MAX_PAYOUT_OUTPUT_BYTES = MAX_STANDARD_TX_SIZE / 2;
+
+// The fee CreateTransaction would ask for this transaction
+static int64 GetPayoutFee(const CTransaction& tx, double dPriority)
+{
+    unsigned int nBytes = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    int64 nPayFee = nTransactionFee * (1 + (int64)nBytes / 1000);
+    bool fAllowFree = CTransaction::AllowFree(dPriority / nBytes);
+    int64 nMinFee = tx.GetMinFee(1, fAllowFree, GMF_SEND);
+    return max(nPayFee, nMinFee);
+}
+
+/** Sign every nThreads'th of the inputs vJobs (transaction, input) of a
+ *  batch, starting with the nThread'th. Each thread signs on copies of the
+ *  transactions, so it never reads a scriptSig another one is writing. */
+static void SignPayoutInputs(const CWallet* pwallet, const vector<CWalletTx>& vwtx, const vector<pair<unsigned int, unsigned int> >& vJobs,
+                             const vector<const CWalletTx*>& vFrom, vector<CScript>& vScriptSig, vector<char>& vfSigned,
+                             unsigned int nThread, unsigned int nThreads)
+{
+    map<unsigned int, CTransaction> mapTx;
+    for (unsigned int j = nThread; j < vJobs.size(); j += nThreads)
+    {
+        unsigned int nTx = vJobs[j].first;
+        unsigned int nIn = vJobs[j].second;
+        map<unsigned int, CTransaction>::iterator mi = mapTx.find(nTx);
+        if (mi == mapTx.end())
+            mi = mapTx.insert(make_pair(nTx, CTransaction(vwtx[nTx]))).first;
+        vfSigned[j] = SignSignature(*pwallet, *vFrom[j], (*mi).second, nIn);
+        vScriptSig[j] = (*mi).second.vin[nIn].scriptSig;
+    }
+}
+
+bool CWallet::CreatePayouts(const vector<pair<CScript, int64> >& vecSend, CPayoutBatch& batch, std::string& strFailReason)
+{
+    batch.SetNull();
+
+    // The payments, in groups that leave room for inputs in a transaction
+    int64 nValue = 0;
+    vector<vector<CTxOut> > vGroup(1);
+    vector<int64> vGroupValue(1, 0);
+    unsigned int nGroupBytes = 0;
+    BOOST_FOREACH (const PAIRTYPE(CScript, int64)& s, vecSend)
+    {
+        CTxOut txout(s.second, s.first);
+        if (s.second < 0 || txout.IsDust())
+        {
+            strFailReason = _("Transaction amounts must be positive");
+            return false;
+        }
+        nValue += s.second;
+
+        unsigned int nBytes = ::GetSerializeSize(txout, SER_NETWORK, PROTOCOL_VERSION);
+        if (!vGroup.back().empty() && nGroupBytes + nBytes > MAX_PAYOUT_OUTPUT_BYTES)
+        {
+            vGroup.push_back(vector<CTxOut>());
+            vGroupValue.push_back(0);
+            nGroupBytes = 0;
+        }
+        vGroup.back().push_back(txout);
+        vGroupValue.back() += s.second;
+        nGroupBytes += nBytes;
+    }
+    if (vecSend.empty() || !MoneyRange(nValue))
+    {
+        strFailReason = _("Transaction amounts must be positive");
+        return false;
+    }
+    unsigned int nTx = vGroup.size();
+
+    // Signed pay-to-pubkey-hash inputs are as long as these, so every
+    // transaction's size and fee are known before anything is signed
+    CScript scriptSigDummy;
+    scriptSigDummy << vector<unsigned char>(66, 0);
+    CScript scriptChangeDummy;
+    scriptChangeDummy.SetDestination(CKeyID());
+
+    LOCK2(cs_main, cs_wallet);
+
+    vector<COutput> vCoins, vCoinsAll;
+    AvailableCoins(vCoinsAll, true);
+    BOOST_FOREACH(const COutput& out, vCoinsAll)
+        if (out.tx->vout[out.i].scriptPubKey.IsPayToPubKeyHash())
+            vCoins.push_back(out);
+
+    batch.vwtx.assign(nTx, CWalletTx(this));
+    vector<int64> vValueIn(nTx), vFee(nTx);
+    vector<const CWalletTx*> vFrom;
+    int64 nFeeTotal = nTransactionFee * nTx;
+    for (int nTry = 0; ; nTry++)
+    {
+        // Coins for all of the payments at once
+        set<pair<const CWalletTx*,unsigned int> > setCoins;
+        int64 nValueSelected = 0;
+        if (nTry == 10 ||
+            !(SelectCoinsMinConf(nValue + nFeeTotal, 1, 6, vCoins, setCoins, nValueSelected) ||
+              SelectCoinsMinConf(nValue + nFeeTotal, 1, 1, vCoins, setCoins, nValueSelected) ||
+              SelectCoinsMinConf(nValue + nFeeTotal, 0, 1, vCoins, setCoins, nValueSelected)))
+        {
+            strFailReason = _("Insufficient funds");
+            return false;
+        }
+        vector<pair<int64, pair<const CWalletTx*, unsigned int> > > vValue;
+        BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoins)
+            vValue.push_back(make_pair(coin.first->vout[coin.second].nValue, coin));
+        sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+
+        // Hand them out largest first, each transaction taking coins until
+        // they pay for it and the last one taking the rest
+        vFrom.clear();
+        int64 nFeeNeeded = 0;
+        int64 nShort = 0;
+        unsigned int nCoin = 0;
+        for (unsigned int i = 0; i < nTx; i++)
+        {
+            CWalletTx& wtx = batch.vwtx[i];
+            wtx.vin.clear();
+            wtx.vout = vGroup[i];
+            wtx.vout.push_back(CTxOut(CENT, scriptChangeDummy));
+            wtx.fFromMe = true;
+            vValueIn[i] = 0;
+            double dPriority = 0;
+            loop
+            {
+                vFee[i] = GetPayoutFee(wtx, dPriority);
+                if (nCoin == vValue.size() || (i + 1 < nTx && vValueIn[i] >= vGroupValue[i] + vFee[i]))
+                    break;
+                const CWalletTx* pcoin = vValue[nCoin].second.first;
+                wtx.vin.push_back(CTxIn(pcoin->GetHash(), vValue[nCoin].second.second, scriptSigDummy));
+                vFrom.push_back(pcoin);
+                vValueIn[i] += vValue[nCoin].first;
+                dPriority += (double)vValue[nCoin].first * (pcoin->GetDepthInMainChain()+1);
+                nCoin++;
+            }
+            if (::GetSerializeSize(*(CTransaction*)&wtx, SER_NETWORK, PROTOCOL_VERSION) >= MAX_STANDARD_TX_SIZE)
+            {
+                strFailReason = _("Transaction too large");
+                return false;
+            }
+            nFeeNeeded += vFee[i];
+            nShort += max((int64)0, vGroupValue[i] + vFee[i] - vValueIn[i]);
+        }
+        if (nShort == 0)
+            break;
+        nFeeTotal = max(nFeeNeeded, nFeeTotal + nShort);
+    }
+
+    // Change, where anything is left over
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        CWalletTx& wtx = batch.vwtx[i];
+        wtx.vout.pop_back();
+        int64 nChange = vValueIn[i] - vGroupValue[i] - vFee[i];
+        // as in CreateTransaction
+        if (vFee[i] < CTransaction::nMinTxFee && nChange > 0 && nChange < CENT)
+        {
+            int64 nMoveToFee = min(nChange, CTransaction::nMinTxFee - vFee[i]);
+            nChange -= nMoveToFee;
+            vFee[i] += nMoveToFee;
+        }
+        // and GetMinFee charges as much again for an output this small
+        if (nChange < DUST_SOFT_LIMIT)
+        {
+            vFee[i] += nChange;
+            nChange = 0;
+        }
+        if (nChange > 0)
+        {
+            CReserveKey* pkeyChange = new CReserveKey(this);
+            batch.vpReserveKey.push_back(pkeyChange);
+            CPubKey vchPubKey;
+            assert(pkeyChange->GetReservedKey(vchPubKey)); // should never fail, as we just unlocked
+            CScript scriptChange;
+            scriptChange.SetDestination(vchPubKey.GetID());
+            wtx.vout.insert(wtx.vout.begin() + GetRandInt(wtx.vout.size() + 1), CTxOut(nChange, scriptChange));
+        }
+        batch.nFee += vFee[i];
+    }
+
+    // Sign all of the inputs, on as many threads as there are cores
+    vector<pair<unsigned int, unsigned int> > vJobs;
+    for (unsigned int i = 0; i < nTx; i++)
+        for (unsigned int nIn = 0; nIn < batch.vwtx[i].vin.size(); nIn++)
+            vJobs.push_back(make_pair(i, nIn));
+    vector<CScript> vScriptSig(vJobs.size());
+    vector<char> vfSigned(vJobs.size(), false);
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS));
+    nThreads = std::min(nThreads, (int)vJobs.size() / 8 + 1);
+    if (nThreads == 1)
+        SignPayoutInputs(this, batch.vwtx, vJobs, vFrom, vScriptSig, vfSigned, 0, 1);
+    else
+    {
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&SignPayoutInputs, this, boost::cref(batch.vwtx), boost::cref(vJobs), boost::cref(vFrom),
+                                                  boost::ref(vScriptSig), boost::ref(vfSigned), i, nThreads));
+        threadGroup.join_all();
+    }
+    for (unsigned int j = 0; j < vJobs.size(); j++)
+    {
+        if (!vfSigned[j])
+        {
+            strFailReason = _("Signing transaction failed");
+            return false;
+        }
+        batch.vwtx[vJobs[j].first].vin[vJobs[j].second].scriptSig = vScriptSig[j];
+    }
+
+    BOOST_FOREACH(CWalletTx& wtx, batch.vwtx)
+    {
+        wtx.AddSupportingTransactions();
+        wtx.fTimeReceivedIsTxTime = true;
+    }
+    return true;
+}
+
+bool CWallet::CommitPayouts(CPayoutBatch& batch)
+{
+    LOCK2(cs_main, cs_wallet);
+    BOOST_FOREACH(CReserveKey* pkey, batch.vpReserveKey)
+        pkey->KeepKey();
+
+    // All of the transactions and the coins they spend are written in one
+    // database transaction, so a crash leaves either all or none of them
+    CWalletDB* pwalletdb = NULL;
+    if (fFileBacked)
+    {
+        pwalletdb = new CWalletDB(strWalletFile);
+        if (!pwalletdb->TxnBegin())
+        {
+            delete pwalletdb;
+            return error("CommitPayouts() : TxnBegin failed");
+        }
+    }
+    bool fWritten = true;
+    BOOST_FOREACH(CWalletTx& wtx, batch.vwtx)
+    {
+        printf("CommitPayouts:\n%s", wtx.ToString().c_str());
+        fWritten &= AddToWallet(wtx, pwalletdb);
+    }
+    if (pwalletdb)
+    {
+        if (fWritten)
+            fWritten = pwalletdb->TxnCommit();
+        else
+            pwalletdb->TxnAbort();
+        delete pwalletdb;
+    }
+    if (!fWritten)
+    {
+        // None of it is on disk, so forget it in memory as well
+        BOOST_FOREACH(const CWalletTx& wtx, batch.vwtx)
+        {
+            mapWallet.erase(wtx.GetHash());
+            setUnspent.erase(wtx.GetHash());
+            BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            {
+                CWalletTx& coin = mapWallet[txin.prevout.hash];
+                if (txin.prevout.n < coin.vfSpent.size())
+                    coin.vfSpent[txin.prevout.n] = false;
+                coin.MarkDirty();
+                UpdateUnspent(coin);
+            }
+            NotifyTransactionChanged(this, wtx.GetHash(), CT_DELETED);
+        }
+        return error("CommitPayouts() : writing the transactions failed");
+    }
+
+    // Broadcast
+    bool fAccepted = true;
+    BOOST_FOREACH(CWalletTx& wtx, batch.vwtx)
+    {
+        mapRequestCount[wtx.GetHash()] = 0;
+        if (!wtx.AcceptToMemoryPool(true, false))
+        {
+            // This must not fail. The transaction has already been signed and recorded.
+            printf("CommitPayouts() : Error: Transaction %s not valid\n", wtx.GetHash().ToString().c_str());
+            fAccepted = false;
+            continue;
+        }
+        wtx.RelayWalletTransaction();
+    }
+    return fAccepted;
+}
+
 
 
 
@@ -1441,6 +2203,12 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return DB_LOAD_OK;
     fFirstRunRet = false;
     DBErrors nLoadWalletRet = CWalletDB(strWalletFile,"cr+").LoadWallet(this);
+    {
+        // The transactions were read straight into mapWallet
+        LOCK(cs_wallet);
+        fUnspentBuilt = false;
+        fBalancesCached = false;
+    }
     if (nLoadWalletRet == DB_NEED_REWRITE)
     {
         if (CDB::Rewrite(strWalletFile, "\x04pool"))
@@ -5,11 +5,15 @@
 #ifndef BITCOIN_WALLET_H
 #define BITCOIN_WALLET_H
 
+#include <list>
 #include <string>
 #include <vector>
 
 #include <stdlib.h>
 
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_set.hpp>
+
 #include "main.h"
 #include "key.h"
 #include "keystore.h"
@@ -21,9 +25,19 @@
 class CAccountingEntry;
 class CWalletTx;
 class CReserveKey;
+class CPayoutBatch;
 class COutput;
 class CCoinControl;
 
+/** Hash of a scriptPubKey for the wallet's set of its own */
+struct CScriptHasher
+{
+    size_t operator()(const CScript& script) const
+    {
+        return boost::hash_range(script.begin(), script.end());
+    }
+};
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -79,11 +93,61 @@ private:
     // the maximum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // The scriptPubKeys paying to our keys and to the P2SH scripts we know,
+    // in the form CScript::SetDestination makes them. Guarded by cs_KeyStore.
+    boost::unordered_set<CScript, CScriptHasher> setMyScripts;
+    // The scripts added to setMyScripts since SyncUnspent last looked,
+    // guarded by cs_KeyStore too
+    mutable std::vector<CScript> vNewScripts;
+    void AddToMyScripts(const CTxDestination& dest);
+
+    // The transactions in mapWallet that have outputs of ours which aren't
+    // spent. Nothing else adds to the balances or AvailableCoins, so they
+    // only look at these. Kept up to date as transactions are added and
+    // spent, and rebuilt from mapWallet by SyncUnspent when it never was
+    // built or a script in setOtherScripts became ours. Guarded by cs_wallet.
+    mutable std::set<uint256> setUnspent;
+    mutable bool fUnspentBuilt;
+    // The scripts that, once in setMyScripts, would make outputs of
+    // transactions in mapWallet ours that aren't yet: the outputs' own
+    // scripts, or for keys in bare scripts and in redeem scripts we know,
+    // the scripts of those keys. Guarded by cs_wallet.
+    mutable boost::unordered_set<CScript, CScriptHasher> setOtherScripts;
+    void IndexOtherOutputs(const CWalletTx& wtx) const;
+    void UpdateUnspent(const CWalletTx& wtx);
+    void SyncUnspent() const;
+
+    // GetBalance, GetUnconfirmedBalance and GetImmatureBalance as of the
+    // chain tip pindexBalances. Cleared whenever a transaction changes.
+    // Guarded by cs_wallet.
+    mutable bool fBalancesCached;
+    mutable const CBlockIndex* pindexBalances;
+    mutable int64 nBalanceCached;
+    mutable int64 nUnconfirmedBalanceCached;
+    mutable int64 nImmatureBalanceCached;
+    void CacheBalances() const;
+
+    // Supporting transactions read back from the store for transactions
+    // that were loaded without them, most recently used at the front.
+    // Nothing changes a transaction's vtxPrev once it is in the wallet,
+    // so entries don't go stale.
+    mutable CCriticalSection cs_PrevCache;
+    mutable std::list<uint256> listPrevCache;
+    mutable std::map<uint256, std::pair<std::vector<CMerkleTx>, std::list<uint256>::iterator> > mapPrevCache;
+
+    // progress of a running rescan, see GetRescanProgress
+    mutable CCriticalSection cs_rescan;
+    int nRescanHeight;
+    int nRescanEndHeight;
+
 public:
     mutable CCriticalSection cs_wallet;
 
     bool fFileBacked;
     std::string strWalletFile;
+    // Leave the supporting transactions of transactions that are in a block
+    // in the store when loading, see ReadPrev
+    bool fLazyLoad;
 
     std::set<int64> setKeyPool;
 
@@ -97,9 +161,15 @@ public:
         nWalletVersion = FEATURE_BASE;
         nWalletMaxVersion = FEATURE_BASE;
         fFileBacked = false;
+        fLazyLoad = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        nRescanHeight = -1;
+        nRescanEndHeight = -1;
+        fUnspentBuilt = false;
+        fBalancesCached = false;
+        pindexBalances = NULL;
     }
     CWallet(std::string strWalletFileIn)
     {
@@ -107,9 +177,15 @@ public:
         nWalletMaxVersion = FEATURE_BASE;
         strWalletFile = strWalletFileIn;
         fFileBacked = true;
+        fLazyLoad = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
+        nRescanHeight = -1;
+        nRescanEndHeight = -1;
+        fUnspentBuilt = false;
+        fBalancesCached = false;
+        pindexBalances = NULL;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -139,7 +215,7 @@ public:
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
 
     bool LoadMinVersion(int nVersion) { nWalletVersion = nVersion; nWalletMaxVersion = std::max(nWalletMaxVersion, nVersion); return true; }
 
@@ -148,7 +224,7 @@ public:
     // Adds an encrypted key to the store, without saving it to disk (used by LoadWallet)
     bool LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddCScript(const CScript& redeemScript);
-    bool LoadCScript(const CScript& redeemScript) { return CCryptoKeyStore::AddCScript(redeemScript); }
+    bool LoadCScript(const CScript& redeemScript);
 
     bool Unlock(const SecureString& strWalletPassphrase);
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
@@ -169,11 +245,16 @@ public:
     TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
 
     void MarkDirty();
-    bool AddToWallet(const CWalletTx& wtxIn);
+    bool AddToWallet(const CWalletTx& wtxIn, CWalletDB *pwalletdb = NULL);
     bool AddToWalletIfInvolvingMe(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate = false, bool fFindBlock = false);
     bool EraseFromWallet(uint256 hash);
-    void WalletUpdateSpent(const CTransaction& prevout);
+    /** The supporting transactions of a transaction loaded without them,
+     *  read back from the wallet store */
+    bool ReadPrev(const uint256& hash, std::vector<CMerkleTx>& vtxPrevRet) const;
+    void WalletUpdateSpent(const CTransaction& prevout, CWalletDB *pwalletdb = NULL);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    /** If a rescan is running, the height it has reached and the one it runs to */
+    bool GetRescanProgress(int& nHeight, int& nEndHeight) const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     int64 GetBalance() const;
@@ -184,6 +265,12 @@ public:
     bool CreateTransaction(CScript scriptPubKey, int64 nValue,
                            CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet, std::string& strFailReason, const CCoinControl *coinControl=NULL);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
+    /** Pay many recipients at once. Coins are selected once for all of them,
+     *  they are split into transactions of standard size and all inputs are
+     *  signed in one pass on several threads. */
+    bool CreatePayouts(const std::vector<std::pair<CScript, int64> >& vecSend, CPayoutBatch& batch, std::string& strFailReason);
+    /** Record the transactions of a batch in one database transaction, then broadcast them */
+    bool CommitPayouts(CPayoutBatch& batch);
     std::string SendMoney(CScript scriptPubKey, int64 nValue, CWalletTx& wtxNew, bool fAskFee=false);
     std::string SendMoneyToDestination(const CTxDestination &address, int64 nValue, CWalletTx& wtxNew, bool fAskFee=false);
 
@@ -202,10 +289,9 @@ public:
 
     bool IsMine(const CTxIn& txin) const;
     int64 GetDebit(const CTxIn& txin) const;
-    bool IsMine(const CTxOut& txout) const
-    {
-        return ::IsMine(*this, txout.scriptPubKey);
-    }
+    /** Same as ::IsMine(*this, txout.scriptPubKey), but the common output
+     *  types are looked up in setMyScripts instead of being solved */
+    bool IsMine(const CTxOut& txout) const;
     int64 GetCredit(const CTxOut& txout) const
     {
         if (!MoneyRange(txout.nValue))
@@ -382,6 +468,7 @@ public:
     int64 nOrderPos;  // position in ordered transaction list
 
     // memory only
+    bool fPrevUnloaded; // vtxPrev was left in the wallet store, see GetPrev
     mutable bool fDebitCached;
     mutable bool fCreditCached;
     mutable bool fImmatureCreditCached;
@@ -436,6 +523,7 @@ public:
         nAvailableCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
+        fPrevUnloaded = false;
     }
 
     IMPLEMENT_SERIALIZE
@@ -649,6 +737,7 @@ public:
 
         // If no confirmations but it's from us, we can still
         // consider it confirmed if all dependencies are confirmed
+        std::vector<CMerkleTx> vtxPrevLoaded;
         std::map<uint256, const CMerkleTx*> mapPrev;
         std::vector<const CMerkleTx*> vWorkQueue;
         vWorkQueue.reserve(vtxPrev.size()+1);
@@ -666,7 +755,7 @@ public:
 
             if (mapPrev.empty())
             {
-                BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
+                BOOST_FOREACH(const CMerkleTx& tx, GetPrev(vtxPrevLoaded))
                     mapPrev[tx.GetHash()] = &tx;
             }
 
@@ -680,7 +769,11 @@ public:
         return true;
     }
 
-    bool WriteToDisk();
+    /** vtxPrev, or if it was left in the wallet store, vtxPrevLoaded with
+     *  what was read from there */
+    const std::vector<CMerkleTx>& GetPrev(std::vector<CMerkleTx>& vtxPrevLoaded) const;
+
+    bool WriteToDisk(CWalletDB *pwalletdb = NULL);
 
     int64 GetTxTime() const;
     int GetRequestCount() const;
@@ -691,6 +784,40 @@ public:
 };
 
 
+/** The transactions CWallet::CreatePayouts made for a batch of payments,
+ *  with the keys reserved for their change. The keys go back to the key
+ *  pool unless CWallet::CommitPayouts keeps them. */
+class CPayoutBatch
+{
+private:
+    // owns the keys
+    CPayoutBatch(const CPayoutBatch&);
+    CPayoutBatch& operator=(const CPayoutBatch&);
+
+public:
+    std::vector<CWalletTx> vwtx;
+    std::vector<CReserveKey*> vpReserveKey;
+    int64 nFee;
+
+    CPayoutBatch()
+    {
+        nFee = 0;
+    }
+
+    ~CPayoutBatch()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        BOOST_FOREACH(CReserveKey* pkey, vpReserveKey)
+            delete pkey;
+        vpReserveKey.clear();
+        vwtx.clear();
+        nFee = 0;
+    }
+};
 
 
 class COutput
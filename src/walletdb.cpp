@@ -33,6 +33,31 @@ bool CWalletDB::EraseName(const string& strAddress)
     return Erase(make_pair(string("name"), strAddress));
 }
 
+bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
+{
+    nWalletDBUpdated++;
+    if (wtx.fPrevUnloaded)
+    {
+        // Its supporting transactions were left here when it was loaded,
+        // they have to be written back with it. If they can't be read,
+        // keep the stored record rather than replace it with one without them.
+        CWalletTx wtxFull(wtx);
+        if (!ReadPrev(hash, wtxFull.vtxPrev))
+            return error("CWalletDB::WriteTx() : can't read supporting transactions of %s", hash.ToString().c_str());
+        return Write(make_pair(string("tx"), hash), wtxFull);
+    }
+    return Write(make_pair(string("tx"), hash), wtx);
+}
+
+bool CWalletDB::ReadPrev(uint256 hash, vector<CMerkleTx>& vtxPrev)
+{
+    CWalletTx wtx;
+    if (!Read(make_pair(string("tx"), hash), wtx))
+        return false;
+    vtxPrev.swap(wtx.vtxPrev);
+    return true;
+}
+
 bool CWalletDB::ReadAccount(const string& strAccount, CAccount& account)
 {
     account.SetNull();
@@ -70,7 +95,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -237,6 +262,15 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             if (wtx.nOrderPos == -1)
                 fAnyUnordered = true;
 
+            // Once a transaction is in a block its supporting transactions
+            // are only needed if the block is disconnected, leave them in
+            // the store. Often they take more memory than the rest of it.
+            if (pwallet->fLazyLoad && wtx.hashBlock != 0 && !wtx.vtxPrev.empty())
+            {
+                std::vector<CMerkleTx>().swap(wtx.vtxPrev);
+                wtx.fPrevUnloaded = true;
+            }
+
             //// debug print
             //printf("LoadWallet  %s\n", wtx.GetHash().ToString().c_str());
             //printf(" %12"PRI64d"  %s  %s  %s\n",
@@ -390,7 +424,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             printf("Error getting wallet database cursor\n");
@@ -482,6 +516,7 @@ void ThreadFlushWalletDB(const string& strFile)
     unsigned int nLastSeen = nWalletDBUpdated;
     unsigned int nLastFlushed = nWalletDBUpdated;
     int64 nLastWalletUpdate = GetTime();
+    CLogDB* plog = bitdb.GetLogDb(strFile);
     while (true)
     {
         MilliSleep(500);
@@ -492,6 +527,17 @@ void ThreadFlushWalletDB(const string& strFile)
             nLastWalletUpdate = GetTime();
         }
 
+        if (plog)
+        {
+            // All the writes of the last half second share one fsync, and
+            // the log is compacted once things have been quiet for a bit
+            boost::this_thread::interruption_point();
+            plog->Sync();
+            if (GetTime() - nLastWalletUpdate >= 2 && plog->NeedsCompaction())
+                plog->Compact();
+            continue;
+        }
+
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
             TRY_LOCK(bitdb.cs_db,lockDb);
@@ -533,6 +579,21 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+
+    CLogDB* plog = bitdb.GetLogDb(wallet.strWalletFile);
+    if (plog)
+    {
+        // The backup is a snapshot, restored by putting it in the data
+        // directory as wallet.dat.snapshot
+        filesystem::path pathDest(strDest);
+        if (filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile + ".snapshot";
+        if (!plog->Backup(pathDest))
+            return false;
+        printf("copied wallet snapshot to %s\n", pathDest.string().c_str());
+        return true;
+    }
+
     while (true)
     {
         {
@@ -659,3 +720,80 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename)
 {
     return CWalletDB::Recover(dbenv, filename, false);
 }
+
+bool CWalletDB::MigrateToLog(const std::string& strFile)
+{
+    if (bitdb.GetLogDb(strFile))
+        return error("CWalletDB::MigrateToLog() : %s is already a log store", strFile.c_str());
+
+    printf("Migrating %s to a log store...\n", strFile.c_str());
+    int64 nStart = GetTimeMillis();
+    CLogDataMap mapRecords;
+    {
+        CWalletDB walletdb(strFile, "r");
+        CDBCursor* pcursor = walletdb.GetCursor();
+        if (!pcursor)
+            return error("CWalletDB::MigrateToLog() : cannot create DB cursor");
+        loop
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = walletdb.ReadAtCursor(pcursor, ssKey, ssValue);
+            if (ret == DB_NOTFOUND)
+                break;
+            else if (ret != 0)
+            {
+                pcursor->close();
+                return error("CWalletDB::MigrateToLog() : error reading %s", strFile.c_str());
+            }
+            mapRecords[CSerializeData(ssKey.begin(), ssKey.end())] = CSerializeData(ssValue.begin(), ssValue.end());
+        }
+        pcursor->close();
+    }
+    bitdb.CloseDb(strFile);
+
+    // The snapshot only appears under its real name once it is complete, so
+    // an interrupted migration is simply done again on the next start
+    filesystem::path pathBase = GetDataDir() / strFile;
+    filesystem::path pathNew = pathBase.string() + ".snapshot.new";
+    if (!CLogDB::WriteSnapshot(pathNew, mapRecords))
+        return false;
+    filesystem::remove(pathBase.string() + ".log");
+    if (!RenameOver(pathNew, pathBase.string() + ".snapshot"))
+        return error("CWalletDB::MigrateToLog() : can't rename %s", pathNew.string().c_str());
+
+    // Load the new store from disk and make sure it holds exactly what was
+    // read, before anything happens to the old file
+    bool fVerified;
+    {
+        CLogDB logdbCheck;
+        fVerified = logdbCheck.Open(pathBase) && logdbCheck.GetRecordCount() == mapRecords.size();
+        for (CLogDataMap::const_iterator it = mapRecords.begin(); fVerified && it != mapRecords.end(); ++it)
+        {
+            CSerializeData vchValue;
+            fVerified = logdbCheck.Read((*it).first, vchValue) && vchValue == (*it).second;
+        }
+    }
+    if (!fVerified)
+    {
+        filesystem::remove(pathBase.string() + ".snapshot");
+        filesystem::remove(pathBase.string() + ".log");
+        return error("CWalletDB::MigrateToLog() : the new store doesn't match %s, which is left as it is", strFile.c_str());
+    }
+
+    // The log store is the wallet from now on. The old file is kept under
+    // another name rather than deleted; init warns about it.
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.CheckpointLSN(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+        string strMigrated = strFile + ".migrated";
+        if (bitdb.dbenv.dbrename(NULL, strFile.c_str(), NULL, strMigrated.c_str(), DB_AUTO_COMMIT) == 0)
+            printf("Renamed %s to %s\n", strFile.c_str(), strMigrated.c_str());
+        else
+            printf("WARNING: CWalletDB::MigrateToLog() : can't rename %s to %s\n", strFile.c_str(), strMigrated.c_str());
+    }
+
+    printf("Migrated %"PRIszu" records of %s in %"PRI64d"ms\n", mapRecords.size(), strFile.c_str(), GetTimeMillis() - nStart);
+    return true;
+}
@@ -38,11 +38,8 @@ public:
 
     bool EraseName(const std::string& strAddress);
 
-    bool WriteTx(uint256 hash, const CWalletTx& wtx)
-    {
-        nWalletDBUpdated++;
-        return Write(std::make_pair(std::string("tx"), hash), wtx);
-    }
+    bool WriteTx(uint256 hash, const CWalletTx& wtx);
+    bool ReadPrev(uint256 hash, std::vector<CMerkleTx>& vtxPrev);
 
     bool EraseTx(uint256 hash)
     {
@@ -158,6 +155,9 @@ public:
     DBErrors LoadWallet(CWallet* pwallet);
     static bool Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys);
     static bool Recover(CDBEnv& dbenv, std::string filename);
+    /** Copy every record of the Berkeley DB file strFile into a new log
+     *  store for it. wallet.dat itself is left as it was. */
+    static bool MigrateToLog(const std::string& strFile);
 };
 
 #endif // BITCOIN_WALLETDB_H